@@ -0,0 +1,45 @@
+############################################################################
+# FindNghttp2.cmake
+# Copyright (C) 2018  Belledonne Communications, Grenoble France
+#
+############################################################################
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+#
+############################################################################
+#
+# - Find the libnghttp2 library
+#
+#  NGHTTP2_FOUND - system has libnghttp2
+#  NGHTTP2_INCLUDE_DIRS - the libnghttp2 include directory
+#  NGHTTP2_LIBRARIES - The libraries needed to use libnghttp2
+
+
+find_path(NGHTTP2_INCLUDE_DIRS
+	NAMES nghttp2/nghttp2.h
+	PATH_SUFFIXES include
+)
+
+find_library(NGHTTP2_LIBRARIES
+	NAMES nghttp2
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Nghttp2
+	DEFAULT_MSG
+	NGHTTP2_INCLUDE_DIRS NGHTTP2_LIBRARIES
+)
+
+mark_as_advanced(NGHTTP2_INCLUDE_DIRS NGHTTP2_LIBRARIES)
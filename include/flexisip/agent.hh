@@ -28,6 +28,7 @@
 #include <flexisip/event.hh>
 #include <flexisip/transaction.hh>
 #include <flexisip/eventlogs.hh>
+#include <flexisip/timer-wheel.hh>
 
 #include <sofia-sip/sip.h>
 #include <sofia-sip/sip_protos.h>
@@ -41,6 +42,8 @@
 #include <string>
 #include <sstream>
 #include <memory>
+#include <unordered_set>
+#include <vector>
 #include <ifaddrs.h>
 
 #if ENABLE_MDNS
@@ -179,6 +182,10 @@ public:
 	typedef void (*timerCallback)(void *unused, su_timer_t *t, void *data);
 	su_timer_t *createTimer(int milliseconds, timerCallback cb, void *data, bool repeating=true);
 	void stopTimer(su_timer_t *t);
+	/// The timing wheel to use for the many short-lived timers of registrations, forks and push notifications.
+	TimerWheel &getTimerWheel() {
+		return *mTimerWheel;
+	}
 	void injectRequestEvent(std::shared_ptr<RequestSipEvent> ev);
 	void injectResponseEvent(std::shared_ptr<ResponseSipEvent> ev);
 	void sendRequestEvent(std::shared_ptr<RequestSipEvent> ev);
@@ -206,10 +213,16 @@ private:
 	void initializePreferredRoute();
 	void loadModules();
 	void startMdns();
+	void updateLocalAddresses();
+	static std::string normalizeHost(const char *host);
 
 	std::string mServerString;
 	std::list<Module *> mModules;
 	std::list<std::string> mAliases;
+	// Normalized forms (see normalizeHost()) of the names of the primary transports and aliases, for isUs().
+	std::unordered_set<std::string> mLocalAddresses; // "host:port" of each primary transport, by canon and host name.
+	std::unordered_set<std::string> mLocalDefaultPortHosts; // hosts of the transports listening on their default port.
+	std::unordered_set<std::string> mAliasHosts;
 	url_t *mPreferredRouteV4;
 	url_t *mPreferredRouteV6;
 	const url_t *mNodeUri = nullptr;
@@ -237,6 +250,7 @@ private:
 	nth_engine_t *mHttpEngine;
 	su_home_t mHome;
 	su_timer_t *mTimer = nullptr;
+	std::unique_ptr<TimerWheel> mTimerWheel;
 	unsigned int mProxyToProxyKeepAliveInterval;
 	std::unique_ptr<EventLogWriter> mLogWriter;
 	DomainRegistrationManager *mDrm;
@@ -32,6 +32,9 @@
 
 #include <flexisip/common.hh>
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -45,6 +48,7 @@
 #include <typeinfo>
 #include <cxxabi.h>
 #include <memory>
+#include <mutex>
 
 #ifdef ENABLE_SNMP
 
@@ -98,7 +102,8 @@ enum GenericValueType {
 	Struct,
 	BooleanExpr,
 	Notification,
-	RuntimeError
+	RuntimeError,
+	Histogram
 };
 
 /* Allows to have a string for each GenericValueType */
@@ -107,7 +112,7 @@ static const std::map<GenericValueType, std::string> GenericValueTypeNameMap = {
 	{ X, #X }
 	TypeToName(Boolean),  TypeToName(Integer),    TypeToName(IntegerRange), TypeToName(Counter64),   TypeToName(String),
 	TypeToName(ByteSize), TypeToName(StringList), TypeToName(Struct),       TypeToName(BooleanExpr), TypeToName(Notification),
-	TypeToName(RuntimeError)
+	TypeToName(RuntimeError), TypeToName(Histogram)
 #undef TypeToName
 };
 
@@ -129,6 +134,7 @@ static const StatItemDescriptor stat_item_end = {Boolean, NULL, NULL};
 class Oid {
 	friend class GenericEntry;
 	friend class StatCounter64;
+	friend class StatHistogram;
 	friend class ConfigValue;
 	friend class GenericStruct;
 	friend class RootConfigStruct;
@@ -307,14 +313,18 @@ template <typename _retType> _retType &GenericEntriesGetter::find(const std::str
 
 class ConfigValue;
 class StatCounter64;
+class StatGauge64;
+class StatHistogram;
 struct StatPair;
 class GenericStruct : public GenericEntry {
   public:
 	GenericStruct(const std::string &name, const std::string &help, oid oid_index);
 	GenericEntry *addChild(GenericEntry *c);
 	StatCounter64 *createStat(const std::string &name, const std::string &help);
+	StatGauge64 *createGauge(const std::string &name, const std::string &help);
 	std::pair<StatCounter64 *, StatCounter64 *> createStatPair(const std::string &name, const std::string &help);
 	std::unique_ptr<StatPair> createStats(const std::string &name, const std::string &help);
+	StatHistogram *createHistogram(const std::string &name, const std::string &help);
 
 	void addChildrenValues(ConfigItemDescriptor *items);
 	void addChildrenValues(ConfigItemDescriptor *items, bool hashed);
@@ -331,6 +341,11 @@ class GenericStruct : public GenericEntry {
 	GenericEntry *findApproximate(const char *name) const;
 	virtual void mibFragment(std::ostream &ost, std::string spacing) const;
 	virtual void setParent(GenericEntry *parent);
+	/*
+	 * Statistics are added to the tree at runtime by the main thread (modules, registrar backends...). Threads other
+	 * than the main one must hold this lock while they walk the children of any struct of the tree.
+	 */
+	static std::mutex &getTreeMutex();
 
   private:
 	std::list<GenericEntry *> mEntries;
@@ -351,30 +366,106 @@ class StatCounter64 : public GenericEntry {
 #endif
 	virtual void mibFragment(std::ostream &ost, std::string spacing) const;
 	void setParent(GenericEntry *parent);
-	uint64_t read() {
-		return mValue;
+	/*
+	 * Counters are updated from several threads (authentication and database pools...) and read by the SNMP, CLI and
+	 * metrics exporter threads. No ordering with other memory operations is needed, hence the relaxed atomics.
+	 */
+	uint64_t read() const {
+		return mValue.load(std::memory_order_relaxed);
 	}
 	void set(uint64_t val) {
-		mValue = val;
+		mValue.store(val, std::memory_order_relaxed);
+	}
+	void add(uint64_t val) {
+		mValue.fetch_add(val, std::memory_order_relaxed);
 	}
 	void operator++() {
-		++mValue;
+		mValue.fetch_add(1, std::memory_order_relaxed);
 	}
 	void operator++(int) {
-		mValue++;
+		mValue.fetch_add(1, std::memory_order_relaxed);
 	}
 	void operator--() {
-		--mValue;
+		mValue.fetch_sub(1, std::memory_order_relaxed);
 	}
 	void operator--(int) {
-		mValue--;
+		mValue.fetch_sub(1, std::memory_order_relaxed);
 	}
 	inline void incr() {
-		mValue++;
+		mValue.fetch_add(1, std::memory_order_relaxed);
+	}
+
+  private:
+	std::atomic<uint64_t> mValue;
+};
+
+/*
+ * A counter whose value goes up and down (queue lengths, resources in use...): it is published like the other counters
+ * through SNMP and the CLI, but exported as a gauge in the OpenMetrics format.
+ */
+class StatGauge64 : public StatCounter64 {
+  public:
+	StatGauge64(const std::string &name, const std::string &help, oid oid_index);
+};
+
+/*
+ * Distribution of a value (typically a duration in microseconds), recorded in fixed base-2 buckets: bucket 0 counts
+ * zeros, bucket i counts values in [2^(i-1), 2^i - 1] and the last bucket counts everything above.
+ * Recording is lock-free and may happen from any thread; readers get a snapshot that is only approximately consistent.
+ */
+class StatHistogram : public GenericEntry {
+  public:
+	static constexpr int sBucketCount = 33;
+	/* Indexes of the sub-objects published through SNMP below the histogram oid. */
+	enum SnmpLeaf { SnmpCount = 1, SnmpSum, SnmpP50, SnmpP90, SnmpP99 };
+
+	StatHistogram(const std::string &name, const std::string &help, oid oid_index);
+#ifdef ENABLE_SNMP
+	virtual int handleSnmpRequest(netsnmp_mib_handler *, netsnmp_handler_registration *, netsnmp_agent_request_info *,
+								  netsnmp_request_info *);
+#endif
+	virtual void mibFragment(std::ostream &ost, std::string spacing) const;
+	void setParent(GenericEntry *parent);
+
+	void record(uint64_t value) {
+		mBuckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		mCount.fetch_add(1, std::memory_order_relaxed);
+		mSum.fetch_add(value, std::memory_order_relaxed);
+	}
+	template <typename _durationT> void recordDuration(const _durationT &duration) {
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		record(us > 0 ? (uint64_t)us : 0);
+	}
+	uint64_t getCount() const {
+		return mCount.load(std::memory_order_relaxed);
+	}
+	uint64_t getSum() const {
+		return mSum.load(std::memory_order_relaxed);
+	}
+	uint64_t getBucket(int index) const {
+		return mBuckets[index].load(std::memory_order_relaxed);
+	}
+	/* Largest value counted by a bucket, UINT64_MAX for the last one. */
+	static uint64_t bucketUpperBound(int index) {
+		return index >= sBucketCount - 1 ? UINT64_MAX : (((uint64_t)1) << index) - 1;
+	}
+	static int bucketIndex(uint64_t value) {
+		int index = 0;
+		while (value != 0 && index < sBucketCount - 1) {
+			value >>= 1;
+			++index;
+		}
+		return index;
 	}
+	/* Estimation of the q-quantile (0 <= q <= 1), interpolated linearly inside the matching bucket. */
+	uint64_t quantile(double q) const;
+	/* Human readable summary used by the CLI. */
+	std::string summary() const;
 
   private:
-	uint64_t mValue;
+	std::atomic<uint64_t> mBuckets[sBucketCount];
+	std::atomic<uint64_t> mCount;
+	std::atomic<uint64_t> mSum;
 };
 
 struct StatPair {
@@ -140,6 +140,10 @@ class SipEvent : public std::enable_shared_from_this<SipEvent> {
 	Module *getCurrentModule() {
 		return mCurrModule;
 	}
+	// Used to inject an event that was not received by the agent, as if it had been processed up to a module.
+	void setCurrentModule(Module *module) {
+		mCurrModule = module;
+	}
 
 	template <typename _eventLogT> std::shared_ptr<_eventLogT> getEventLog() {
 		return std::dynamic_pointer_cast<_eventLogT>(mEventLog);
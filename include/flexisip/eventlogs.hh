@@ -27,9 +27,17 @@
 #include <memory>
 #include <queue>
 #include <mutex>
+#include <condition_variable>
+#include <list>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace flexisip {
 
+class StatCounter64;
+
 class EventLog {
 	friend class FilesystemEventLogWriter;
 	friend class DataBaseEventLogWriter;
@@ -161,24 +169,57 @@ public:
 	virtual ~EventLogWriter();
 };
 
+/*
+ * Writes the event logs as text files, one per user, kind and day.
+ * Logs are formatted on the caller thread and appended to their file by a background thread, which keeps the most
+ * recently used files open and groups the lines going to the same file into a single write.
+ */
 class FilesystemEventLogWriter: public EventLogWriter {
 public:
 
-	FilesystemEventLogWriter(const std::string &rootpath);
+	FilesystemEventLogWriter(const std::string &rootpath, size_t maxQueueSize = 10000, size_t maxOpenFiles = 128);
+	~FilesystemEventLogWriter();
 	virtual void write(const std::shared_ptr<EventLog> &evlog);
 	bool isReady() const;
 
 private:
+	struct PendingLine {
+		std::string path; // relative to mRootPath, with a leading '/'
+		std::string line;
+	};
 
-	int openPath(const url_t *uri, const char *kind, time_t curtime, int errorcode = 0);
+	void queue(const url_t *uri, const char *kind, time_t curtime, const std::string &line, int errorcode = 0);
 	void writeRegistrationLog(const std::shared_ptr<RegistrationLog> &evlog);
 	void writeCallLog(const std::shared_ptr<CallLog> &clog);
 	void writeCallQualityStatisticsLog(const std::shared_ptr<CallQualityStatisticsLog> &mlog);
 	void writeMessageLog(const std::shared_ptr<MessageLog> &mlog);
 	void writeAuthLog(const std::shared_ptr<AuthLog> &alog);
 	void writeErrorLog(const std::shared_ptr<EventLog> &log, const char *kind, const std::string &logstr);
+
+	/* Background thread */
+	void run();
+	void flush(std::vector<PendingLine> &lines);
+	int openPath(const std::string &path);
+	bool createDirectories(const std::string &path);
+
 	std::string mRootPath;
 	bool mIsReady;
+	size_t mMaxQueueSize;
+	size_t mMaxOpenFiles;
+	StatCounter64 *mCountDropped = nullptr;
+	StatGauge64 *mCountQueued = nullptr;
+
+	std::mutex mMutex;
+	std::condition_variable mCond;
+	std::vector<PendingLine> mQueue;
+	bool mDropping = false; // a series of dropped logs is in progress, it is reported once
+	bool mRunning = false;
+	std::thread mThread;
+
+	// Only accessed by the background thread.
+	std::unordered_set<std::string> mKnownDirectories;
+	std::list<std::pair<std::string, int>> mOpenFiles; // most recently used first
+	std::unordered_map<std::string, std::list<std::pair<std::string, int>>::iterator> mOpenFilesByPath;
 };
 
 }
@@ -208,7 +249,7 @@ public:
 
 	DataBaseEventLogWriter(
 		const std::string &backendString, const std::string &connectionString,
-		int maxQueueSize, int nbThreadsMax
+		int maxQueueSize, int nbThreadsMax, int batchSize = 1, int batchDelay = 0
 	);
 	~DataBaseEventLogWriter();
 
@@ -226,16 +267,24 @@ private:
 	void writeAuthLog(soci::session *session, const std::shared_ptr<AuthLog> &evlog);
 	void writeCallQualityStatisticsLog(soci::session *session, const std::shared_ptr<CallQualityStatisticsLog> &evlog);
 
+	void writeEvent(soci::session *session, const std::shared_ptr<EventLog> &evlog);
 	void writeEventFromQueue();
 
 	bool mIsReady;
 	std::mutex mMutex;
+	std::condition_variable mCond;
 	std::queue<std::shared_ptr<EventLog>> mListLogs;
 
 	soci::connection_pool *mConnectionPool;
 	ThreadPool *mThreadPool;
 
 	size_t mMaxQueueSize;
+	size_t mBatchSize;
+	int mBatchDelay;
+
+	StatCounter64 *mCountBatches;
+	StatCounter64 *mCountBatchedLogs;
+	StatCounter64 *mCountFlushTime;
 
 	std::string mInsertReq[5];
 };
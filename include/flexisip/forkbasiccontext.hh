@@ -30,9 +30,8 @@ namespace flexisip {
 
 class ForkBasicContext : public ForkContext {
   private:
-	su_timer_t
-		*mDecisionTimer; /*timeout after which an answer must be sent through the incoming transaction even if no
-							success response was received on the outgoing transactions*/
+	WheelTimer mDecisionTimer; /*timeout after which an answer must be sent through the incoming transaction even if no
+								success response was received on the outgoing transactions*/
   public:
 	ForkBasicContext(Agent *agent, const std::shared_ptr<RequestSipEvent> &event,
 					 std::shared_ptr<ForkContextConfig> cfg, ForkContextListener *listener);
@@ -44,7 +43,6 @@ class ForkBasicContext : public ForkContext {
 
   private:
 	void finishIncomingTransaction();
-	static void sOnDecisionTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
 	void onDecisionTimer();
 };
 
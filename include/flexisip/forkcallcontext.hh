@@ -31,8 +31,8 @@ enum FlexisipForkStatus {FlexisipForkAcceptedElsewhere, FlexisipForkDeclineElsew
 
 class ForkCallContext : public ForkContext {
   private:
-	su_timer_t *mShortTimer; // optionaly used to send retryable responses
-	su_timer_t *mPushTimer; // used to track push responses
+	WheelTimer mShortTimer; // optionaly used to send retryable responses
+	WheelTimer mPushTimer; // used to track push responses
 	std::shared_ptr<CallLog> mLog;
 	bool mCancelled;
 
@@ -59,8 +59,6 @@ class ForkCallContext : public ForkContext {
 	void cancelOthers(const std::shared_ptr<BranchInfo> &br, sip_t* received_cancel);
 	void cancelOthersWithStatus(const std::shared_ptr<BranchInfo> &br, FlexisipForkStatus status);
 	void logResponse(const std::shared_ptr<ResponseSipEvent> &ev);
-	static void sOnShortTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
-	static void sOnPushTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
 	int mActivePushes;
 	static const int sUrgentCodesWithout603[];
 };
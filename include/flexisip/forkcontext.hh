@@ -38,6 +38,7 @@ class ForkContextConfig {
 	bool mForkNoGlobalDecline;
 	bool mTreatDeclineAsUrgent; /*treat 603 declined as a urgent response, only useful is mForkNoGlobalDecline==true*/
 	int mCurrentBranchesTimeout; /*timeout for receiving response on current branches*/
+	StatHistogram *mDuration; /*time between the creation of the fork contexts and their end, if not null*/
 };
 
 class ForkContext;
@@ -46,6 +47,9 @@ class ForkContextListener {
   public:
 	virtual ~ForkContextListener();
 	virtual void onForkContextFinished(std::shared_ptr<ForkContext> ctx) = 0;
+	// Called when a late forking context has answered the request and only waits for new registrations.
+	// Returning true means the listener takes the request over: the context then finishes.
+	virtual bool onForkContextIdle(std::shared_ptr<ForkContext> ctx);
 };
 
 class BranchInfo {
@@ -70,17 +74,13 @@ class BranchInfo {
 
 class ForkContext : public std::enable_shared_from_this<ForkContext> {
   private:
-	static void __timer_callback(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
-	static void sOnFinished(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
-	static void sOnNextBanches(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
 	ForkContextListener *mListener;
-	su_timer_t *mNextBranchesTimer;
+	WheelTimer mNextBranchesTimer;
 	std::list<std::shared_ptr<BranchInfo>> mWaitingBranches;
 	std::list<std::shared_ptr<BranchInfo>> mCurrentBranches;
 	float mCurrentPriority;
 	std::list<std::string> mKeys;
-	void init();
-	void processLateTimeout();
+	void init(bool answered);
 	std::shared_ptr<BranchInfo> _findBestBranch(const int urgentReplies[], bool ignore503And408);
 	std::shared_ptr<OnContactRegisteredListener> mContactRegisteredListener;
 	// Request if the fork has other branches with lower priorities to try
@@ -96,10 +96,14 @@ class ForkContext : public std::enable_shared_from_this<ForkContext> {
 	std::shared_ptr<IncomingTransaction> mIncoming;
 	std::shared_ptr<ForkContextConfig> mCfg;
 	std::shared_ptr<ForkContext> mSelf;
-	su_timer_t *mLateTimer;
-	su_timer_t *mFinishTimer;
+	WheelTimer mLateTimer;
+	WheelTimer mFinishTimer;
+	std::chrono::steady_clock::time_point mCreationTime;
 	// Mark the fork process as terminated. The real destruction is performed asynchrously, in next main loop iteration.
 	void setFinished();
+	// Offer the context to the listener when it only waits for late registrations, and finish if it is taken over.
+	void setIdle();
+	void processLateTimeout();
 	// Used by derived class to allocate a derived type of BranchInfo if necessary.
 	virtual std::shared_ptr<BranchInfo> createBranchInfo();
 	// Notifies derived class of the creation of a new branch
@@ -134,8 +138,9 @@ class ForkContext : public std::enable_shared_from_this<ForkContext> {
 	static bool isUrgent(int code, const int urgentCodes[]);
 
   public:
+	// An answered context has no incoming transaction: it is restored from a request that was already answered.
 	ForkContext(Agent *agent, const std::shared_ptr<RequestSipEvent> &event, std::shared_ptr<ForkContextConfig> cfg,
-				ForkContextListener *listener);
+				ForkContextListener *listener, bool answered = false);
 	virtual ~ForkContext();
 	// Called by the Router module to create a new branch.
 	void addBranch(const std::shared_ptr<RequestSipEvent> &ev, const std::shared_ptr<ExtendedContact> &contact);
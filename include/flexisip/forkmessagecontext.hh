@@ -23,24 +23,39 @@
 #include <flexisip/transaction.hh>
 #include <flexisip/forkcontext.hh>
 
+#include <ctime>
 #include <list>
 #include <map>
+#include <set>
 
 namespace flexisip {
 
 class ForkMessageContext : public ForkContext {
   private:
-	su_timer_t
-		*mAcceptanceTimer; /*timeout after which an answer must be sent through the incoming transaction even if no
-							  success response was received on the outgoing transactions*/
+	WheelTimer mAcceptanceTimer; /*timeout after which an answer must be sent through the incoming transaction even if
+								  no success response was received on the outgoing transactions*/
 	static const int sAcceptanceTimeout = 20; /* this must be less than the transaction time (32 seconds)*/
 	int mDeliveredCount;
 	bool mIsMessage; /* tells if the ForkMessageContext is a message, if false it's a refer */
+	time_t mExpireAt; /* end of the delivery, in seconds since the Epoch */
+	std::set<std::string> mDeliveredUids; /* instances served before the context was restored */
+	std::set<std::string> mPendingUids; /* instances still to be served when the context was restored */
 
   public:
 	ForkMessageContext(Agent *agent, const std::shared_ptr<RequestSipEvent> &event,
-					   std::shared_ptr<ForkContextConfig> cfg, ForkContextListener *listener);
+					   std::shared_ptr<ForkContextConfig> cfg, ForkContextListener *listener, bool restored = false);
 	virtual ~ForkMessageContext();
+	// Recreate the context of a request that was accepted and spooled, with the state of its delivery.
+	static std::shared_ptr<ForkMessageContext> restore(Agent *agent, const std::shared_ptr<RequestSipEvent> &event,
+													   std::shared_ptr<ForkContextConfig> cfg,
+													   ForkContextListener *listener, time_t expireAt,
+													   const std::vector<std::string> &deliveredUids,
+													   const std::vector<std::string> &pendingUids);
+	// Instances that shall not receive the request again, and instances to which it could not be delivered yet.
+	void getDeliveryState(std::vector<std::string> &deliveredUids, std::vector<std::string> &pendingUids) const;
+	time_t getExpireAt() const {
+		return mExpireAt;
+	}
 
   protected:
 	virtual bool onNewRegister(const url_t *url, const std::string &uid);
@@ -49,11 +64,11 @@ class ForkMessageContext : public ForkContext {
 	virtual bool shouldFinish();
 
   private:
-	static void sOnAcceptanceTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
 	void acceptMessage();
 	void onAcceptanceTimer();
 	void logReceivedFromUserEvent(const std::shared_ptr<ResponseSipEvent> &ev);
 	void checkFinished();
+	void checkIdle();
 	void logDeliveredToUserEvent(const std::shared_ptr<BranchInfo> &br, const std::shared_ptr<ResponseSipEvent> &event);
 };
 
@@ -0,0 +1,111 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <flexisip/timer-wheel.hh>
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace flexisip {
+
+class MessageSpoolListener {
+  public:
+	virtual ~MessageSpoolListener();
+	// Called when the first message for a routing key is stored, and when the last one is taken or expires.
+	virtual void onSpoolKeyAdded(const std::string &key) = 0;
+	virtual void onSpoolKeyRemoved(const std::string &key) = 0;
+};
+
+/**
+ * Stores on disk the messages that wait for the late registration of their recipients.
+ *
+ * The spool is an append-only file, read through a memory mapping. A removed message is only marked as such in place;
+ * the file is compacted when removed messages take more room than the pending ones, and when it is opened.
+ * In memory, only the location of each message, an index by routing key and an expiration timer are kept.
+ * Messages are not synced to disk one by one: a system crash may lose the last ones, not a restart of the proxy.
+ */
+class MessageSpool {
+  public:
+	struct Message {
+		std::string mRequest; // the request, as received
+		std::vector<std::string> mKeys; // routing keys the request waits for
+		std::vector<std::string> mDeliveredUids; // instances that shall not receive the request again
+		std::vector<std::string> mPendingUids; // instances to which it could not be delivered yet
+		std::string mTargetGr; // gr parameter of the request uri, if any
+		time_t mExpireAt = 0; // end of the delivery, in seconds since the Epoch
+	};
+
+	MessageSpool(TimerWheel &wheel, const std::string &path, MessageSpoolListener *listener);
+	MessageSpool(const MessageSpool &) = delete;
+	MessageSpool &operator=(const MessageSpool &) = delete;
+	~MessageSpool();
+
+	bool isReady() const {
+		return mFd != -1;
+	}
+	/// Store a message. Returns false if it could not be written, in which case the caller keeps it.
+	bool add(const Message &message);
+	/// Remove and return the messages waiting for a routing key that are accepted by the filter.
+	std::vector<Message> take(const std::string &key, const std::function<bool(const Message &)> &filter);
+
+	size_t size() const {
+		return mEntries.size();
+	}
+	uint64_t getFileSize() const {
+		return mEnd;
+	}
+	/// Approximate memory used by the index of the pending messages, in bytes.
+	size_t getIndexSize() const;
+
+  private:
+	struct Entry {
+		uint64_t mOffset;
+		uint32_t mLength;
+		std::unique_ptr<WheelTimer> mTimer;
+	};
+
+	void load();
+	bool mapFile();
+	void unmapFile();
+	bool decode(uint64_t offset, uint32_t length, Message &message) const;
+	uint64_t index(uint64_t offset, uint32_t length, const Message &message);
+	void remove(uint64_t id, const std::vector<std::string> &keys);
+	void compact();
+
+	TimerWheel &mWheel;
+	std::string mPath;
+	MessageSpoolListener *mListener;
+	int mFd = -1;
+	const char *mMap = nullptr;
+	uint64_t mMapSize = 0;
+	uint64_t mEnd = 0; // end of the last record
+	uint64_t mRemovedBytes = 0;
+	uint64_t mNextId = 0;
+	size_t mKeyBytes = 0;
+	std::map<uint64_t, Entry> mEntries;
+	std::multimap<std::string, uint64_t> mKeyIndex;
+};
+
+}
@@ -24,6 +24,7 @@
 #include <flexisip/forkcallcontext.hh>
 #include <flexisip/forkmessagecontext.hh>
 #include <flexisip/forkbasiccontext.hh>
+#include <flexisip/message-spool.hh>
 
 namespace flexisip {
 
@@ -32,18 +33,26 @@ struct RouterStats {
 	std::unique_ptr<StatPair> mCountForkTransactions;
 	StatCounter64 *mCountNonForks = nullptr;
 	StatCounter64 *mCountLocalActives = nullptr;
+	StatHistogram *mCallForkDuration = nullptr;
+	StatHistogram *mMessageForkDuration = nullptr;
+	StatHistogram *mOtherForkDuration = nullptr;
+	StatCounter64 *mCountSpooledMessages = nullptr;
+	StatCounter64 *mMessageSpoolSize = nullptr;
+	StatCounter64 *mMessageSpoolIndexMemory = nullptr;
 };
 
-class ModuleRouter : public Module, public ModuleToolbox, public ForkContextListener {
+class ModuleRouter : public Module, public ModuleToolbox, public ForkContextListener, public MessageSpoolListener {
 	RouterStats mStats;
 	bool rewriteContactUrl(const std::shared_ptr<MsgSip> &ms, const url_t *ct_url, const char *route);
+	void removeFork(const std::shared_ptr<ForkContext> &ctx);
+	void restoreSpooledMessages(const std::string &key, const std::string &uid,
+								const std::shared_ptr<ExtendedContact> &ec);
 
   public:
 	ModuleRouter(Agent *ag) : Module(ag) {
 	}
 
-	~ModuleRouter() {
-	}
+	~ModuleRouter();
 
 	virtual void onDeclare(GenericStruct *mc) override;
 
@@ -55,8 +64,16 @@ class ModuleRouter : public Module, public ModuleToolbox, public ForkContextList
 
 	virtual void onResponse(std::shared_ptr<ResponseSipEvent> &ev) override;
 
+	virtual void onIdle() override;
+
 	virtual void onForkContextFinished(std::shared_ptr<ForkContext> ctx) override;
 
+	virtual bool onForkContextIdle(std::shared_ptr<ForkContext> ctx) override;
+
+	virtual void onSpoolKeyAdded(const std::string &key) override;
+
+	virtual void onSpoolKeyRemoved(const std::string &key) override;
+
 	void sendReply(std::shared_ptr<RequestSipEvent> &ev, int code, const char *reason, int warn_code = 0, const char *warning = nullptr);
 	void routeRequest(std::shared_ptr<RequestSipEvent> &ev, const std::shared_ptr<Record> &aor, const url_t *sipUri);
 	void onContactRegistered(const std::string &uid, const std::shared_ptr<Record> &aor, const url_t *sipUri);
@@ -110,6 +127,9 @@ class ModuleRouter : public Module, public ModuleToolbox, public ForkContextList
 	std::string mFallbackRoute;
 	url_t *mFallbackRouteParsed = nullptr;
 	bool mFallbackParentDomain = false;
+	MessageSpool *mMessageSpool = nullptr;
+	// Registration listeners of the routing keys that spooled messages wait for.
+	std::map<std::string, std::shared_ptr<OnContactRegisteredListener>> mSpoolListeners;
 
   private:
 	static ModuleInfo<ModuleRouter> sInfo;
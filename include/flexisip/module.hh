@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <array>
+#include <chrono>
+
 #include <sofia-sip/msg_header.h>
 #include <sofia-sip/nta_tport.h>
 #include <sofia-sip/tport.h>
@@ -31,6 +34,28 @@ namespace flexisip {
 
 // =============================================================================
 
+// -----------------------------------------------------------------------------
+// ModuleLatencyStats.
+// -----------------------------------------------------------------------------
+
+/**
+ * Histograms of the time spent by a module in onRequest()/onResponse(), in microseconds, one StatHistogram of the
+ * module's configuration node per kind of SIP message.
+ */
+class ModuleLatencyStats {
+public:
+	ModuleLatencyStats(GenericStruct *moduleConfig);
+
+	void recordRequest(sip_method_t method, std::chrono::steady_clock::duration elapsed);
+	void recordResponse(std::chrono::steady_clock::duration elapsed);
+
+private:
+	enum Category { Invite, Register, Message, Subscribe, OtherRequest, Response, CategoryCount };
+	static const char *sCategoryNames[CategoryCount];
+
+	std::array<StatHistogram *, CategoryCount> mHistograms;
+};
+
 // -----------------------------------------------------------------------------
 // Module.
 // -----------------------------------------------------------------------------
@@ -104,6 +129,13 @@ protected:
 
 	void sendTrap(const std::string &msg) {GenericManager::get()->sendTrap(mModuleConfig, msg);}
 
+private:
+	void doProcessRequest(std::shared_ptr<RequestSipEvent> &ev);
+	void doProcessResponse(std::shared_ptr<ResponseSipEvent> &ev);
+
+	// Only set when 'module-latency-stats' is enabled, so that disabled timing costs a pointer check.
+	std::unique_ptr<ModuleLatencyStats> mLatencyStats;
+
 protected:
 	SofiaAutoHome mHome;
 	Agent *mAgent = nullptr;
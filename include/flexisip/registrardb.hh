@@ -34,13 +34,91 @@
 #include <cstdlib>
 #include <algorithm>
 #include <limits>
+#include <memory>
 #include <mutex>
+#include <vector>
 #include <iosfwd>
 
 namespace flexisip {
 
 class ContactUpdateListener;
 
+/*
+ * Immutable value shared by all its holders, for the values repeated across the contacts of the registrar such as
+ * user agents and accept headers. The pool only keeps weak references: a value leaves it with its last holder.
+ */
+template <typename ValueT> class InternedValue {
+  public:
+	InternedValue() : mValue(empty()) {
+	}
+	InternedValue(const ValueT &value) : mValue(value == ValueT() ? empty() : intern(value)) {
+	}
+	const ValueT &operator*() const {
+		return *mValue;
+	}
+	const ValueT *operator->() const {
+		return mValue.get();
+	}
+	operator const ValueT &() const {
+		return *mValue;
+	}
+	bool operator==(const InternedValue &other) const {
+		return mValue == other.mValue;
+	}
+	bool operator!=(const InternedValue &other) const {
+		return mValue != other.mValue;
+	}
+
+  private:
+	struct PointeeLess {
+		bool operator()(const ValueT *a, const ValueT *b) const {
+			return *a < *b;
+		}
+	};
+	// Keyed by the shared values themselves, so that each distinct value is stored once.
+	typedef std::map<const ValueT *, std::weak_ptr<const ValueT>, PointeeLess> Pool;
+
+	// Never destroyed, values may be released by static objects at exit.
+	static std::mutex &poolMutex() {
+		static std::mutex *mutex = new std::mutex();
+		return *mutex;
+	}
+	static Pool &pool() {
+		static Pool *pool = new Pool();
+		return *pool;
+	}
+	static const std::shared_ptr<const ValueT> &empty() {
+		static std::shared_ptr<const ValueT> *value = new std::shared_ptr<const ValueT>(std::make_shared<ValueT>());
+		return *value;
+	}
+	static std::shared_ptr<const ValueT> intern(const ValueT &value) {
+		std::lock_guard<std::mutex> lock(poolMutex());
+		auto it = pool().find(&value);
+		if (it != pool().end()) {
+			std::shared_ptr<const ValueT> shared = it->second.lock();
+			if (shared) return shared;
+			// Released, but its deleter did not run yet: it will leave the new entry alone.
+			pool().erase(it);
+		}
+		std::shared_ptr<const ValueT> shared(new ValueT(value), release);
+		pool().emplace(shared.get(), shared);
+		return shared;
+	}
+	static void release(const ValueT *value) {
+		{
+			std::lock_guard<std::mutex> lock(poolMutex());
+			auto it = pool().find(value);
+			if (it != pool().end() && it->first == value) pool().erase(it);
+		}
+		delete value;
+	}
+
+	std::shared_ptr<const ValueT> mValue;
+};
+
+typedef InternedValue<std::string> InternedString;
+typedef InternedValue<std::list<std::string>> InternedStringList;
+
 struct ExtendedContactCommon {
 	std::string mContactId;
 	std::string mCallId;
@@ -66,14 +144,14 @@ struct ExtendedContact {
 	std::string mCallId;
 	std::string mUniqueId;
 	std::list<std::string> mPath; //list of urls as string (not enclosed with brakets)
-	std::string mUserAgent;
+	InternedString mUserAgent; // shared with the contacts of the same user agent
 	sip_contact_t *mSipContact; // Full contact
 	float mQ;
 	time_t mExpireAt;
 	time_t mExpireNotAtMessage;  // real expires time but not for message
 	time_t mUpdatedTime;
 	uint32_t mCSeq;
-	std::list<std::string> mAcceptHeader;
+	InternedStringList mAcceptHeader;
 	uintptr_t mConnId; // a unique id shared with associate t_port
 	SofiaAutoHome mHome;
 	bool mAlias;
@@ -81,6 +159,7 @@ struct ExtendedContact {
 						  replacing the request-uri*/
 	
 	bool mIsFallback = false; // boolean indicating whether this ExtendedContact is a fallback route or not. There is no need for it to be serialized to database.
+	std::string mRecordKey; // key of the record the contact is bound to, set by the recursive fetches. Not serialized either.
 
 	const char *callId() const {
 		return mCallId.c_str();
@@ -95,10 +174,10 @@ struct ExtendedContact {
 		return (mPath.empty() ? nullptr : mPath.cbegin()->c_str());
 	}
 	const char *userAgent() const {
-		return mUserAgent.c_str();
+		return mUserAgent->c_str();
 	}
 	const std::string &getUserAgent() const {
-		return mUserAgent;
+		return *mUserAgent;
 	}
 
 	static int resolveExpire(const char *contact_expire, int global_expire) {
@@ -136,6 +215,17 @@ struct ExtendedContact {
 	}
 
 	std::string serializeAsUrlEncodedParams();
+	/*
+	 * Compact encoding of the contact for the redis hash fields: a marker byte and a version byte, followed by the
+	 * contact header and the fields otherwise added as url parameters and headers, as varints and length prefixed
+	 * strings. It may contain NUL bytes.
+	 */
+	std::string serializeAsBinary() const;
+	static bool isBinaryEncoded(const char *data, size_t len) {
+		return len >= 2 && data[0] == sBinaryMarker;
+	}
+	static const char sBinaryMarker = '\x01';
+	static const uint8_t sBinaryVersion = 1;
 
 	std::string getOrgLinphoneSpecs() const;
 
@@ -143,16 +233,31 @@ struct ExtendedContact {
 	const std::string getMessageExpires(const msg_param_t *m_params);
 	void init();
 	void extractInfoFromUrl(const char* full_url);
+	bool extractInfoFromBinary(const char *data, size_t len);
 
 	ExtendedContact(const char *contactId, const char *uniqueId, const char* fullUrl)
 		: mCallId(), mUserAgent(), mSipContact(nullptr), mQ(1.0), mExpireAt(LONG_MAX), mExpireNotAtMessage(LONG_MAX),
-			mUpdatedTime(0), mCSeq(0), mAcceptHeader({}), mConnId(0), mHome(), mAlias(false), mUsedAsRoute(false) {
+			mUpdatedTime(0), mCSeq(0), mAcceptHeader(), mConnId(0), mHome(), mAlias(false), mUsedAsRoute(false) {
 		if (contactId) mContactId = contactId;
 		if (uniqueId) mUniqueId = uniqueId;
 		extractInfoFromUrl(fullUrl);
 		init();
 	}
 
+	// Contact stored in a redis hash field, in binary or url encoded form.
+	ExtendedContact(const char *contactId, const char *uniqueId, const char *data, size_t len)
+		: mCallId(), mUserAgent(), mSipContact(nullptr), mQ(1.0), mExpireAt(LONG_MAX), mExpireNotAtMessage(LONG_MAX),
+			mUpdatedTime(0), mCSeq(0), mAcceptHeader(), mConnId(0), mHome(), mAlias(false), mUsedAsRoute(false) {
+		if (contactId) mContactId = contactId;
+		if (uniqueId) mUniqueId = uniqueId;
+		if (isBinaryEncoded(data, len)) {
+			if (!extractInfoFromBinary(data, len)) return;
+		} else {
+			extractInfoFromUrl(std::string(data, len).c_str());
+		}
+		init();
+	}
+
 	ExtendedContact(const ExtendedContactCommon &common, const sip_contact_t *sip_contact, int global_expire, uint32_t cseq,
 					time_t updateTime, bool alias, const std::list<std::string> &acceptHeaders, const std::string &userAgent)
 		: mContactId(common.mContactId), mCallId(common.mCallId), mUniqueId(common.mUniqueId), mPath(common.mPath),
@@ -166,7 +271,7 @@ struct ExtendedContact {
 
 	ExtendedContact(const url_t *url, const std::string &route, const float q = 1.0)
 	: mContactId(), mCallId(), mUniqueId(), mPath({route}), mUserAgent(), mSipContact(nullptr), mQ(q), mExpireAt(LONG_MAX),
-		mExpireNotAtMessage(LONG_MAX), mUpdatedTime(0), mCSeq(0), mAcceptHeader({}),
+		mExpireNotAtMessage(LONG_MAX), mUpdatedTime(0), mCSeq(0), mAcceptHeader(),
 		mConnId(0), mHome(), mAlias(false), mUsedAsRoute(false) {
 		mSipContact = sip_contact_create(mHome.home(), (url_string_t*)url, nullptr);
 	}
@@ -174,7 +279,7 @@ struct ExtendedContact {
 	ExtendedContact(const ExtendedContact &ec)
 		: mContactId(ec.mContactId), mCallId(ec.mCallId), mUniqueId(ec.mUniqueId), mPath(ec.mPath), mUserAgent(ec.mUserAgent),
 		mSipContact(nullptr), mQ(ec.mQ), mExpireAt(ec.mExpireAt), mExpireNotAtMessage(ec.mExpireNotAtMessage), mUpdatedTime(ec.mUpdatedTime),
-		mCSeq(ec.mCSeq), mAcceptHeader(ec.mAcceptHeader), mConnId(ec.mConnId), mHome(), mAlias(ec.mAlias), mUsedAsRoute(ec.mUsedAsRoute), mIsFallback(ec.mIsFallback){
+		mCSeq(ec.mCSeq), mAcceptHeader(ec.mAcceptHeader), mConnId(ec.mConnId), mHome(), mAlias(ec.mAlias), mUsedAsRoute(ec.mUsedAsRoute), mIsFallback(ec.mIsFallback), mRecordKey(ec.mRecordKey){
 		mSipContact = sip_contact_dup(mHome.home(), ec.mSipContact);
 		mSipContact->m_next = nullptr;
 	}
@@ -201,8 +306,9 @@ class Record {
 	void operator=(const Record &other) = delete; //disable assignement operator too
 	SofiaAutoHome mHome;
 	static void init();
-	std::list<std::shared_ptr<ExtendedContact>> mContacts;
-	std::list<std::shared_ptr<ExtendedContact>> mContactsToRemove;
+	// Contiguous: records are mostly iterated, and hold few contacts.
+	std::vector<std::shared_ptr<ExtendedContact>> mContacts;
+	std::vector<std::shared_ptr<ExtendedContact>> mContactsToRemove;
 	std::string mKey;
 	url_t *mAor;
 	bool mIsDomain; /*is a domain registration*/
@@ -222,7 +328,7 @@ class Record {
 	void pushContact(const std::shared_ptr<ExtendedContact> &ct) {
 		mContacts.push_back(ct);
 	}
-	std::list<std::shared_ptr<ExtendedContact>>::iterator removeContact(const std::shared_ptr<ExtendedContact> &ct) {
+	std::vector<std::shared_ptr<ExtendedContact>>::iterator removeContact(const std::shared_ptr<ExtendedContact> &ct) {
 		return mContacts.erase(find(mContacts.begin(), mContacts.end(), ct));
 	}
 	bool isInvalidRegister(const std::string &call_id, uint32_t cseq);
@@ -233,6 +339,9 @@ class Record {
 				time_t updated_time, bool alias, const std::list<std::string> accept, bool usedAsRoute,
 				const std::shared_ptr<ContactUpdateListener> &listener);
 	bool updateFromUrlEncodedParams(const char *key, const char *uid, const char *full_url, const std::shared_ptr<ContactUpdateListener> &listener);
+	// Same as updateFromUrlEncodedParams(), for a contact in either of the encodings of the redis hash fields.
+	bool updateFromSerializedContact(const char *key, const char *uid, const char *data, size_t len,
+									 const std::shared_ptr<ContactUpdateListener> &listener);
 
 	void print(std::ostream &stream) const;
 	bool isEmpty() const {
@@ -244,10 +353,10 @@ class Record {
 	int count() {
 		return mContacts.size();
 	}
-	const std::list<std::shared_ptr<ExtendedContact>> &getExtendedContacts() const {
+	const std::vector<std::shared_ptr<ExtendedContact>> &getExtendedContacts() const {
 		return mContacts;
 	}
-	const std::list<std::shared_ptr<ExtendedContact>> &getContactsToRemove() const {
+	const std::vector<std::shared_ptr<ExtendedContact>> &getContactsToRemove() const {
 		return mContactsToRemove;
 	}
 	void cleanContactsToRemoveList() {
@@ -404,10 +513,17 @@ class RegistrarDb {
 	static std::string grToUniqueId(const std::string &gr);
   protected:
 	class LocalRegExpire {
-		std::map<std::string, time_t> mRegMap;
+		// Latest expiration of the record, and the timer removing it from the map at that time.
+		struct Expiration {
+			time_t mExpire;
+			std::unique_ptr<WheelTimer> mTimer;
+		};
+		std::map<std::string, Expiration> mRegMap;
 		std::mutex mMutex;
 		std::list<LocalRegExpireListener *> mLocalRegListenerList;
 		Agent *mAgent;
+		void setTimer(const std::string &key, Expiration &expiration);
+		void onExpired(const std::string &key);
 
 	  public:
 		void remove(const std::string key) {
@@ -416,7 +532,6 @@ class RegistrarDb {
 		}
 		void update(const std::shared_ptr<Record> &record);
 		size_t countActives();
-		void removeExpiredBefore(time_t before);
 		LocalRegExpire(Agent *ag);
 		void clearAll() {
 			std::lock_guard<std::mutex> lock(mMutex);
@@ -431,6 +546,8 @@ class RegistrarDb {
 	virtual void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
 	virtual void doFetch(const url_t *url, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
 	virtual void doFetchInstance(const url_t *url, const std::string &uniqueId, const std::shared_ptr<ContactUpdateListener> &listener) = 0;
+	/* Default implementation fetches each url independently, backends may override it to group the requests. */
+	virtual void doFetchList(const std::vector<url_t *> &urls, const std::shared_ptr<ListContactUpdateListener> &listener);
 	virtual void doMigration() = 0;
 
 	int count_sip_contacts(const sip_contact_t *contact);
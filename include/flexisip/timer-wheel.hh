@@ -0,0 +1,137 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include <sofia-sip/su_wait.h>
+
+namespace flexisip {
+
+class TimerWheel;
+
+/**
+ * @brief A timer scheduled on a TimerWheel.
+ *
+ * The timer is an intrusive node of the wheel, so that setting and cancelling it neither allocates nor searches.
+ * It is cancelled when destroyed, and may be destroyed or set again from its own callback.
+ * Like su_timer_t, it must only be used from the thread of the su_root driving the wheel.
+ */
+class WheelTimer {
+  public:
+	typedef std::function<void()> Callback;
+
+	explicit WheelTimer(TimerWheel &wheel) : mWheel(&wheel) {
+	}
+	WheelTimer(const WheelTimer &) = delete;
+	WheelTimer &operator=(const WheelTimer &) = delete;
+	~WheelTimer() {
+		cancel();
+	}
+
+	/// (Re)arm the timer to call cb once, after at least the given delay.
+	void set(std::chrono::milliseconds delay, const Callback &cb);
+	void setSeconds(unsigned int seconds, const Callback &cb) {
+		set(std::chrono::seconds(seconds), cb);
+	}
+	void cancel();
+	bool isSet() const {
+		return mNext != nullptr;
+	}
+
+  private:
+	friend class TimerWheel;
+	WheelTimer() : mWheel(nullptr) {
+	}
+	void unlink() {
+		mPrev->mNext = mNext;
+		mNext->mPrev = mPrev;
+		mPrev = mNext = nullptr;
+	}
+
+	TimerWheel *mWheel;
+	WheelTimer *mPrev = nullptr;
+	WheelTimer *mNext = nullptr;
+	uint64_t mExpireTick = 0;
+	Callback mCallback;
+};
+
+/**
+ * @brief Hierarchical timing wheel shared by the timers of the proxy.
+ *
+ * Timers are hashed by expiration tick into levels of sBucketCount slots, each level sBucketCount times coarser than
+ * the previous one. Inserting and cancelling are O(1); the timers of a slot of an upper level are moved down when the
+ * lower level wraps. Timers beyond the range of the last level are parked in its farthest slot and rehashed when it
+ * comes up. A single sofia timer advances the wheel: it is armed for the next tick at which a slot holding timers comes
+ * up, so that the empty stretches of the wheel are skipped, and stopped while no timer is pending.
+ */
+class TimerWheel {
+  public:
+	typedef std::function<std::chrono::steady_clock::time_point()> Clock;
+
+	TimerWheel(su_root_t *root, std::chrono::milliseconds resolution = std::chrono::milliseconds(10),
+			   const Clock &clock = &std::chrono::steady_clock::now);
+	TimerWheel(const TimerWheel &) = delete;
+	TimerWheel &operator=(const TimerWheel &) = delete;
+	~TimerWheel();
+
+	std::chrono::milliseconds getResolution() const {
+		return mResolution;
+	}
+	size_t size() const {
+		return mCount;
+	}
+	/// Time the sofia timer of the wheel is armed for, time_point::max() while it is stopped.
+	std::chrono::steady_clock::time_point getWakeUpTime() const;
+
+	/// Runs the timers due at the current time of the clock, then arms the sofia timer again.
+	/// Called by the sofia timer; tests driving the clock themselves call it directly.
+	void runDue();
+
+  private:
+	friend class WheelTimer;
+	static constexpr int sLevelBits = 6;
+	static constexpr int sBucketCount = 1 << sLevelBits;
+	static constexpr int sLevels = 5;
+
+	static void sOnTick(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
+	uint64_t currentTick() const;
+	void schedule(WheelTimer &timer, std::chrono::milliseconds delay);
+	void remove(WheelTimer &timer);
+	uint64_t insert(WheelTimer &timer);
+	void cascade(int level);
+	uint64_t nextDueTick() const;
+	void arm(uint64_t tick);
+	void runTick();
+
+	su_root_t *mRoot;
+	su_timer_t *mTimer = nullptr;
+	std::chrono::milliseconds mResolution;
+	Clock mClock;
+	std::chrono::steady_clock::time_point mStart;
+	uint64_t mTick = 0; // next tick to run
+	uint64_t mWakeUpTick = UINT64_MAX; // tick the sofia timer is armed for, 0 while the due timers are run
+	size_t mCount = 0;
+	// Slot heads, as sentinels of circular lists.
+	WheelTimer mSlots[sLevels][sBucketCount];
+};
+
+}
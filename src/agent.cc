@@ -37,6 +37,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 
 #include <net/if.h>
@@ -123,7 +124,9 @@ void Agent::startLogWriter() {
 				cr->get<ConfigString>("database-backend")->read(),
 				cr->get<ConfigString>("database-connection-string")->read(),
 				cr->get<ConfigInt>("database-max-queue-size")->read(),
-				cr->get<ConfigInt>("database-nb-threads-max")->read()
+				cr->get<ConfigInt>("database-nb-threads-max")->read(),
+				cr->get<ConfigInt>("database-batch-size")->read(),
+				cr->get<ConfigInt>("database-batch-delay")->read()
 			);
 			if (!dbw->isReady()) {
 				LOGF("DataBaseEventLogWriter: unable to use database.");
@@ -135,7 +138,9 @@ void Agent::startLogWriter() {
 			#endif
 		} else {
 			string logdir = cr->get<ConfigString>("dir")->read();
-			FilesystemEventLogWriter *lw = new FilesystemEventLogWriter(logdir);
+			FilesystemEventLogWriter *lw = new FilesystemEventLogWriter(logdir,
+				cr->get<ConfigInt>("filesystem-max-queue-size")->read(),
+				cr->get<ConfigInt>("filesystem-max-open-files")->read());
 			if (!lw->isReady()) {
 				delete lw;
 			} else {
@@ -394,6 +399,7 @@ void Agent::start(const string &transport_override, const string passphrase) {
 	tport_t *primaries = tport_primaries(nta_agent_tports(mAgent));
 	if (primaries == NULL)
 		LOGF("No sip transport defined.");
+	updateLocalAddresses();
 
 	startMdns();
 
@@ -641,6 +647,7 @@ Agent::Agent(su_root_t *root) : mBaseConfigListener(NULL), mTerminating(false) {
 		LOGE("Can't find interface addresses: %s", strerror(err));
 	}
 	mRoot = root;
+	mTimerWheel.reset(new TimerWheel(mRoot));
 	mAgent = nta_agent_create(root, (url_string_t *)-1, &Agent::messageCallback, (nta_agent_magic_t *)this, TAG_END());
 	su_home_init(&mHome);
 	mPreferredRouteV4 = NULL;
@@ -659,6 +666,7 @@ Agent::~Agent() {
 	mTerminating = true;
 	for (Module *module : mModules)
 		delete module;
+	mTimerWheel.reset();
 
 	if (mTimer)
 		su_timer_destroy(mTimer);
@@ -689,6 +697,7 @@ bool Agent::doOnConfigStateChanged(const ConfigValue &conf, ConfigState state) {
 
 	if (conf.getName() == "aliases" && state == ConfigState::Commited) {
 		mAliases = ((ConfigStringList *)(&conf))->read();
+		updateLocalAddresses();
 		LOGD("Global aliases updated");
 		return true;
 	}
@@ -707,6 +716,7 @@ void Agent::loadConfig(GenericManager *cm) {
 	for (list<string>::iterator it = mAliases.begin(); it != mAliases.end(); ++it) {
 		LOGD("%s", (*it).c_str());
 	}
+	updateLocalAddresses();
 
 	RegistrarDb::initialize(this);
 
@@ -884,45 +894,69 @@ int Agent::countUsInVia(sip_via_t *via) const {
 	return count;
 }
 
-bool Agent::isUs(const char *host, const char *port, bool check_aliases) const {
-	char *tmp = NULL;
-	size_t end;
-	tport_t *tport = tport_primaries(nta_agent_tports(mAgent));
-
-	// skip possibly trailing '.' at the end of host
-	if (host[end = (strlen(host) - 1)] == '.') {
-		tmp = (char *)alloca(end + 1);
-		memcpy(tmp, host, end);
-		tmp[end] = '\0';
-		host = tmp;
+/*
+ * Lower-case the host, remove the trailing '.' of a fully qualified domain name, and the brackets of an IPv6 address,
+ * which is also rewritten in its canonical text form as it has several text representations.
+ */
+string Agent::normalizeHost(const char *host) {
+	string normalized(host);
+	if (!normalized.empty() && normalized.back() == '.')
+		normalized.pop_back();
+	if (normalized.size() >= 2 && normalized.front() == '[' && normalized.back() == ']')
+		normalized = normalized.substr(1, normalized.size() - 2);
+	if (normalized.find(':') != string::npos) {
+		struct in6_addr addr;
+		char canonical[INET6_ADDRSTRLEN];
+		if (inet_pton(AF_INET6, normalized.c_str(), &addr) == 1
+			&& inet_ntop(AF_INET6, &addr, canonical, sizeof(canonical)) != NULL)
+			return canonical;
 	}
-	const char *matched_port = port;
+	transform(normalized.begin(), normalized.end(), normalized.begin(), ::tolower);
+	return normalized;
+}
+
+/*
+ * Compute the sets looked up by isUs(). To be called whenever the primary transports or the aliases change.
+ */
+void Agent::updateLocalAddresses() {
+	mLocalAddresses.clear();
+	mLocalDefaultPortHosts.clear();
+	mAliasHosts.clear();
+
+	for (const string &alias : mAliases)
+		mAliasHosts.insert(normalizeHost(alias.c_str()));
+
+	if (!mAgent)
+		return;
+	for (tport_t *tport = tport_primaries(nta_agent_tports(mAgent)); tport != NULL; tport = tport_next(tport)) {
+		const tp_name_t *tn = tport_name(tport);
+		const char *defaultPort = strcasecmp(tn->tpn_proto, "tls") == 0 ? "5061" : "5060";
+		for (const char *name : {tn->tpn_canon, tn->tpn_host}) {
+			if (name == NULL)
+				continue;
+			string host = normalizeHost(name);
+			mLocalAddresses.insert(host + ":" + tn->tpn_port);
+			if (strcmp(tn->tpn_port, defaultPort) == 0)
+				mLocalDefaultPortHosts.insert(host);
+		}
+	}
+}
+
+bool Agent::isUs(const char *host, const char *port, bool check_aliases) const {
+	string normalized = normalizeHost(host);
 
 	if (check_aliases) {
 		/*the checking of aliases ignores the port number, since a domain name in a Route header might resolve to
 		 * multiple ports
 			* thanks to SRV records*/
-		list<string>::const_iterator it;
-		for (it = mAliases.begin(); it != mAliases.end(); ++it) {
-			if (ModuleToolbox::urlHostMatch(host, (*it).c_str()))
-				return true;
-		}
+		if (mAliasHosts.count(normalized))
+			return true;
 	}
 
-	for (; tport != NULL; tport = tport_next(tport)) {
-		const tp_name_t *tn = tport_name(tport);
-		if (port == NULL) {
-			if (strcasecmp(tn->tpn_proto, "tls") == 0)
-				matched_port = "5061";
-			else
-				matched_port = "5060";
-		}
-		if (strcmp(matched_port, tn->tpn_port) == 0) {
-			if (ModuleToolbox::urlHostMatch(host, tn->tpn_canon) || ModuleToolbox::urlHostMatch(host, tn->tpn_host))
-				return true;
-		}
-	}
-	return false;
+	// Without port, the host is compared to the transports listening on the default port of their protocol.
+	if (port == NULL)
+		return mLocalDefaultPortHosts.count(normalized) != 0;
+	return mLocalAddresses.count(normalized + ":" + port) != 0;
 }
 
 sip_via_t *Agent::getNextVia(sip_t *response) {
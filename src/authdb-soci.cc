@@ -227,6 +227,7 @@ void SociAuthDB::getPasswordWithPool(const string &id, const string &domain,
 			if(listener_ref) listener_ref->finishVerifyAlgos(passwd);
 
 			stop = steady_clock::now();
+			mQueryTime->recordDuration(stop - start);
 			SLOGD << "[SOCI] Got pass for " << id << " in " << DURATION_MS(start, stop) << "ms";
 			if (!passwd.empty()) cachePassword(createPasswordKey(id, authid), domain, passwd, mCacheExpire);
 			if (listener){
@@ -296,6 +297,7 @@ void SociAuthDB::getUserWithPhoneWithPool(const string &phone, const string &dom
 			}
 		}
 		stop = steady_clock::now();
+		mQueryTime->recordDuration(stop - start);
 		if (!user.empty())  {
 			SLOGD << "[SOCI] Got user for " << phone << " in " << DURATION_MS(start, stop) << "ms";
 			cacheUserWithPhone(phone, domain, user);
@@ -361,6 +363,7 @@ void SociAuthDB::getUsersWithPhonesWithPool(list<tuple<string, string,AuthDbList
 		rowset<row> ret = (sql->prepare << s);
 		stop = steady_clock::now();
 
+		mQueryTime->recordDuration(stop - start);
 		SLOGD << "[SOCI] Got users in " << DURATION_MS(start, stop) << "ms";
 
 		for (rowset<row>::const_iterator it = ret.begin(); it != ret.end(); ++it) {
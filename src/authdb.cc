@@ -70,12 +70,15 @@ AuthDbBackend::AuthDbBackend() {
 	GenericStruct *ma = cr->get<GenericStruct>("module::Authentication");
 	list<string> domains = ma->get<ConfigStringList>("auth-domains")->read();
 	mCacheExpire = ma->get<ConfigInt>("cache-expire")->read();
+	mQueryTime = ma->get<StatHistogram>("auth-db-query-time-us");
 }
 
 AuthDbBackend::~AuthDbBackend() {
 }
 
 void AuthDbBackend::declareConfig(GenericStruct *mc) {
+	mc->createHistogram("auth-db-query-time-us",
+		"Time spent by the authentication backend to answer a query, in microseconds.");
 
 	FileAuthDb::declareConfig(mc);
 #if ENABLE_ODBC
@@ -89,6 +89,7 @@ protected:
 	void createCachedAccount(const std::string & user, const std::string & domain, const std::string &auth_username, const std::vector<passwd_algo_t> &password, int expires, const std::string & phone_alias = "");
 	void clearCache();
 	int mCacheExpire;
+	StatHistogram *mQueryTime;
 public:
 	virtual ~AuthDbBackend();
 	// warning: listener may be invoked on authdb backend thread, so listener must be threadsafe somehow!
@@ -132,7 +132,7 @@ CallContextBase::~CallContextBase() {
 	}
 }
 
-CallStore::CallStore() : mCountCalls(NULL), mCountCallsFinished(NULL) {
+CallStore::CallStore() : mCount(0), mCountCalls(NULL), mCountCallsFinished(NULL) {
 }
 
 CallStore::~CallStore() {
@@ -141,69 +141,131 @@ CallStore::~CallStore() {
 void CallStore::store(const shared_ptr<CallContextBase> &ctx) {
 	if (mCountCalls)
 		++(*mCountCalls);
-	mCalls.push_back(ctx);
+	CallEntry entry;
+	entry.ctx = ctx;
+	entry.activityIt = mCallsByActivity.insert(make_pair(ctx->getLastActivity(), ctx.get()));
+	mCalls[ctx->getCallHash()].push_back(entry);
+	mCount++;
 }
 
-shared_ptr<CallContextBase> CallStore::find(Agent *ag, sip_t *sip, bool match_call_id_only) {
-	for (auto it = mCalls.begin(); it != mCalls.end(); ++it) {
-		if ((*it)->match(ag, sip, match_call_id_only))
-			return *it;
+CallStore::CallEntries::iterator CallStore::findEntry(CallEntries &entries, const CallContextBase *ctx) {
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		if ((*it).ctx.get() == ctx)
+			return it;
 	}
-	return shared_ptr<CallContextBase>();
+	return entries.end();
 }
 
-shared_ptr<CallContextBase> CallStore::findEstablishedDialog(Agent *ag, sip_t *sip) {
-	for (auto it = mCalls.begin(); it != mCalls.end(); ++it) {
-		if ((*it)->match(ag, sip, false, true))
-			return *it;
+void CallStore::erase(unordered_map<uint32_t, CallEntries>::iterator bucket, CallEntries::iterator entry) {
+	mCallsByActivity.erase((*entry).activityIt);
+	(*bucket).second.erase(entry);
+	if ((*bucket).second.empty())
+		mCalls.erase(bucket);
+	mCount--;
+}
+
+shared_ptr<CallContextBase> CallStore::findMatching(Agent *ag, sip_t *sip, bool match_call_id_only,
+													bool match_established) {
+	if (sip->sip_call_id == NULL)
+		return shared_ptr<CallContextBase>();
+	auto bucket = mCalls.find(sip->sip_call_id->i_hash);
+	if (bucket == mCalls.end())
+		return shared_ptr<CallContextBase>();
+	for (auto it = (*bucket).second.begin(); it != (*bucket).second.end(); ++it) {
+		if ((*it).ctx->match(ag, sip, match_call_id_only, match_established))
+			return (*it).ctx;
 	}
 	return shared_ptr<CallContextBase>();
 }
 
+shared_ptr<CallContextBase> CallStore::find(Agent *ag, sip_t *sip, bool match_call_id_only) {
+	return findMatching(ag, sip, match_call_id_only, false);
+}
+
+shared_ptr<CallContextBase> CallStore::findEstablishedDialog(Agent *ag, sip_t *sip) {
+	return findMatching(ag, sip, false, true);
+}
+
 void CallStore::findAndRemoveExcept(Agent *ag, sip_t *sip, const shared_ptr<CallContextBase> &ctx, bool stateful) {
 	int removed = 0;
-	for (auto it = mCalls.begin(); it != mCalls.end();) {
-		if (*it != ctx && (*it)->match(ag, sip, stateful)) {
+	if (sip->sip_call_id == NULL)
+		return;
+	auto bucket = mCalls.find(sip->sip_call_id->i_hash);
+	if (bucket == mCalls.end())
+		return;
+	CallEntries &entries = (*bucket).second;
+	for (auto it = entries.begin(); it != entries.end();) {
+		if ((*it).ctx != ctx && (*it).ctx->match(ag, sip, stateful)) {
 			if (mCountCallsFinished)
 				++(*mCountCallsFinished);
 			LOGD("CallStore::findAndRemoveExcept() removing CallContext %p", ctx.get());
-			it = mCalls.erase(it);
+			mCallsByActivity.erase((*it).activityIt);
+			it = entries.erase(it);
+			mCount--;
 			++removed;
 		} else
 			++it;
 	}
+	if (entries.empty())
+		mCalls.erase(bucket);
 	LOGD("Removed %d maching call contexts from store", removed);
 }
 
 void CallStore::remove(const shared_ptr<CallContextBase> &ctx) {
-	auto it = std::find(mCalls.begin(), mCalls.end(), ctx);
-	if (it != mCalls.end()) {
+	auto bucket = mCalls.find(ctx->getCallHash());
+	if (bucket == mCalls.end())
+		return;
+	auto it = findEntry((*bucket).second, ctx.get());
+	if (it != (*bucket).second.end()) {
 		LOGD("CallStore::remove() removing CallContext %p", ctx.get());
 		if (mCountCallsFinished)
 			++(*mCountCallsFinished);
-		(*it)->terminate();
-		mCalls.erase(it);
+		/* keep the context alive until terminate() returns */
+		shared_ptr<CallContextBase> removedCtx = (*it).ctx;
+		removedCtx->terminate();
+		erase(bucket, it);
 	}
 }
 
 void CallStore::removeAndDeleteInactives(time_t inactivityPeriod) {
 	time_t cur = getCurrentTime();
-	for (auto it = mCalls.begin(); it != mCalls.end();) {
-		if ((*it)->getLastActivity() + inactivityPeriod < cur) {
-			LOGD("CallStore::removeAndDeleteInactives() removing CallContext %p", (*it).get());
+	/* The activity time recorded in mCallsByActivity is never more recent than the actual one, so contexts beyond
+	 * the first one that is recorded as active cannot have expired. */
+	while (!mCallsByActivity.empty() && mCallsByActivity.begin()->first + inactivityPeriod < cur) {
+		CallContextBase *ctx = mCallsByActivity.begin()->second;
+		auto bucket = mCalls.find(ctx->getCallHash());
+		auto entry = findEntry((*bucket).second, ctx);
+		time_t lastActivity = ctx->getLastActivity();
+		if (lastActivity + inactivityPeriod < cur) {
+			LOGD("CallStore::removeAndDeleteInactives() removing CallContext %p", ctx);
 			if (mCountCallsFinished)
 				++(*mCountCallsFinished);
-			(*it)->terminate();
-			it = mCalls.erase(it);
-		} else
-			++it;
+			shared_ptr<CallContextBase> removedCtx = (*entry).ctx;
+			removedCtx->terminate();
+			erase(bucket, entry);
+		} else {
+			mCallsByActivity.erase((*entry).activityIt);
+			(*entry).activityIt = mCallsByActivity.insert(make_pair(lastActivity, ctx));
+		}
 	}
 }
 
 void CallStore::dump() {
-	for_each(mCalls.begin(), mCalls.end(), bind(&CallContextBase::dump, placeholders::_1));
+	for (auto bucket = mCalls.begin(); bucket != mCalls.end(); ++bucket) {
+		for (auto it = (*bucket).second.begin(); it != (*bucket).second.end(); ++it) {
+			(*it).ctx->dump();
+		}
+	}
+}
+
+void CallStore::forEach(const function<void(const shared_ptr<CallContextBase> &)> &func) {
+	for (auto bucket = mCalls.begin(); bucket != mCalls.end(); ++bucket) {
+		for (auto it = (*bucket).second.begin(); it != (*bucket).second.end(); ++it) {
+			func((*it).ctx);
+		}
+	}
 }
 
 int CallStore::size() {
-	return mCalls.size();
+	return mCount;
 }
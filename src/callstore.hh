@@ -19,7 +19,10 @@
 #pragma once
 
 #include <flexisip/agent.hh>
+#include <functional>
 #include <list>
+#include <map>
+#include <unordered_map>
 
 namespace flexisip {
 
@@ -49,6 +52,9 @@ class CallContextBase {
 	uint32_t getViaCount() const {
 		return mViaCount;
 	}
+	uint32_t getCallHash() const {
+		return mCallHash;
+	}
 
   private:
 	su_home_t mHome;
@@ -64,6 +70,12 @@ class CallContextBase {
 	time_t mLastSIPActivity;
 };
 
+/**
+ * Call contexts are indexed by the hash of their Call-ID, which is the first criteria checked by
+ * CallContextBase::match(), so that looking up the context of a SIP message does not depend on the number of calls.
+ * They are also ordered by their last known activity time, so that only the contexts that may have expired are
+ * examined by removeAndDeleteInactives().
+**/
 class CallStore {
   public:
 	CallStore();
@@ -80,16 +92,30 @@ class CallStore {
 		mCountCallsFinished = invFinishedCount;
 	}
 	void dump();
-	const std::list<std::shared_ptr<CallContextBase>> &getList() const {
-		return mCalls;
-	}
+	/// Calls func on every stored call context.
+	void forEach(const std::function<void(const std::shared_ptr<CallContextBase> &)> &func);
 	/// Returns the number of calls registered in the CallStore.
 	int size();
 
   private:
-	std::list<std::shared_ptr<CallContextBase>> mCalls;
+	struct CallEntry {
+		std::shared_ptr<CallContextBase> ctx;
+		std::multimap<time_t, CallContextBase *>::iterator activityIt;
+	};
+	typedef std::list<CallEntry> CallEntries;
+
+	std::shared_ptr<CallContextBase> findMatching(Agent *ag, sip_t *sip, bool match_call_id_only,
+												  bool match_established);
+	CallEntries::iterator findEntry(CallEntries &entries, const CallContextBase *ctx);
+	void erase(std::unordered_map<uint32_t, CallEntries>::iterator bucket, CallEntries::iterator entry);
+
+	/* contexts sharing the same Call-ID hash, in insertion order */
+	std::unordered_map<uint32_t, CallEntries> mCalls;
+	/* last activity time known to the store, which may be older than the actual one */
+	std::multimap<time_t, CallContextBase *> mCallsByActivity;
+	size_t mCount;
 	StatCounter64 *mCountCalls;
 	StatCounter64 *mCountCallsFinished;
 };
 
-}
\ No newline at end of file
+}
@@ -25,6 +25,7 @@
 #include <cerrno>
 #include <cstring>
 #include <poll.h>
+#include <mutex>
 
 #include "cli.hh"
 #include <flexisip/common.hh>
@@ -95,17 +96,18 @@ void CommandLineInterface::handle_config_get_command(unsigned int socket, const
 		return;
 	}
 
-	GenericEntry *entry = get_generic_entry(args.front());
-	if (!entry) {
-		answer(socket, "Error: " + args.front() + " not found");
-		return;
+	std::string message;
+	{
+		std::lock_guard<std::mutex> lock(GenericStruct::getTreeMutex());
+		GenericEntry *entry = get_generic_entry(args.front());
+		if (!entry) {
+			message = "Error: " + args.front() + " not found";
+		} else {
+			GenericStruct *gstruct = dynamic_cast<GenericStruct *>(entry);
+			message = gstruct ? printSection(gstruct, false) : printEntry(entry, false);
+		}
 	}
-
-	GenericStruct *gstruct = dynamic_cast<GenericStruct *>(entry);
-	if (gstruct)
-		answer(socket, printSection(gstruct, false));
-	else
-		answer(socket, printEntry(entry, false));
+	answer(socket, message);
 }
 
 void CommandLineInterface::handle_config_list_command(unsigned int socket, const std::vector<std::string> &args) {
@@ -114,17 +116,18 @@ void CommandLineInterface::handle_config_list_command(unsigned int socket, const
 		return;
 	}
 
-	GenericEntry *entry = get_generic_entry(args.front());
-	if (!entry) {
-		answer(socket, "Error: " + args.front() + " not found");
-		return;
+	std::string message;
+	{
+		std::lock_guard<std::mutex> lock(GenericStruct::getTreeMutex());
+		GenericEntry *entry = get_generic_entry(args.front());
+		if (!entry) {
+			message = "Error: " + args.front() + " not found";
+		} else {
+			GenericStruct *gstruct = dynamic_cast<GenericStruct *>(entry);
+			message = gstruct ? printSection(gstruct, true) : printEntry(entry, true);
+		}
 	}
-
-	GenericStruct *gstruct = dynamic_cast<GenericStruct *>(entry);
-	if (gstruct)
-		answer(socket, printSection(gstruct, true));
-	else
-		answer(socket, printEntry(entry, true));
+	answer(socket, message);
 }
 
 void CommandLineInterface::handle_config_set_command(unsigned int socket, const std::vector<std::string> &args) {
@@ -134,7 +137,11 @@ void CommandLineInterface::handle_config_set_command(unsigned int socket, const
 	}
 
 	std::string arg = args.front();
-	GenericEntry *entry = get_generic_entry(arg);
+	GenericEntry *entry;
+	{
+		std::lock_guard<std::mutex> lock(GenericStruct::getTreeMutex());
+		entry = get_generic_entry(arg);
+	}
 	if (!entry) {
 		answer(socket, "Error: " + args.front() + " not found");
 		return;
@@ -237,6 +244,7 @@ void CommandLineInterface::run() {
 	unlink(path.c_str());
 }
 
+/* Called with the tree lock held, as the main thread may add statistics to the tree while it is walked. */
 GenericEntry* CommandLineInterface::find(GenericStruct *root, std::vector<std::string> &path) {
 	std::string elem = path.front();
 	path.erase(path.begin());
@@ -275,6 +283,8 @@ std::string CommandLineInterface::printEntry(GenericEntry *entry, bool printHelp
 			auto counter = dynamic_cast<StatCounter64 *>(entry);
 			if (counter) {
 				answer += counter->getName() + " : " + std::to_string(counter->read());
+			} else if (auto histogram = dynamic_cast<StatHistogram *>(entry)) {
+				answer += histogram->getName() + " : " + histogram->summary();
 			} else {
 				auto value = dynamic_cast<ConfigValue *>(entry);
 				if (value)
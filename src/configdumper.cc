@@ -326,6 +326,7 @@ ostream &MibDumper::dump2(ostream &ostr, GenericEntry *entry, int level) const {
 	GenericStruct *cs = dynamic_cast<GenericStruct *>(entry);
 	ConfigValue *cVal;
 	StatCounter64 *sVal;
+	StatHistogram *hVal;
 	NotificationEntry *ne;
 	string spacing = "";
 	while (level > 0) {
@@ -344,6 +345,8 @@ ostream &MibDumper::dump2(ostream &ostr, GenericEntry *entry, int level) const {
 		cVal->mibFragment(ostr, spacing);
 	} else if ((sVal = dynamic_cast<StatCounter64 *>(entry)) != NULL) {
 		sVal->mibFragment(ostr, spacing);
+	} else if ((hVal = dynamic_cast<StatHistogram *>(entry)) != NULL) {
+		hVal->mibFragment(ostr, spacing);
 	} else if ((ne = dynamic_cast<NotificationEntry *>(entry)) != NULL) {
 		ne->mibFragment(ostr, spacing);
 	}
@@ -142,6 +142,33 @@ void StatCounter64::mibFragment(ostream &ost, string spacing) const {
 	string s("Counter64");
 	doMibFragment(ost, "", "read-only", s, spacing);
 }
+void StatHistogram::mibFragment(ostream &ost, string spacing) const {
+	if (!getParent())
+		LOGA("no parent found for %s", getName().c_str());
+	static const struct {
+		SnmpLeaf leaf;
+		const char *suffix;
+		const char *help;
+	} leaves[] = {{SnmpCount, "Count", "Number of recorded values."},
+				  {SnmpSum, "Sum", "Sum of the recorded values."},
+				  {SnmpP50, "P50", "Estimated median."},
+				  {SnmpP90, "P90", "Estimated 90th percentile."},
+				  {SnmpP99, "P99", "Estimated 99th percentile."}};
+	string name = sanitize(getName());
+	ost << spacing << name << "	"
+		<< "OBJECT IDENTIFIER ::= { " << sanitize(getParent()->getName()) << " " << mOid->getLeaf() << " }" << endl;
+	for (const auto &l : leaves) {
+		ost << spacing << "	" << name << l.suffix << " OBJECT-TYPE" << endl
+			<< spacing << "		SYNTAX	Counter64" << endl
+			<< spacing << "		MAX-ACCESS	read-only" << endl
+			<< spacing << "		STATUS	current" << endl
+			<< spacing << "		DESCRIPTION" << endl
+			<< spacing << "		\"" << escapeDoubleQuotes(getHelp()) << " " << l.help << endl
+			<< spacing << "		"
+			<< " PN:" << getPrettyName() << "\"" << endl
+			<< spacing << "		::= { " << name << " " << l.leaf << " }" << endl;
+	}
+}
 void GenericStruct::mibFragment(ostream &ost, string spacing) const {
 	string parent = getParent() ? getParent()->getName() : "flexisipMIB";
 	ost << spacing << sanitize(getName()) << "	"
@@ -389,6 +416,30 @@ void ConfigValue::setParent(GenericEntry *parent) {
 #endif
 }
 
+void StatHistogram::setParent(GenericEntry *parent) {
+	GenericEntry::setParent(parent);
+
+#ifdef ENABLE_SNMP
+	static const SnmpLeaf leaves[] = {SnmpCount, SnmpSum, SnmpP50, SnmpP90, SnmpP99};
+	for (SnmpLeaf leaf : leaves) {
+		vector<oid> path = mOid->getValue();
+		path.push_back(leaf);
+		string handlerName = sanitize(mName) + to_string(leaf);
+		netsnmp_handler_registration *reginfo = netsnmp_create_handler_registration(
+			handlerName.c_str(), &GenericEntry::sHandleSnmpRequest, path.data(), path.size(), HANDLER_CAN_RONLY);
+		reginfo->my_reg_void = this;
+		int res = netsnmp_register_read_only_scalar(reginfo);
+		if (res != MIB_REGISTERED_OK) {
+			if (res == MIB_DUPLICATE_REGISTRATION) {
+				LOGE("Duplicate registration of SNMP %s", handlerName.c_str());
+			} else {
+				LOGE("Couldn't register SNMP %s", handlerName.c_str());
+			}
+		}
+	}
+#endif
+}
+
 void StatCounter64::setParent(GenericEntry *parent) {
 	GenericEntry::setParent(parent);
 
@@ -420,8 +471,16 @@ void GenericStruct::setParent(GenericEntry *parent) {
 #endif
 }
 
+std::mutex &GenericStruct::getTreeMutex() {
+	static std::mutex treeMutex;
+	return treeMutex;
+}
+
 GenericEntry *GenericStruct::addChild(GenericEntry *c) {
-	mEntries.push_back(c);
+	{
+		lock_guard<mutex> lock(getTreeMutex());
+		mEntries.push_back(c);
+	}
 	c->setParent(this);
 	return c;
 }
@@ -474,12 +533,26 @@ void GenericStruct::addChildrenValues(ConfigItemDescriptor *items, bool hashed)
 	}
 }
 
+StatHistogram *GenericStruct::createHistogram(const string &name, const string &help) {
+	oid cOid = Oid::oidFromHashedString(name);
+	StatHistogram *val = new StatHistogram(name, help, cOid);
+	addChild(val);
+	return val;
+}
+
 StatCounter64 *GenericStruct::createStat(const string &name, const string &help) {
 	oid cOid = Oid::oidFromHashedString(name);
 	StatCounter64 *val = new StatCounter64(name, help, cOid);
 	addChild(val);
 	return val;
 }
+
+StatGauge64 *GenericStruct::createGauge(const string &name, const string &help) {
+	oid cOid = Oid::oidFromHashedString(name);
+	StatGauge64 *val = new StatGauge64(name, help, cOid);
+	addChild(val);
+	return val;
+}
 pair<StatCounter64 *, StatCounter64 *> GenericStruct::createStatPair(const string &name, const string &help) {
 	return make_pair(createStat(name, help), createStat(name + "-finished", help + " Finished."));
 }
@@ -680,6 +753,60 @@ StatCounter64::StatCounter64(const string &name, const string &help, oid oid_ind
 	mValue = 0;
 }
 
+StatGauge64::StatGauge64(const string &name, const string &help, oid oid_index) : StatCounter64(name, help, oid_index) {
+}
+
+constexpr int StatHistogram::sBucketCount;
+
+StatHistogram::StatHistogram(const string &name, const string &help, oid oid_index)
+	: GenericEntry(name, Histogram, help, oid_index) {
+	for (auto &bucket : mBuckets)
+		bucket = 0;
+	mCount = 0;
+	mSum = 0;
+}
+
+uint64_t StatHistogram::quantile(double q) const {
+	uint64_t buckets[sBucketCount];
+	uint64_t total = 0;
+	for (int i = 0; i < sBucketCount; ++i) {
+		buckets[i] = getBucket(i);
+		total += buckets[i];
+	}
+	if (total == 0)
+		return 0;
+	q = max(0.0, min(1.0, q));
+	double rank = q * total;
+	uint64_t cumulated = 0;
+	for (int i = 0; i < sBucketCount; ++i) {
+		if (buckets[i] == 0)
+			continue;
+		if (cumulated + buckets[i] >= rank) {
+			if (i == 0)
+				return 0;
+			/* The last bucket has no upper bound, report its lower bound. */
+			uint64_t lower = bucketUpperBound(i - 1) + 1;
+			if (i == sBucketCount - 1)
+				return lower;
+			uint64_t upper = bucketUpperBound(i);
+			double fraction = (rank - cumulated) / buckets[i];
+			return lower + (uint64_t)(fraction * (upper - lower));
+		}
+		cumulated += buckets[i];
+	}
+	return bucketUpperBound(sBucketCount - 2) + 1;
+}
+
+string StatHistogram::summary() const {
+	ostringstream oss;
+	uint64_t count = getCount();
+	oss << "count=" << count << " sum=" << getSum();
+	if (count > 0)
+		oss << " avg=" << getSum() / count;
+	oss << " p50=" << quantile(0.5) << " p90=" << quantile(0.9) << " p99=" << quantile(0.99);
+	return oss.str();
+}
+
 ConfigString::ConfigString(const string &name, const string &help, const string &default_value, oid oid_index)
 	: ConfigValue(name, String, help, default_value, oid_index) {
 }
@@ -906,6 +1033,10 @@ GenericManager::GenericManager()
 		{Boolean, "require-peer-certificate", "Require client certificate from peer (inbound connections only).", "false"},
 		{Integer, "transaction-timeout", "SIP transaction timeout in milliseconds. It is T1*64 (32000 ms) by default.",
 		 "32000"},
+		{Boolean, "module-latency-stats",
+		 "Measure the time spent by each enabled module processing requests and responses. The measures are exported "
+		 "as histograms by SIP method in the statistics of each module (latency-<method>-us).",
+		 "false"},
 		{Integer, "udp-mtu",
 		 "The UDP MTU. Flexisip will fallback to TCP when sending a message whose size exceeds the UDP MTU."
 		 " Please read http://sofia-sip.sourceforge.net/refdocs/nta/nta__tag_8h.html#a6f51c1ff713ed4b285e95235c4cc999a "
@@ -1328,4 +1459,44 @@ int StatCounter64::handleSnmpRequest(netsnmp_mib_handler *handler, netsnmp_handl
 
 	return SNMP_ERR_NOERROR;
 }
+
+int StatHistogram::handleSnmpRequest(netsnmp_mib_handler *handler, netsnmp_handler_registration *reginfo,
+									 netsnmp_agent_request_info *reqinfo, netsnmp_request_info *requests) {
+	uint64_t value;
+
+	switch (reqinfo->mode) {
+		case MODE_GET:
+			/* The scalar helper appended the ".0" instance suffix to the registered oid. */
+			switch (reginfo->rootoid[reginfo->rootoid_len - 2]) {
+				case SnmpCount:
+					value = getCount();
+					break;
+				case SnmpSum:
+					value = getSum();
+					break;
+				case SnmpP50:
+					value = quantile(0.5);
+					break;
+				case SnmpP90:
+					value = quantile(0.9);
+					break;
+				case SnmpP99:
+					value = quantile(0.99);
+					break;
+				default:
+					return SNMP_ERR_NOSUCHNAME;
+			}
+			struct counter64 counter;
+			counter.high = value >> 32;
+			counter.low = value & 0x00000000FFFFFFFF;
+			snmp_set_var_typed_value(requests->requestvb, ASN_COUNTER64, (const u_char *)&counter, sizeof(counter));
+			break;
+		default:
+			/* we should never get here, so this is a really bad error */
+			snmp_log(LOG_ERR, "unknown mode (%d)\n", reqinfo->mode);
+			return SNMP_ERR_GENERR;
+	}
+
+	return SNMP_ERR_NOERROR;
+}
 #endif /* enable_snmp */
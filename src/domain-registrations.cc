@@ -292,7 +292,7 @@ DomainRegistration::DomainRegistration(DomainRegistrationManager &mgr, const str
 	domainRegistrationStatName<<"registration-status-"<<lineIndex;
 	ostringstream domainRegistrationStatHelp;
 	domainRegistrationStatHelp<<"Domain registration status for "<< localDomain;
-	mRegistrationStatus = mgr.mDomainRegistrationArea->createStat(domainRegistrationStatName.str(), domainRegistrationStatHelp.str());
+	mRegistrationStatus = mgr.mDomainRegistrationArea->createGauge(domainRegistrationStatName.str(), domainRegistrationStatHelp.str());
 }
 
 bool DomainRegistration::hasTport(const tport_t *tport) const {
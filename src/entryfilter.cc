@@ -35,7 +35,9 @@ static ConfigItemDescriptor config[] = {
 	{String, "to-domains", "Deprecated: List of domain names in sip to allowed to enter the module.", "*"},
 	{BooleanExpr, "filter", "A request/response enters module if the boolean filter evaluates to true. Ex:"
 							" from.uri.domain contains 'sip.linphone.org', from.uri.domain in 'a.org b.org c.org',"
-							" (to.uri.domain in 'a.org b.org c.org') && (user-agent == 'Linphone v2')",
+							" (to.uri.domain in 'a.org b.org c.org') && (user-agent == 'Linphone v2')."
+							" A comparison with an attribute missing from the message is false, except '!=' which is"
+							" true, like '!(a == b)'.",
 	 ""},
 	config_item_end};
 
@@ -65,7 +67,11 @@ void ConfigEntryFilter::loadConfig(const GenericStruct *mc) {
 		}
 	}
 	mEnabled = mc->get<ConfigBoolean>("enabled")->read();
-	mBooleanExprFilter = BooleanExpression::parse(filter);
+	try {
+		mBooleanExprFilter = BooleanExpression::parse(filter);
+	} catch (invalid_argument &e) {
+		LOGF("Invalid filter '%s' for %s: %s", filter.c_str(), mc->getName().c_str(), e.what());
+	}
 	mEntryName = mc->getName();
 }
 
@@ -24,6 +24,7 @@
 #include <sofia-sip/sip_protos.h>
 #include <sofia-sip/su_tagarg.h>
 #include <sofia-sip/msg_addr.h>
+#include <sofia-sip/msg_mclass.h>
 #include "sipattrextractor.hh"
 
 using namespace std;
@@ -38,10 +39,50 @@ MsgSip::MsgSip(msg_t *msg) {
 	assignMsg(msg);
 }
 
-/*Invoking the copy constructor of MsgSip implies the deep copy of the underlying msg_t */
+/*
+ * Duplicate the headers of a serialized message but share its body: the payload of the duplicate is a shallow copy
+ * that points to the data of the original message, which is kept alive as the parent of the duplicate.
+ * Bodies are never modified in place (modules replace the payload header instead), so the forks of a request with a
+ * large body (SDP, file transfer description, encrypted message...) don't need a copy of it each.
+ * Like msg_dup(), each header is appended to the end of its list, so that the order of the Via and Record-Route
+ * headers is kept (msg_header_insert() would put them in front of the ones already copied). The fragment chain is then
+ * built by msg_serialize().
+ */
+static msg_t *dupSharingPayload(msg_t *orig) {
+	msg_t *dup = msg_create(msg_mclass(orig), msg_get_flags(orig, ~0U));
+	if (!dup)
+		return NULL;
+	su_home_t *home = msg_home(dup);
+	msg_pub_t *pub = msg_object(dup);
+	for (const msg_header_t *h = msg_chain_head(orig); h != NULL; h = (const msg_header_t *)h->sh_succ) {
+		msg_header_t **list = msg_hclass_offset(msg_mclass(dup), pub, h->sh_class);
+		msg_header_t *copy = (h->sh_class == sip_payload_class) ? msg_header_copy_one(home, h)
+																 : msg_header_dup_one(home, h);
+		if (!list || !copy) {
+			msg_destroy(dup);
+			return NULL;
+		}
+		while (*list)
+			list = &(*list)->sh_next;
+		*list = copy;
+	}
+	if (msg_serialize(dup, pub) < 0) {
+		msg_destroy(dup);
+		return NULL;
+	}
+	msg_addr_copy(dup, orig);
+	msg_set_parent(dup, orig);
+	return dup;
+}
+
+/*Invoking the copy constructor of MsgSip implies the deep copy of the underlying msg_t headers, the body being shared*/
 MsgSip::MsgSip(const MsgSip &msgSip) {
 	msgSip.serialize();
-	msg_t *freshCopy = msg_dup(msgSip.mMsg);
+	msg_t *freshCopy = NULL;
+	if (msgSip.getSip()->sip_payload)
+		freshCopy = dupSharingPayload(msgSip.mMsg);
+	if (!freshCopy)
+		freshCopy = msg_dup(msgSip.mMsg);
 	assignMsg(freshCopy);
 	msg_destroy(freshCopy);
 	LOGD("New MsgSip %p copied from MsgSip %p", this, &msgSip);
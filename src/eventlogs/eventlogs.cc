@@ -27,6 +27,7 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <chrono>
 #include <typeinfo>
 
 using namespace std;
@@ -61,6 +62,21 @@ EventLog::Init::Init() {
 		{Integer, "database-nb-threads-max", "Maximum number of threads for writing in database.\n"
 		 "If you get a `database is locked` error with sqlite3, you must set this variable to 1.",
 		 "10"},
+		{Integer, "database-batch-size",
+		 "Maximum number of queued event logs written in a single database transaction.",
+		 "50"},
+		{Integer, "database-batch-delay",
+		 "Time in milliseconds a writing thread may wait for 'database-batch-size' event logs to be queued before "
+		 "writing the ones already there. 0 writes them immediately, batching only the events that accumulated while "
+		 "the previous transactions were running.",
+		 "0"},
+		{Integer, "filesystem-max-queue-size",
+		 "Amount of event logs that can wait to be written by the filesystem logger before new ones are dropped.",
+		 "10000"},
+		{Integer, "filesystem-max-open-files",
+		 "Maximum number of log files the filesystem logger keeps open, the least recently used ones being closed "
+		 "first.",
+		 "128"},
 		config_item_end};
 	GenericStruct *ev = new GenericStruct(
 		"event-logs",
@@ -70,6 +86,12 @@ EventLog::Init::Init() {
 	);
 	GenericManager::get()->getRoot()->addChild(ev);
 	ev->addChildrenValues(items);
+
+	ev->createGauge("count-filesystem-queued-logs", "Number of event logs waiting to be written by the filesystem logger.");
+	ev->createStat("count-filesystem-dropped-logs", "Number of event logs dropped because the filesystem logger queue was full.");
+	ev->createStat("count-database-batches", "Number of transactions used to write event logs in the database.");
+	ev->createStat("count-database-batched-logs", "Number of event logs written in the database.");
+	ev->createStat("count-database-flush-time-ms", "Cumulated time in milliseconds spent writing event logs in the database.");
 }
 
 EventLog::EventLog(const sip_t *sip) {
@@ -236,7 +258,8 @@ inline ostream &operator<<(ostream &ostr, MessageLog::ReportType type) {
 EventLogWriter::~EventLogWriter() {
 }
 
-FilesystemEventLogWriter::FilesystemEventLogWriter(const std::string &rootpath) : mRootPath(rootpath), mIsReady(false) {
+FilesystemEventLogWriter::FilesystemEventLogWriter(const std::string &rootpath, size_t maxQueueSize, size_t maxOpenFiles)
+	: mRootPath(rootpath), mIsReady(false), mMaxQueueSize(maxQueueSize), mMaxOpenFiles(maxOpenFiles) {
 	if (rootpath.c_str()[0] != '/') {
 		LOGE("Path for event log writer must be absolute.");
 		return;
@@ -244,51 +267,42 @@ FilesystemEventLogWriter::FilesystemEventLogWriter(const std::string &rootpath)
 	if (!createDirectoryIfNotExist(rootpath.c_str()))
 		return;
 
+	GenericStruct *cr = GenericManager::get()->getRoot()->get<GenericStruct>("event-logs");
+	mCountDropped = cr->get<StatCounter64>("count-filesystem-dropped-logs");
+	mCountQueued = cr->get<StatGauge64>("count-filesystem-queued-logs");
+
+	mRunning = true;
+	mThread = thread(&FilesystemEventLogWriter::run, this);
 	mIsReady = true;
 }
 
+FilesystemEventLogWriter::~FilesystemEventLogWriter() {
+	if (mThread.joinable()) {
+		mMutex.lock();
+		mRunning = false;
+		mMutex.unlock();
+		mCond.notify_one();
+		mThread.join();
+	}
+	for (const auto &file : mOpenFiles)
+		close(file.second);
+}
+
 bool FilesystemEventLogWriter::isReady() const {
 	return mIsReady;
 }
 
-int FilesystemEventLogWriter::openPath(const url_t *uri, const char *kind, time_t curtime, int errorcode) {
+void FilesystemEventLogWriter::queue(const url_t *uri, const char *kind, time_t curtime, const string &line,
+									 int errorcode) {
 	ostringstream path;
 
-	if (errorcode == 0) {
+	if (uri) {
 		const char *username = uri->url_user;
-		const char *domain = uri->url_host;
-
-		path << mRootPath << "/users";
-
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-
-		path << "/" << domain;
-
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-
 		if (!username)
 			username = "anonymous";
-
-		path << "/" << username;
-
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-		path << "/" << kind;
-
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
+		path << "/users/" << uri->url_host << "/" << username << "/" << kind;
 	} else {
-		path << mRootPath << "/" << "errors/";
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-		path << kind;
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
-		path << "/" << errorcode;
-		if (!createDirectoryIfNotExist(path.str().c_str()))
-			return -1;
+		path << "/errors/" << kind << "/" << errorcode;
 	}
 
 	struct tm tm;
@@ -296,19 +310,128 @@ int FilesystemEventLogWriter::openPath(const url_t *uri, const char *kind, time_
 	path << "/" << 1900 + tm.tm_year << "-" << std::setfill('0') << std::setw(2) << tm.tm_mon + 1 << "-" <<
 		std::setfill('0') << std::setw(2) << tm.tm_mday << ".log";
 
-	int fd = open(path.str().c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+	bool dropped = false;
+	bool reportDrop = false;
+	size_t queued;
+	mMutex.lock();
+	if (mQueue.size() < mMaxQueueSize) {
+		mQueue.push_back({path.str(), line});
+		mDropping = false;
+	} else {
+		dropped = true;
+		// Only report the first loss of a series, the counter tells how many followed.
+		reportDrop = !mDropping;
+		mDropping = true;
+	}
+	queued = mQueue.size();
+	mMutex.unlock();
+
+	mCountQueued->set(queued);
+	if (dropped) {
+		if (reportDrop)
+			LOGE("FilesystemEventLogWriter: too many event logs in queue (%i), dropping them.", (int)mMaxQueueSize);
+		mCountDropped->incr();
+		return;
+	}
+	mCond.notify_one();
+}
+
+void FilesystemEventLogWriter::run() {
+	vector<PendingLine> lines;
+	unique_lock<mutex> lock(mMutex);
+
+	while (true) {
+		mCond.wait(lock, [this]() { return !mQueue.empty() || !mRunning; });
+		if (mQueue.empty())
+			break; // stopped, and everything was written
+		lines.swap(mQueue);
+		lock.unlock();
+		flush(lines);
+		lines.clear();
+		lock.lock();
+	}
+}
+
+/* Writes the lines queued since the previous flush, with a single write() per file. */
+void FilesystemEventLogWriter::flush(vector<PendingLine> &lines) {
+	unordered_map<string, string> buffers;
+	vector<const string *> paths; // in the order of their first line
+
+	for (auto &pending : lines) {
+		auto res = buffers.emplace(move(pending.path), string());
+		if (res.second)
+			paths.push_back(&res.first->first);
+		res.first->second += pending.line;
+	}
+	for (const string *path : paths) {
+		const string &buffer = buffers[*path];
+		int fd = openPath(*path);
+		if (fd == -1)
+			continue;
+		if (::write(fd, buffer.c_str(), buffer.size()) == -1) {
+			LOGE("Fail to write event log %s%s: %s", mRootPath.c_str(), path->c_str(), strerror(errno));
+		}
+	}
+}
+
+/* Returns a descriptor of the log file, opening it if it is not among the most recently used ones. */
+int FilesystemEventLogWriter::openPath(const string &path) {
+	auto it = mOpenFilesByPath.find(path);
+	if (it != mOpenFilesByPath.end()) {
+		mOpenFiles.splice(mOpenFiles.begin(), mOpenFiles, it->second);
+		return it->second->second;
+	}
+
+	string fullpath = mRootPath + path;
+	if (!createDirectories(path))
+		return -1;
+	int fd = open(fullpath.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+	if (fd == -1 && errno == ENOENT) {
+		// A directory was removed since we created it.
+		mKnownDirectories.clear();
+		if (!createDirectories(path))
+			return -1;
+		fd = open(fullpath.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+	}
 	if (fd == -1) {
-		LOGE("Cannot open %s: %s", path.str().c_str(), strerror(errno));
+		LOGE("Cannot open %s: %s", fullpath.c_str(), strerror(errno));
 		return -1;
 	}
+
+	if (mOpenFiles.size() >= mMaxOpenFiles) {
+		close(mOpenFiles.back().second);
+		mOpenFilesByPath.erase(mOpenFiles.back().first);
+		mOpenFiles.pop_back();
+	}
+	mOpenFiles.emplace_front(path, fd);
+	mOpenFilesByPath[path] = mOpenFiles.begin();
 	return fd;
 }
 
+/* Bounds the memory used to remember the existing directories, there is one per user and kind of log. */
+static constexpr size_t sMaxKnownDirectories = 100000;
+
+/* Creates the directories of the log file, skipping the ones already known to exist. */
+bool FilesystemEventLogWriter::createDirectories(const string &path) {
+	size_t end = path.rfind('/');
+	if (mKnownDirectories.count(path.substr(0, end)))
+		return true;
+	if (mKnownDirectories.size() >= sMaxKnownDirectories)
+		mKnownDirectories.clear();
+
+	for (size_t pos = path.find('/', 1); pos != string::npos && pos <= end; pos = path.find('/', pos + 1)) {
+		string dir = path.substr(0, pos);
+		if (mKnownDirectories.count(dir))
+			continue;
+		if (!createDirectoryIfNotExist((mRootPath + dir).c_str()))
+			return false;
+		mKnownDirectories.insert(dir);
+	}
+	return true;
+}
+
 void FilesystemEventLogWriter::writeRegistrationLog(const std::shared_ptr<RegistrationLog> &rlog) {
 	const char *label = "registers";
-	int fd = openPath(rlog->mFrom->a_url, label, rlog->mDate);
-	if (fd == -1)
-		return;
 
 	ostringstream msg;
 	msg << PrettyTime(rlog->mDate) << ": " << rlog->mType << " " << rlog->mFrom;
@@ -317,10 +440,7 @@ void FilesystemEventLogWriter::writeRegistrationLog(const std::shared_ptr<Regist
 	if (rlog->mUA)
 		msg << rlog->mUA << endl;
 
-	if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-		LOGE("Fail to write registration log: %s", strerror(errno));
-	}
-	close(fd);
+	queue(rlog->mFrom->a_url, label, rlog->mDate, msg.str());
 	if (rlog->mStatusCode >= 300) {
 		writeErrorLog(rlog, label, msg.str());
 	}
@@ -328,8 +448,6 @@ void FilesystemEventLogWriter::writeRegistrationLog(const std::shared_ptr<Regist
 
 void FilesystemEventLogWriter::writeCallLog(const std::shared_ptr<CallLog> &calllog) {
 	const char *label = "calls";
-	int fd1 = openPath(calllog->mFrom->a_url, label, calllog->mDate);
-	int fd2 = openPath(calllog->mTo->a_url, label, calllog->mDate);
 
 	ostringstream msg;
 
@@ -340,20 +458,12 @@ void FilesystemEventLogWriter::writeCallLog(const std::shared_ptr<CallLog> &call
 		msg << calllog->mStatusCode << " " << calllog->mReason;
 	msg << endl;
 
-	if (fd1 == -1 || ::write(fd1, msg.str().c_str(), msg.str().size()) == -1) {
-		LOGE("Fail to write registration log: %s", strerror(errno));
-	}
+	queue(calllog->mFrom->a_url, label, calllog->mDate, msg.str());
 	// Avoid to write logs for users that possibly do not exist.
 	// However the error will be reported in the errors directory.
 	if (calllog->mStatusCode != 404) {
-		if (fd2 == -1 || ::write(fd2, msg.str().c_str(), msg.str().size()) == -1) {
-			LOGE("Fail to write registration log: %s", strerror(errno));
-		}
+		queue(calllog->mTo->a_url, label, calllog->mDate, msg.str());
 	}
-	if (fd1 != -1)
-		close(fd1);
-	if (fd2 != -1)
-		close(fd2);
 	if (calllog->mStatusCode >= 300) {
 		writeErrorLog(calllog, label, msg.str());
 	}
@@ -371,32 +481,14 @@ void FilesystemEventLogWriter::writeMessageLog(const std::shared_ptr<MessageLog>
 	msg << mlog->mStatusCode << " " << mlog->mReason << endl;
 
 	if (mlog->mReportType == MessageLog::ReceivedFromUser){
-		int fd = openPath(mlog->mFrom->a_url, label, mlog->mDate);
-		if (fd != -1){
-			if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-				LOGE("Fail to write message log: %s", strerror(errno));
-			}
-			close(fd);
-		}
+		queue(mlog->mFrom->a_url, label, mlog->mDate, msg.str());
 	}else { //MessageLog::DeliveredToUser
 		/*the event is added into the sender's log file and the receiver's log file, for convenience*/
-		int fd = openPath(mlog->mFrom->a_url, label, mlog->mDate);
-		if (fd != -1){
-			if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-				LOGE("Fail to write message log: %s", strerror(errno));
-			}
-			close(fd);
-		}
+		queue(mlog->mFrom->a_url, label, mlog->mDate, msg.str());
 		// Avoid to write logs for users that possibly do not exist.
 		// However the error will be reported in the errors directory.
 		if (mlog->mStatusCode != 404){
-			fd = openPath(mlog->mTo->a_url, label, mlog->mDate);
-			if (fd != -1){
-				if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-					LOGE("Fail to write message log: %s", strerror(errno));
-				}
-				close(fd);
-			}
+			queue(mlog->mTo->a_url, label, mlog->mDate, msg.str());
 		}
 	}
 	if (mlog->mStatusCode >= 300) {
@@ -406,9 +498,6 @@ void FilesystemEventLogWriter::writeMessageLog(const std::shared_ptr<MessageLog>
 
 void FilesystemEventLogWriter::writeCallQualityStatisticsLog(const std::shared_ptr<CallQualityStatisticsLog> &mlog) {
 	const char *label = "statistics_reports";
-	int fd = openPath(mlog->mFrom->a_url, label, mlog->mDate);
-	if (fd == -1)
-		return;
 	ostringstream msg;
 
 	msg << PrettyTime(mlog->mDate) << " ";
@@ -416,11 +505,7 @@ void FilesystemEventLogWriter::writeCallQualityStatisticsLog(const std::shared_p
 	msg << mlog->mStatusCode << " " << mlog->mReason << ": ";
 	msg << mlog->mReport << endl;
 
-	if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-		LOGE("Fail to write registration log: %s", strerror(errno));
-	}
-
-	close(fd);
+	queue(mlog->mFrom->a_url, label, mlog->mDate, msg.str());
 	if (mlog->mStatusCode >= 300) {
 		writeErrorLog(mlog, label, msg.str());
 	}
@@ -438,13 +523,7 @@ void FilesystemEventLogWriter::writeAuthLog(const std::shared_ptr<AuthLog> &alog
 	msg << alog->mStatusCode << " " << alog->mReason << endl;
 
 	if (alog->mUserExists) {
-		int fd = openPath(alog->mFrom->a_url, label, alog->mDate);
-		if (fd != -1) {
-			if (::write(fd, msg.str().c_str(), msg.str().size()) == -1) {
-				LOGE("Fail to write auth log: %s", strerror(errno));
-			}
-			close(fd);
-		}
+		queue(alog->mFrom->a_url, label, alog->mDate, msg.str());
 	}
 	writeErrorLog(alog, "auth", msg.str());
 }
@@ -453,13 +532,7 @@ void FilesystemEventLogWriter::writeErrorLog(
 	const std::shared_ptr<EventLog> &log, const char *kind,
 	const std::string &logstr
 ) {
-	int fd = openPath(NULL, kind, log->mDate, log->mStatusCode);
-	if (fd == -1)
-		return;
-	if (::write(fd, logstr.c_str(), logstr.size()) == -1) {
-		LOGE("Fail to write error log: %s", strerror(errno));
-	}
-	close(fd);
+	queue(NULL, kind, log->mDate, logstr, log->mStatusCode);
 }
 
 void FilesystemEventLogWriter::write(const std::shared_ptr<EventLog> &evlog) {
@@ -590,12 +663,21 @@ DataBaseEventLogWriter::DataBaseEventLogWriter(
 	const std::string &backendString,
 	const std::string &connectionString,
 	int maxQueueSize,
-	int nbThreadsMax
+	int nbThreadsMax,
+	int batchSize,
+	int batchDelay
 ) {
 	mConnectionPool = nullptr;
 	mThreadPool = nullptr;
 	mIsReady = false;
 	mMaxQueueSize = maxQueueSize;
+	mBatchSize = batchSize > 0 ? batchSize : 1;
+	mBatchDelay = batchDelay;
+
+	GenericStruct *cr = GenericManager::get()->getRoot()->get<GenericStruct>("event-logs");
+	mCountBatches = cr->get<StatCounter64>("count-database-batches");
+	mCountBatchedLogs = cr->get<StatCounter64>("count-database-batched-logs");
+	mCountFlushTime = cr->get<StatCounter64>("count-database-flush-time-ms");
 	try {
 		if (backendString != "mysql" && backendString != "sqlite3" && backendString != "postgresql") {
 			LOGE("DataBaseEventLogWriter: backend must be equals to `mysql`, `sqlite3` or `postgresql`.");
@@ -846,31 +928,62 @@ void DataBaseEventLogWriter::writeCallQualityStatisticsLog(
 	*session << mInsertReq[SqlCallQualityEventLogId], soci::use(evlog->mReport);
 }
 
-void DataBaseEventLogWriter::writeEventFromQueue() {
-	mMutex.lock();
+void DataBaseEventLogWriter::writeEvent(soci::session *session, const std::shared_ptr<EventLog> &evlog) {
+	EventLog *ev = evlog.get();
+	// TODO: Avoid usage of the digusting typeid helper. Use a visitor pattern instead.
+	if (typeid(*ev) == typeid(RegistrationLog)) {
+		writeRegistrationLog(session, static_pointer_cast<RegistrationLog>(evlog));
+	} else if (typeid(*ev) == typeid(CallLog)) {
+		writeCallLog(session, static_pointer_cast<CallLog>(evlog));
+	} else if (typeid(*ev) == typeid(MessageLog)) {
+		writeMessageLog(session, static_pointer_cast<MessageLog>(evlog));
+	} else if (typeid(*ev) == typeid(AuthLog)) {
+		writeAuthLog(session, static_pointer_cast<AuthLog>(evlog));
+	} else if (typeid(*ev) == typeid(CallQualityStatisticsLog)) {
+		writeCallQualityStatisticsLog(session, static_pointer_cast<CallQualityStatisticsLog>(evlog));
+	}
+}
 
-	shared_ptr<EventLog> evlog = mListLogs.front();
-	mListLogs.pop();
+// Each queued event is followed by a task in the thread pool, but a task writes up to mBatchSize events in a single
+// transaction: the tasks of the events already written by another one have nothing left to do.
+void DataBaseEventLogWriter::writeEventFromQueue() {
+	vector<shared_ptr<EventLog>> batch;
 
-	mMutex.unlock();
+	{
+		unique_lock<mutex> lock(mMutex);
+		if (mBatchDelay > 0 && !mListLogs.empty() && mListLogs.size() < mBatchSize) {
+			mCond.wait_for(lock, chrono::milliseconds(mBatchDelay), [this]() { return mListLogs.size() >= mBatchSize; });
+		}
+		while (!mListLogs.empty() && batch.size() < mBatchSize) {
+			batch.push_back(move(mListLogs.front()));
+			mListLogs.pop();
+		}
+	}
+	if (batch.empty())
+		return;
 
-	EventLog *ev = evlog.get();
+	auto start = chrono::steady_clock::now();
 	soci::session session(*mConnectionPool);
-	DB_TRANSACTION(&session) {
-		// TODO: Avoid usage of the digusting typeid helper. Use a visitor pattern instead.
-		if (typeid(*ev) == typeid(RegistrationLog)) {
-			writeRegistrationLog(&session, static_pointer_cast<RegistrationLog>(evlog));
-		} else if (typeid(*ev) == typeid(CallLog)) {
-			writeCallLog(&session, static_pointer_cast<CallLog>(evlog));
-		} else if (typeid(*ev) == typeid(MessageLog)) {
-			writeMessageLog(&session, static_pointer_cast<MessageLog>(evlog));
-		} else if (typeid(*ev) == typeid(AuthLog)) {
-			writeAuthLog(&session, static_pointer_cast<AuthLog>(evlog));
-		} else if (typeid(*ev) == typeid(CallQualityStatisticsLog)) {
-			writeCallQualityStatisticsLog(&session, static_pointer_cast<CallQualityStatisticsLog>(evlog));
-		}
+	bool written = DB_TRANSACTION(&session) {
+		for (const auto &evlog : batch)
+			writeEvent(&session, evlog);
 		tr.commit();
 	};
+	if (!written && batch.size() > 1) {
+		// Do not lose the whole batch because of a single faulty event.
+		LOGE("DataBaseEventLogWriter: failed to write a batch of %i events, writing them one by one.", (int)batch.size());
+		for (const auto &evlog : batch) {
+			DB_TRANSACTION(&session) {
+				writeEvent(&session, evlog);
+				tr.commit();
+			};
+		}
+	}
+	auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+
+	mCountBatches->incr();
+	mCountBatchedLogs->add(batch.size());
+	mCountFlushTime->add(elapsed.count());
 }
 
 void DataBaseEventLogWriter::write(const std::shared_ptr<EventLog> &evlog) {
@@ -878,7 +991,10 @@ void DataBaseEventLogWriter::write(const std::shared_ptr<EventLog> &evlog) {
 
 	if (mListLogs.size() < mMaxQueueSize) {
 		mListLogs.push(evlog);
+		bool batchReady = mListLogs.size() >= mBatchSize;
 		mMutex.unlock();
+		if (batchReady)
+			mCond.notify_one();
 
 		// Save event in database.
 		if (!mThreadPool->Enqueue(bind(&DataBaseEventLogWriter::writeEventFromQueue, this))) {
@@ -25,6 +25,7 @@
 #include <tuple>
 #include <stdexcept>
 #include <algorithm>
+#include <unordered_set>
 #include "sipattrextractor.hh"
 
 #include <regex.h>
@@ -99,45 +100,44 @@ void log_boolean_expression_parsing(bool value) {
 	if (logEval)                                                                                                       \
 	SLOGI
 
-class VariableOrConstant {
-	list<string> mValueList;
+static void splitList(const string &s, list<string> &values) {
+	size_t pos1 = 0;
+	size_t pos2 = 0;
+	for (pos2 = 0; pos2 < s.size(); ++pos2) {
+		if (s[pos2] != ' ') {
+			if (s[pos1] == ' ')
+				pos1 = pos2;
+			continue;
+		}
+		if (s[pos2] == ' ' && s[pos1] == ' ') {
+			pos1 = pos2;
+			continue;
+		}
+		values.push_back(s.substr(pos1, pos2 - pos1));
+		pos1 = pos2;
+	}
 
+	if (pos1 != pos2)
+		values.push_back(s.substr(pos1, pos2 - pos1));
+}
+
+/*
+ * Variables and constants are shared by all the evaluations of a filter, which may run concurrently, so the value of
+ * a variable is extracted into a buffer provided by the caller for each evaluation.
+ */
+class VariableOrConstant {
   public:
 	virtual ~VariableOrConstant() {
 	}
-	virtual const std::string &get(const SipAttributes *args) = 0;
-	bool defined(const SipAttributes *args) {
-		try {
-			get(args);
-			return true;
-		} catch (exception &) {
-		}
+	/* Returns NULL if the value is not available in the message, never throws. buffer may be used to store the value. */
+	virtual const std::string *find(const SipAttributes *args, std::string &buffer) const = 0;
+	virtual const std::string &getName() const = 0;
+	virtual bool isConstant() const {
 		return false;
 	}
-	const list<string> &getAsList(const SipAttributes *args) {
-		string s = get(args);
-		mValueList.clear();
-
-		size_t pos1 = 0;
-		size_t pos2 = 0;
-		for (pos2 = 0; pos2 < s.size(); ++pos2) {
-			if (s[pos2] != ' ') {
-				if (s[pos1] == ' ')
-					pos1 = pos2;
-				continue;
-			}
-			if (s[pos2] == ' ' && s[pos1] == ' ') {
-				pos1 = pos2;
-				continue;
-			}
-			mValueList.push_back(s.substr(pos1, pos2 - pos1));
-			pos1 = pos2;
-		}
-
-		if (pos1 != pos2)
-			mValueList.push_back(s.substr(pos1, pos2 - pos1));
-
-		return mValueList;
+	bool defined(const SipAttributes *args) const {
+		string buffer;
+		return find(args, buffer) != NULL;
 	}
 };
 
@@ -148,37 +148,61 @@ class Constant : public VariableOrConstant {
 	Constant(const std::string &val) : mVal(val) {
 		LOGPARSE << "Creating constant XX" << val << "XX";
 	}
-	virtual const std::string &get(const SipAttributes *args) {
+	virtual const std::string *find(const SipAttributes *args, std::string &buffer) const {
+		return &mVal;
+	}
+	virtual const std::string &getName() const {
+		return mVal;
+	}
+	virtual bool isConstant() const {
+		return true;
+	}
+	const std::string &getValue() const {
 		return mVal;
 	}
 };
 
 class Variable : public VariableOrConstant {
 	string mId;
-	string mVal;
+	int mKey;
 
   public:
-	Variable(const std::string &val) : mId(val) {
+	Variable(const std::string &val) : mId(val), mKey(SipAttributes::compileKey(val)) {
 		LOGPARSE << "Creating variable XX" << val << "XX";
 	}
-	virtual const std::string &get(const SipAttributes *args) {
-		mVal = args->get(mId);
-		return mVal;
+	virtual const std::string *find(const SipAttributes *args, std::string &buffer) const {
+		return args->get(mKey, buffer) ? &buffer : NULL;
+	}
+	virtual const std::string &getName() const {
+		return mId;
 	}
 };
 
 class TrueFalseExpression : public BooleanExpression {
-	string mId;
+	enum { True, False, Attribute } mType;
+	int mKey;
 
   public:
-	TrueFalseExpression(const string &value) : mId(value) {
+	TrueFalseExpression(const string &value) : mKey(-1) {
+		if (value == "true")
+			mType = True;
+		else if (value == "false")
+			mType = False;
+		else {
+			mType = Attribute;
+			mKey = SipAttributes::compileBooleanKey(value);
+		}
 	}
 	virtual bool eval(const SipAttributes *args) {
-		if (mId == "true")
-			return true;
-		if (mId == "false")
-			return false;
-		return args->isTrue(mId);
+		switch (mType) {
+			case True:
+				return true;
+			case False:
+				return false;
+			case Attribute:
+				break;
+		}
+		return args->isTrue(mKey);
 	}
 };
 
@@ -239,8 +263,15 @@ class EqualsOp : public BooleanExpression {
 		LOGPARSE << "Creating EqualsOperator";
 	}
 	virtual bool eval(const SipAttributes *args) {
-		bool res = mVar1->get(args) == mVar2->get(args);
-		LOGEVAL << "evaluating " << mVar1->get(args) << " == " << mVar2->get(args) << " : " << (res ? "true" : "false");
+		string buffer1, buffer2;
+		const string *var1 = mVar1->find(args, buffer1);
+		const string *var2 = mVar2->find(args, buffer2);
+		if (!var1 || !var2) {
+			LOGEVAL << "evaluating == : " << (var1 ? mVar2 : mVar1)->getName() << " is missing : false";
+			return false;
+		}
+		bool res = *var1 == *var2;
+		LOGEVAL << "evaluating " << *var1 << " == " << *var2 << " : " << (res ? "true" : "false");
 		return res;
 	}
 
@@ -254,8 +285,16 @@ class UnEqualsOp : public BooleanExpression {
 		LOGPARSE << "Creating UnEqualsOperator";
 	}
 	virtual bool eval(const SipAttributes *args) {
-		bool res = mVar1->get(args) != mVar2->get(args);
-		LOGEVAL << "evaluating " << mVar1->get(args) << " != " << mVar2->get(args) << " : " << (res ? "true" : "false");
+		string buffer1, buffer2;
+		const string *var1 = mVar1->find(args, buffer1);
+		const string *var2 = mVar2->find(args, buffer2);
+		if (!var1 || !var2) {
+			/* the negation of '==', so that 'a != b' and '!(a == b)' agree */
+			LOGEVAL << "evaluating != : " << (var1 ? mVar2 : mVar1)->getName() << " is missing : true";
+			return true;
+		}
+		bool res = *var1 != *var2;
+		LOGEVAL << "evaluating " << *var1 << " != " << *var2 << " : " << (res ? "true" : "false");
 		return res;
 	}
 
@@ -271,15 +310,20 @@ class NumericOp : public BooleanExpression {
 		LOGPARSE << "Creating NumericOperator";
 	}
 	virtual bool eval(const SipAttributes *args) {
-		string var = mVar->get(args);
+		string buffer;
+		const string *var = mVar->find(args, buffer);
+		if (!var) {
+			LOGEVAL << "evaluating " << mVar->getName() << " is numeric : missing : false";
+			return false;
+		}
 		bool res = true;
-		for (auto it = var.begin(); it != var.end(); ++it) {
+		for (auto it = var->begin(); it != var->end(); ++it) {
 			if (!isdigit(*it)) {
 				res = false;
 				break;
 			}
 		}
-		LOGEVAL << "evaluating " << var << " is numeric : " << (res ? "true" : "false");
+		LOGEVAL << "evaluating " << *var << " is numeric : " << (res ? "true" : "false");
 		return res;
 	}
 };
@@ -308,7 +352,7 @@ class Regex : public BooleanExpression {
   public:
 	Regex(shared_ptr<VariableOrConstant> input, shared_ptr<Constant> pattern) : mInput(input), mPattern(pattern) {
 		LOGPARSE << "Creating Regular Expression";
-		string p = pattern->get(NULL);
+		const string &p = pattern->getValue();
 		int err = regcomp(&preg, p.c_str(), REG_NOSUB | REG_EXTENDED);
 		if (err != 0)
 			throw invalid_argument("couldn't compile regex " + p);
@@ -317,8 +361,13 @@ class Regex : public BooleanExpression {
 		regfree(&preg);
 	}
 	virtual bool eval(const SipAttributes *args) {
-		string input = mInput->get(args);
-		int match = regexec(&preg, input.c_str(), 0, NULL, 0);
+		string buffer;
+		const string *input = mInput->find(args, buffer);
+		if (!input) {
+			LOGEVAL << "evaluating " << mInput->getName() << " is regex " << mPattern->getValue() << " : missing : false";
+			return false;
+		}
+		int match = regexec(&preg, input->c_str(), 0, NULL, 0);
 		bool res;
 		switch (match) {
 			case 0:
@@ -332,7 +381,7 @@ class Regex : public BooleanExpression {
 				throw invalid_argument("Error evaluating regex " + string(error_msg_buff));
 		}
 
-		LOGEVAL << "evaluating " << input << " is regex  " << mPattern->get(NULL) << " : " << (res ? "true" : "false");
+		LOGEVAL << "evaluating " << *input << " is regex  " << mPattern->getValue() << " : " << (res ? "true" : "false");
 		return res;
 	}
 };
@@ -344,20 +393,16 @@ class ContainsOp : public BooleanExpression {
 	ContainsOp(shared_ptr<VariableOrConstant> var1, shared_ptr<VariableOrConstant> var2) : mVar1(var1), mVar2(var2) {
 	}
 	virtual bool eval(const SipAttributes *args) {
-		bool res = false;
-		try {
-			string var1 = mVar1->get(args);
-			string var2 = mVar2->get(args);
-			res = var1.find(var2) != std::string::npos;
-
-			LOGEVAL << "evaluating " << mVar1->get(args) << " contains " << mVar2->get(args) << " : "
-			<< (res ? "true" : "false");
-		} catch (invalid_argument &e) {
-			// We allow to use "contains()" with empty arguments, which returns always false instead of bubbling an exception.
-			SLOGE << "Exception: Some arguments were missing (" << e.what() << "): return false";
+		string buffer1, buffer2;
+		const string *var1 = mVar1->find(args, buffer1);
+		const string *var2 = mVar2->find(args, buffer2);
+		if (!var1 || !var2) {
+			// We allow to use "contains()" with empty arguments, which returns always false.
+			SLOGE << "Some arguments were missing (" << (var1 ? mVar2 : mVar1)->getName() << "): return false";
 			return false;
 		}
-		// we could get a runtime_error, which we let bubble up because this error denotes a badly written filter (instead of just a missing field in the SIP message.
+		bool res = var1->find(*var2) != std::string::npos;
+		LOGEVAL << "evaluating " << *var1 << " contains " << *var2 << " : " << (res ? "true" : "false");
 		return res;
 	}
 };
@@ -365,18 +410,35 @@ class ContainsOp : public BooleanExpression {
 class InOp : public BooleanExpression {
   public:
 	InOp(shared_ptr<VariableOrConstant> var1, shared_ptr<VariableOrConstant> var2) : mVar1(var1), mVar2(var2) {
+		if (mVar2->isConstant()) {
+			/* the list is split once for all */
+			list<string> values;
+			splitList(mVar2->getName(), values);
+			mConstantValues.insert(values.begin(), values.end());
+		}
 	}
 	virtual bool eval(const SipAttributes *args) {
 		bool res = false;
-		const list<string> &values = mVar2->getAsList(args);
-		const string &varValue = mVar1->get(args);
+		string buffer1, buffer2;
+		const string *varValue = mVar1->find(args, buffer1);
+		const string *listValue = mVar2->find(args, buffer2);
+		if (!varValue || !listValue) {
+			LOGEVAL << "Evaluating IN : " << (varValue ? mVar2 : mVar1)->getName() << " is missing : false";
+			return false;
+		}
 
-		LOGEVAL << "Evaluating '" << varValue << "' IN {" << mVar2->get(args) << "}";
-		for (auto it = values.begin(); it != values.end(); ++it) {
-			LOGEVAL << "Trying '" << *it << "'";
-			if (varValue == *it) {
-				res = true;
-				break;
+		LOGEVAL << "Evaluating '" << *varValue << "' IN {" << *listValue << "}";
+		if (mVar2->isConstant()) {
+			res = mConstantValues.find(*varValue) != mConstantValues.end();
+		} else {
+			list<string> values;
+			splitList(*listValue, values);
+			for (auto it = values.begin(); it != values.end(); ++it) {
+				LOGEVAL << "Trying '" << *it << "'";
+				if (*varValue == *it) {
+					res = true;
+					break;
+				}
 			}
 		}
 		LOGEVAL << "->" << (res ? "true" : "false");
@@ -385,6 +447,7 @@ class InOp : public BooleanExpression {
 
   private:
 	shared_ptr<VariableOrConstant> mVar1, mVar2;
+	unordered_set<string> mConstantValues;
 };
 
 static size_t find_first_non_word(const string &expr, size_t offset) {
@@ -26,17 +26,13 @@ using namespace flexisip;
 
 ForkBasicContext::ForkBasicContext(Agent *agent, const std::shared_ptr<RequestSipEvent> &event,
 								   shared_ptr<ForkContextConfig> cfg, ForkContextListener *listener)
-	: ForkContext(agent, event, cfg, listener) {
+	: ForkContext(agent, event, cfg, listener), mDecisionTimer(agent->getTimerWheel()) {
 	LOGD("New ForkBasicContext %p", this);
-	mDecisionTimer = NULL;
 	// start the acceptance timer immediately
-	mDecisionTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
-	su_timer_set_interval(mDecisionTimer, &ForkBasicContext::sOnDecisionTimer, this, (su_duration_t)20000);
+	mDecisionTimer.setSeconds(20, [this]() { onDecisionTimer(); });
 }
 
 ForkBasicContext::~ForkBasicContext() {
-	if (mDecisionTimer)
-		su_timer_destroy(mDecisionTimer);
 	LOGD("Destroy ForkBasicContext %p", this);
 }
 
@@ -45,10 +41,7 @@ void ForkBasicContext::onResponse(const shared_ptr<BranchInfo> &br, const shared
 	if (code >= 200) {
 		if (code < 300) {
 			forwardResponse(br);
-			if (mDecisionTimer) {
-				su_timer_destroy(mDecisionTimer);
-				mDecisionTimer = NULL;
-			}
+			mDecisionTimer.cancel();
 		} else {
 			if (allBranchesAnswered()) {
 				finishIncomingTransaction();
@@ -58,10 +51,7 @@ void ForkBasicContext::onResponse(const shared_ptr<BranchInfo> &br, const shared
 }
 
 void ForkBasicContext::finishIncomingTransaction() {
-	if (mDecisionTimer) {
-		su_timer_destroy(mDecisionTimer);
-		mDecisionTimer = NULL;
-	}
+	mDecisionTimer.cancel();
 	shared_ptr<BranchInfo> best = findBestBranch(sUrgentCodes);
 	if (best == NULL) {
 		// Create response
@@ -81,10 +71,6 @@ void ForkBasicContext::onDecisionTimer() {
 	finishIncomingTransaction();
 }
 
-void ForkBasicContext::sOnDecisionTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	static_cast<ForkBasicContext *>(arg)->onDecisionTimer();
-}
-
 bool ForkBasicContext::onNewRegister(const url_t *url, const string &uid) {
 	return false;
 }
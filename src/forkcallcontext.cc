@@ -30,7 +30,8 @@ template <typename T> static bool contains(const list<T> &l, T value) {
 
 ForkCallContext::ForkCallContext(Agent *agent, const shared_ptr<RequestSipEvent> &event,
 								 shared_ptr<ForkContextConfig> cfg, ForkContextListener *listener)
-	: ForkContext(agent, event, cfg, listener), mShortTimer(NULL), mPushTimer(NULL), mCancelled(false) {
+	: ForkContext(agent, event, cfg, listener), mShortTimer(agent->getTimerWheel()),
+	  mPushTimer(agent->getTimerWheel()), mCancelled(false) {
 	SLOGD << "New ForkCallContext " << this;
 	mLog = event->getEventLog<CallLog>();
 	mActivePushes = 0;
@@ -38,16 +39,6 @@ ForkCallContext::ForkCallContext(Agent *agent, const shared_ptr<RequestSipEvent>
 
 ForkCallContext::~ForkCallContext() {
 	SLOGD << "Destroy ForkCallContext " << this;
-
-	if (mShortTimer) {
-		su_timer_destroy(mShortTimer);
-		mShortTimer = NULL;
-	}
-
-	if (mPushTimer) {
-		su_timer_destroy(mPushTimer);
-		mPushTimer = NULL;
-	}
 }
 
 void ForkCallContext::onCancel(const shared_ptr<RequestSipEvent> &ev) {
@@ -133,10 +124,8 @@ void ForkCallContext::onResponse(const shared_ptr<BranchInfo> &br, const shared_
 			return;
 		}
 
-		if (isUrgent(code, getUrgentCodes()) && mShortTimer == NULL) {
-			mShortTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
-			su_timer_set_interval(mShortTimer, &ForkCallContext::sOnShortTimer, this,
-								  (su_duration_t)mCfg->mUrgentTimeout * 1000);
+		if (isUrgent(code, getUrgentCodes()) && !mShortTimer.isSet()) {
+			mShortTimer.setSeconds(mCfg->mUrgentTimeout, [this]() { onShortTimer(); });
 			return;
 		}
 
@@ -171,12 +160,10 @@ void ForkCallContext::sendResponse(int code, char const *phrase) {
 	shared_ptr<ResponseSipEvent> ev(
 		new ResponseSipEvent(dynamic_pointer_cast<OutgoingAgent>(mAgent->shared_from_this()), msgsip));
 
-	if (mPushTimer)
-		su_timer_destroy(mPushTimer), mPushTimer = NULL;
+	mPushTimer.cancel();
 
 	if (mCfg->mPushResponseTimeout > 0) {
-		mPushTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
-		su_timer_set_interval(mPushTimer, &ForkCallContext::sOnPushTimer, this, (su_duration_t)mCfg->mPushResponseTimeout * 1000);
+		mPushTimer.setSeconds(mCfg->mPushResponseTimeout, [this]() { onPushTimer(); });
 	}
 	forwardResponse(ev);
 }
@@ -221,10 +208,6 @@ bool ForkCallContext::isRingingSomewhere()const{
 void ForkCallContext::onShortTimer() {
 	SLOGD << "ForkCallContext [" << this << "]: time to send urgent replies";
 
-	/*first stop the timer, it has to be one shot*/
-	su_timer_destroy(mShortTimer);
-	mShortTimer = NULL;
-
 	if (isRingingSomewhere())
 		return; /*it's ringing somewhere*/
 
@@ -253,24 +236,14 @@ void ForkCallContext::onLateTimeout() {
 	cancelOthers(shared_ptr<BranchInfo>(), NULL);
 }
 
-void ForkCallContext::sOnShortTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	ForkCallContext *zis = static_cast<ForkCallContext *>(arg);
-	zis->onShortTimer();
-}
-
 void ForkCallContext::onPushTimer() {
 	if (!isCompleted() && getLastResponseCode() < 180) {
 		SLOGD << "ForkCallContext [" << this << "] push timer : no uac response";
 	}
 
-	su_timer_destroy(mPushTimer);
-	mPushTimer = NULL;
+	mPushTimer.cancel();
 }
 
-void ForkCallContext::sOnPushTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	ForkCallContext *zis = static_cast<ForkCallContext *>(arg);
-	zis->onPushTimer();
-}
 void ForkCallContext::onPushInitiated(const string &key) {
 	++mActivePushes;
 }
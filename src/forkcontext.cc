@@ -31,38 +31,29 @@ const int ForkContext::sAllCodesUrgent[] = {-1, 0};
 ForkContextConfig::ForkContextConfig()
 	: mDeliveryTimeout(0), mUrgentTimeout(5), mForkLate(false), mTreatAllErrorsAsUrgent(false),
 	  mForkNoGlobalDecline(false), mTreatDeclineAsUrgent(false),
-	  mCurrentBranchesTimeout(0) {
+	  mCurrentBranchesTimeout(0), mDuration(NULL) {
 }
 
 ForkContextListener::~ForkContextListener() {
 }
 
-void ForkContext::__timer_callback(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	(static_cast<ForkContext *>(arg))->processLateTimeout();
-}
-
-void ForkContext::sOnFinished(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	(static_cast<ForkContext *>(arg))->onFinished();
-}
-
-void ForkContext::sOnNextBanches(su_root_magic_t* magic, su_timer_t* t, su_timer_arg_t* arg) {
-	(static_cast<ForkContext *>(arg))->onNextBranches();
+bool ForkContextListener::onForkContextIdle(shared_ptr<ForkContext> ctx) {
+	return false;
 }
 
 ForkContext::ForkContext(Agent *agent, const shared_ptr<RequestSipEvent> &event, shared_ptr<ForkContextConfig> cfg,
-						 ForkContextListener *listener)
-	: mListener(listener), mNextBranchesTimer(NULL), mCurrentPriority(-1), mAgent(agent),
+						 ForkContextListener *listener, bool answered)
+	: mListener(listener), mNextBranchesTimer(agent->getTimerWheel()), mCurrentPriority(-1), mAgent(agent),
 	  mEvent(make_shared<RequestSipEvent>(event)), // Is this deep copy really necessary ?
-	  mCfg(cfg), mLateTimer(NULL), mFinishTimer(NULL) {
-	init();
+	  mCfg(cfg), mLateTimer(agent->getTimerWheel()), mFinishTimer(agent->getTimerWheel()),
+	  mCreationTime(chrono::steady_clock::now()) {
+	init(answered);
 }
 
 void ForkContext::onLateTimeout() {
 }
 
 void ForkContext::processLateTimeout() {
-	su_timer_destroy(mLateTimer);
-	mLateTimer = NULL;
 	onLateTimeout();
 	setFinished();
 }
@@ -240,15 +231,14 @@ bool ForkContext::onNewRegister(const url_t *url, const string &uid) {
 		return true;
 }
 
-void ForkContext::init() {
-	mIncoming = mEvent->createIncomingTransaction();
+void ForkContext::init(bool answered) {
+	if (!answered)
+		mIncoming = mEvent->createIncomingTransaction();
 
-	if (mCfg->mForkLate && mLateTimer == NULL) {
+	if (mCfg->mForkLate && !mLateTimer.isSet()) {
 		/*this timer is for when outgoing transaction all die prematuraly, we still need to wait that late register
 		 * arrive.*/
-		mLateTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
-		su_timer_set_interval(mLateTimer, &ForkContext::__timer_callback, this,
-							  (su_duration_t)mCfg->mDeliveryTimeout * (su_duration_t)1000);
+		mLateTimer.setSeconds(mCfg->mDeliveryTimeout, [this]() { processLateTimeout(); });
 	}
 }
 
@@ -398,10 +388,7 @@ void ForkContext::nextBranches() {
 
 void ForkContext::start() {
 	/* Remove existing timer */
-	if (mNextBranchesTimer) {
-		su_timer_destroy(mNextBranchesTimer);
-		mNextBranchesTimer = NULL;
-	}
+	mNextBranchesTimer.cancel();
 
 	/* Prepare branches */
 	nextBranches();
@@ -415,8 +402,7 @@ void ForkContext::start() {
 
 	if (mCfg->mCurrentBranchesTimeout > 0 && hasNextBranches()) {
 		/* Start the timer for next branches */
-		mNextBranchesTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
-		su_timer_set_interval(mNextBranchesTimer, &ForkContext::sOnNextBanches, this, (su_duration_t)mCfg->mCurrentBranchesTimeout * (su_duration_t)1000);
+		mNextBranchesTimer.setSeconds(mCfg->mCurrentBranchesTimeout, [this]() { onNextBranches(); });
 	}
 }
 
@@ -425,16 +411,11 @@ const shared_ptr<RequestSipEvent> &ForkContext::getEvent() {
 }
 
 ForkContext::~ForkContext() {
-	if (mLateTimer)
-		su_timer_destroy(mLateTimer);
-
-	if (mNextBranchesTimer)
-		su_timer_destroy(mNextBranchesTimer);
 }
 
 void ForkContext::onFinished() {
-	su_timer_destroy(mFinishTimer);
-	mFinishTimer = NULL;
+	if (mCfg->mDuration)
+		mCfg->mDuration->recordDuration(chrono::steady_clock::now() - mCreationTime);
 
 	// force references to be loosed immediately, to avoid circular dependencies.
 	mEvent.reset();
@@ -451,24 +432,23 @@ void ForkContext::onFinished() {
 }
 
 void ForkContext::setFinished() {
-	if (mFinishTimer) {
+	if (mFinishTimer.isSet()) {
 		/*already finishing, ignore*/
 		return;
 	}
 
-	if (mLateTimer) {
-		su_timer_destroy(mLateTimer);
-		mLateTimer = NULL;
-	}
-
-	if (mNextBranchesTimer) {
-		su_timer_destroy(mNextBranchesTimer);
-		mNextBranchesTimer = NULL;
-	}
+	mLateTimer.cancel();
+	mNextBranchesTimer.cancel();
 
 	mSelf = shared_from_this(); // to prevent destruction until finishTimer arrives
-	mFinishTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
-	su_timer_set_interval(mFinishTimer, &ForkContext::sOnFinished, this, (su_duration_t)0);
+	mFinishTimer.set(chrono::milliseconds(0), [this]() { onFinished(); });
+}
+
+void ForkContext::setIdle() {
+	if (mFinishTimer.isSet())
+		return;
+	if (mListener->onForkContextIdle(shared_from_this()))
+		setFinished();
 }
 
 bool ForkContext::shouldFinish() {
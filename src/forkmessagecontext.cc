@@ -38,23 +38,55 @@ static bool needsDelivery(int code) {
 }
 
 ForkMessageContext::ForkMessageContext(Agent *agent, const std::shared_ptr<RequestSipEvent> &event,
-									   shared_ptr<ForkContextConfig> cfg, ForkContextListener *listener)
-	: ForkContext(agent, event, cfg, listener) {
+									   shared_ptr<ForkContextConfig> cfg, ForkContextListener *listener, bool restored)
+	: ForkContext(agent, event, cfg, listener, restored), mAcceptanceTimer(agent->getTimerWheel()) {
 	LOGD("New ForkMessageContext %p", this);
-	mAcceptanceTimer = NULL;
 	// start the acceptance timer immediately
-	if (mCfg->mForkLate && mCfg->mDeliveryTimeout > 30) {
-		mAcceptanceTimer = su_timer_create(su_root_task(mAgent->getRoot()), 0);
-		su_timer_set_interval(mAcceptanceTimer, &ForkMessageContext::sOnAcceptanceTimer, this,
-							  (su_duration_t)mCfg->mUrgentTimeout * 1000);
+	if (mCfg->mForkLate && mCfg->mDeliveryTimeout > 30 && !restored) {
+		mAcceptanceTimer.setSeconds(mCfg->mUrgentTimeout, [this]() { onAcceptanceTimer(); });
 	}
 	mDeliveredCount = 0;
 	mIsMessage = event->getMsgSip()->getSip()->sip_request->rq_method == sip_method_message;
+	mExpireAt = time(NULL) + mCfg->mDeliveryTimeout;
+}
+
+shared_ptr<ForkMessageContext> ForkMessageContext::restore(Agent *agent, const shared_ptr<RequestSipEvent> &event,
+														   shared_ptr<ForkContextConfig> cfg,
+														   ForkContextListener *listener, time_t expireAt,
+														   const vector<string> &deliveredUids,
+														   const vector<string> &pendingUids) {
+	auto context = make_shared<ForkMessageContext>(agent, event, cfg, listener, true);
+	context->mExpireAt = expireAt;
+	context->mDeliveredUids.insert(deliveredUids.begin(), deliveredUids.end());
+	context->mPendingUids.insert(pendingUids.begin(), pendingUids.end());
+	// Declined instances are counted as well: only the instances without unique id depend on it.
+	context->mDeliveredCount = deliveredUids.size();
+	time_t now = time(NULL);
+	ForkMessageContext *ctx = context.get();
+	context->mLateTimer.setSeconds(expireAt > now ? expireAt - now : 0, [ctx]() { ctx->processLateTimeout(); });
+	return context;
+}
+
+void ForkMessageContext::getDeliveryState(vector<string> &deliveredUids, vector<string> &pendingUids) const {
+	deliveredUids.assign(mDeliveredUids.begin(), mDeliveredUids.end());
+	pendingUids.clear();
+	const auto &branches = getBranches();
+	for (const auto &uid : mPendingUids) {
+		if (find_if(branches.begin(), branches.end(),
+					[&uid](const shared_ptr<BranchInfo> &br) { return br->mUid == uid; }) == branches.end())
+			pendingUids.push_back(uid);
+	}
+	for (const auto &br : branches) {
+		if (br->mUid.empty())
+			continue;
+		if (needsDelivery(br->getStatus()))
+			pendingUids.push_back(br->mUid);
+		else
+			deliveredUids.push_back(br->mUid);
+	}
 }
 
 ForkMessageContext::~ForkMessageContext() {
-	if (mAcceptanceTimer)
-		su_timer_destroy(mAcceptanceTimer);
 	LOGD("Destroy ForkMessageContext %p", this);
 }
 
@@ -80,6 +112,10 @@ void ForkMessageContext::checkFinished() {
 				break;
 			}
 		}
+		for (auto it = mPendingUids.begin(); !awaiting_responses && it != mPendingUids.end(); ++it) {
+			if (!findBranchByUid(*it))
+				awaiting_responses = true;
+		}
 	}
 	if (!awaiting_responses) {
 		shared_ptr<BranchInfo> br = findBestBranch(sUrgentCodes);
@@ -87,9 +123,22 @@ void ForkMessageContext::checkFinished() {
 			forwardResponse(br);
 		}
 		setFinished();
+	} else if (mCfg->mForkLate) {
+		checkIdle();
 	}
 }
 
+/* in fork-late mode, once the request is answered and no branch is in progress, only new registrations are awaited */
+void ForkMessageContext::checkIdle() {
+	if (!mCfg->mForkLate || mIncoming != NULL)
+		return;
+	for (const auto &br : getBranches()) {
+		if (br->getStatus() < 200)
+			return;
+	}
+	setIdle();
+}
+
 void ForkMessageContext::logDeliveredToUserEvent(const std::shared_ptr<BranchInfo> &br,
 										  const shared_ptr<ResponseSipEvent> &event) {
 	sip_t *sip = event->getMsgSip()->getSip();
@@ -109,11 +158,10 @@ void ForkMessageContext::onResponse(const std::shared_ptr<BranchInfo> &br, const
 	if (code > 100 && code < 300) {
 		if (code >= 200) {
 			mDeliveredCount++;
-			if (mAcceptanceTimer) {
+			if (mAcceptanceTimer.isSet()) {
 				if (mIncoming && mIsMessage)
 					logReceivedFromUserEvent(event); /*in the sender's log will appear the status code from the receiver*/
-				su_timer_destroy(mAcceptanceTimer);
-				mAcceptanceTimer = NULL;
+				mAcceptanceTimer.cancel();
 			}
 		}
 		if (mIsMessage)
@@ -157,12 +205,7 @@ void ForkMessageContext::acceptMessage() {
 void ForkMessageContext::onAcceptanceTimer() {
 	LOGD("ForkMessageContext::onAcceptanceTimer()");
 	acceptMessage();
-	su_timer_destroy(mAcceptanceTimer);
-	mAcceptanceTimer = NULL;
-}
-
-void ForkMessageContext::sOnAcceptanceTimer(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	static_cast<ForkMessageContext *>(arg)->onAcceptanceTimer();
+	checkIdle();
 }
 
 bool isMessageARCSFileTransferMessage(shared_ptr<RequestSipEvent> &ev) {
@@ -176,7 +219,7 @@ bool isMessageARCSFileTransferMessage(shared_ptr<RequestSipEvent> &ev) {
 }
 
 bool isConversionFromRcsToExternalBodyUrlNeeded(shared_ptr<ExtendedContact> &ec) {
-	list<string> acceptHeaders = ec->mAcceptHeader;
+	const list<string> &acceptHeaders = *ec->mAcceptHeader;
 	if (acceptHeaders.size() == 0) {
 		return true;
 	}
@@ -253,6 +296,10 @@ void ForkMessageContext::onNewBranch(const shared_ptr<BranchInfo> &br) {
 }
 
 bool ForkMessageContext::onNewRegister(const url_t *dest, const string &uid) {
+	if (mDeliveredUids.count(uid)) {
+		LOGD("ForkMessageContext::onNewRegister(): the message was delivered to this instance before being spooled.");
+		return false;
+	}
 	bool already_have_transaction = !ForkContext::onNewRegister(dest, uid);
 	if (already_have_transaction)
 		return false;
@@ -39,6 +39,7 @@
 #include <flexisip/agent.hh>
 #include "cli.hh"
 #include "stun.hh"
+#include "metrics-exporter.hh"
 #include <flexisip/module.hh>
 
 #include <cstdlib>
@@ -609,6 +610,7 @@ static string getPkcsPassphrase(TCLAP::ValueArg<string> &pkcsFile){
 int main(int argc, char *argv[]) {
 	shared_ptr<Agent> a;
 	StunServer *stun = NULL;
+	unique_ptr<MetricsExporter> metricsExporter;
 	unique_ptr<CommandLineInterface> proxy_cli;
 #ifdef ENABLE_PRESENCE
 	unique_ptr<CommandLineInterface> presence_cli;
@@ -920,6 +922,13 @@ int main(int argc, char *argv[]) {
 			stun->start();
 		}
 
+		GenericStruct *metricsCfg = cfg->getRoot()->get<GenericStruct>("metrics-exporter");
+		if (metricsCfg->get<ConfigBoolean>("enabled")->read()) {
+			metricsExporter = unique_ptr<MetricsExporter>(new MetricsExporter(
+				metricsCfg->get<ConfigString>("bind-address")->read(), metricsCfg->get<ConfigInt>("port")->read()));
+			metricsExporter->start();
+		}
+
 		proxy_cli = unique_ptr<CommandLineInterface>(new ProxyCommandLineInterface(a));
 		proxy_cli->start();
 
@@ -985,6 +994,7 @@ int main(int argc, char *argv[]) {
 		stun->stop();
 		delete stun;
 	}
+	metricsExporter = nullptr;
 	proxy_cli = nullptr;
 	su_root_destroy(root);
 
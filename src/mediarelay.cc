@@ -23,9 +23,13 @@
 #include <poll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include <algorithm>
 #include <list>
+#include <random>
 
 using namespace std;
 using namespace flexisip;
@@ -62,11 +66,56 @@ unsigned int PollFd::getREvents(int index) const {
 	return mPfd[index].revents;
 }
 
+RelayPortPool::RelayPortPool(int minPort, int maxPort, StatCounter64 *usedPairsStat)
+	: mFirstPort((minPort + 1) & ~1), mUsedCount(0), mUsedPairsStat(usedPairsStat) {
+	size_t count = maxPort > mFirstPort ? (maxPort - mFirstPort + 1) / 2 : 0;
+	mUsed.resize(count, false);
+	vector<int> indexes(count);
+	for (size_t i = 0; i < count; ++i)
+		indexes[i] = i;
+	/* keep ports hard to guess, as they used to be when picked randomly */
+	shuffle(indexes.begin(), indexes.end(), default_random_engine(random_device()()));
+	mFree.assign(indexes.begin(), indexes.end());
+	mUsedPairsStat->set(0);
+	LOGD("RelayPortPool created with %zu port pairs starting from %i", count, mFirstPort);
+}
+
+int RelayPortPool::allocate() {
+	int port = -1;
+	mMutex.lock();
+	if (!mFree.empty()) {
+		int index = mFree.front();
+		mFree.pop_front();
+		mUsed[index] = true;
+		mUsedCount++;
+		mUsedPairsStat->set(mUsedCount);
+		port = mFirstPort + 2 * index;
+	}
+	mMutex.unlock();
+	return port;
+}
+
+void RelayPortPool::release(int port) {
+	int index = (port - mFirstPort) / 2;
+	mMutex.lock();
+	if (port < mFirstPort || (port & 1) || (size_t)index >= mUsed.size() || !mUsed[index]) {
+		mMutex.unlock();
+		LOGE("RelayPortPool: port %i was not allocated from this pool.", port);
+		return;
+	}
+	mUsed[index] = false;
+	mUsedCount--;
+	mUsedPairsStat->set(mUsedCount);
+	mFree.push_back(index);
+	mMutex.unlock();
+}
+
 RelayChannel::RelayChannel(RelaySession *relaySession, const std::pair<std::string, std::string> &relayIps,
 						   bool preventLoops)
-	: mDir(SendRecv), mLocalIp(relayIps.first), mRemoteIp(std::string("undefined")) {
+	: mServer(relaySession->getRelayServer()), mId(0), mDir(SendRecv), mLocalIp(relayIps.first),
+	  mRemoteIp(std::string("undefined")) {
 	mPfdIndex = -1;
-	mSession = relaySession->getRelayServer()->createRtpSession(relayIps.second);
+	mSession = mServer->createRtpSession(relayIps.second, mPort);
 	mSockets[0] = rtp_session_get_rtp_socket(mSession);
 	mSockets[1] = rtp_session_get_rtcp_socket(mSession);
 	mSockAddrSize[0] = mSockAddrSize[1] = 0;
@@ -84,7 +133,12 @@ bool RelayChannel::checkSocketsValid() {
 }
 
 RelayChannel::~RelayChannel() {
+	if (mId != 0)
+		mServer->unregisterChannel(this);
 	rtp_session_destroy(mSession);
+	/* the sockets are closed, the ports can be given to another channel*/
+	if (mPort != -1)
+		mServer->releasePort(mPort);
 }
 
 const char *RelayChannel::dirToString(Dir dir) {
@@ -167,43 +221,56 @@ bool RelayChannel::checkPollFd(const PollFd *pfd, int i) {
 	return false;
 }
 
+bool RelayChannel::acceptPacket(int i, uint8_t *buf, size_t size, const struct sockaddr_storage &ss,
+							   socklen_t addrsize) {
+	mPacketsReceived++;
+	if (mSockAddrSize[i] == 0){
+		/* Remote destination has never been set previously (for example if 183 or 200 OK is not yet received),
+		 * but we receive a packet.
+		 * Our policy is to drop the packet until the destination address is set.*/
+		LOGW("RelayChannel[%p]: remote address not set, packet ignored.", this);
+		return false;
+	}
+	mRecvErrorCount[i] = 0;
+	if (addrsize != mSockAddrSize[i] || memcmp(&ss, &mSockAddr[i], addrsize) != 0 ){
+		LOGD("RelayChannel[%p] destination address changed.", this);
+		mSockAddrSize[i] = addrsize;
+		memcpy(&mSockAddr[i], &ss, addrsize);
+		mDestAddrChanged = true;
+	}
+
+	mSockAddrSize[i] = addrsize;
+	if (mDir == SendOnly || mDir == Inactive) {
+		/*LOGD("ignored packet");*/
+		return false;
+	}
+	if (mFilter &&
+		mFilter->onIncomingTransfer(buf, size, (struct sockaddr *)&mSockAddr[i], mSockAddrSize[i]) == false) {
+		return false;
+	}
+	return true;
+}
+
+void RelayChannel::onRecvError(int i) {
+	LOGW("Error receiving on port %i from %s:%i: %s", getLocalPort(), mRemoteIp.c_str(), mRemotePort[i],
+		 strerror(errno));
+	if (errno == ECONNREFUSED) {
+		mRecvErrorCount[i]++;
+	}
+}
+
 int RelayChannel::recv(int i, uint8_t *buf, size_t buflen) {
 	struct sockaddr_storage ss;
 	socklen_t addrsize = sizeof(ss);
 
 	int err = recvfrom(mSockets[i], buf, buflen, 0, (struct sockaddr *)&ss, &addrsize);
+	mServer->mRecvSyscalls++;
 	if (err > 0) {
-		mPacketsReceived++;
-		if (mSockAddrSize[i] == 0){
-			/* Remote destination has never been set previously (for example if 183 or 200 OK is not yet received),
-			 * but we receive a packet.
-			 * Our policy is to drop the packet until the destination address is set.*/
-			LOGW("RelayChannel[%p]: remote address not set, packet ignored.", this);
-			return 0;
-		}
-		mRecvErrorCount[i] = 0;
-		if (addrsize != mSockAddrSize[i] || memcmp(&ss, &mSockAddr[i], addrsize) != 0 ){
-			LOGD("RelayChannel[%p] destination address changed.", this);
-			mSockAddrSize[i] = addrsize;
-			memcpy(&mSockAddr[i], &ss, addrsize);
-			mDestAddrChanged = true;
-		}
-
-		mSockAddrSize[i] = addrsize;
-		if (mDir == SendOnly || mDir == Inactive) {
-			/*LOGD("ignored packet");*/
+		mServer->mReceivedPackets++;
+		if (!acceptPacket(i, buf, err, ss, addrsize))
 			return 0;
-		}
-		if (mFilter &&
-			mFilter->onIncomingTransfer(buf, buflen, (struct sockaddr *)&mSockAddr[i], mSockAddrSize[i]) == false) {
-			return 0;
-		}
 	} else if (err == -1) {
-		LOGW("Error receiving on port %i from %s:%i: %s", getLocalPort(), mRemoteIp.c_str(), mRemotePort[i],
-			 strerror(errno));
-		if (errno == ECONNREFUSED) {
-			mRecvErrorCount[i]++;
-		}
+		onRecvError(i);
 	}
 	return err;
 }
@@ -215,6 +282,8 @@ int RelayChannel::send(int i, uint8_t *buf, size_t buflen) {
 		if (!mFilter || mFilter->onOutgoingTransfer(buf, buflen, (struct sockaddr *)&mSockAddr[i], mSockAddrSize[i])) {
 			err = sendto(mSockets[i], buf, buflen, 0, (struct sockaddr *)&mSockAddr[i], mSockAddrSize[i]);
 			mPacketsSent++;
+			mServer->mSendSyscalls++;
+			mServer->mSentPackets++;
 			if (err == -1) {
 				LOGW("Error sending %i bytes (localport=%i dest=%s:%i) : %s", (int)buflen, getLocalPort() + i,
 					 mRemoteIp.c_str(), mRemotePort[i], strerror(errno));
@@ -229,6 +298,83 @@ int RelayChannel::send(int i, uint8_t *buf, size_t buflen) {
 	return err;
 }
 
+int RelayChannel::recvBatch(int i, PacketBatch &batch) {
+	batch.mCount = 0;
+#ifdef MEDIARELAY_BATCHING_ENABLED
+	for (int k = 0; k < batch.mMaxPackets; ++k) {
+		batch.mMsgs[k].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		batch.mMsgs[k].msg_hdr.msg_flags = 0;
+	}
+	int count = recvmmsg(mSockets[i], batch.mMsgs.data(), batch.mMaxPackets, MSG_DONTWAIT, NULL);
+	mServer->mRecvSyscalls++;
+	if (count == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			onRecvError(i);
+		return 0;
+	}
+	mServer->mReceivedPackets += count;
+	for (int k = 0; k < count; ++k) {
+		size_t size = batch.mMsgs[k].msg_len;
+		if (size == 0 || !acceptPacket(i, batch.getData(k), size, batch.mAddrs[k], batch.mMsgs[k].msg_hdr.msg_namelen))
+			size = 0;
+		batch.mSizes[k] = size;
+	}
+	batch.mCount = count;
+#else
+	int err = recv(i, batch.getData(0), PacketBatch::sMaxPacketSize);
+	if (err > 0) {
+		batch.mSizes[0] = err;
+		batch.mCount = 1;
+	}
+#endif
+	return batch.mCount;
+}
+
+int RelayChannel::sendBatch(int i, PacketBatch &batch) {
+	if (mRemotePort[i] <= 0 || mSockAddrSize[i] == 0 || mDir == Inactive || mRecvErrorCount[i] >= sMaxRecvErrors) {
+		/*destination not valid or inactive stream*/
+		return 0;
+	}
+#ifdef MEDIARELAY_BATCHING_ENABLED
+	int count = 0;
+	for (int k = 0; k < batch.mCount; ++k) {
+		size_t size = batch.mSizes[k];
+		if (size == 0)
+			continue;
+		uint8_t *data = batch.getData(k);
+		if (mFilter && !mFilter->onOutgoingTransfer(data, size, (struct sockaddr *)&mSockAddr[i], mSockAddrSize[i]))
+			continue;
+		batch.mSendIovs[count].iov_base = data;
+		batch.mSendIovs[count].iov_len = size;
+		batch.mSendMsgs[count].msg_hdr.msg_name = &mSockAddr[i];
+		batch.mSendMsgs[count].msg_hdr.msg_namelen = mSockAddrSize[i];
+		count++;
+	}
+	mPacketsSent += count;
+	mServer->mSentPackets += count;
+	int sent = 0;
+	while (sent < count) {
+		int err = sendmmsg(mSockets[i], &batch.mSendMsgs[sent], count - sent, 0);
+		mServer->mSendSyscalls++;
+		if (err <= 0) {
+			/*the first failed packet is skipped, the others are attempted again*/
+			LOGW("Error sending packet (localport=%i dest=%s:%i) : %s", getLocalPort() + i, mRemoteIp.c_str(),
+				 mRemotePort[i], strerror(errno));
+			err = 1;
+		}
+		sent += err;
+	}
+	return count;
+#else
+	int count = 0;
+	for (int k = 0; k < batch.mCount; ++k) {
+		if (batch.mSizes[k] > 0 && send(i, batch.getData(k), batch.mSizes[k]) > 0)
+			count++;
+	}
+	return count;
+#endif
+}
+
 void RelayChannel::setFilter(shared_ptr<MediaFilter> filter) {
 	mFilter = filter;
 }
@@ -265,6 +411,7 @@ std::shared_ptr<RelayChannel> RelaySession::createBranch(const std::string &trId
 	mMutex.lock();
 	ret = make_shared<RelayChannel>(this, relayIps, mServer->loopPreventionEnabled());
 	ret->setMultipleTargets(hasMultipleTargets);
+	mServer->registerChannel(shared_from_this(), ret.get());
 	mBacks.insert(make_pair(trId, ret));
 	mMutex.unlock();
 	LOGD("RelaySession [%p]: branch corresponding to transaction [%s] added.", this, trId.c_str());
@@ -277,6 +424,7 @@ void RelaySession::removeBranch(const std::string &trId) {
 	auto it = mBacks.find(trId);
 	if (it != mBacks.end()) {
 		removed = true;
+		releaseChannel((*it).second);
 		mBacks.erase(it);
 	}
 	mMutex.unlock();
@@ -305,6 +453,10 @@ void RelaySession::setEstablished(const std::string &tr_id) {
 		LOGD("RelaySession [%p] is established.", this);
 		mMutex.lock();
 		mBack = winner;
+		for (auto it = mBacks.begin(); it != mBacks.end(); ++it) {
+			if ((*it).second != winner)
+				releaseChannel((*it).second);
+		}
 		mBacks.clear();
 		mMutex.unlock();
 	} else LOGE("RelaySession [%p] is with from an unknown branch [%s].", this, tr_id.c_str());
@@ -344,6 +496,33 @@ void RelaySession::checkPollFd(const PollFd *pfd, time_t curtime) {
 	mMutex.unlock();
 }
 
+void RelaySession::checkChannel(uint64_t channelId, int i, time_t curtime) {
+	mMutex.lock();
+	if (mFront && mFront->getId() == channelId) {
+		transfer(curtime, mFront, i);
+	} else if (mBack) {
+		if (mBack->getId() == channelId)
+			transfer(curtime, mBack, i);
+	} else {
+		for (auto it = mBacks.begin(); it != mBacks.end(); ++it) {
+			if ((*it).second->getId() == channelId) {
+				transfer(curtime, (*it).second, i);
+				break;
+			}
+		}
+	}
+	mMutex.unlock();
+}
+
+/*
+ * The call may keep a channel alive after the session dropped it: its sockets must no longer be watched, otherwise the
+ * level-triggered epoll backend would wake up for their packets until the channel is destroyed, without reading them.
+ */
+void RelaySession::releaseChannel(const shared_ptr<RelayChannel> &chan) {
+	if (chan && chan->getId() != 0)
+		mServer->unregisterChannel(chan.get());
+}
+
 RelaySession::~RelaySession() {
 	LOGD("RelaySession %p destroyed", this);
 }
@@ -369,6 +548,10 @@ void RelaySession::unuse() {
 		back.recv = mBack->getReceivedPackets();
 		back.sent = mBack->getSentPackets();
 	}
+	releaseChannel(mFront);
+	releaseChannel(mBack);
+	for (auto it = mBacks.begin(); it != mBacks.end(); ++it)
+		releaseChannel((*it).second);
 	mFront.reset();
 	mBacks.clear();
 	mBack.reset();
@@ -405,6 +588,11 @@ void RelaySession::transfer(time_t curtime, const shared_ptr<RelayChannel> &chan
 	int recv_len;
 
 	mLastActivityTime = curtime;
+	PacketBatch *batch = mServer->getPacketBatch();
+	if (batch) {
+		transferBatch(chan, i, *batch);
+		return;
+	}
 	recv_len = chan->recv(i, buf, maxsize);
 	if (recv_len > 0) {
 		if (chan == mFront) {
@@ -422,26 +610,92 @@ void RelaySession::transfer(time_t curtime, const shared_ptr<RelayChannel> &chan
 	}
 }
 
-MediaRelayServer::MediaRelayServer(MediaRelay *module) : mModule(module) {
+void RelaySession::transferBatch(const shared_ptr<RelayChannel> &chan, int i, PacketBatch &batch) {
+	if (chan->recvBatch(i, batch) <= 0)
+		return;
+	if (chan == mFront) {
+		if (mBack) {
+			mBack->sendBatch(i, batch);
+		} else {
+			for (auto it = mBacks.begin(); it != mBacks.end(); ++it) {
+				(*it).second->sendBatch(i, batch);
+			}
+		}
+	} else {
+		mFront->sendBatch(i, batch);
+	}
+}
+
+PacketBatch::PacketBatch(int maxPackets)
+	: mMaxPackets(maxPackets), mCount(0), mData(maxPackets * sMaxPacketSize), mSizes(maxPackets, 0),
+	  mAddrs(maxPackets) {
+#ifdef MEDIARELAY_BATCHING_ENABLED
+	mIovs.resize(maxPackets);
+	mMsgs.resize(maxPackets);
+	mSendIovs.resize(maxPackets);
+	mSendMsgs.resize(maxPackets);
+	for (int k = 0; k < maxPackets; ++k) {
+		memset(&mMsgs[k], 0, sizeof(mMsgs[k]));
+		mIovs[k].iov_base = getData(k);
+		mIovs[k].iov_len = sMaxPacketSize;
+		mMsgs[k].msg_hdr.msg_name = &mAddrs[k];
+		mMsgs[k].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		mMsgs[k].msg_hdr.msg_iov = &mIovs[k];
+		mMsgs[k].msg_hdr.msg_iovlen = 1;
+
+		memset(&mSendMsgs[k], 0, sizeof(mSendMsgs[k]));
+		mSendMsgs[k].msg_hdr.msg_iov = &mSendIovs[k];
+		mSendMsgs[k].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+}
+
+MediaRelayServer::MediaRelayServer(MediaRelay *module)
+	: mModule(module), mEpollFd(-1), mNextChannelId(1), mRegisteredSockets(0), mDispatchedSockets(0),
+	  mIdleSockets(0), mRecvSyscalls(0), mReceivedPackets(0), mSendSyscalls(0), mSentPackets(0) {
 	mRunning = false;
 	mSessionsCount = 0;
 	if (pipe(mCtlPipe) == -1) {
 		LOGF("Could not create MediaRelayServer control pipe.");
 	}
+#ifdef MEDIARELAY_BATCHING_ENABLED
+	if (mModule->mMaxPacketsPerSyscall > 1)
+		mPacketBatch.reset(new PacketBatch(mModule->mMaxPacketsPerSyscall));
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+	if (mModule->mUseEpoll) {
+		mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (mEpollFd == -1) {
+			LOGW("MediaRelayServer: epoll_create1() failed: %s, falling back to poll().", strerror(errno));
+		} else {
+			struct epoll_event ev = {0};
+			ev.events = EPOLLIN;
+			ev.data.u64 = 0; /* channel ids start at 1, so 0 designates the control pipe*/
+			if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mCtlPipe[0], &ev) == -1) {
+				LOGW("MediaRelayServer: cannot watch control pipe with epoll: %s, falling back to poll().",
+					 strerror(errno));
+				close(mEpollFd);
+				mEpollFd = -1;
+			}
+		}
+	}
+#endif
 }
 
 Agent *MediaRelayServer::getAgent() {
 	return mModule->getAgent();
 }
 
-RtpSession *MediaRelayServer::createRtpSession(const std::string &bindIp) {
+RtpSession *MediaRelayServer::createRtpSession(const std::string &bindIp, int &port) {
 	RtpSession *session = rtp_session_new(RTP_SESSION_SENDRECV);
 #if ORTP_HAS_REUSEADDR
 	rtp_session_set_reuseaddr(session, FALSE);
 #endif
+	RelayPortPool *pool = mModule->mPortPool.get();
 	for (int i = 0; i < 100; ++i) {
-		int port = ((rand() % (mModule->mMaxPort - mModule->mMinPort)) + mModule->mMinPort) & 0xfffe;
-
+		port = pool->allocate();
+		if (port == -1)
+			break;
 #if ORTP_ABI_VERSION >= 9
 		if (rtp_session_set_local_addr(session, bindIp.c_str(), port, port + 1) == 0) {
 #else
@@ -449,12 +703,19 @@ RtpSession *MediaRelayServer::createRtpSession(const std::string &bindIp) {
 #endif
 			return session;
 		}
+		/* the port is used by another application: it goes back at the end of the queue and the next one is tried*/
+		pool->release(port);
 	}
 
-	LOGE("Could not find a random port on interface %s !", bindIp.c_str());
+	port = -1;
+	LOGE("Could not find a free port on interface %s !", bindIp.c_str());
 	return session;
 }
 
+void MediaRelayServer::releasePort(int port) {
+	mModule->mPortPool->release(port);
+}
+
 void MediaRelayServer::start() {
 	mRunning = true;
 	pthread_create(&mThread, NULL, &MediaRelayServer::threadFunc, this);
@@ -471,11 +732,14 @@ MediaRelayServer::~MediaRelayServer() {
 	mSessionsCount = 0;
 	close(mCtlPipe[0]);
 	close(mCtlPipe[1]);
+	if (mEpollFd != -1)
+		close(mEpollFd);
 }
 
 shared_ptr<RelaySession> MediaRelayServer::createSession(const std::string &frontId,
 														 const std::pair<std::string, std::string> &frontRelayIps) {
 	shared_ptr<RelaySession> s = make_shared<RelaySession>(this, frontId, frontRelayIps);
+	registerChannel(s, s->mFront.get());
 	mMutex.lock();
 	mSessions.push_back(s);
 	mSessionsCount++;
@@ -489,6 +753,43 @@ shared_ptr<RelaySession> MediaRelayServer::createSession(const std::string &fron
 	return s;
 }
 
+void MediaRelayServer::registerChannel(const shared_ptr<RelaySession> &session, RelayChannel *chan) {
+#ifdef HAVE_SYS_EPOLL_H
+	if (mEpollFd == -1 || !chan->checkSocketsValid())
+		return;
+	mChannelsMutex.lock();
+	uint64_t id = mNextChannelId++;
+	for (int i = 0; i < 2; ++i) {
+		struct epoll_event ev = {0};
+		ev.events = EPOLLIN;
+		ev.data.u64 = (id << 1) | i;
+		if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, chan->getSocket(i), &ev) == -1) {
+			LOGE("MediaRelayServer: cannot watch socket %i with epoll: %s", chan->getSocket(i), strerror(errno));
+		} else {
+			mRegisteredSockets++;
+		}
+	}
+	mChannels[id] = session;
+	chan->mId = id;
+	mChannelsMutex.unlock();
+#endif
+}
+
+void MediaRelayServer::unregisterChannel(RelayChannel *chan) {
+#ifdef HAVE_SYS_EPOLL_H
+	mChannelsMutex.lock();
+	for (int i = 0; i < 2; ++i) {
+		/* a non-NULL event is required by kernels older than 2.6.9*/
+		struct epoll_event ev = {0};
+		if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, chan->getSocket(i), &ev) == 0)
+			mRegisteredSockets--;
+	}
+	mChannels.erase(chan->mId);
+	chan->mId = 0;
+	mChannelsMutex.unlock();
+#endif
+}
+
 void MediaRelayServer::update() {
 	/*write to the control pipe to wakeup the server thread */
 	if (write(mCtlPipe[1], "e", 1) == -1)
@@ -527,11 +828,91 @@ static void set_high_prio() {
 }
 
 void MediaRelayServer::run() {
+	set_high_prio();
+	if (mEpollFd != -1)
+		runEpoll();
+	else
+		runPoll();
+}
+
+void MediaRelayServer::removeUnusedSessions() {
+	list<shared_ptr<RelaySession>> unused;
+	mMutex.lock();
+	for (auto it = mSessions.begin(); it != mSessions.end();) {
+		if (!(*it)->isUsed()) {
+			auto next = it;
+			++next;
+			unused.splice(unused.end(), mSessions, it);
+			it = next;
+			mSessionsCount--;
+			LOGD("There are now %i relay sessions running.", (int)mSessionsCount);
+		} else {
+			++it;
+		}
+	}
+	mMutex.unlock();
+	/* sessions may be destroyed here, which unregisters their channels: this must not happen with mMutex held*/
+	unused.clear();
+}
+
+void MediaRelayServer::runEpoll() {
+#ifdef HAVE_SYS_EPOLL_H
+	const int maxEvents = 256;
+	struct epoll_event events[maxEvents];
+	vector<pair<shared_ptr<RelaySession>, uint64_t>> ready;
+	time_t lastCleanup = getCurrentTime();
+
+	ready.reserve(maxEvents);
+	while (mRunning) {
+		int err = epoll_wait(mEpollFd, events, maxEvents, 1000);
+		time_t curtime = getCurrentTime();
+		if (err > 0) {
+			size_t watched;
+			mChannelsMutex.lock();
+			watched = mRegisteredSockets;
+			for (int i = 0; i < err; ++i) {
+				uint64_t token = events[i].data.u64;
+				if (token == 0) {
+					char tmp;
+					if (read(mCtlPipe[0], &tmp, 1) == -1) {
+						LOGE("Fail to read from control pipe.");
+					}
+					continue;
+				}
+				auto it = mChannels.find(token >> 1);
+				if (it == mChannels.end())
+					continue; /*channel was destroyed meanwhile*/
+				shared_ptr<RelaySession> session = (*it).second.lock();
+				if (session)
+					ready.emplace_back(session, token);
+			}
+			mChannelsMutex.unlock();
+
+			for (auto it = ready.begin(); it != ready.end(); ++it) {
+				if ((*it).first->isUsed())
+					(*it).first->checkChannel((*it).second >> 1, (int)((*it).second & 1), curtime);
+			}
+			mDispatchedSockets += ready.size();
+			if (watched > ready.size())
+				mIdleSockets += watched - ready.size();
+			ready.clear();
+		} else if (err == -1 && errno != EINTR) {
+			LOGE("MediaRelayServer: epoll_wait() failed: %s", strerror(errno));
+		}
+		if (curtime != lastCleanup) {
+			/* sessions are no longer walked on every wakeup, so unused ones are only collected once per second*/
+			removeUnusedSessions();
+			lastCleanup = curtime;
+		}
+	}
+#endif
+}
+
+void MediaRelayServer::runPoll() {
 	PollFd pfd(512);
 	int ctl_index;
 	int err;
 
-	set_high_prio();
 	while (mRunning) {
 		pfd.reset();
 		// fill the pollfd table
@@ -547,12 +928,16 @@ void MediaRelayServer::run() {
 		err = poll(pfd.getPfd(), pfd.getCurIndex(), 1000);
 		if (err > 0) {
 			// examine pollfd results
+			int dispatched = err;
 			if (pfd.getREvents(ctl_index) & POLLIN) {
 				char tmp;
 				if (read(mCtlPipe[0], &tmp, 1) == -1) {
 					LOGE("Fail to read from control pipe.");
 				}
+				dispatched--;
 			}
+			mDispatchedSockets += dispatched;
+			mIdleSockets += ctl_index - dispatched;
 			time_t curtime = getCurrentTime();
 			mMutex.lock();
 			for (auto it = mSessions.begin(); it != mSessions.end();) {
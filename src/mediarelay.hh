@@ -24,11 +24,44 @@
 #include "sdp-modifier.hh"
 #include <ortp/rtpsession.h>
 
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#include <sys/socket.h>
+
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG)
+#define MEDIARELAY_BATCHING_ENABLED 1
+#endif
+
 namespace flexisip {
 
 class RelayedCall;
 class MediaRelayServer;
 
+/**
+ * Pool of RTP/RTCP port pairs (even port for RTP, next odd one for RTCP) within the configured port range.
+ * Free pairs are kept in a queue, so that allocation and release are O(1) whatever the occupancy of the range, and
+ * a released pair is reused only after all the other free ones. Thread-safe.
+**/
+class RelayPortPool {
+  public:
+	RelayPortPool(int minPort, int maxPort, StatCounter64 *usedPairsStat);
+	/* Returns the RTP port of a free pair, or -1 if the pool is exhausted. */
+	int allocate();
+	void release(int port);
+	size_t getSize() const {
+		return mUsed.size();
+	}
+
+  private:
+	Mutex mMutex;
+	int mFirstPort;
+	std::deque<int> mFree; /* indexes of free pairs */
+	std::vector<bool> mUsed;
+	size_t mUsedCount;
+	StatCounter64 *mUsedPairsStat;
+};
+
 class MediaRelay : public Module, protected ModuleToolbox {
 	friend class MediaRelayServer;
 	friend class RelayedCall;
@@ -62,6 +95,14 @@ class MediaRelay : public Module, protected ModuleToolbox {
 
 	StatCounter64 *mCountCalls;
 	StatCounter64 *mCountCallsFinished;
+	std::vector<StatCounter64 *> mCountDispatchedSockets; /* one per relay server*/
+	std::vector<StatCounter64 *> mCountIdleSockets;
+	StatCounter64 *mCountRecvSyscalls;
+	StatCounter64 *mCountReceivedPackets;
+	StatCounter64 *mCountSendSyscalls;
+	StatCounter64 *mCountSentPackets;
+	StatCounter64 *mCountUsedPortPairs;
+	std::unique_ptr<RelayPortPool> mPortPool;
 	int mH264Decim;
 	int mMaxCalls;
 	int mMinPort, mMaxPort;
@@ -73,10 +114,13 @@ class MediaRelay : public Module, protected ModuleToolbox {
 	bool mPreventLoop;
 	bool mForceRelayForNonIceTargets;
 	bool mUsePublicIpForSdpMasquerading = false;
+	bool mUseEpoll = true;
+	int mMaxPacketsPerSyscall;
 	static ModuleInfo<MediaRelay> sInfo;
 };
 
 class RelaySession;
+class RelayChannel;
 class MediaRelay;
 
 class PollFd {
@@ -99,6 +143,44 @@ class PollFd {
 	int mCurSize;
 };
 
+/**
+ * Storage for the packets read from a socket with a single recvmmsg() call, so that they can be forwarded to each
+ * destination with a single sendmmsg() call. Each MediaRelayServer thread owns one.
+**/
+class PacketBatch {
+  public:
+	static const size_t sMaxPacketSize = 1500;
+
+	PacketBatch(int maxPackets);
+	int getMaxPackets() const {
+		return mMaxPackets;
+	}
+	int getCount() const {
+		return mCount;
+	}
+	uint8_t *getData(int index) {
+		return &mData[index * sMaxPacketSize];
+	}
+	/* Returns 0 for packets that must not be relayed. */
+	size_t getSize(int index) const {
+		return mSizes[index];
+	}
+
+  private:
+	friend class RelayChannel;
+	int mMaxPackets;
+	int mCount;
+	std::vector<uint8_t> mData;
+	std::vector<size_t> mSizes;
+	std::vector<struct sockaddr_storage> mAddrs;
+#ifdef MEDIARELAY_BATCHING_ENABLED
+	std::vector<struct iovec> mIovs;
+	std::vector<struct mmsghdr> mMsgs;
+	std::vector<struct iovec> mSendIovs;
+	std::vector<struct mmsghdr> mSendMsgs;
+#endif
+};
+
 class MediaRelayServer {
 	friend class RelayedCall;
 
@@ -109,15 +191,48 @@ class MediaRelayServer {
 												const std::pair<std::string, std::string> &frontRelayIps);
 	void update();
 	Agent *getAgent();
-	RtpSession *createRtpSession(const std::string &bindIp);
+	/* The RTP port is returned in port, -1 if no free port could be bound. It must be given back with releasePort(). */
+	RtpSession *createRtpSession(const std::string &bindIp, int &port);
+	void releasePort(int port);
 	void enableLoopPrevention(bool val);
 	bool loopPreventionEnabled() const {
 		return mModule->mPreventLoop;
 	}
+	/* Number of sockets that had data to relay when the server thread woke up. */
+	uint64_t getDispatchedSockets() const {
+		return mDispatchedSockets;
+	}
+	/* Number of sockets that were watched but had nothing to relay when the server thread woke up. */
+	uint64_t getIdleSockets() const {
+		return mIdleSockets;
+	}
+	uint64_t getRecvSyscalls() const {
+		return mRecvSyscalls;
+	}
+	uint64_t getReceivedPackets() const {
+		return mReceivedPackets;
+	}
+	uint64_t getSendSyscalls() const {
+		return mSendSyscalls;
+	}
+	uint64_t getSentPackets() const {
+		return mSentPackets;
+	}
+	/* Returns NULL when packets are relayed one by one. Must only be used from the server thread. */
+	PacketBatch *getPacketBatch() {
+		return mPacketBatch.get();
+	}
 
   private:
 	void start();
 	void run();
+	void runPoll();
+	void runEpoll();
+	void removeUnusedSessions();
+	/* Registers the RTP and RTCP sockets of the channel once, so that the server thread only gets woken up for it
+	 * when a packet is available. Only used with the epoll backend.*/
+	void registerChannel(const std::shared_ptr<RelaySession> &session, RelayChannel *chan);
+	void unregisterChannel(RelayChannel *chan);
 	static void *threadFunc(void *arg);
 	Mutex mMutex;
 	std::list<std::shared_ptr<RelaySession>> mSessions;
@@ -125,8 +240,21 @@ class MediaRelayServer {
 	MediaRelay *mModule;
 	pthread_t mThread;
 	int mCtlPipe[2];
+	int mEpollFd;
+	Mutex mChannelsMutex; /* protects mChannels, never held while locking a RelaySession*/
+	std::unordered_map<uint64_t, std::weak_ptr<RelaySession>> mChannels; /* channel id to owning session*/
+	uint64_t mNextChannelId;
+	size_t mRegisteredSockets;
+	std::atomic<uint64_t> mDispatchedSockets;
+	std::atomic<uint64_t> mIdleSockets;
+	std::atomic<uint64_t> mRecvSyscalls;
+	std::atomic<uint64_t> mReceivedPackets;
+	std::atomic<uint64_t> mSendSyscalls;
+	std::atomic<uint64_t> mSentPackets;
+	std::unique_ptr<PacketBatch> mPacketBatch;
 	bool mRunning;
 	friend class RelayChannel;
+	friend class RelaySession;
 };
 
 class RelayChannel;
@@ -148,6 +276,8 @@ class RelaySession : public std::enable_shared_from_this<RelaySession> {
 
 	void fillPollFd(PollFd *pfd);
 	void checkPollFd(const PollFd *pfd, time_t curtime);
+	/* Relays a packet received on socket i of the channel with the given id, used by the epoll backend. */
+	void checkChannel(uint64_t channelId, int i, time_t curtime);
 	void unuse();
 	int getActiveBranchesCount();
 
@@ -179,7 +309,10 @@ class RelaySession : public std::enable_shared_from_this<RelaySession> {
 	bool checkChannels();
 
   private:
+	friend class MediaRelayServer;
 	void transfer(time_t current, const std::shared_ptr<RelayChannel> &org, int i);
+	void releaseChannel(const std::shared_ptr<RelayChannel> &chan);
+	void transferBatch(const std::shared_ptr<RelayChannel> &org, int i, PacketBatch &batch);
 	Mutex mMutex;
 	MediaRelayServer *mServer;
 	time_t mLastActivityTime;
@@ -225,8 +358,18 @@ class RelayChannel : public SdpMasqueradeContext{
 	}
 	int recv(int i, uint8_t *buf, size_t size);
 	int send(int i, uint8_t *buf, size_t size);
+	/* Reads as many packets as the batch can hold with a single system call, returns the number of packets read. */
+	int recvBatch(int i, PacketBatch &batch);
+	/* Sends all relayable packets of the batch with as few system calls as possible. */
+	int sendBatch(int i, PacketBatch &batch);
 	void fillPollFd(PollFd *pfd);
 	bool checkPollFd(const PollFd *pfd, int i);
+	int getSocket(int i) const {
+		return mSockets[i];
+	}
+	uint64_t getId() const {
+		return mId;
+	}
 	void setFilter(std::shared_ptr<MediaFilter> filter);
 	uint64_t getReceivedPackets() const {
 		return mPacketsReceived;
@@ -243,7 +386,13 @@ class RelayChannel : public SdpMasqueradeContext{
 	static const char *dirToString(Dir dir);
 
   private:
+	friend class MediaRelayServer;
+	bool acceptPacket(int i, uint8_t *buf, size_t size, const struct sockaddr_storage &ss, socklen_t addrsize);
+	void onRecvError(int i);
 	static const int sMaxRecvErrors = 50;
+	MediaRelayServer *mServer;
+	uint64_t mId; /* assigned by MediaRelayServer::registerChannel(), 0 when not registered*/
+	int mPort; /* allocated from the RelayPortPool, -1 if none*/
 	Dir mDir;
 	std::string mLocalIp;
 	std::string mRemoteIp;
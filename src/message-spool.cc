@@ -0,0 +1,427 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <flexisip/message-spool.hh>
+
+#include <flexisip/logmanager.hh>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace flexisip;
+
+/*
+ * File layout, in host byte order:
+ * - the 8 bytes of sFileMagic,
+ * - records made of a 20 bytes header (magic, length of the whole record, state, 3 bytes of padding, expiration
+ *   time as 64 bits), followed by the keys, delivered uids and pending uids as lists of strings (a 32 bits count of
+ *   32 bits length prefixed strings), then the gr parameter and the request, as 32 bits length prefixed strings.
+ */
+static const char sFileMagic[8] = {'F', 'X', 'S', 'P', 'O', 'O', 'L', '1'};
+static const uint32_t sRecordMagic = 0x4d534658;
+static const uint32_t sRecordHeaderSize = 20;
+static const uint32_t sStateOffset = 8;
+static const uint8_t sStatePending = 1;
+static const uint8_t sStateRemoved = 0;
+// The mapping is larger than the file, so that appending does not require to map it again each time.
+static const uint64_t sMapIncrement = 64 * 1024 * 1024;
+// Below this amount of removed records, the file is not worth compacting.
+static const uint64_t sCompactThreshold = 1024 * 1024;
+
+MessageSpoolListener::~MessageSpoolListener() {
+}
+
+namespace {
+
+void putUint32(string &out, uint32_t value) {
+	out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void putString(string &out, const string &value) {
+	putUint32(out, value.size());
+	out.append(value);
+}
+
+void putList(string &out, const vector<string> &values) {
+	putUint32(out, values.size());
+	for (const auto &value : values)
+		putString(out, value);
+}
+
+string encode(const MessageSpool::Message &message) {
+	string out;
+	out.reserve(sRecordHeaderSize + message.mRequest.size() + 256);
+	putUint32(out, sRecordMagic);
+	putUint32(out, 0); // length, set below
+	out.push_back((char)sStatePending);
+	out.append(3, '\0');
+	int64_t expireAt = message.mExpireAt;
+	out.append(reinterpret_cast<const char *>(&expireAt), sizeof(expireAt));
+	putList(out, message.mKeys);
+	putList(out, message.mDeliveredUids);
+	putList(out, message.mPendingUids);
+	putString(out, message.mTargetGr);
+	putString(out, message.mRequest);
+	uint32_t length = out.size();
+	memcpy(&out[4], &length, sizeof(length));
+	return out;
+}
+
+class RecordReader {
+  public:
+	RecordReader(const char *data, size_t length) : mData(data), mEnd(data + length) {
+	}
+	bool getUint32(uint32_t &value) {
+		if ((size_t)(mEnd - mData) < sizeof(value))
+			return false;
+		memcpy(&value, mData, sizeof(value));
+		mData += sizeof(value);
+		return true;
+	}
+	bool getString(string &value) {
+		uint32_t length;
+		if (!getUint32(length) || (size_t)(mEnd - mData) < length)
+			return false;
+		value.assign(mData, length);
+		mData += length;
+		return true;
+	}
+	bool getList(vector<string> &values) {
+		uint32_t count;
+		if (!getUint32(count))
+			return false;
+		values.clear();
+		for (uint32_t i = 0; i < count; ++i) {
+			string value;
+			if (!getString(value))
+				return false;
+			values.push_back(move(value));
+		}
+		return true;
+	}
+
+  private:
+	const char *mData;
+	const char *mEnd;
+};
+
+bool writeAll(int fd, const char *data, size_t length, off_t offset) {
+	while (length > 0) {
+		ssize_t written = pwrite(fd, data, length, offset);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		length -= written;
+		offset += written;
+	}
+	return true;
+}
+
+/* Maps a spool file of end bytes, with room to grow. Returns nullptr on failure. */
+const char *mapSpool(int fd, uint64_t end, uint64_t &size) {
+	size = (end / sMapIncrement + 1) * sMapIncrement;
+	void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	return map == MAP_FAILED ? nullptr : static_cast<const char *>(map);
+}
+
+}
+
+MessageSpool::MessageSpool(TimerWheel &wheel, const string &path, MessageSpoolListener *listener)
+	: mWheel(wheel), mPath(path), mListener(listener) {
+	load();
+}
+
+MessageSpool::~MessageSpool() {
+	unmapFile();
+	if (mFd != -1)
+		close(mFd);
+}
+
+void MessageSpool::load() {
+	mFd = open(mPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (mFd == -1) {
+		LOGE("Cannot open message spool %s: %s", mPath.c_str(), strerror(errno));
+		return;
+	}
+	struct stat st;
+	if (fstat(mFd, &st) != 0) {
+		LOGE("Cannot stat message spool %s: %s", mPath.c_str(), strerror(errno));
+		close(mFd);
+		mFd = -1;
+		return;
+	}
+	uint64_t size = st.st_size;
+	if (size == 0) {
+		if (!writeAll(mFd, sFileMagic, sizeof(sFileMagic), 0)) {
+			LOGE("Cannot write message spool %s: %s", mPath.c_str(), strerror(errno));
+			close(mFd);
+			mFd = -1;
+			return;
+		}
+		size = sizeof(sFileMagic);
+	}
+	mEnd = size;
+	if (!mapFile()) {
+		close(mFd);
+		mFd = -1;
+		return;
+	}
+	if (size < sizeof(sFileMagic) || memcmp(mMap, sFileMagic, sizeof(sFileMagic)) != 0) {
+		LOGE("%s is not a message spool, it is left untouched.", mPath.c_str());
+		unmapFile();
+		close(mFd);
+		mFd = -1;
+		return;
+	}
+
+	time_t now = time(NULL);
+	size_t expired = 0;
+	uint64_t offset = sizeof(sFileMagic);
+	while (offset < size) {
+		uint32_t magic, length;
+		Message message;
+		if (size - offset < sRecordHeaderSize)
+			break;
+		memcpy(&magic, mMap + offset, sizeof(magic));
+		memcpy(&length, mMap + offset + 4, sizeof(length));
+		if (magic != sRecordMagic || length < sRecordHeaderSize || length > size - offset)
+			break;
+		if ((uint8_t)mMap[offset + sStateOffset] == sStateRemoved) {
+			mRemovedBytes += length;
+		} else if (!decode(offset, length, message)) {
+			break;
+		} else if (message.mExpireAt <= now) {
+			mRemovedBytes += length;
+			++expired;
+		} else {
+			index(offset, length, message);
+		}
+		offset += length;
+	}
+	if (offset < size) {
+		// Most likely the proxy stopped while appending a record.
+		LOGW("Message spool %s is truncated after %llu bytes of %llu.", mPath.c_str(), (unsigned long long)offset,
+			 (unsigned long long)size);
+		if (ftruncate(mFd, offset) != 0)
+			LOGE("Cannot truncate message spool %s: %s", mPath.c_str(), strerror(errno));
+		mEnd = offset;
+	}
+	LOGI("Message spool %s: %zu pending messages restored, %zu expired.", mPath.c_str(), mEntries.size(), expired);
+	if (mRemovedBytes > 0)
+		compact();
+}
+
+/* The current mapping, if any, is only replaced once the new one is made, so that the indexed messages stay readable. */
+bool MessageSpool::mapFile() {
+	uint64_t size;
+	const char *map = mapSpool(mFd, mEnd, size);
+	if (!map) {
+		LOGE("Cannot map message spool %s: %s", mPath.c_str(), strerror(errno));
+		return false;
+	}
+	unmapFile();
+	mMap = map;
+	mMapSize = size;
+	return true;
+}
+
+void MessageSpool::unmapFile() {
+	if (mMap) {
+		munmap(const_cast<char *>(mMap), mMapSize);
+		mMap = nullptr;
+		mMapSize = 0;
+	}
+}
+
+bool MessageSpool::decode(uint64_t offset, uint32_t length, Message &message) const {
+	int64_t expireAt;
+	memcpy(&expireAt, mMap + offset + sRecordHeaderSize - sizeof(int64_t), sizeof(expireAt));
+	RecordReader body(mMap + offset + sRecordHeaderSize, length - sRecordHeaderSize);
+	message.mExpireAt = (time_t)expireAt;
+	return body.getList(message.mKeys) && body.getList(message.mDeliveredUids) && body.getList(message.mPendingUids) &&
+		   body.getString(message.mTargetGr) && body.getString(message.mRequest);
+}
+
+uint64_t MessageSpool::index(uint64_t offset, uint32_t length, const Message &message) {
+	uint64_t id = mNextId++;
+	Entry &entry = mEntries[id];
+	entry.mOffset = offset;
+	entry.mLength = length;
+	entry.mTimer.reset(new WheelTimer(mWheel));
+	time_t now = time(NULL);
+	entry.mTimer->setSeconds(message.mExpireAt > now ? message.mExpireAt - now : 0, [this, id]() {
+		auto it = mEntries.find(id);
+		Message expired;
+		if (it != mEntries.end() && decode(it->second.mOffset, it->second.mLength, expired)) {
+			LOGD("Spooled message for %s expired.", expired.mKeys.empty() ? "" : expired.mKeys.front().c_str());
+			remove(id, expired.mKeys);
+		}
+	});
+
+	vector<string> newKeys;
+	for (const auto &key : message.mKeys) {
+		if (mKeyIndex.find(key) == mKeyIndex.end())
+			newKeys.push_back(key);
+		mKeyIndex.emplace(key, id);
+		mKeyBytes += key.size();
+	}
+	for (const auto &key : newKeys)
+		mListener->onSpoolKeyAdded(key);
+	return id;
+}
+
+bool MessageSpool::add(const Message &message) {
+	if (!isReady())
+		return false;
+	string record = encode(message);
+	if (!writeAll(mFd, record.data(), record.size(), mEnd)) {
+		LOGE("Cannot write message spool %s: %s", mPath.c_str(), strerror(errno));
+		if (ftruncate(mFd, mEnd) != 0)
+			LOGE("Cannot truncate message spool %s: %s", mPath.c_str(), strerror(errno));
+		return false;
+	}
+	uint64_t offset = mEnd;
+	mEnd += record.size();
+	if (mEnd > mMapSize && !mapFile()) {
+		mEnd = offset;
+		if (ftruncate(mFd, mEnd) != 0)
+			LOGE("Cannot truncate message spool %s: %s", mPath.c_str(), strerror(errno));
+		return false;
+	}
+	index(offset, record.size(), message);
+	return true;
+}
+
+vector<MessageSpool::Message> MessageSpool::take(const string &key, const function<bool(const Message &)> &filter) {
+	vector<Message> messages;
+	if (!isReady())
+		return messages;
+	vector<uint64_t> ids;
+	auto range = mKeyIndex.equal_range(key);
+	for (auto it = range.first; it != range.second; ++it)
+		ids.push_back(it->second);
+
+	for (uint64_t id : ids) {
+		auto it = mEntries.find(id);
+		if (it == mEntries.end())
+			continue;
+		Message message;
+		if (!decode(it->second.mOffset, it->second.mLength, message) || !filter(message))
+			continue;
+		remove(id, message.mKeys);
+		messages.push_back(move(message));
+	}
+	return messages;
+}
+
+void MessageSpool::remove(uint64_t id, const vector<string> &keys) {
+	auto it = mEntries.find(id);
+	if (it == mEntries.end())
+		return;
+	char state = (char)sStateRemoved;
+	if (!writeAll(mFd, &state, 1, it->second.mOffset + sStateOffset))
+		LOGE("Cannot write message spool %s: %s", mPath.c_str(), strerror(errno));
+	mRemovedBytes += it->second.mLength;
+	mEntries.erase(it);
+
+	vector<string> removedKeys;
+	for (const auto &key : keys) {
+		auto range = mKeyIndex.equal_range(key);
+		for (auto keyIt = range.first; keyIt != range.second; ++keyIt) {
+			if (keyIt->second == id) {
+				mKeyBytes -= keyIt->first.size();
+				mKeyIndex.erase(keyIt);
+				break;
+			}
+		}
+		if (mKeyIndex.find(key) == mKeyIndex.end())
+			removedKeys.push_back(key);
+	}
+	for (const auto &key : removedKeys)
+		mListener->onSpoolKeyRemoved(key);
+
+	if (mEntries.empty()) {
+		// Nothing pending anymore: start over with an empty file.
+		if (ftruncate(mFd, sizeof(sFileMagic)) == 0) {
+			mEnd = sizeof(sFileMagic);
+			mRemovedBytes = 0;
+		} else {
+			LOGE("Cannot truncate message spool %s: %s", mPath.c_str(), strerror(errno));
+		}
+	} else if (mRemovedBytes > sCompactThreshold && mRemovedBytes > mEnd / 2) {
+		compact();
+	}
+}
+
+void MessageSpool::compact() {
+	string tmpPath = mPath + ".tmp";
+	int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		LOGE("Cannot create %s: %s", tmpPath.c_str(), strerror(errno));
+		return;
+	}
+	bool ok = writeAll(fd, sFileMagic, sizeof(sFileMagic), 0);
+	uint64_t end = sizeof(sFileMagic);
+	map<uint64_t, uint64_t> offsets;
+	for (auto it = mEntries.begin(); ok && it != mEntries.end(); ++it) {
+		ok = writeAll(fd, mMap + it->second.mOffset, it->second.mLength, end);
+		offsets[it->first] = end;
+		end += it->second.mLength;
+	}
+	// The compacted file is mapped before it replaces the current one: on any failure, the spool goes on as it was.
+	const char *map = nullptr;
+	uint64_t mapSize = 0;
+	if (ok)
+		ok = fdatasync(fd) == 0 && (map = mapSpool(fd, end, mapSize)) != nullptr &&
+			 rename(tmpPath.c_str(), mPath.c_str()) == 0;
+	if (!ok) {
+		LOGE("Cannot compact message spool %s: %s", mPath.c_str(), strerror(errno));
+		if (map)
+			munmap(const_cast<char *>(map), mapSize);
+		close(fd);
+		unlink(tmpPath.c_str());
+		return;
+	}
+
+	unmapFile();
+	close(mFd);
+	mFd = fd;
+	mMap = map;
+	mMapSize = mapSize;
+	mEnd = end;
+	mRemovedBytes = 0;
+	for (auto &entry : mEntries)
+		entry.second.mOffset = offsets[entry.first];
+	LOGD("Message spool %s compacted to %llu bytes.", mPath.c_str(), (unsigned long long)mEnd);
+}
+
+size_t MessageSpool::getIndexSize() const {
+	// Nodes of the red-black trees have three pointers and a color on top of their value.
+	const size_t nodeOverhead = 4 * sizeof(void *);
+	return mEntries.size() * (nodeOverhead + sizeof(pair<const uint64_t, Entry>) + sizeof(WheelTimer)) +
+		   mKeyIndex.size() * (nodeOverhead + sizeof(pair<const string, uint64_t>)) + mKeyBytes;
+}
@@ -0,0 +1,288 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010  Belledonne Communications SARL.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "metrics-exporter.hh"
+#include <flexisip/common.hh>
+#include <flexisip/configmanager.hh>
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+using namespace flexisip;
+
+MetricsExporter::Init MetricsExporter::sStaticInit;
+
+MetricsExporter::Init::Init() {
+	ConfigItemDescriptor items[] = {
+		{Boolean, "enabled", "Serve the statistics counters over HTTP, in the OpenMetrics text format used by "
+		"Prometheus. The counters are available at the '/metrics' path.", "false"},
+		{String, "bind-address", "Local ip address where to bind the HTTP socket.", "127.0.0.1"},
+		{Integer, "port", "HTTP port number of the metrics exporter.", "9500"},
+		config_item_end};
+	GenericStruct *s = new GenericStruct("metrics-exporter", "OpenMetrics exporter parameters.", 0);
+	GenericManager::get()->getRoot()->addChild(s);
+	s->addChildrenValues(items);
+}
+
+MetricsExporter::MetricsExporter(const string &bindAddress, int port) : mBindAddress(bindAddress) {
+	mRunning = false;
+	mPort = port;
+	mSock = -1;
+}
+
+MetricsExporter::~MetricsExporter() {
+	stop();
+	if (mSock != -1)
+		close(mSock);
+}
+
+int MetricsExporter::start() {
+	struct addrinfo hints, *res = NULL;
+	string bindAddress = mBindAddress.empty() ? "127.0.0.1" : mBindAddress;
+	string port = to_string(mPort);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+	int err = getaddrinfo(bindAddress.c_str(), port.c_str(), &hints, &res);
+	if (err != 0) {
+		LOGE("Metrics exporter: invalid bind address %s: %s", bindAddress.c_str(), gai_strerror(err));
+		return -1;
+	}
+
+	mSock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (mSock == -1) {
+		LOGE("Metrics exporter: could not create socket: %s", strerror(errno));
+		freeaddrinfo(res);
+		return -1;
+	}
+	int on = 1;
+	setsockopt(mSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	err = ::bind(mSock, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (err == -1 || listen(mSock, 16) == -1) {
+		LOGE("Metrics exporter: could not listen on %s port %i: %s", bindAddress.c_str(), mPort, strerror(errno));
+		close(mSock);
+		mSock = -1;
+		return -1;
+	}
+
+	mRunning = true;
+	pthread_create(&mThread, NULL, &MetricsExporter::threadfunc, this);
+	LOGI("Metrics exporter listening on %s port %i", bindAddress.c_str(), mPort);
+	return 0;
+}
+
+void MetricsExporter::stop() {
+	if (mRunning) {
+		mRunning = false;
+		pthread_join(mThread, NULL);
+	}
+}
+
+void MetricsExporter::run() {
+	while (mRunning) {
+		struct pollfd pfd[1];
+
+		pfd[0].fd = mSock;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+
+		int err = poll(pfd, 1, 100);
+		if (err > 0 && (pfd[0].revents & POLLIN)) {
+			int client = accept(mSock, NULL, NULL);
+			if (client == -1) {
+				LOGW("Metrics exporter: accept() failed: %s", strerror(errno));
+				continue;
+			}
+			handleClient(client);
+			close(client);
+		} else if (err == -1 && errno != EINTR) {
+			LOGE("Metrics exporter: poll() failed: %s", strerror(errno));
+			break;
+		}
+	}
+}
+
+void MetricsExporter::handleClient(int sock) {
+	string request;
+	char buf[1024];
+
+	// Only the request line matters; headers are read until the blank line so that the client does not get a reset.
+	while (request.find("\r\n\r\n") == string::npos && request.size() < 8192) {
+		struct pollfd pfd = {sock, POLLIN, 0};
+		if (poll(&pfd, 1, 1000) <= 0)
+			return;
+		ssize_t n = recv(sock, buf, sizeof(buf), 0);
+		if (n <= 0)
+			return;
+		request.append(buf, n);
+	}
+
+	string status = "200 OK";
+	string contentType = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+	ostringstream body;
+	string requestLine = request.substr(0, request.find("\r\n"));
+	if (requestLine.compare(0, 13, "GET /metrics ") == 0 || requestLine.compare(0, 13, "GET /metrics?") == 0) {
+		render(body, GenericManager::get()->getRoot());
+	} else if (requestLine.compare(0, 4, "GET ") != 0) {
+		status = "405 Method Not Allowed";
+		contentType = "text/plain";
+		body << "Method not allowed\n";
+	} else {
+		status = "404 Not Found";
+		contentType = "text/plain";
+		body << "Not found\n";
+	}
+
+	ostringstream response;
+	string content = body.str();
+	response << "HTTP/1.1 " << status << "\r\n"
+			 << "Content-Type: " << contentType << "\r\n"
+			 << "Content-Length: " << content.size() << "\r\n"
+			 << "Connection: close\r\n\r\n"
+			 << content;
+	string data = response.str();
+	size_t sent = 0;
+	while (sent < data.size()) {
+		ssize_t n = send(sock, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) {
+			LOGW("Metrics exporter: could not send response: %s", strerror(errno));
+			return;
+		}
+		sent += n;
+	}
+}
+
+void *MetricsExporter::threadfunc(void *arg) {
+	MetricsExporter *exporter = (MetricsExporter *)arg;
+	exporter->run();
+	return NULL;
+}
+
+string MetricsExporter::metricName(const string &prefix, const string &name) {
+	string res = prefix;
+	if (!res.empty())
+		res += '_';
+	for (char c : name) {
+		if (isalnum((unsigned char)c)) {
+			res += c;
+		} else if (!res.empty() && res.back() != '_') {
+			res += '_';
+		}
+	}
+	while (!res.empty() && res.back() == '_')
+		res.pop_back();
+	return res;
+}
+
+void MetricsExporter::collectStruct(vector<Metric> &metrics, const GenericStruct *gstruct, const string &prefix) {
+	for (GenericEntry *entry : gstruct->getChildren()) {
+		GenericStruct *child = dynamic_cast<GenericStruct *>(entry);
+		if (child) {
+			collectStruct(metrics, child, metricName(prefix, child->getName()));
+			continue;
+		}
+		StatGauge64 *gauge = dynamic_cast<StatGauge64 *>(entry);
+		if (gauge) {
+			metrics.push_back({metricName(prefix, gauge->getName()), nullptr, gauge, nullptr});
+			continue;
+		}
+		StatCounter64 *counter = dynamic_cast<StatCounter64 *>(entry);
+		if (counter) {
+			metrics.push_back({metricName(prefix, counter->getName()), counter, nullptr, nullptr});
+			continue;
+		}
+		StatHistogram *histogram = dynamic_cast<StatHistogram *>(entry);
+		if (histogram)
+			metrics.push_back({metricName(prefix, histogram->getName()), nullptr, nullptr, histogram});
+	}
+}
+
+void MetricsExporter::renderCounter(ostream &ostr, const StatCounter64 *counter, const string &name) {
+	ostr << "# TYPE " << name << " counter\n";
+	ostr << "# HELP " << name << " " << escapeHelp(counter->getHelp()) << "\n";
+	ostr << name << "_total " << counter->read() << "\n";
+}
+
+void MetricsExporter::renderGauge(ostream &ostr, const StatGauge64 *gauge, const string &name) {
+	ostr << "# TYPE " << name << " gauge\n";
+	ostr << "# HELP " << name << " " << escapeHelp(gauge->getHelp()) << "\n";
+	ostr << name << " " << gauge->read() << "\n";
+}
+
+void MetricsExporter::renderHistogram(ostream &ostr, const StatHistogram *histogram, const string &name) {
+	ostr << "# TYPE " << name << " histogram\n";
+	ostr << "# HELP " << name << " " << escapeHelp(histogram->getHelp()) << "\n";
+	/*
+	 * Buckets are read one by one while other threads may be recording: the +Inf bucket and the count are derived
+	 * from the same snapshot so that the exposition stays self-consistent.
+	 */
+	uint64_t cumulated = 0;
+	for (int i = 0; i < StatHistogram::sBucketCount - 1; ++i) {
+		cumulated += histogram->getBucket(i);
+		ostr << name << "_bucket{le=\"" << StatHistogram::bucketUpperBound(i) << "\"} " << cumulated << "\n";
+	}
+	cumulated += histogram->getBucket(StatHistogram::sBucketCount - 1);
+	ostr << name << "_bucket{le=\"+Inf\"} " << cumulated << "\n";
+	ostr << name << "_count " << cumulated << "\n";
+	ostr << name << "_sum " << histogram->getSum() << "\n";
+}
+
+string MetricsExporter::escapeHelp(const string &help) {
+	string escaped;
+	for (char c : help) {
+		if (c == '\\')
+			escaped += "\\\\";
+		else if (c == '\n')
+			escaped += "\\n";
+		else
+			escaped += c;
+	}
+	return escaped;
+}
+
+/*
+ * The main thread may add statistics to the tree at any time: the tree is only walked under its lock, to list the
+ * statistics to render. Statistics are never removed while the proxy runs, so they can then be read without it.
+ */
+void MetricsExporter::render(ostream &ostr, const GenericStruct *root) {
+	vector<Metric> metrics;
+	{
+		lock_guard<mutex> lock(GenericStruct::getTreeMutex());
+		collectStruct(metrics, root, metricName("", root->getName()));
+	}
+	for (const Metric &metric : metrics) {
+		if (metric.counter)
+			renderCounter(ostr, metric.counter, metric.name);
+		else if (metric.gauge)
+			renderGauge(ostr, metric.gauge, metric.name);
+		else
+			renderHistogram(ostr, metric.histogram, metric.name);
+	}
+	ostr << "# EOF\n";
+}
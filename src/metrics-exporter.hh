@@ -0,0 +1,77 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <pthread.h>
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace flexisip {
+
+class GenericStruct;
+class StatCounter64;
+class StatGauge64;
+class StatHistogram;
+
+/*
+ * Serves the statistics of the configuration tree (StatCounter64, StatGauge64 and StatHistogram entries) over HTTP in
+ * the OpenMetrics text format, so that they can be scraped by Prometheus without going through SNMP. Requests are
+ * answered by a dedicated thread.
+ */
+class MetricsExporter {
+  public:
+	MetricsExporter(const std::string &bindAddress, int port);
+	~MetricsExporter();
+	int start();
+	void stop();
+
+	static void render(std::ostream &ostr, const GenericStruct *root);
+
+  private:
+	void run();
+	void handleClient(int sock);
+	static void *threadfunc(void *arg);
+	// A statistic of the tree, collected under the tree lock so that it can be rendered without holding it.
+	struct Metric {
+		std::string name;
+		const StatCounter64 *counter;
+		const StatGauge64 *gauge;
+		const StatHistogram *histogram;
+	};
+	static void collectStruct(std::vector<Metric> &metrics, const GenericStruct *gstruct, const std::string &prefix);
+	static void renderCounter(std::ostream &ostr, const StatCounter64 *counter, const std::string &name);
+	static void renderGauge(std::ostream &ostr, const StatGauge64 *gauge, const std::string &name);
+	static void renderHistogram(std::ostream &ostr, const StatHistogram *histogram, const std::string &name);
+	static std::string metricName(const std::string &prefix, const std::string &name);
+	static std::string escapeHelp(const std::string &help);
+	std::atomic<bool> mRunning;
+	pthread_t mThread;
+	std::string mBindAddress;
+	int mPort;
+	int mSock;
+	class Init {
+	  public:
+		Init();
+	};
+	static Init sStaticInit;
+};
+
+}
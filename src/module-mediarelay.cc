@@ -79,6 +79,11 @@ void MediaRelay::onDeclare(GenericStruct * mc) {
 				"3600"},
 			{ Boolean, "force-public-ip-for-sdp-masquerading", "Force the media relay to use the public address of Flexisip to relay calls. It not enabled, Flexisip will deduce a suitable "
 				"IP address by basing on data from SIP messages, which could fail in tricky situations e.g. when Flexisip is behind a TCP proxy.", "false" },
+			{ String, "polling-backend", "Mechanism used by the relay threads to wait for RTP/RTCP packets. Possible values are 'epoll' and 'poll'. "
+				"With 'epoll', sockets are registered once per relayed stream and only streams with pending packets are processed at each wakeup. "
+				"'poll' is used anyway on platforms without epoll.", "epoll" },
+			{ Integer, "max-packets-per-syscall", "Maximum number of packets read from a RTP/RTCP socket, or sent to a destination, with a single "
+				"system call (recvmmsg/sendmmsg). A value of 1 relays packets one by one.", "16" },
 #ifdef MEDIARELAY_SPECIFIC_FEATURES_ENABLED
 			/*very specific features, useless for most people*/
 			{ Integer, "h264-filtering-bandwidth", "Enable I-frame only filtering for video H264 for clients annoucing a total bandwith below this value expressed in kbit/s. Use 0 to disable the feature", "0" },
@@ -92,6 +97,19 @@ void MediaRelay::onDeclare(GenericStruct * mc) {
 	auto p=mc->createStatPair("count-calls", "Number of relayed calls.");
 	mCountCalls=p.first;
 	mCountCallsFinished=p.second;
+	/* there is one relay server per cpu, see createServers()*/
+	for (int i = 0; i < ModuleToolbox::getCpuCount(); ++i) {
+		string server = "relay thread " + to_string(i);
+		mCountDispatchedSockets.push_back(mc->createStat("count-server-" + to_string(i) + "-dispatched-sockets",
+			"Number of times the " + server + " woke up with pending packets on a RTP/RTCP socket."));
+		mCountIdleSockets.push_back(mc->createStat("count-server-" + to_string(i) + "-idle-sockets",
+			"Number of times the " + server + " woke up while a watched RTP/RTCP socket had no pending packet."));
+	}
+	mCountRecvSyscalls = mc->createStat("count-recv-syscalls", "Number of system calls made to read relayed RTP/RTCP packets.");
+	mCountReceivedPackets = mc->createStat("count-received-packets", "Number of RTP/RTCP packets read by the relay threads.");
+	mCountSendSyscalls = mc->createStat("count-send-syscalls", "Number of system calls made to send relayed RTP/RTCP packets.");
+	mCountSentPackets = mc->createStat("count-sent-packets", "Number of RTP/RTCP packets sent by the relay threads.");
+	mCountUsedPortPairs = mc->createGauge("count-used-port-pairs", "Number of RTP/RTCP port pairs currently allocated within the SDP port range.");
 }
 
 void MediaRelay::createServers(){
@@ -124,12 +142,25 @@ void MediaRelay::onLoad(const GenericStruct * modconf) {
 #endif
 	mMinPort = modconf->get<ConfigInt>("sdp-port-range-min")->read();
 	mMaxPort = modconf->get<ConfigInt>("sdp-port-range-max")->read();
+	mPortPool.reset(new RelayPortPool(mMinPort, mMaxPort, mCountUsedPortPairs));
 	mPreventLoop = modconf->get<ConfigBoolean>("prevent-loops")->read();
 	mMaxCalls=modconf->get<ConfigInt>("max-calls")->read();
 	mMaxRelayedEarlyMedia = modconf->get<ConfigInt>("max-early-media-per-call")->read();
 	mForceRelayForNonIceTargets = modconf->get<ConfigBoolean>("force-relay-for-non-ice-targets")->read();
 	mUsePublicIpForSdpMasquerading = modconf->get<ConfigBoolean>("force-public-ip-for-sdp-masquerading")->read();
 	mInactivityPeriod = modconf->get<ConfigInt>("inactivity-period")->read();
+	string pollingBackend = modconf->get<ConfigString>("polling-backend")->read();
+	if (pollingBackend == "epoll") {
+		mUseEpoll = true;
+	} else if (pollingBackend == "poll") {
+		mUseEpoll = false;
+	} else {
+		LOGF("MediaRelay: invalid polling-backend '%s', must be 'epoll' or 'poll'.", pollingBackend.c_str());
+	}
+	mMaxPacketsPerSyscall = modconf->get<ConfigInt>("max-packets-per-syscall")->read();
+	if (mMaxPacketsPerSyscall < 1) {
+		LOGF("MediaRelay: max-packets-per-syscall must be at least 1.");
+	}
 	createServers();
 }
 
@@ -139,6 +170,7 @@ void MediaRelay::onUnload() {
 		mCalls=NULL;
 	}
 	mServers.clear();
+	mPortPool.reset();
 }
 
 
@@ -389,6 +421,21 @@ void MediaRelay::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 }
 
 void MediaRelay::onIdle() {
+	uint64_t recvSyscalls = 0, received = 0, sendSyscalls = 0, sent = 0;
+	for (size_t i = 0; i < mServers.size() && i < mCountDispatchedSockets.size(); ++i) {
+		mCountDispatchedSockets[i]->set(mServers[i]->getDispatchedSockets());
+		mCountIdleSockets[i]->set(mServers[i]->getIdleSockets());
+	}
+	for (auto it = mServers.begin(); it != mServers.end(); ++it) {
+		recvSyscalls += (*it)->getRecvSyscalls();
+		received += (*it)->getReceivedPackets();
+		sendSyscalls += (*it)->getSendSyscalls();
+		sent += (*it)->getSentPackets();
+	}
+	mCountRecvSyscalls->set(recvSyscalls);
+	mCountReceivedPackets->set(received);
+	mCountSendSyscalls->set(sendSyscalls);
+	mCountSentPackets->set(sent);
 	mCalls->dump();
 	mCalls->removeAndDeleteInactives(mInactivityPeriod);
 	if (mCalls->size() > 0)
@@ -20,6 +20,7 @@
 #include <flexisip/agent.hh>
 #include <flexisip/event.hh>
 #include <flexisip/transaction.hh>
+#include <flexisip/registrardb.hh>
 
 #include "pushnotification/pushnotificationservice.hh"
 #include "pushnotification/applepush.hh"
@@ -29,7 +30,10 @@
 #include "pushnotification/firebasepush.hh"
 #include <flexisip/forkcallcontext.hh>
 
+#include <chrono>
 #include <map>
+#include <mutex>
+#include <tuple>
 #include <sofia-sip/msg_mime.h>
 #include <sofia-sip/sip_status.h>
 
@@ -40,12 +44,14 @@ class PushNotification;
 
 class PushNotificationContext : public enable_shared_from_this<PushNotificationContext> {
 private:
-	su_timer_t *mTimer; // timer after which push is sent
-	su_timer_t *mEndTimer; // timer after which push is cleared from global map.
+	WheelTimer mTimer; // timer after which push is sent
+	WheelTimer mEndTimer; // timer after which push is cleared from global map.
 	PushNotification *mModule;
 	shared_ptr<PushNotificationRequest> mPushNotificationRequest;
 	shared_ptr<ForkCallContext> mForkContext;
 	string mKey; // unique key for the push notification, identifiying the device and the call.
+	string mDeviceKey; // identifies the device only, for the coalescing of the push notifications.
+	string mCallId;
 	bool mSendRinging;
 	bool mPushSentResponseSent = false; // whether the 110 Push sent was sent already
 	void onTimeout();
@@ -53,13 +59,11 @@ private:
 	void onEnd();
 	void clear();
 
-	static void __timer_callback(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
-	static void __end_timer_callback(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg);
-
 public:
 	PushNotificationContext(
 		const shared_ptr<OutgoingTransaction> &transaction, PushNotification *module,
-		const shared_ptr<PushNotificationRequest> &pnr, const string &pnKey
+		const shared_ptr<PushNotificationRequest> &pnr, const string &pnKey, const string &deviceKey,
+		const string &callId
 	);
 	~PushNotificationContext();
 	void start(int seconds, bool sendRinging);
@@ -81,10 +85,14 @@ public:
 		return mPNS;
 	}
 	void clearNotification(const shared_ptr<PushNotificationContext> &ctx);
+	void sendPush(const shared_ptr<PushNotificationRequest> &pn, const string &deviceKey, const string &callId);
 
 private:
 	bool needsPush(const sip_t *sip);
 	void makePushNotification(const shared_ptr<MsgSip> &ms, const shared_ptr<OutgoingTransaction> &transaction);
+	void onInvalidToken(const shared_ptr<PushNotificationRequest> &pn);
+	void purgeInvalidTokens();
+	static void sOnInvalidTokenQueued(su_root_magic_t *rm, su_msg_r msg, void *u);
 	map<string, shared_ptr<PushNotificationContext>> mPendingNotifications; // map of pending push notifications. Its
 																			// purpose is to avoid sending multiples
 																			// notifications for the same call attempt
@@ -99,39 +107,134 @@ private:
 	PushNotificationService *mPNS;
 	StatCounter64 *mCountFailed;
 	StatCounter64 *mCountSent;
+	StatHistogram *mDeliveryTime;
+	map<string, pair<StatHistogram *, StatCounter64 *>> mRequestStats; // latency and requests in flight, by provider
+	StatCounter64 *mCountCoalesced;
+	StatCounter64 *mCountPreempted;
+	struct RecentPush {
+		chrono::steady_clock::time_point mSentAt;
+		shared_ptr<PushNotificationRequest> mRequest; // tells whether the server accepted it
+		string mCallId;
+	};
+	// Last push notification sent to each device during the coalescing window.
+	map<string, RecentPush> mRecentPushes;
+	chrono::steady_clock::time_point mRecentPushesCleanup;
+	int mCoalescingWindow;
+	StatCounter64 *mCountPurgedTokens;
+	// Time at which the servers reported each couple app-id, device token invalid, by address of record, waiting to be
+	// purged from the registrar. Filled by the threads of the clients.
+	map<string, map<pair<string, string>, time_t>> mInvalidTokens;
+	mutex mInvalidTokensMutex;
+	unique_ptr<WheelTimer> mPurgeTimer; // set while invalid tokens wait to be purged
+	static const int sPurgeInterval; /* seconds between a report of an invalid token and its purge */
 	bool mNoBadgeiOS;
 };
 
+const int PushNotification::sPurgeInterval = 5;
+
+/*
+ * Unregisters the contacts of a record whose push notification parameters carry a device token reported invalid,
+ * the way a REGISTER with expires=0 would. The contacts registered again since the report are kept.
+ */
+class InvalidTokenPurgeListener : public ContactUpdateListener {
+public:
+	InvalidTokenPurgeListener(const map<pair<string, string>, time_t> &tokens, StatCounter64 *countPurged)
+		: mTokens(tokens), mCountPurged(countPurged) {
+	}
+	void onRecordFound(const shared_ptr<Record> &r) override {
+		if (r == nullptr)
+			return;
+		// The contacts are collected first: binding may update the record synchronously.
+		SofiaAutoHome home;
+		url_t *aor = url_hdup(home.home(), r->getAor());
+		list<tuple<sip_contact_t *, string, string>> contacts; // contact, call-id, unique id
+		for (const auto &ec : r->getExtendedContacts()) {
+			char token[256] = {0};
+			char appId[256] = {0};
+			if (ec->mSipContact == nullptr || ec->mCallId.empty())
+				continue;
+			const char *params = ec->mSipContact->m_url->url_params;
+			if (url_param(params, "pn-tok", token, sizeof(token)) == 0 ||
+				url_param(params, "app-id", appId, sizeof(appId)) == 0)
+				continue;
+			auto it = mTokens.find(make_pair(string(appId), string(token)));
+			if (it == mTokens.end() || ec->mUpdatedTime > it->second)
+				continue;
+
+			sip_contact_t *contact = sip_contact_dup(home.home(), ec->mSipContact);
+			contact->m_next = nullptr;
+			msg_header_remove_param((msg_common_t *)contact, RegistrarDb::get()->messageExpiresName().c_str());
+			msg_header_replace_param(home.home(), (msg_common_t *)contact, "expires=0");
+			SLOGD << "Purging contact " << ec->mContactId << " of " << r->getKey() << ": invalid device token";
+			contacts.emplace_back(contact, ec->mCallId, ec->mUniqueId);
+		}
+		string topic = Record::defineKeyFromUrl(aor);
+		for (const auto &contact : contacts) {
+			BindingParameters parameter;
+			parameter.callId = get<1>(contact);
+			RegistrarDb::get()->bind(aor, get<0>(contact), parameter,
+									 make_shared<BindListener>(topic, get<2>(contact), mCountPurged));
+		}
+	}
+	void onError() override {
+		SLOGE << "Cannot fetch the record whose device tokens are to be purged";
+	}
+	void onInvalid() override {
+	}
+	void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override {
+	}
+
+private:
+	class BindListener : public ContactUpdateListener {
+	public:
+		BindListener(const string &topic, const string &uid, StatCounter64 *countPurged)
+			: mTopic(topic), mUid(uid), mCountPurged(countPurged) {
+		}
+		void onRecordFound(const shared_ptr<Record> &r) override {
+			// Like an unREGISTER: the other proxies update their view of the record.
+			RegistrarDb::get()->publish(mTopic, mUid);
+			if (mCountPurged)
+				mCountPurged->incr();
+		}
+		void onError() override {
+			SLOGE << "Cannot purge a contact with an invalid device token";
+		}
+		void onInvalid() override {
+		}
+		void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override {
+		}
+
+	private:
+		string mTopic;
+		string mUid;
+		StatCounter64 *mCountPurged;
+	};
+
+	map<pair<string, string>, time_t> mTokens;
+	StatCounter64 *mCountPurged;
+};
+
 PushNotificationContext::PushNotificationContext(const shared_ptr<OutgoingTransaction> &transaction,
 												 PushNotification *module,
-												 const shared_ptr<PushNotificationRequest> &pnr, const string &key)
-	: mModule(module), mPushNotificationRequest(pnr), mKey(key) {
-	mTimer = su_timer_create(su_root_task(mModule->getAgent()->getRoot()), 0);
-	mEndTimer = su_timer_create(su_root_task(mModule->getAgent()->getRoot()), 0);
+												 const shared_ptr<PushNotificationRequest> &pnr, const string &key,
+												 const string &deviceKey, const string &callId)
+	: mTimer(module->getAgent()->getTimerWheel()), mEndTimer(module->getAgent()->getTimerWheel()), mModule(module),
+	  mPushNotificationRequest(pnr), mKey(key), mDeviceKey(deviceKey), mCallId(callId) {
 	mForkContext = dynamic_pointer_cast<ForkCallContext>(ForkContext::get(transaction));
 	mSendRinging = true;
 }
 
 PushNotificationContext::~PushNotificationContext() {
-	if (mTimer)
-		su_timer_destroy(mTimer);
-	if (mEndTimer)
-		su_timer_destroy(mEndTimer);
 }
 
 void PushNotificationContext::start(int seconds, bool sendRinging) {
-	if (!mTimer)
-		return;
 	mSendRinging = sendRinging;
-	su_timer_set_interval(mTimer, &PushNotificationContext::__timer_callback, this, seconds * 1000);
-	su_timer_set_interval(mEndTimer, &PushNotificationContext::__end_timer_callback, this, 30 * 1000);
+	mTimer.setSeconds(seconds, [this]() { onTimeout(); });
+	mEndTimer.setSeconds(30, [this]() { onEnd(); });
 }
 
 void PushNotificationContext::cancel() {
-	if (mTimer) {
-		su_timer_destroy(mTimer);
-		mTimer = NULL;
-	}
+	mTimer.cancel();
 }
 
 void PushNotificationContext::onError(const string &errormsg) {
@@ -159,7 +262,7 @@ void PushNotificationContext::onTimeout() {
 			mForkContext->sendResponse(SIP_180_RINGING);
 	}
 
-	mModule->getService()->sendPush(mPushNotificationRequest);
+	mModule->sendPush(mPushNotificationRequest, mDeviceKey, mCallId);
 	if (mForkContext && !mPushSentResponseSent){
 		mForkContext->sendResponse(110, "Push sent");
 		mPushSentResponseSent = true;
@@ -168,10 +271,7 @@ void PushNotificationContext::onTimeout() {
 
 void PushNotificationContext::clear() {
 	SLOGD << "PNR " << mPushNotificationRequest.get() << ": PushNotificationContext clear";
-	if (mEndTimer) {
-		su_timer_destroy(mEndTimer);
-		mEndTimer = NULL;
-	}
+	mEndTimer.cancel();
 	mModule->clearNotification(shared_from_this());
 }
 
@@ -180,16 +280,6 @@ void PushNotificationContext::onEnd() {
 	mModule->clearNotification(shared_from_this());
 }
 
-void PushNotificationContext::__timer_callback(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	PushNotificationContext *context = (PushNotificationContext *)arg;
-	context->onTimeout();
-}
-
-void PushNotificationContext::__end_timer_callback(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
-	PushNotificationContext *context = (PushNotificationContext *)arg;
-	context->onEnd();
-}
-
 ModuleInfo<PushNotification> PushNotification::sInfo(
 	"PushNotification",
 	"This module performs push notifications to mobile phone notification systems: apple, "
@@ -202,7 +292,8 @@ ModuleInfo<PushNotification> PushNotification::sInfo(
 );
 
 PushNotification::PushNotification(Agent *ag)
-	: Module(ag), mExternalPushUri(NULL), mPNS(NULL), mCountFailed(NULL), mCountSent(NULL), mNoBadgeiOS(false) {
+	: Module(ag), mExternalPushUri(NULL), mPNS(NULL), mCountFailed(NULL), mCountSent(NULL), mDeliveryTime(NULL),
+	  mCountCoalesced(NULL), mCountPreempted(NULL), mCoalescingWindow(0), mCountPurgedTokens(NULL), mNoBadgeiOS(false) {
 }
 
 PushNotification::~PushNotification() {
@@ -218,6 +309,26 @@ void PushNotification::onDeclare(GenericStruct *module_config) {
 		 "Number of seconds to wait before sending a push notification to device. A value lesser or equal to zero will make "
 		 "the push notification to be sent immediately.", "5"},
 		{Integer, "max-queue-size", "Maximum number of notifications queued for each client", "100"},
+		{Integer, "http-connections-per-provider",
+		 "Maximum number of keep-alive connections opened to each HTTP/1.1 push notification server (google, "
+		 "firebase, windowsphone and external-push-uri), all served by a single event-driven thread. 0 restores the "
+		 "former behavior: one thread and one blocking connection per application.", "2"},
+		{Integer, "http-pipelining-depth",
+		 "Maximum number of requests sent on an HTTP/1.1 connection before receiving their responses. The number of "
+		 "requests in flight to a server is limited to http-connections-per-provider times this value. Only the "
+		 "requests that were not completely written are sent again when a connection breaks, the others fail.", "1"},
+		{Integer, "coalescing-window",
+		 "Number of seconds after a push notification during which the following ones to the same device are not "
+		 "sent, unless they are more urgent: calls are more urgent than messages, which are more urgent than the "
+		 "other notifications, and a call is never coalesced with another call. A push notification that the server "
+		 "rejects does not coalesce the following ones. This avoids waking up a device several times when it is "
+		 "reached by several forks in a short time. 0 disables the coalescing.", "0"},
+		{Boolean, "purge-invalid-tokens",
+		 "Unregister the contacts whose device token is reported unregistered by the push notification server (HTTP/2 "
+		 "API of Apple, Firebase, Google or Microsoft), so that no more notifications are sent to them until the device "
+		 "registers again. Tokens rejected as malformed or for the wrong environment, which may come from a "
+		 "misconfiguration of the server, are not purged. The contacts are purged in batches, every few seconds.",
+		 "true"},
 		{Integer, "time-to-live", "Default time to live for the push notifications, in seconds. This parameter shall be set according to mDeliveryTimeout parameter in ForkContext.cc", "2592000"},
 		{Boolean, "apple", "Enable push notification for apple devices", "true"},
 		{String, "apple-certificate-dir",
@@ -229,6 +340,20 @@ void PushNotification::onDeclare(GenericStruct *module_config) {
 		 "They should bear the appid of the application, suffixed by the release mode and .pem extension, and made of certificate followed by private key. "
 		 "For example: org.linphone.voip.dev.pem org.linphone.voip.prod.pem com.somephone.voip.dev.pem etc...",
 		 "/etc/flexisip/apn"},
+		{String, "apple-api",
+		 "Interface used to reach the Apple Push Notification service: 'binary' for the legacy binary protocol, or "
+		 "'http2' for the HTTP/2 API, which sends the notifications of each certificate or authentication key as "
+		 "concurrent streams of a single connection. The HTTP/2 API requires Flexisip to be built with "
+		 "ENABLE_APNS_HTTP2.", "binary"},
+		{String, "apple-auth-key",
+		 "Path to the authentication key (.p8 file) of the developer account, for the token-based authentication of "
+		 "the HTTP/2 API. When set, it is used for all the apple applications instead of the certificates of "
+		 "apple-certificate-dir.", ""},
+		{String, "apple-auth-key-id", "Identifier of apple-auth-key, as given by the developer account.", ""},
+		{String, "apple-team-id", "Team identifier of the developer account that owns apple-auth-key.", ""},
+		{String, "apple-http2-server",
+		 "host:port of the server to use for the HTTP/2 API instead of the servers of Apple, for example a local test "
+		 "server. Empty to use the development and production servers of Apple.", ""},
 		{Boolean, "google", "Enable push notification for android devices (for compatibility only)", "true"},
 		{StringList, "google-projects-api-keys",
 		 "List of couples projectId:ApiKey for each android project that supports push notifications (for compatibility only)", ""},
@@ -267,14 +392,36 @@ void PushNotification::onDeclare(GenericStruct *module_config) {
 	module_config->addChildrenValues(items);
 	mCountFailed = module_config->createStat("count-pn-failed", "Number of push notifications failed to be sent");
 	mCountSent = module_config->createStat("count-pn-sent", "Number of push notifications successfully sent");
+	mDeliveryTime = module_config->createHistogram("pn-delivery-time-us",
+		"Time between the queuing of a push notification and its successful sending, in microseconds");
+	mCountCoalesced = module_config->createStat("count-pn-coalesced",
+		"Number of push notifications not sent because another one reached the same device within coalescing-window");
+	mCountPreempted = module_config->createStat("count-pn-preempted",
+		"Number of push notifications overtaken in the queue of their client by a more urgent one");
+	mCountPurgedTokens = module_config->createStat("count-pn-purged-tokens",
+		"Number of contacts unregistered because the push notification server reported their device token invalid");
+	for (const string &provider : {"apple", "firebase", "google", "windows", "generic"}) {
+		mRequestStats[provider] = make_pair(
+			module_config->createHistogram("pn-" + provider + "-latency-us",
+				"Time between the sending of a " + provider + " push notification request and the response of the "
+				"server, in microseconds"),
+			module_config->createGauge("count-pn-" + provider + "-in-flight",
+				"Number of " + provider + " push notification requests sent and waiting for a response"));
+	}
 }
 
 void PushNotification::onLoad(const GenericStruct *mc) {
 	mNoBadgeiOS = mc->get<ConfigBoolean>("no-badge")->read();
 	mTimeout = mc->get<ConfigInt>("timeout")->read();
 	mTtl = mc->get<ConfigInt>("time-to-live")->read();
+	mCoalescingWindow = mc->get<ConfigInt>("coalescing-window")->read();
 	int maxQueueSize = mc->get<ConfigInt>("max-queue-size")->read();
+	int httpConnections = mc->get<ConfigInt>("http-connections-per-provider")->read();
+	int httpPipeliningDepth = mc->get<ConfigInt>("http-pipelining-depth")->read();
 	string certdir = mc->get<ConfigString>("apple-certificate-dir")->read();
+	string appleApi = mc->get<ConfigString>("apple-api")->read();
+	string appleAuthKey = mc->get<ConfigString>("apple-auth-key")->read();
+	string appleHttp2Server = mc->get<ConfigString>("apple-http2-server")->read();
 	auto googleKeys = mc->get<ConfigStringList>("google-projects-api-keys")->read();
 	auto firebaseKeys = mc->get<ConfigStringList>("firebase-projects-api-keys")->read();
 	string externalUri = mc->get<ConfigString>("external-push-uri")->read();
@@ -307,12 +454,34 @@ void PushNotification::onLoad(const GenericStruct *mc) {
 		mFirebaseKeys.insert(make_pair(keyval.substr(0, sep), keyval.substr(sep + 1)));
 	}
 
+	if (appleApi != "binary" && appleApi != "http2") {
+		LOGF("Invalid value '%s' for apple-api in module PushNotification", appleApi.c_str());
+		return;
+	}
+
 	mPNS = new PushNotificationService(maxQueueSize);
-	mPNS->setStatCounters(mCountFailed, mCountSent);
+	mPNS->setStatCounters(mCountFailed, mCountSent, mDeliveryTime, mCountPreempted);
+	for (const auto &stats : mRequestStats)
+		mPNS->setRequestStats(stats.first, stats.second.first, stats.second.second);
+	// the windows requests are typed after the version of the platform
+	for (const char *type : {"wp", "w10"})
+		mPNS->setRequestStats(type, mRequestStats["windows"].first, mRequestStats["windows"].second);
+	if (mc->get<ConfigBoolean>("purge-invalid-tokens")->read()) {
+		mPNS->setInvalidTokenListener([this](const shared_ptr<PushNotificationRequest> &pn) { onInvalidToken(pn); });
+		mPurgeTimer.reset(new WheelTimer(getAgent()->getTimerWheel()));
+	}
+	if (httpConnections > 0)
+		mPNS->setupHttpEngine(httpConnections, max(httpPipeliningDepth, 1));
 	if (mExternalPushUri)
 		mPNS->setupGenericClient(mExternalPushUri);
-	if (appleEnabled)
-		mPNS->setupiOSClient(certdir, "");
+	if (appleEnabled) {
+		if (appleApi == "http2" && !appleAuthKey.empty()) {
+			mPNS->setupiOSTokenClients(appleAuthKey, mc->get<ConfigString>("apple-auth-key-id")->read(),
+									   mc->get<ConfigString>("apple-team-id")->read(), "", appleHttp2Server);
+		} else {
+			mPNS->setupiOSClient(certdir, "", appleApi == "http2", appleHttp2Server);
+		}
+	}
 	if (googleEnabled)
 		mPNS->setupAndroidClient(mGoogleKeys);
 	if (firebaseEnabled)
@@ -361,6 +530,14 @@ void PushNotification::makePushNotification(const shared_ptr<MsgSip> &ms,
 		if (br)
 			pinfo.mUid = br->mUid;
 
+		// The record the contact was fetched from, possibly through an alias, is where its device token is purged
+		string aor;
+		if (br && br->mContact && !br->mContact->mRecordKey.empty()) {
+			url_t *aorUrl = Record::makeUrlFromKey(ms->getHome(), br->mContact->mRecordKey);
+			if (aorUrl)
+				aor = url_as_string(ms->getHome(), aorUrl);
+		}
+
 		// check if another push notification for this device wouldn't be pending
 		string keyValue = pinfo.mUid.empty() ? deviceToken : pinfo.mUid;
 		string pnKey(pinfo.mCallId + ":" + keyValue + ":" + appId);
@@ -478,8 +655,13 @@ void PushNotification::makePushNotification(const shared_ptr<MsgSip> &ms,
 
 			if (pn) {
 				if (time_out < 0) time_out = 0;
+				pn->setPriority(pinfo.mEvent == PushInfo::Call ? PushNotificationRequest::Call
+							   : pinfo.mEvent == PushInfo::Message ? PushNotificationRequest::Message
+							   : PushNotificationRequest::Other);
+				pn->setRegistration(aor, deviceToken);
 				SLOGD << "Creating a push notif context PNR " << pn.get() << " to send in " << time_out << "s";
-				context = make_shared<PushNotificationContext>(transaction, this, pn, pnKey);
+				context = make_shared<PushNotificationContext>(transaction, this, pn, pnKey,
+															   string(appId) + ":" + deviceToken, pinfo.mCallId);
 				context->start(time_out, !pinfo.mSilent);
 				mPendingNotifications.insert(make_pair(pnKey, context));
 			}
@@ -549,6 +731,90 @@ void PushNotification::onResponse(std::shared_ptr<ResponseSipEvent> &ev) {
 	}
 }
 
+void PushNotification::sendPush(const shared_ptr<PushNotificationRequest> &pn, const string &deviceKey,
+								const string &callId) {
+	if (mCoalescingWindow <= 0) {
+		mPNS->sendPush(pn);
+		return;
+	}
+	auto now = chrono::steady_clock::now();
+	auto window = chrono::seconds(mCoalescingWindow);
+	if (now - mRecentPushesCleanup > window) {
+		for (auto it = mRecentPushes.begin(); it != mRecentPushes.end();) {
+			if (now - it->second.mSentAt > window)
+				it = mRecentPushes.erase(it);
+			else
+				++it;
+		}
+		mRecentPushesCleanup = now;
+	}
+	auto it = mRecentPushes.find(deviceKey);
+	if (it != mRecentPushes.end() && now - it->second.mSentAt <= window &&
+		it->second.mRequest->getState() != PushNotificationRequest::Failed &&
+		it->second.mRequest->getPriority() <= pn->getPriority() &&
+		// each call rings the device, another call is never coalesced with it
+		(pn->getPriority() != PushNotificationRequest::Call || it->second.mCallId == callId)) {
+		SLOGD << "PNR " << pn.get() << " coalesced with the push notification sent to " << deviceKey << " "
+			  << chrono::duration_cast<chrono::milliseconds>(now - it->second.mSentAt).count() << " ms ago";
+		if (mCountCoalesced)
+			mCountCoalesced->incr();
+		return;
+	}
+	// Only a request handed to a client coalesces the following ones, and only until it fails.
+	if (mPNS->sendPush(pn) == 0 && pn->getState() != PushNotificationRequest::Failed) {
+		RecentPush &recent = mRecentPushes[deviceKey];
+		recent.mSentAt = now;
+		recent.mRequest = pn;
+		recent.mCallId = callId;
+	}
+}
+
+void PushNotification::onInvalidToken(const shared_ptr<PushNotificationRequest> &pn) {
+	if (pn->getAor().empty())
+		return;
+	SLOGD << "PNR " << pn.get() << ": device token of " << pn->getAor() << " reported invalid";
+	unique_lock<mutex> lock(mInvalidTokensMutex);
+	bool first = mInvalidTokens.empty();
+	mInvalidTokens[pn->getAor()][make_pair(pn->getAppIdentifier(), pn->getDeviceToken())] = getCurrentTime();
+	lock.unlock();
+	if (!first)
+		return;
+	// The purge timer is armed from the main thread, once per batch of tokens.
+	su_msg_r msg = SU_MSG_R_INIT;
+	su_root_t *root = getAgent()->getRoot();
+	if (su_msg_create(msg, su_root_task(root), su_root_task(root), sOnInvalidTokenQueued, sizeof(PushNotification *)) ==
+		-1) {
+		LOGE("Cannot schedule the purge of invalid device tokens.");
+		return;
+	}
+	*reinterpret_cast<PushNotification **>(su_msg_data(msg)) = this;
+	if (su_msg_send(msg) == -1)
+		LOGE("Cannot schedule the purge of invalid device tokens.");
+}
+
+void PushNotification::sOnInvalidTokenQueued(su_root_magic_t *rm, su_msg_r msg, void *u) {
+	PushNotification *module = *reinterpret_cast<PushNotification **>(su_msg_data(msg));
+	if (!module->mPurgeTimer->isSet())
+		module->mPurgeTimer->setSeconds(sPurgeInterval, [module]() { module->purgeInvalidTokens(); });
+}
+
+void PushNotification::purgeInvalidTokens() {
+	map<string, map<pair<string, string>, time_t>> invalidTokens;
+	{
+		unique_lock<mutex> lock(mInvalidTokensMutex);
+		invalidTokens.swap(mInvalidTokens);
+	}
+	for (const auto &aor : invalidTokens) {
+		SofiaAutoHome home;
+		url_t *url = url_make(home.home(), aor.first.c_str());
+		if (url == NULL) {
+			SLOGE << "Cannot purge the device tokens of invalid address of record " << aor.first;
+			continue;
+		}
+		RegistrarDb::get()->fetch(url, make_shared<InvalidTokenPurgeListener>(aor.second, mCountPurgedTokens));
+	}
+}
+
 void PushNotification::clearNotification(const shared_ptr<PushNotificationContext> &ctx) {
 	LOGD("Push notification to %s cleared.", ctx->getKey().c_str());
 	auto it = mPendingNotifications.find(ctx->getKey());
@@ -351,6 +351,34 @@ void ModuleRegistrar::onDeclare(GenericStruct *mc) {
 												"Note: This requires that all redis instances have the same "
 												"password. Otherwise the authentication will fail.",
 			"60"},
+		{Integer, "redis-fetch-batch-size", "Maximum number of records fetched from redis in a single pipeline when "
+												"several AORs are looked up at once (presence, forking to aliases). "
+												"The next batch is only sent once all the replies of the previous one "
+												"were received.",
+			"64"},
+		{StringList, "redis-shards", "List of whitespace separated redis primaries, as host[:port], across which the "
+										"records are sharded by consistent hashing of their AOR. "
+										"The list must be identical on all the flexisip nodes sharing these servers. "
+										"The server set by 'redis-server-domain' is still used for publish/subscribe and "
+										"replication checks. Leave empty to store the records on that server only.",
+			""},
+		{Integer, "redis-record-cache-size", "Maximum number of records kept in a local cache to avoid fetching them "
+												"from redis again when routing requests. Cached records are invalidated "
+												"when flexisip nodes publish a change of the record, and when redis "
+												"notifies the expiration of its key. 0 disables the cache.",
+			"0"},
+		{Integer, "redis-record-cache-ttl", "Maximum time in seconds a record is kept in the local cache. It bounds "
+											"how long a change missed by the cache, for instance while the "
+											"subscription to the record is not yet active, can go unnoticed.",
+			"30"},
+		{String, "redis-contact-encoding", "Encoding of the contacts stored in the redis hash of a record:\n"
+											"- url-params : the contact uri with its binding information as url "
+											"parameters and headers, readable by all flexisip versions\n"
+											"- binary : a compact versioned binary form, smaller and faster to parse.\n"
+											"Both encodings are always read, so the setting can be changed at any time, "
+											"but 'binary' must only be used once all the flexisip nodes sharing the "
+											"redis servers support it.",
+			"url-params"},
 		{String, "service-route",
 			"Sequence of proxies (space-separated) where requests will be redirected through (RFC3608)", ""},
 		{String, "name-message-expires", "The name used for the expire time of forking message", "message-expires"},
@@ -360,7 +388,12 @@ void ModuleRegistrar::onDeclare(GenericStruct *mc) {
 
 	mStats.mCountClear = mc->createStats("count-clear", "Number of cleared registrations.");
 	mStats.mCountBind = mc->createStats("count-bind", "Number of registers.");
-	mStats.mCountLocalActives = mc->createStat("count-local-registered-users", "Number of users currently registered through this server.");
+	mStats.mCountLocalActives = mc->createGauge("count-local-registered-users", "Number of users currently registered through this server.");
+	mc->createHistogram("redis-round-trip-time-us",
+		"Time between sending a record command to redis and receiving its reply, in microseconds.");
+	mc->createStat("count-redis-cache-hits", "Number of records fetched from the local cache.");
+	mc->createStat("count-redis-cache-misses", "Number of records fetched from redis because they were not in the local cache.");
+	mc->createStat("count-redis-cache-evictions", "Number of records evicted from the full local cache.");
 }
 
 void ModuleRegistrar::onLoad(const GenericStruct *mc) {
@@ -422,7 +455,6 @@ void ModuleRegistrar::idle() {
 }
 
 void ModuleRegistrar::updateLocalRegExpire() {
-	RegistrarDb::get()->mLocalRegExpire->removeExpiredBefore(getCurrentTime());
 	mStats.mCountLocalActives->set(RegistrarDb::get()->mLocalRegExpire->countActives());
 }
 
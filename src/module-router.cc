@@ -20,6 +20,8 @@
 #include <flexisip/logmanager.hh>
 #include <sofia-sip/sip_status.h>
 
+#include <algorithm>
+
 using namespace std;
 using namespace flexisip;
 
@@ -53,6 +55,11 @@ void ModuleRouter::onDeclare(GenericStruct *mc) {
 		{Integer, "message-accept-timeout",
 			"Maximum duration for accepting a text message if no response is received from any recipients."
 			" This property is meaningful when message-fork-late is set to true.", "15"},
+		{String, "message-spool",
+			"Path of a file where the messages waiting for the late registration of their recipients are stored, once"
+			" accepted. Only the location of each message is then kept in memory, and pending messages survive a restart."
+			" This property is meaningful when message-fork-late is set to true. Messages are kept in memory if empty.",
+			""},
 		{String, "fallback-route", "Default route to apply when the recipient is unreachable, given as a SIP URI, for"
 			" example: sip:example.org;transport=tcp (without surrounding brakets)", ""},
 		{Boolean, "allow-target-factorization",
@@ -81,6 +88,21 @@ void ModuleRouter::onDeclare(GenericStruct *mc) {
 	mStats.mCountNonForks = mc->createStat("count-non-forked", "Number of non forked invites.");
 	mStats.mCountLocalActives =
 		mc->createStat("count-local-registered-users", "Number of users currently registered through this server.");
+	mStats.mCallForkDuration =
+		mc->createHistogram("call-fork-duration-us", "Lifetime of the fork contexts of INVITE requests, in microseconds.");
+	mStats.mMessageForkDuration =
+		mc->createHistogram("message-fork-duration-us", "Lifetime of the fork contexts of MESSAGE requests, in microseconds.");
+	mStats.mOtherForkDuration =
+		mc->createHistogram("other-fork-duration-us", "Lifetime of the fork contexts of other requests, in microseconds.");
+	mStats.mCountSpooledMessages =
+		mc->createGauge("count-spooled-messages", "Number of messages waiting in the message spool.");
+	mStats.mMessageSpoolSize = mc->createGauge("message-spool-size", "Size of the message spool file, in bytes.");
+	mStats.mMessageSpoolIndexMemory =
+		mc->createGauge("message-spool-index-memory", "Memory used by the index of the message spool, in bytes.");
+}
+
+ModuleRouter::~ModuleRouter() {
+	delete mMessageSpool;
 }
 
 void ModuleRouter::onLoad(const GenericStruct *mc) {
@@ -108,18 +130,21 @@ void ModuleRouter::onLoad(const GenericStruct *mc) {
 	mForkCfg->mDeliveryTimeout = mc->get<ConfigInt>("call-fork-timeout")->read();
 	mForkCfg->mTreatDeclineAsUrgent = mc->get<ConfigBoolean>("treat-decline-as-urgent")->read();
 	mForkCfg->mCurrentBranchesTimeout = mc->get<ConfigInt>("call-fork-current-branches-timeout")->read();
+	mForkCfg->mDuration = mStats.mCallForkDuration;
 
 	//Forking configuration for MESSAGEs
 	mMessageForkCfg = make_shared<ForkContextConfig>();
 	mMessageForkCfg->mForkLate = mc->get<ConfigBoolean>("message-fork-late")->read();
 	mMessageForkCfg->mDeliveryTimeout = mc->get<ConfigInt>("message-delivery-timeout")->read();
 	mMessageForkCfg->mUrgentTimeout = mc->get<ConfigInt>("message-accept-timeout")->read();
+	mMessageForkCfg->mDuration = mStats.mMessageForkDuration;
 
 	//Forking configuration for other kind of requests.
 	mOtherForkCfg = make_shared<ForkContextConfig>();
 	mOtherForkCfg->mTreatAllErrorsAsUrgent = false;
 	mOtherForkCfg->mForkLate = false;
 	mOtherForkCfg->mDeliveryTimeout = 30;
+	mOtherForkCfg->mDuration = mStats.mOtherForkDuration;
 
 	mUseGlobalDomain = mc->get<ConfigBoolean>("use-global-domain")->read();
 
@@ -136,6 +161,24 @@ void ModuleRouter::onLoad(const GenericStruct *mc) {
 		mFallbackRouteParsed = sipUrlMake(mHome.home(), mFallbackRoute.c_str());
 		if (!mFallbackRouteParsed) LOGF("Bad value [%s] for fallback-route in module::Router.", mFallbackRoute.c_str());
 	}
+
+	string spoolPath = mc->get<ConfigString>("message-spool")->read();
+	if (!spoolPath.empty() && mMessageForkCfg->mForkLate && !mMessageSpool) {
+		mMessageSpool = new MessageSpool(getAgent()->getTimerWheel(), spoolPath, this);
+		if (!mMessageSpool->isReady()) {
+			LOGE("Message spool disabled, pending messages are kept in memory.");
+			delete mMessageSpool;
+			mMessageSpool = nullptr;
+		}
+	}
+}
+
+void ModuleRouter::onIdle() {
+	if (mMessageSpool) {
+		mStats.mCountSpooledMessages->set(mMessageSpool->size());
+		mStats.mMessageSpoolSize->set(mMessageSpool->getFileSize());
+		mStats.mMessageSpoolIndexMemory->set(mMessageSpool->getIndexSize());
+	}
 }
 
 void ModuleRouter::sendReply(shared_ptr<RequestSipEvent> &ev, int code, const char *reason, int warn_code,
@@ -375,6 +418,55 @@ void ModuleRouter::onContactRegistered(const string &uid, const shared_ptr<Recor
 			}
 		}
 	}
+
+	if (ec && mMessageSpool && mMessageSpool->isReady())
+		restoreSpooledMessages(key, uid, ec);
+}
+
+void ModuleRouter::restoreSpooledMessages(const string &key, const string &uid,
+										  const shared_ptr<ExtendedContact> &ec) {
+	// Same rules as ForkMessageContext::onNewRegister(), for a context that has no branch yet.
+	auto messages = mMessageSpool->take(key, [&uid](const MessageSpool::Message &message) {
+		if (find(message.mDeliveredUids.begin(), message.mDeliveredUids.end(), uid) != message.mDeliveredUids.end())
+			return false;
+		if (uid.empty() && !message.mDeliveredUids.empty())
+			return false;
+		return message.mTargetGr.empty() || uid.find(message.mTargetGr) != string::npos;
+	});
+
+	for (const auto &message : messages) {
+		msg_t *msg = msg_make(sip_default_mclass(), 0, message.mRequest.c_str(), message.mRequest.size());
+		if (!msg || !sip_object(msg) || !sip_object(msg)->sip_request) {
+			LOGE("Cannot parse a spooled message for %s, it is dropped.", key.c_str());
+			if (msg)
+				msg_destroy(msg);
+			continue;
+		}
+		auto ms = make_shared<MsgSip>(msg);
+		msg_destroy(msg);
+		auto ev = make_shared<RequestSipEvent>(dynamic_pointer_cast<IncomingAgent>(getAgent()->shared_from_this()), ms);
+		// The request was already accepted: it goes on from this module, without incoming transaction.
+		ev->setCurrentModule(this);
+		ev->SipEvent::suspendProcessing();
+
+		shared_ptr<ForkContext> context =
+			ForkMessageContext::restore(getAgent(), ev, mMessageForkCfg, this, message.mExpireAt,
+										message.mDeliveredUids, message.mPendingUids);
+		for (const auto &k : message.mKeys) {
+			context->addKey(k);
+			mForks.insert(make_pair(k, context));
+			if (mForks.count(k) == 1) {
+				SofiaAutoHome home;
+				auto listener = make_shared<OnContactRegisteredListener>(this, url_make(home.home(), ("sip:" + k).c_str()));
+				context->setContactRegisteredListener(listener);
+				RegistrarDb::get()->subscribe(k, listener);
+			}
+		}
+		mStats.mCountForks->incrStart();
+		SLOGD << "Restored spooled fork " << context.get() << " for key '" << key << "'";
+		lateDispatch(context->getEvent(), ec, context, "");
+		context->start();
+	}
 }
 
 bool ModuleRouter::makeGeneratedContactRoute(shared_ptr<RequestSipEvent> &ev, const shared_ptr<Record> &aor,
@@ -503,7 +595,7 @@ void ModuleRouter::routeRequest(shared_ptr<RequestSipEvent> &ev, const shared_pt
 
 	// _Copy_ list of extended contacts
 	if (aor)
-		contacts = aor->getExtendedContacts();
+		contacts.assign(aor->getExtendedContacts().begin(), aor->getExtendedContacts().end());
 
 	time_t now = getCurrentTime();
 
@@ -974,6 +1066,55 @@ void ModuleRouter::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 void ModuleRouter::onForkContextFinished(shared_ptr<ForkContext> ctx) {
 	if (!ctx->getConfig()->mForkLate) return;
 
+	removeFork(ctx);
+}
+
+bool ModuleRouter::onForkContextIdle(shared_ptr<ForkContext> ctx) {
+	auto messageCtx = dynamic_pointer_cast<ForkMessageContext>(ctx);
+	if (!mMessageSpool || !messageCtx)
+		return false;
+
+	MessageSpool::Message message;
+	message.mExpireAt = messageCtx->getExpireAt();
+	if (message.mExpireAt <= time(NULL))
+		return false;
+
+	const shared_ptr<MsgSip> &ms = ctx->getEvent()->getMsgSip();
+	SofiaAutoHome home;
+	size_t len = 0;
+	ms->serialize();
+	char *data = msg_as_string(home.home(), ms->getMsg(), NULL, 0, &len);
+	if (!data)
+		return false;
+	message.mRequest.assign(data, len);
+	list<string> keys = ctx->getKeys();
+	message.mKeys.assign(keys.begin(), keys.end());
+	messageCtx->getDeliveryState(message.mDeliveredUids, message.mPendingUids);
+	ModuleToolbox::getUriParameter(ms->getSip()->sip_request->rq_url, "gr", message.mTargetGr);
+
+	if (!mMessageSpool->add(message))
+		return false;
+	SLOGD << "Fork " << ctx.get() << " spooled";
+	removeFork(ctx);
+	return true;
+}
+
+void ModuleRouter::onSpoolKeyAdded(const string &key) {
+	SofiaAutoHome home;
+	auto listener = make_shared<OnContactRegisteredListener>(this, url_make(home.home(), ("sip:" + key).c_str()));
+	mSpoolListeners[key] = listener;
+	RegistrarDb::get()->subscribe(key, listener);
+}
+
+void ModuleRouter::onSpoolKeyRemoved(const string &key) {
+	auto it = mSpoolListeners.find(key);
+	if (it == mSpoolListeners.end())
+		return;
+	RegistrarDb::get()->unsubscribe(key, it->second);
+	mSpoolListeners.erase(it);
+}
+
+void ModuleRouter::removeFork(const shared_ptr<ForkContext> &ctx) {
 	list<string> keys = ctx->getKeys();
 	for (list<string>::iterator it=keys.begin(); it != keys.end(); ++it) {
 		string key = *it;
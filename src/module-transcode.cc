@@ -493,9 +493,9 @@ void Transcoder::onResponse(shared_ptr<ResponseSipEvent> &ev) {
 }
 
 void Transcoder::onTimer() {
-	for (auto it = mCalls.getList().begin(); it != mCalls.getList().end(); ++it) {
-		dynamic_pointer_cast<TranscodedCall>(*it)->doBgTasks();
-	}
+	mCalls.forEach([](const shared_ptr<CallContextBase> &ctx) {
+		dynamic_pointer_cast<TranscodedCall>(ctx)->doBgTasks();
+	});
 }
 
 void Transcoder::sOnTimer(void *unused, su_timer_t *t, void *zis) {
@@ -33,6 +33,46 @@
 using namespace std;
 using namespace flexisip;
 
+// -----------------------------------------------------------------------------
+// ModuleLatencyStats.
+// -----------------------------------------------------------------------------
+
+const char *ModuleLatencyStats::sCategoryNames[CategoryCount] = {
+	"invite", "register", "message", "subscribe", "other-request", "response"
+};
+
+ModuleLatencyStats::ModuleLatencyStats(GenericStruct *moduleConfig) {
+	for (size_t c = 0; c < CategoryCount; ++c) {
+		string what = sCategoryNames[c] + string(c == Response ? "s" : " requests");
+		mHistograms[c] = moduleConfig->createHistogram(string("latency-") + sCategoryNames[c] + "-us",
+			"Time spent by the module processing " + what + ", in microseconds.");
+	}
+}
+
+void ModuleLatencyStats::recordRequest(sip_method_t method, chrono::steady_clock::duration elapsed) {
+	switch (method) {
+		case sip_method_invite:
+			mHistograms[Invite]->recordDuration(elapsed);
+			break;
+		case sip_method_register:
+			mHistograms[Register]->recordDuration(elapsed);
+			break;
+		case sip_method_message:
+			mHistograms[Message]->recordDuration(elapsed);
+			break;
+		case sip_method_subscribe:
+			mHistograms[Subscribe]->recordDuration(elapsed);
+			break;
+		default:
+			mHistograms[OtherRequest]->recordDuration(elapsed);
+			break;
+	}
+}
+
+void ModuleLatencyStats::recordResponse(chrono::steady_clock::duration elapsed) {
+	mHistograms[Response]->recordDuration(elapsed);
+}
+
 // -----------------------------------------------------------------------------
 // Module.
 // -----------------------------------------------------------------------------
@@ -99,8 +139,12 @@ void Module::checkConfig() {
 
 void Module::load() {
 	mFilter->loadConfig(mModuleConfig);
-	if (mFilter->isEnabled())
+	if (mFilter->isEnabled()) {
+		// The histograms are created once: the stats of a config node can't be removed.
+		if (!mLatencyStats && GenericManager::get()->getGlobal()->get<ConfigBoolean>("module-latency-stats")->read())
+			mLatencyStats.reset(new ModuleLatencyStats(mModuleConfig));
 		onLoad(mModuleConfig);
+	}
 }
 
 void Module::unload() {
@@ -114,6 +158,17 @@ void Module::reload() {
 }
 
 void Module::processRequest(shared_ptr<RequestSipEvent> &ev) {
+	if (!mLatencyStats) {
+		doProcessRequest(ev);
+		return;
+	}
+	sip_method_t method = ev->getSip()->sip_request->rq_method;
+	auto start = chrono::steady_clock::now();
+	doProcessRequest(ev);
+	mLatencyStats->recordRequest(method, chrono::steady_clock::now() - start);
+}
+
+void Module::doProcessRequest(shared_ptr<RequestSipEvent> &ev) {
 	const shared_ptr<MsgSip> &ms = ev->getMsgSip();
 	LOG_SCOPED_THREAD("Module", getModuleName());
 
@@ -137,6 +192,16 @@ void Module::processRequest(shared_ptr<RequestSipEvent> &ev) {
 }
 
 void Module::processResponse(shared_ptr<ResponseSipEvent> &ev) {
+	if (!mLatencyStats) {
+		doProcessResponse(ev);
+		return;
+	}
+	auto start = chrono::steady_clock::now();
+	doProcessResponse(ev);
+	mLatencyStats->recordResponse(chrono::steady_clock::now() - start);
+}
+
+void Module::doProcessResponse(shared_ptr<ResponseSipEvent> &ev) {
 	const shared_ptr<MsgSip> &ms = ev->getMsgSip();
 	LOG_SCOPED_THREAD("Module", getModuleName());
 
@@ -4,6 +4,7 @@
 #include <sstream>
 #include <string>
 #include <stdexcept>
+#include <cstring>
 
 using namespace std;
 using namespace flexisip;
@@ -13,7 +14,7 @@ const unsigned int ApplePushNotificationRequest::DEVICE_BINARY_SIZE = 32;
 uint32_t ApplePushNotificationRequest::sIdentifier = 1;
 
 ApplePushNotificationRequest::ApplePushNotificationRequest(const PushInfo &info)
-: PushNotificationRequest(info.mAppId, "apple") {
+: PushNotificationRequest(info.mAppId, "apple"), mResponseStatus(0) {
 	const string &deviceToken = info.mDeviceToken;
 	const string &msg_id = info.mAlertMsgId;
 	const string &arg = info.mFromName.empty() ? info.mFromUri : info.mFromName;
@@ -85,6 +86,34 @@ int ApplePushNotificationRequest::formatDeviceToken(const string &deviceToken) {
 	return 0;
 }
 
+string ApplePushNotificationRequest::getDeviceTokenHex() const {
+	static const char digits[] = "0123456789abcdef";
+	string hex;
+	hex.reserve(mDeviceToken.size() * 2);
+	for (char c : mDeviceToken) {
+		hex.push_back(digits[(c >> 4) & 0x0f]);
+		hex.push_back(digits[c & 0x0f]);
+	}
+	return hex;
+}
+
+/* the topic is the bundle id, that is the app id without its release mode suffix: org.linphone.voip.dev gives
+ org.linphone.voip */
+string ApplePushNotificationRequest::getTopic() const {
+	const string &appId = getAppIdentifier();
+	for (const char *suffix : {".dev", ".prod"}) {
+		size_t len = strlen(suffix);
+		if (appId.size() > len && appId.compare(appId.size() - len, len, suffix) == 0)
+			return appId.substr(0, appId.size() - len);
+	}
+	return appId;
+}
+
+bool ApplePushNotificationRequest::isVoip() const {
+	string topic = getTopic();
+	return topic.size() > 5 && topic.compare(topic.size() - 5, 5, ".voip") == 0;
+}
+
 size_t ApplePushNotificationRequest::writeItem(size_t pos, Item &item){
 	size_t newSize = pos + sizeof(uint8_t) + sizeof(uint16_t) + item.mData.size();
 	uint16_t itemSize = htons((uint16_t)item.mData.size());
@@ -29,6 +29,23 @@ public:
 	virtual const std::vector<char> &getData();
 	virtual std::string isValidResponse(const std::string &str);
 	virtual bool isServerAlwaysResponding() { return false; }
+
+	// Elements of the request for the HTTP/2 API of APNs.
+	std::string getDeviceTokenHex() const;
+	std::string getTopic() const;
+	bool isVoip() const;
+	const std::string &getPayload() const { return mPayload; }
+	unsigned int getTtl() const { return mTtl; }
+	// Status and reason of the HTTP/2 response, 0 and empty until a response is received.
+	void setResponse(int status, const std::string &reason) {
+		mResponseStatus = status;
+		mResponseReason = reason;
+		// BadDeviceToken is also returned for a token of the other environment: only 410 proves it is unregistered
+		if (status == 410)
+			setFailure(InvalidToken);
+	}
+	int getResponseStatus() const { return mResponseStatus; }
+	const std::string &getResponseReason() const { return mResponseReason; }
 protected:
 	int formatDeviceToken(const std::string &deviceToken);
 	void createPushNotification();
@@ -47,6 +64,8 @@ protected:
 	std::vector<char> mDeviceToken;
 	std::string mPayload;
 	unsigned int mTtl;
+	int mResponseStatus;
+	std::string mResponseReason;
 	static uint32_t sIdentifier;
 };
 
@@ -51,5 +51,14 @@ const vector<char> &FirebasePushNotificationRequest::getData() {
 
 string FirebasePushNotificationRequest::isValidResponse(const string &str) {
 	static const char expected[] = "HTTP/1.1 200";
-	return strncmp(expected, str.c_str(), sizeof(expected) - 1) == 0 ? "" : "Unexpected HTTP response value (not 200 OK)";
+	if (strncmp(expected, str.c_str(), sizeof(expected) - 1) != 0)
+		return "Unexpected HTTP response value (not 200 OK)";
+	// the errors of the message are reported in the body of a 200 OK
+	string error = getResultError(str);
+	if (error.empty())
+		return "";
+	// InvalidRegistration may come from a mangled token, only NotRegistered proves the device is gone
+	if (error == "NotRegistered")
+		setFailure(InvalidToken);
+	return "Error reported by server: " + error;
 }
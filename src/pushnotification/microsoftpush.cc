@@ -144,6 +144,12 @@ std::string WindowsPhonePushNotificationRequest::isValidResponse ( const string
 	string line;
 	istringstream iss ( str );
 	bool valid = false, connect = false, notif = false;
+	// the channel of the device expired, or was never valid
+	if (str.compare(0, 12, "HTTP/1.1 404") == 0 || str.compare(0, 12, "HTTP/1.1 410") == 0 ||
+		str.find("X-SubscriptionStatus: Expired") != string::npos) {
+		setFailure(InvalidToken);
+		return "Channel expired";
+	}
 	while ( getline ( iss, line ) ) {
 		if ( mPushInfo.mType == "w10" ) {
 			valid |= ( line.find ( "HTTP/1.1 200 OK" ) != string::npos );
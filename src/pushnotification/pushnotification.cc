@@ -26,7 +26,7 @@ using namespace std;
 using namespace flexisip;
 
 PushNotificationRequest::PushNotificationRequest(const string &appid, const string &type)
-			: mState( NotSubmitted), mAppId(appid), mType(type) {
+			: mState( NotSubmitted), mPriority(Other), mFailure(UnspecifiedFailure), mAppId(appid), mType(type) {
 }
 
 string PushNotificationRequest::quoteStringIfNeeded(const string &str) const {
@@ -39,6 +39,17 @@ string PushNotificationRequest::quoteStringIfNeeded(const string &str) const {
 	}
 }
 
+string PushNotificationRequest::getResultError(const string &response) const {
+	// {"multicast_id":...,"success":0,"failure":1,...,"results":[{"error":"NotRegistered"}]}
+	static const char key[] = "\"error\"";
+	size_t pos = response.find(key);
+	if (pos == string::npos)
+		return "";
+	size_t begin = response.find('"', response.find(':', pos + sizeof(key) - 1));
+	size_t end = begin == string::npos ? string::npos : response.find('"', begin + 1);
+	return end == string::npos ? "unknown error" : response.substr(begin + 1, end - begin - 1);
+}
+
 string PushNotificationRequest::getPushTimeStamp() const {
 	time_t t = time(NULL);
 	struct tm time;
@@ -17,6 +17,7 @@
 */
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <memory>
@@ -56,6 +57,17 @@ class PushNotificationRequest {
 			Successful,
 			Failed
 		};
+		// Classes of the requests waiting to be sent, from the most urgent one.
+		enum Priority {
+			Call,
+			Message,
+			Other
+		};
+		// Failure reported by the server, as understood by isValidResponse().
+		enum Failure {
+			UnspecifiedFailure,
+			InvalidToken // the device token is unknown to the server or no longer valid: it must not be used anymore
+		};
 
 		virtual ~PushNotificationRequest() {};
 
@@ -74,12 +86,41 @@ class PushNotificationRequest {
 		void setState(State state){
 			mState = state;
 		}
+		Priority getPriority() const {
+			return mPriority;
+		}
+		void setPriority(Priority priority) {
+			mPriority = priority;
+		}
+		Failure getFailure() const {
+			return mFailure;
+		}
+		// Address of record and device token of the registration the request is sent for.
+		const std::string &getAor() const {
+			return mAor;
+		}
+		const std::string &getDeviceToken() const {
+			return mToken;
+		}
+		void setRegistration(const std::string &aor, const std::string &deviceToken) {
+			mAor = aor;
+			mToken = deviceToken;
+		}
 	protected:
 		PushNotificationRequest(const std::string &appid, const std::string &type);
 		std::string quoteStringIfNeeded(const std::string &str) const;
 		std::string getPushTimeStamp() const;
+		void setFailure(Failure failure) {
+			mFailure = failure;
+		}
+		// Error of the first result of a JSON response of the legacy HTTP APIs of Google, empty if none.
+		std::string getResultError(const std::string &response) const;
 	private:
-		State mState;
+		std::atomic<State> mState; // set by the threads of the clients
+		Priority mPriority;
+		Failure mFailure;
+		std::string mAor;
+		std::string mToken;
 		const std::string mAppId;
 		const std::string mType;
 
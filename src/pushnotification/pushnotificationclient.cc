@@ -17,6 +17,7 @@
 */
 
 #include "pushnotificationclient.hh"
+#include "pushnotificationengine.hh"
 
 #include <openssl/ssl.h>
 #include <openssl/bio.h>
@@ -51,6 +52,9 @@ PushNotificationClient::~PushNotificationClient() {
 	}
 }
 int PushNotificationClient::sendPush(const std::shared_ptr<PushNotificationRequest> &req) {
+	if (mService->mEngine && req->isServerAlwaysResponding()) {
+		return mService->mEngine->sendPush(this, req);
+	}
 	if (!mThreadRunning) {
 		// start thread only when we have at least one push to send
 		mThreadRunning = true;
@@ -60,7 +64,8 @@ int PushNotificationClient::sendPush(const std::shared_ptr<PushNotificationReque
 	mMutex.lock();
 
 	int size = mRequestQueue.size();
-	if (size >= mMaxQueueSize) {
+	decltype(mRequestQueue)::value_type evicted;
+	if (size >= mMaxQueueSize && !mRequestQueue.evict(req->getPriority(), evicted)) {
 		mMutex.unlock();
 		SLOGW << "PushNotificationClient " << mName << " PNR " << req.get() << " queue full, push lost";
 		onError(req, "Error queue full");
@@ -68,18 +73,24 @@ int PushNotificationClient::sendPush(const std::shared_ptr<PushNotificationReque
 		return 0;
 	} else {
 		req->setState(PushNotificationRequest::InProgress);
-		mRequestQueue.push(req);
+		size_t preempted = mRequestQueue.push(make_pair(req, chrono::steady_clock::now()), req->getPriority());
 		/*client is running, it will pop the queue as soon he is finished with current request*/
 		SLOGD << "PushNotificationClient " << mName << " PNR " << req.get() << " running, queue_size=" << size;
 
 		if (mThreadWaiting) mCondVar.notify_one();
 		mMutex.unlock();
+		mService->onRequestsPreempted(preempted);
+		if (evicted.first) {
+			SLOGW << "PushNotificationClient " << mName << " PNR " << evicted.first.get() << " queue full, push dropped for"
+				  << " PNR " << req.get();
+			onError(evicted.first, "Error queue full");
+		}
 		return 1;
 	}
 }
 
 bool PushNotificationClient::isIdle() {
-	return mThreadWaiting;
+	return mThreadWaiting && (!mService->mEngine || mService->mEngine->isIdle(this));
 }
 
 void PushNotificationClient::recreateConnection() {
@@ -227,12 +238,18 @@ void PushNotificationClient::run() {
 		if (!mRequestQueue.empty()) {
 			size_t size =  mRequestQueue.size();
 			SLOGD << "PushNotificationClient " << mName << " next, queue_size=" <<  size;
-			auto req = mRequestQueue.front();
+			auto req = mRequestQueue.front().first;
+			auto queuedAt = mRequestQueue.front().second;
 			mRequestQueue.pop();
 			lock.unlock();
 
 			// send push to the server and wait for its answer
+			auto sentAt = chrono::steady_clock::now();
+			mService->onRequestSent(*req);
 			sendPushToServer(req, size > 2);
+			mService->onRequestDone(*req, sentAt, req->getState() == PushNotificationRequest::Successful);
+			if (mService->mDeliveryTime && req->getState() == PushNotificationRequest::Successful)
+				mService->mDeliveryTime->recordDuration(chrono::steady_clock::now() - queuedAt);
 
 			lock.lock();
 		} else {
@@ -250,6 +267,9 @@ void PushNotificationClient::onError(shared_ptr<PushNotificationRequest> req, co
 	if (mService->mCountFailed) {
 		mService->mCountFailed->incr();
 	}
+	if (req->getFailure() == PushNotificationRequest::InvalidToken && mService->mInvalidTokenListener) {
+		mService->mInvalidTokenListener(req);
+	}
 }
 
 void PushNotificationClient::onSuccess(shared_ptr<PushNotificationRequest> req) {
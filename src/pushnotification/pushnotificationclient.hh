@@ -18,7 +18,7 @@
 
 #pragma once
 
-#include <queue>
+#include <chrono>
 #include <vector>
 #include <ctime>
 #include <mutex>
@@ -26,11 +26,14 @@
 
 #include <openssl/ssl.h>
 
+#include "pushnotificationqueue.hh"
 #include "pushnotificationservice.hh"
 
 namespace flexisip {
 
 class PushNotificationClient {
+	friend class PushNotificationEngine;
+
 	public:
 		PushNotificationClient(const std::string &name, PushNotificationService *service,
 			 				   SSL_CTX * ctx,
@@ -38,7 +41,7 @@ class PushNotificationClient {
 							   int maxQueueSize, bool isSecure);
 		virtual ~PushNotificationClient();
 		virtual int sendPush(const std::shared_ptr<PushNotificationRequest> &req);
-		bool isIdle();
+		virtual bool isIdle();
 		void run();
 
 	protected:
@@ -51,7 +54,9 @@ class PushNotificationClient {
 		PushNotificationService *mService;
 		BIO * mBio;
 		SSL_CTX * mCtx;
-		std::queue<std::shared_ptr<PushNotificationRequest>> mRequestQueue;
+		// Requests waiting to be sent, with the time they were queued at.
+		PushNotificationQueue<std::pair<std::shared_ptr<PushNotificationRequest>, std::chrono::steady_clock::time_point>>
+			mRequestQueue;
 		std::string mName;
 		std::string mHost, mPort;
 		int mMaxQueueSize;
@@ -0,0 +1,608 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pushnotificationclient_apns.hh"
+#include "applepush.hh"
+
+#include <flexisip/logmanager.hh>
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/ecdsa.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "cJSON.h"
+
+using namespace std;
+using namespace flexisip;
+
+static string base64UrlEncode(const unsigned char *data, size_t len) {
+	vector<unsigned char> buf(4 * ((len + 2) / 3) + 1);
+	int written = EVP_EncodeBlock(buf.data(), data, len);
+	string res;
+	for (int i = 0; i < written; ++i) {
+		char c = buf[i];
+		if (c == '=')
+			break;
+		res.push_back(c == '+' ? '-' : (c == '/' ? '_' : c));
+	}
+	return res;
+}
+
+static string base64UrlEncode(const string &str) {
+	return base64UrlEncode(reinterpret_cast<const unsigned char *>(str.data()), str.size());
+}
+
+shared_ptr<ApnsTokenSigner> ApnsTokenSigner::create(const string &keyFile, const string &keyId, const string &teamId) {
+	FILE *f = fopen(keyFile.c_str(), "r");
+	if (f == NULL) {
+		LOGE("Cannot open APNs authentication key %s: %s", keyFile.c_str(), strerror(errno));
+		return nullptr;
+	}
+	EVP_PKEY *key = PEM_read_PrivateKey(f, NULL, NULL, NULL);
+	fclose(f);
+	if (key == NULL || EVP_PKEY_base_id(key) != EVP_PKEY_EC) {
+		LOGE("%s is not an APNs authentication key (PKCS#8 elliptic curve private key)", keyFile.c_str());
+		ERR_print_errors_fp(stderr);
+		if (key)
+			EVP_PKEY_free(key);
+		return nullptr;
+	}
+	auto signer = shared_ptr<ApnsTokenSigner>(new ApnsTokenSigner(key, keyId, teamId));
+	if (signer->getToken().empty())
+		return nullptr;
+	return signer;
+}
+
+ApnsTokenSigner::ApnsTokenSigner(EVP_PKEY *key, const string &keyId, const string &teamId)
+	: mKey(key), mKeyId(keyId), mTeamId(teamId), mIssuedAt(0) {
+}
+
+ApnsTokenSigner::~ApnsTokenSigner() {
+	EVP_PKEY_free(mKey);
+}
+
+string ApnsTokenSigner::getToken() {
+	lock_guard<mutex> lock(mMutex);
+	time_t now = time(NULL);
+	if (mToken.empty() || now - mIssuedAt >= sRenewalDelay) {
+		mToken = sign(now);
+		mIssuedAt = now;
+	}
+	return mToken;
+}
+
+void ApnsTokenSigner::invalidate(const string &token) {
+	lock_guard<mutex> lock(mMutex);
+	/* another client may have renewed it already */
+	if (token == mToken)
+		mToken.clear();
+}
+
+string ApnsTokenSigner::sign(time_t issuedAt) {
+	ostringstream header, claims;
+	header << "{\"alg\":\"ES256\",\"kid\":\"" << mKeyId << "\"}";
+	claims << "{\"iss\":\"" << mTeamId << "\",\"iat\":" << issuedAt << "}";
+	string signingInput = base64UrlEncode(header.str()) + "." + base64UrlEncode(claims.str());
+
+	string token;
+	unsigned char der[128];
+	size_t derLen = sizeof(der);
+	EVP_MD_CTX *mdCtx = EVP_MD_CTX_new();
+	if (EVP_DigestSignInit(mdCtx, NULL, EVP_sha256(), NULL, mKey) == 1 &&
+		EVP_DigestSignUpdate(mdCtx, signingInput.data(), signingInput.size()) == 1 &&
+		EVP_DigestSignFinal(mdCtx, der, &derLen) == 1) {
+		/* a JWS signature is the concatenation of r and s, where OpenSSL gives a DER sequence */
+		const unsigned char *p = der;
+		ECDSA_SIG *sig = d2i_ECDSA_SIG(NULL, &p, derLen);
+		if (sig) {
+			const BIGNUM *r, *s;
+			unsigned char rs[64];
+			ECDSA_SIG_get0(sig, &r, &s);
+			if (BN_bn2binpad(r, rs, 32) == 32 && BN_bn2binpad(s, rs + 32, 32) == 32)
+				token = signingInput + "." + base64UrlEncode(rs, sizeof(rs));
+			ECDSA_SIG_free(sig);
+		}
+	}
+	EVP_MD_CTX_free(mdCtx);
+	if (token.empty()) {
+		LOGE("Cannot sign APNs authentication token with key %s", mKeyId.c_str());
+		ERR_print_errors_fp(stderr);
+	}
+	return token;
+}
+
+const int PushNotificationClientApns::sConnectTimeout = 10;
+const int PushNotificationClientApns::sResponseTimeout = 10;
+const int PushNotificationClientApns::sPingInterval = 60;
+
+PushNotificationClientApns::PushNotificationClientApns(const string &name, PushNotificationService *service,
+													   SSL_CTX *ctx, const string &host, const string &port,
+													   int maxQueueSize, const shared_ptr<ApnsTokenSigner> &signer)
+	: PushNotificationClient(name, service, ctx, host, port, maxQueueSize, true), mSigner(signer), mSocket(-1),
+	  mSsl(NULL), mSession(NULL), mGoAwayReceived(false), mPingPending(false), mLoopRunning(false),
+	  mRequestsInProgress(0) {
+	if (pipe2(mWakeUpPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+		LOGF("PushNotificationClientApns %s cannot create pipe: %s", mName.c_str(), strerror(errno));
+	}
+}
+
+PushNotificationClientApns::~PushNotificationClientApns() {
+	mQueueMutex.lock();
+	bool running = mLoopRunning;
+	mLoopRunning = false;
+	mQueueMutex.unlock();
+	if (running) {
+		wakeUp();
+		mLoopThread.join();
+	}
+	close(mWakeUpPipe[0]);
+	close(mWakeUpPipe[1]);
+}
+
+bool PushNotificationClientApns::setupSslContext(SSL_CTX *ctx) {
+	static const unsigned char alpn[] = {2, 'h', '2'};
+	SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1 |
+								 SSL_OP_NO_COMPRESSION | SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	return SSL_CTX_set_alpn_protos(ctx, alpn, sizeof(alpn)) == 0;
+}
+
+int PushNotificationClientApns::sendPush(const shared_ptr<PushNotificationRequest> &req) {
+	unique_lock<mutex> lock(mQueueMutex);
+	if (!mLoopRunning) {
+		// start thread only when we have at least one push to send
+		mLoopRunning = true;
+		mLoopThread = thread(&PushNotificationClientApns::run, this);
+	}
+	int size = mRequestQueue.size();
+	decltype(mRequestQueue)::value_type evicted;
+	if (size >= mMaxQueueSize && !mRequestQueue.evict(req->getPriority(), evicted)) {
+		lock.unlock();
+		SLOGW << "PushNotificationClientApns " << mName << " PNR " << req.get() << " queue full, push lost";
+		onError(req, "Error queue full");
+		return 0;
+	}
+	req->setState(PushNotificationRequest::InProgress);
+	size_t preempted = mRequestQueue.push(make_pair(req, chrono::steady_clock::now()), req->getPriority());
+	lock.unlock();
+	SLOGD << "PushNotificationClientApns " << mName << " PNR " << req.get() << " queued, queue_size=" << size;
+	mService->onRequestsPreempted(preempted);
+	if (evicted.first) {
+		SLOGW << "PushNotificationClientApns " << mName << " PNR " << evicted.first.get() << " queue full, push dropped"
+			  << " for PNR " << req.get();
+		onError(evicted.first, "Error queue full");
+	}
+	wakeUp();
+	return 1;
+}
+
+bool PushNotificationClientApns::isIdle() {
+	lock_guard<mutex> lock(mQueueMutex);
+	return mRequestQueue.empty() && mRequestsInProgress == 0;
+}
+
+void PushNotificationClientApns::wakeUp() {
+	char c = 0;
+	if (write(mWakeUpPipe[1], &c, 1) < 0 && errno != EAGAIN) {
+		SLOGE << "PushNotificationClientApns " << mName << " cannot wake up its thread: " << strerror(errno);
+	}
+}
+
+void PushNotificationClientApns::run() {
+	unique_lock<mutex> lock(mQueueMutex);
+	while (mLoopRunning) {
+		bool pending = !mRequestQueue.empty();
+		lock.unlock();
+
+		if (pending && mSession == NULL && !connect()) {
+			/* fail what is queued now instead of retrying in loop: new requests will try a new connection */
+			lock.lock();
+			auto failed = mRequestQueue.takeAll();
+			lock.unlock();
+			for (const auto &item : failed)
+				onError(item.first, "Cannot create connection to server");
+		}
+
+		auto now = chrono::steady_clock::now();
+		if (mSession) {
+			submitRequests();
+			if (!mStreams.empty() || mPingPending) {
+				if (now - mLastRead > chrono::seconds(sResponseTimeout))
+					disconnect("No response from server");
+			} else if (now - mLastRead > chrono::seconds(sPingInterval)) {
+				nghttp2_submit_ping(mSession, NGHTTP2_FLAG_NONE, NULL);
+				mPingPending = true;
+			}
+		}
+		if (mSession && nghttp2_session_send(mSession) != 0)
+			disconnect("Cannot send to server");
+		/* the session ends once the streams left by a GOAWAY are closed */
+		if (mSession && !nghttp2_session_want_read(mSession) && !nghttp2_session_want_write(mSession))
+			disconnect("Connection closed by server");
+
+		pollfd fds[2];
+		fds[0].fd = mWakeUpPipe[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		nfds_t nfds = 1;
+		if (mSession) {
+			fds[1].fd = mSocket;
+			fds[1].events = POLLIN | (nghttp2_session_want_write(mSession) ? POLLOUT : 0);
+			fds[1].revents = 0;
+			nfds = 2;
+		}
+		if (poll(fds, nfds, mSession ? 1000 : -1) < 0 && errno != EINTR) {
+			SLOGE << "PushNotificationClientApns " << mName << " poll error: " << strerror(errno);
+		}
+		if (fds[0].revents & POLLIN) {
+			char buf[64];
+			while (read(mWakeUpPipe[0], buf, sizeof(buf)) > 0)
+				;
+		}
+		if (mSession && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) && !readFromServer())
+			disconnect("Connection lost");
+
+		lock.lock();
+	}
+	lock.unlock();
+	disconnect("Client destroyed");
+}
+
+bool PushNotificationClientApns::connect() {
+	string hostname = mHost + ":" + mPort;
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *addresses = NULL;
+	int err = getaddrinfo(mHost.c_str(), mPort.c_str(), &hints, &addresses);
+	if (err != 0) {
+		SLOGE << "PushNotificationClientApns " << mName << " cannot resolve " << hostname << ": " << gai_strerror(err);
+		return false;
+	}
+	for (addrinfo *ai = addresses; ai != NULL && mSocket < 0; ai = ai->ai_next) {
+		mSocket = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (mSocket < 0)
+			continue;
+		/* the timeouts bound the connection and the handshake, which are blocking */
+		timeval tv = {sConnectTimeout, 0};
+		setsockopt(mSocket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		if (::connect(mSocket, ai->ai_addr, ai->ai_addrlen) != 0) {
+			close(mSocket);
+			mSocket = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	if (mSocket < 0) {
+		SLOGE << "Error attempting to connect to " << hostname << ": " << strerror(errno);
+		return false;
+	}
+	int one = 1;
+	setsockopt(mSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	const unsigned char *alpn = NULL;
+	unsigned int alpnLen = 0;
+	nghttp2_session_callbacks *callbacks;
+	nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_ENABLE_PUSH, 0}};
+
+	mSsl = SSL_new(mCtx);
+	SSL_set_fd(mSsl, mSocket);
+	/* the certificate must be issued to the server, a test server may be given by its address */
+	if (X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(mSsl), mHost.c_str()) != 1) {
+		SSL_set_tlsext_host_name(mSsl, mHost.c_str());
+		SSL_set_hostflags(mSsl, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+		if (SSL_set1_host(mSsl, mHost.c_str()) != 1) {
+			SLOGE << "Cannot set the expected name of " << hostname;
+			goto error;
+		}
+	}
+	if (SSL_connect(mSsl) != 1) {
+		SLOGE << "Error attempting to handshake to " << hostname << ": " << strerror(errno);
+		if (SSL_get_verify_result(mSsl) != X509_V_OK)
+			SLOGE << "Certificate verification error: " << X509_verify_cert_error_string(SSL_get_verify_result(mSsl));
+		ERR_print_errors_fp(stderr);
+		goto error;
+	}
+	if (SSL_get_verify_result(mSsl) != X509_V_OK) {
+		SLOGE << "Certificate verification error: " << X509_verify_cert_error_string(SSL_get_verify_result(mSsl));
+		goto error;
+	}
+	SSL_get0_alpn_selected(mSsl, &alpn, &alpnLen);
+	if (alpnLen != 2 || memcmp(alpn, "h2", 2) != 0) {
+		SLOGE << "Server " << hostname << " does not support HTTP/2";
+		goto error;
+	}
+	fcntl(mSocket, F_SETFL, fcntl(mSocket, F_GETFL) | O_NONBLOCK);
+
+	nghttp2_session_callbacks_new(&callbacks);
+	nghttp2_session_callbacks_set_send_callback(callbacks, onSend);
+	nghttp2_session_callbacks_set_on_header_callback(callbacks, onHeader);
+	nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, onDataChunk);
+	nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, onFrameReceived);
+	nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, onStreamClose);
+	nghttp2_session_client_new(&mSession, callbacks, this);
+	nghttp2_session_callbacks_del(callbacks);
+	nghttp2_submit_settings(mSession, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0]));
+
+	mLastRead = chrono::steady_clock::now();
+	mGoAwayReceived = false;
+	mPingPending = false;
+	SLOGD << "PushNotificationClientApns " << mName << " connected to " << hostname;
+	return true;
+
+error:
+	disconnect("");
+	return false;
+}
+
+void PushNotificationClientApns::disconnect(const string &reason) {
+	if (mSession) {
+		SLOGD << "PushNotificationClientApns " << mName << " closing connection: " << reason;
+		/* the session does not notify the closure of its streams when deleted */
+		nghttp2_session_del(mSession);
+		mSession = NULL;
+	}
+	auto streams = move(mStreams);
+	mStreams.clear();
+	for (auto &it : streams) {
+		onError(it.second->mRequest, reason);
+		mService->onRequestDone(*it.second->mRequest, it.second->mSentAt, false);
+		onRequestDone();
+	}
+	if (mSsl) {
+		SSL_free(mSsl);
+		mSsl = NULL;
+	}
+	if (mSocket >= 0) {
+		close(mSocket);
+		mSocket = -1;
+	}
+}
+
+bool PushNotificationClientApns::readFromServer() {
+	uint8_t buf[16384];
+	while (true) {
+		int count = SSL_read(mSsl, buf, sizeof(buf));
+		if (count <= 0) {
+			int err = SSL_get_error(mSsl, count);
+			return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+		}
+		mLastRead = chrono::steady_clock::now();
+		ssize_t ret = nghttp2_session_mem_recv(mSession, buf, count);
+		if (ret < 0) {
+			SLOGE << "PushNotificationClientApns " << mName << " invalid data from server: " << nghttp2_strerror(ret);
+			return false;
+		}
+	}
+}
+
+void PushNotificationClientApns::submitRequests() {
+	if (mGoAwayReceived)
+		return;
+	size_t maxStreams =
+		nghttp2_session_get_remote_settings(mSession, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+	vector<unique_ptr<Stream>> streams;
+	mQueueMutex.lock();
+	while (!mRequestQueue.empty() && mStreams.size() + streams.size() < maxStreams) {
+		unique_ptr<Stream> stream(new Stream());
+		stream->mRequest = mRequestQueue.front().first;
+		stream->mQueuedAt = mRequestQueue.front().second;
+		mRequestQueue.pop();
+		mRequestsInProgress++;
+		streams.push_back(move(stream));
+	}
+	mQueueMutex.unlock();
+	for (auto &stream : streams)
+		submitRequest(move(stream));
+}
+
+static nghttp2_nv makeHeader(const string &name, const string &value) {
+	nghttp2_nv nv;
+	nv.name = (uint8_t *)name.data();
+	nv.namelen = name.size();
+	nv.value = (uint8_t *)value.data();
+	nv.valuelen = value.size();
+	nv.flags = NGHTTP2_NV_FLAG_NONE;
+	return nv;
+}
+
+void PushNotificationClientApns::submitRequest(unique_ptr<Stream> stream) {
+	auto req = dynamic_pointer_cast<ApplePushNotificationRequest>(stream->mRequest);
+	if (!req) {
+		onError(stream->mRequest, "Not an Apple push notification request");
+		onRequestDone();
+		return;
+	}
+	stream->mBody = req->getPayload();
+	vector<pair<string, string>> headers = {
+		{":method", "POST"},
+		{":scheme", "https"},
+		{":authority", mHost},
+		{":path", "/3/device/" + req->getDeviceTokenHex()},
+		{"apns-topic", req->getTopic()},
+		{"apns-push-type", req->isVoip() ? "voip" : "alert"},
+		{"apns-priority", "10"},
+		{"apns-expiration", to_string(time(NULL) + req->getTtl())},
+		{"content-length", to_string(stream->mBody.size())}};
+	if (mSigner) {
+		stream->mToken = mSigner->getToken();
+		headers.emplace_back("authorization", "bearer " + stream->mToken);
+	}
+	vector<nghttp2_nv> nva;
+	for (const auto &header : headers)
+		nva.push_back(makeHeader(header.first, header.second));
+	nghttp2_data_provider body;
+	body.source.ptr = stream.get();
+	body.read_callback = onReadBody;
+
+	int32_t streamId = nghttp2_submit_request(mSession, NULL, nva.data(), nva.size(), &body, stream.get());
+	if (streamId < 0) {
+		SLOGE << "PushNotificationClientApns " << mName << " cannot submit PNR " << req.get() << ": "
+			  << nghttp2_strerror(streamId);
+		if (streamId == NGHTTP2_ERR_STREAM_ID_NOT_AVAILABLE) {
+			/* the stream ids of this connection are exhausted: open another one once the streams are closed */
+			mGoAwayReceived = true;
+			nghttp2_session_terminate_session(mSession, NGHTTP2_NO_ERROR);
+			requeue(stream->mRequest, stream->mQueuedAt);
+		} else {
+			onError(stream->mRequest, "Cannot submit request");
+			onRequestDone();
+		}
+		return;
+	}
+	SLOGD << "PushNotificationClientApns " << mName << " PNR " << req.get() << " submitted on stream " << streamId;
+	stream->mSentAt = chrono::steady_clock::now();
+	mService->onRequestSent(*req);
+	mStreams[streamId] = move(stream);
+}
+
+void PushNotificationClientApns::requeue(const shared_ptr<PushNotificationRequest> &req,
+										 chrono::steady_clock::time_point queuedAt) {
+	lock_guard<mutex> lock(mQueueMutex);
+	mRequestQueue.pushFront(make_pair(req, queuedAt), req->getPriority());
+	mRequestsInProgress--;
+}
+
+void PushNotificationClientApns::onRequestDone() {
+	lock_guard<mutex> lock(mQueueMutex);
+	mRequestsInProgress--;
+}
+
+void PushNotificationClientApns::onStreamDone(unique_ptr<Stream> stream, uint32_t errorCode) {
+	auto req = static_pointer_cast<ApplePushNotificationRequest>(stream->mRequest);
+	mService->onRequestDone(*req, stream->mSentAt, stream->mStatus != 0);
+	if (stream->mStatus == 0) {
+		if (errorCode == NGHTTP2_REFUSED_STREAM) {
+			/* not processed by the server, typically after a GOAWAY: it can be sent on a new connection */
+			SLOGD << "PushNotificationClientApns " << mName << " PNR " << req.get() << " refused, requeued";
+			requeue(req, stream->mQueuedAt);
+		} else {
+			onError(req, string("Stream closed without response: ") + nghttp2_http2_strerror(errorCode));
+			onRequestDone();
+		}
+		return;
+	}
+
+	string reason;
+	if (!stream->mResponse.empty()) {
+		cJSON *root = cJSON_Parse(stream->mResponse.c_str());
+		cJSON *item = root ? cJSON_GetObjectItem(root, "reason") : NULL;
+		if (item && item->type == cJSON_String)
+			reason = item->valuestring;
+		if (root)
+			cJSON_Delete(root);
+	}
+	req->setResponse(stream->mStatus, reason);
+	if (stream->mStatus == 200) {
+		onSuccess(req);
+		if (mService->mDeliveryTime)
+			mService->mDeliveryTime->recordDuration(chrono::steady_clock::now() - stream->mQueuedAt);
+	} else {
+		if (reason == "ExpiredProviderToken" && mSigner)
+			mSigner->invalidate(stream->mToken);
+		ostringstream msg;
+		msg << "Invalid server response: " << stream->mStatus << " " << reason;
+		onError(req, msg.str());
+	}
+	onRequestDone();
+}
+
+ssize_t PushNotificationClientApns::onSend(nghttp2_session *session, const uint8_t *data, size_t length, int flags,
+										   void *userData) {
+	auto client = static_cast<PushNotificationClientApns *>(userData);
+	ERR_clear_error();
+	int count = SSL_write(client->mSsl, data, length);
+	if (count > 0)
+		return count;
+	int err = SSL_get_error(client->mSsl, count);
+	if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+		return NGHTTP2_ERR_WOULDBLOCK;
+	return NGHTTP2_ERR_CALLBACK_FAILURE;
+}
+
+ssize_t PushNotificationClientApns::onReadBody(nghttp2_session *session, int32_t streamId, uint8_t *buf,
+											   size_t length, uint32_t *dataFlags, nghttp2_data_source *source,
+											   void *userData) {
+	auto stream = static_cast<Stream *>(source->ptr);
+	size_t count = min(length, stream->mBody.size() - stream->mSentBytes);
+	memcpy(buf, stream->mBody.data() + stream->mSentBytes, count);
+	stream->mSentBytes += count;
+	if (stream->mSentBytes == stream->mBody.size())
+		*dataFlags |= NGHTTP2_DATA_FLAG_EOF;
+	return count;
+}
+
+int PushNotificationClientApns::onHeader(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name,
+										 size_t namelen, const uint8_t *value, size_t valuelen, uint8_t flags,
+										 void *userData) {
+	auto client = static_cast<PushNotificationClientApns *>(userData);
+	if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_RESPONSE)
+		return 0;
+	auto it = client->mStreams.find(frame->hd.stream_id);
+	if (it != client->mStreams.end() && namelen == 7 && memcmp(name, ":status", 7) == 0)
+		it->second->mStatus = atoi(string((const char *)value, valuelen).c_str());
+	return 0;
+}
+
+int PushNotificationClientApns::onDataChunk(nghttp2_session *session, uint8_t flags, int32_t streamId,
+											const uint8_t *data, size_t len, void *userData) {
+	auto client = static_cast<PushNotificationClientApns *>(userData);
+	auto it = client->mStreams.find(streamId);
+	if (it != client->mStreams.end())
+		it->second->mResponse.append((const char *)data, len);
+	return 0;
+}
+
+int PushNotificationClientApns::onFrameReceived(nghttp2_session *session, const nghttp2_frame *frame,
+												void *userData) {
+	auto client = static_cast<PushNotificationClientApns *>(userData);
+	if (frame->hd.type == NGHTTP2_GOAWAY) {
+		SLOGD << "PushNotificationClientApns " << client->mName << " GOAWAY received, last stream "
+			  << frame->goaway.last_stream_id << ", error " << nghttp2_http2_strerror(frame->goaway.error_code);
+		client->mGoAwayReceived = true;
+	} else if (frame->hd.type == NGHTTP2_PING && (frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+		client->mPingPending = false;
+	}
+	return 0;
+}
+
+int PushNotificationClientApns::onStreamClose(nghttp2_session *session, int32_t streamId, uint32_t errorCode,
+											  void *userData) {
+	auto client = static_cast<PushNotificationClientApns *>(userData);
+	auto it = client->mStreams.find(streamId);
+	if (it == client->mStreams.end())
+		return 0;
+	unique_ptr<Stream> stream = move(it->second);
+	client->mStreams.erase(it);
+	client->onStreamDone(move(stream), errorCode);
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "pushnotificationclient.hh"
+
+#include <map>
+#include <memory>
+
+#include <nghttp2/nghttp2.h>
+#include <openssl/evp.h>
+
+namespace flexisip {
+
+/*
+ * Provider authentication tokens of the APNs HTTP/2 API: JSON Web Tokens signed with ES256 by a .p8 key.
+ * A token is renewed when it gets older than sRenewalDelay. It can be shared by several clients.
+ */
+class ApnsTokenSigner {
+	public:
+		static std::shared_ptr<ApnsTokenSigner> create(const std::string &keyFile, const std::string &keyId,
+													   const std::string &teamId);
+		~ApnsTokenSigner();
+		std::string getToken();
+		// Forces the renewal of the token, when the server reports it as expired.
+		void invalidate(const std::string &token);
+
+	private:
+		ApnsTokenSigner(EVP_PKEY *key, const std::string &keyId, const std::string &teamId);
+		std::string sign(time_t issuedAt);
+
+		static const int sRenewalDelay = 3000; /* Apple rejects tokens older than one hour */
+		EVP_PKEY *mKey;
+		std::string mKeyId, mTeamId;
+		std::mutex mMutex;
+		std::string mToken;
+		time_t mIssuedAt;
+};
+
+/*
+ * Client of the HTTP/2 API of the Apple Push Notification service. The notifications are sent as concurrent streams of
+ * a single TLS connection, up to the limit announced by the server, and the status of each stream gives the outcome
+ * of its request. Authentication uses the client certificate of the SSL_CTX, or the tokens of an ApnsTokenSigner.
+ */
+class PushNotificationClientApns : public PushNotificationClient {
+	public:
+		PushNotificationClientApns(const std::string &name, PushNotificationService *service, SSL_CTX *ctx,
+								   const std::string &host, const std::string &port, int maxQueueSize,
+								   const std::shared_ptr<ApnsTokenSigner> &signer = nullptr);
+		virtual ~PushNotificationClientApns();
+
+		virtual int sendPush(const std::shared_ptr<PushNotificationRequest> &req);
+		virtual bool isIdle();
+
+		// Sets the protocol negotiation of the HTTP/2 API on a context.
+		static bool setupSslContext(SSL_CTX *ctx);
+
+	private:
+		struct Stream {
+			std::shared_ptr<PushNotificationRequest> mRequest;
+			std::chrono::steady_clock::time_point mQueuedAt;
+			std::chrono::steady_clock::time_point mSentAt;
+			std::string mToken;
+			std::string mBody;
+			size_t mSentBytes = 0;
+			int mStatus = 0;
+			std::string mResponse;
+		};
+
+		void run();
+		bool connect();
+		void disconnect(const std::string &reason);
+		bool readFromServer();
+		void submitRequests();
+		void submitRequest(std::unique_ptr<Stream> stream);
+		void requeue(const std::shared_ptr<PushNotificationRequest> &req, std::chrono::steady_clock::time_point queuedAt);
+		void onStreamDone(std::unique_ptr<Stream> stream, uint32_t errorCode);
+		void onRequestDone();
+		void wakeUp();
+
+		static ssize_t onSend(nghttp2_session *session, const uint8_t *data, size_t length, int flags, void *userData);
+		static ssize_t onReadBody(nghttp2_session *session, int32_t streamId, uint8_t *buf, size_t length,
+								  uint32_t *dataFlags, nghttp2_data_source *source, void *userData);
+		static int onHeader(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
+							const uint8_t *value, size_t valuelen, uint8_t flags, void *userData);
+		static int onDataChunk(nghttp2_session *session, uint8_t flags, int32_t streamId, const uint8_t *data,
+							   size_t len, void *userData);
+		static int onFrameReceived(nghttp2_session *session, const nghttp2_frame *frame, void *userData);
+		static int onStreamClose(nghttp2_session *session, int32_t streamId, uint32_t errorCode, void *userData);
+
+		static const int sConnectTimeout; /* seconds */
+		static const int sResponseTimeout; /* seconds without data from the server while waiting for it */
+		static const int sPingInterval; /* seconds of inactivity before checking the connection */
+
+		std::shared_ptr<ApnsTokenSigner> mSigner;
+		int mSocket;
+		SSL *mSsl;
+		nghttp2_session *mSession;
+		std::map<int32_t, std::unique_ptr<Stream>> mStreams;
+		std::chrono::steady_clock::time_point mLastRead;
+		bool mGoAwayReceived;
+		bool mPingPending;
+		int mWakeUpPipe[2];
+
+		/* the queue of the base class and the following are shared with the callers of sendPush() */
+		std::thread mLoopThread;
+		std::mutex mQueueMutex;
+		bool mLoopRunning;
+		size_t mRequestsInProgress; /* taken from the queue and not answered yet */
+};
+
+}
@@ -0,0 +1,791 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "flexisip-config.h"
+#include "pushnotificationengine.hh"
+#include "pushnotificationclient.hh"
+
+#include <flexisip/logmanager.hh>
+
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#include <openssl/err.h>
+
+using namespace std;
+using namespace flexisip;
+
+static const size_t sMaxHeaderSize = 16384;
+
+static bool headerEquals(const string &line, size_t nameLen, const char *name) {
+	return nameLen == strlen(name) && strncasecmp(line.c_str(), name, nameLen) == 0;
+}
+
+static string headerValue(const string &line, size_t colon) {
+	size_t start = line.find_first_not_of(" \t", colon + 1);
+	return start == string::npos ? "" : line.substr(start);
+}
+
+HttpResponseParser::Result HttpResponseParser::parse(string &input, bool closedByServer, Response &response) {
+	while (true) {
+		size_t headerEnd = input.find("\r\n\r\n");
+		if (headerEnd == string::npos)
+			return input.size() <= sMaxHeaderSize ? Incomplete : Invalid;
+		size_t bodyStart = headerEnd + 4;
+		int status = 0;
+		if (input.compare(0, 5, "HTTP/") != 0 || sscanf(input.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+			return Invalid;
+		bool keepAlive = input.compare(0, 8, "HTTP/1.0") != 0;
+		bool chunked = false;
+		long contentLength = -1;
+		size_t pos = input.find("\r\n") + 2;
+		while (pos < headerEnd + 2) {
+			size_t eol = input.find("\r\n", pos);
+			string line = input.substr(pos, eol - pos);
+			pos = eol + 2;
+			size_t colon = line.find(':');
+			if (colon == string::npos)
+				continue;
+			if (headerEquals(line, colon, "Content-Length")) {
+				contentLength = atol(headerValue(line, colon).c_str());
+			} else if (headerEquals(line, colon, "Transfer-Encoding")) {
+				chunked = strcasestr(line.c_str() + colon, "chunked") != NULL;
+			} else if (headerEquals(line, colon, "Connection")) {
+				string value = headerValue(line, colon);
+				if (strcasecmp(value.c_str(), "close") == 0)
+					keepAlive = false;
+				else if (strcasecmp(value.c_str(), "keep-alive") == 0)
+					keepAlive = true;
+			}
+		}
+		if (status >= 100 && status < 200) {
+			/* interim response */
+			input.erase(0, bodyStart);
+			continue;
+		}
+
+		string body;
+		size_t end;
+		if (chunked) {
+			pos = bodyStart;
+			while (true) {
+				size_t eol = input.find("\r\n", pos);
+				if (eol == string::npos)
+					return Incomplete;
+				size_t chunkSize = strtoul(input.c_str() + pos, NULL, 16);
+				pos = eol + 2;
+				if (chunkSize == 0) {
+					/* optional trailers, then an empty line */
+					end = input.compare(pos, 2, "\r\n") == 0 ? pos + 2 : input.find("\r\n\r\n", pos);
+					if (end == string::npos)
+						return Incomplete;
+					if (end != pos + 2)
+						end += 4;
+					break;
+				}
+				if (input.size() < pos + chunkSize + 2)
+					return Incomplete;
+				body.append(input, pos, chunkSize);
+				pos += chunkSize + 2;
+			}
+		} else if (contentLength >= 0) {
+			if (input.size() < bodyStart + contentLength)
+				return Incomplete;
+			body = input.substr(bodyStart, contentLength);
+			end = bodyStart + contentLength;
+		} else if (status == 204 || status == 304) {
+			end = bodyStart;
+		} else {
+			/* delimited by the end of the connection */
+			if (!closedByServer)
+				return Incomplete;
+			body = input.substr(bodyStart);
+			end = input.size();
+			keepAlive = false;
+		}
+
+		response.mStatus = status;
+		response.mMessage = input.substr(0, bodyStart) + body;
+		response.mKeepAlive = keepAlive;
+		input.erase(0, end);
+		return Complete;
+	}
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+const int PushNotificationEngine::sConnectTimeout = 10;
+const int PushNotificationEngine::sResponseTimeout = 10;
+const int PushNotificationEngine::sIdleTimeout = 60;
+const int PushNotificationEngine::sResolveInterval = 60;
+
+PushNotificationEngine::PushNotificationEngine(int connectionsPerProvider, int pipeliningDepth)
+	: mConnectionsPerProvider(max(connectionsPerProvider, 1)), mPipeliningDepth(max(pipeliningDepth, 1)),
+	  mEpollFd(-1), mRunning(false) {
+	mWakeUpPipe[0] = mWakeUpPipe[1] = -1;
+}
+
+PushNotificationEngine::~PushNotificationEngine() {
+	mMutex.lock();
+	bool running = mRunning;
+	mRunning = false;
+	mMutex.unlock();
+	if (running) {
+		wakeUp();
+		mThread.join();
+	}
+	/* waits for the pending resolutions, which wake the engine up when done */
+	mProviders.clear();
+	for (int fd : {mEpollFd, mWakeUpPipe[0], mWakeUpPipe[1]}) {
+		if (fd != -1)
+			close(fd);
+	}
+}
+
+bool PushNotificationEngine::start() {
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (mEpollFd == -1 || pipe2(mWakeUpPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+		LOGE("PushNotificationEngine cannot be started: %s", strerror(errno));
+		return false;
+	}
+	struct epoll_event ev = {0};
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; /* designates the wake up pipe */
+	if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeUpPipe[0], &ev) == -1) {
+		LOGE("PushNotificationEngine cannot watch its pipe: %s", strerror(errno));
+		return false;
+	}
+	mRunning = true;
+	mThread = thread(&PushNotificationEngine::run, this);
+	return true;
+}
+
+int PushNotificationEngine::sendPush(PushNotificationClient *client, const shared_ptr<PushNotificationRequest> &req) {
+	unique_lock<mutex> lock(mMutex);
+	auto &provider = mProviders[client];
+	if (!provider) {
+		provider.reset(new Provider());
+		provider->mClient = client;
+		provider->mInFlight = 0;
+		provider->mPreferredAddress = 0;
+	}
+	size_t size = provider->mQueue.size();
+	Request evicted;
+	if (size >= (size_t)client->mMaxQueueSize && !provider->mQueue.evict(req->getPriority(), evicted)) {
+		lock.unlock();
+		SLOGW << "PushNotificationEngine " << client->mName << " PNR " << req.get() << " queue full, push lost";
+		client->onError(req, "Error queue full");
+		return 0;
+	}
+	req->setState(PushNotificationRequest::InProgress);
+	Request request;
+	request.mRequest = req;
+	request.mQueuedAt = chrono::steady_clock::now();
+	request.mEndOffset = 0;
+	size_t preempted = provider->mQueue.push(request, req->getPriority());
+	lock.unlock();
+	SLOGD << "PushNotificationEngine " << client->mName << " PNR " << req.get() << " queued, queue_size=" << size;
+	client->mService->onRequestsPreempted(preempted);
+	if (evicted.mRequest) {
+		SLOGW << "PushNotificationEngine " << client->mName << " PNR " << evicted.mRequest.get()
+			  << " queue full, push dropped for PNR " << req.get();
+		client->onError(evicted.mRequest, "Error queue full");
+	}
+	wakeUp();
+	return 1;
+}
+
+bool PushNotificationEngine::isIdle(PushNotificationClient *client) {
+	lock_guard<mutex> lock(mMutex);
+	auto it = mProviders.find(client);
+	return it == mProviders.end() || (it->second->mQueue.empty() && it->second->mInFlight == 0);
+}
+
+void PushNotificationEngine::wakeUp() {
+	if (write(mWakeUpPipe[1], "e", 1) == -1 && errno != EAGAIN)
+		LOGE("PushNotificationEngine: fail to write to wake up pipe.");
+}
+
+void PushNotificationEngine::run() {
+	struct epoll_event events[64];
+	vector<Provider *> providers;
+	while (true) {
+		providers.clear();
+		mMutex.lock();
+		bool running = mRunning;
+		/* providers are never removed: they can be used without the lock once listed */
+		for (auto &it : mProviders)
+			providers.push_back(it.second.get());
+		mMutex.unlock();
+		if (!running)
+			break;
+
+		for (Provider *provider : providers)
+			dispatch(*provider);
+		checkTimeouts();
+
+		int count = epoll_wait(mEpollFd, events, sizeof(events) / sizeof(events[0]), 1000);
+		if (count == -1 && errno != EINTR)
+			LOGE("PushNotificationEngine: epoll_wait() failed: %s", strerror(errno));
+		for (int i = 0; i < count; ++i) {
+			if (events[i].data.ptr == NULL) {
+				char buf[64];
+				while (read(mWakeUpPipe[0], buf, sizeof(buf)) > 0)
+					;
+			} else {
+				onConnectionEvent(*static_cast<Connection *>(events[i].data.ptr), events[i].events);
+			}
+		}
+
+		/* closed connections are released once no event can refer to them anymore */
+		for (Provider *provider : providers) {
+			auto &conns = provider->mConnections;
+			conns.erase(remove_if(conns.begin(), conns.end(),
+								  [](const unique_ptr<Connection> &conn) { return conn->mState == Connection::Closed; }),
+						conns.end());
+		}
+	}
+	for (Provider *provider : providers) {
+		for (auto &conn : provider->mConnections)
+			closeConnection(*conn, "Push notification engine stopped");
+		provider->mConnections.clear();
+	}
+}
+
+/* assign the queued requests of a provider to its ready connections, opening new ones if needed */
+void PushNotificationEngine::dispatch(Provider &provider) {
+	auto now = chrono::steady_clock::now();
+	while (true) {
+		Connection *target = NULL;
+		int opening = 0;
+		for (auto &conn : provider.mConnections) {
+			if (conn->mState == Connection::Connecting || conn->mState == Connection::Handshaking) {
+				opening++;
+			} else if (conn->mState == Connection::Ready && !conn->mCloseAfterResponse &&
+					   conn->mRequests.size() < (size_t)mPipeliningDepth &&
+					   (target == NULL || conn->mRequests.size() < target->mRequests.size())) {
+				target = conn.get();
+			}
+		}
+
+		mMutex.lock();
+		size_t queued = provider.mQueue.size();
+		if (queued == 0 || target == NULL) {
+			mMutex.unlock();
+			if (queued > (size_t)opening * mPipeliningDepth &&
+				provider.mConnections.size() < (size_t)mConnectionsPerProvider) {
+				/* the requests wait for the resolution of the server, if any is pending */
+				if (openConnection(provider) == NULL && provider.mConnections.empty() &&
+					!provider.mResolution.valid()) {
+					mMutex.lock();
+					deque<Request> failed = provider.mQueue.takeAll();
+					mMutex.unlock();
+					for (auto &req : failed)
+						provider.mClient->onError(req.mRequest, "Cannot create connection to server");
+				}
+			}
+			break;
+		}
+		Request req = provider.mQueue.front();
+		provider.mQueue.pop();
+		provider.mInFlight++;
+		mMutex.unlock();
+
+		const vector<char> &data = req.mRequest->getData();
+		if (target->mRequests.empty())
+			target->mLastActivity = now; /* the response timeout starts now */
+		target->mOutput.append(data.data(), data.size());
+		req.mSentAt = now;
+		req.mEndOffset = target->mWrittenBytes + target->mOutput.size() - target->mOutputOffset;
+		target->mRequests.push_back(req);
+		provider.mClient->mService->onRequestSent(*req.mRequest);
+		SLOGD << "PushNotificationEngine " << provider.mClient->mName << " PNR " << req.mRequest.get()
+			  << " sent on connection " << target << ", " << target->mRequests.size() << " in flight";
+	}
+
+	for (auto &conn : provider.mConnections) {
+		if (conn->mState == Connection::Ready && conn->mOutputOffset < conn->mOutput.size() && !conn->mWantWrite) {
+			if (!writeToServer(*conn))
+				closeConnection(*conn, "Cannot send to server");
+			else
+				updateEvents(*conn);
+		}
+	}
+}
+
+/*
+ * Tells whether addresses of the server are known. They are resolved again from time to time, off the engine thread:
+ * the previous ones are used meanwhile, if any.
+ */
+bool PushNotificationEngine::resolve(Provider &provider) {
+	auto now = chrono::steady_clock::now();
+	bool failed = false;
+	if (provider.mResolution.valid() && provider.mResolution.wait_for(chrono::seconds(0)) == future_status::ready) {
+		vector<Address> addresses = provider.mResolution.get();
+		failed = addresses.empty();
+		if (!failed) {
+			provider.mAddresses = move(addresses);
+			provider.mPreferredAddress = 0;
+		}
+		provider.mResolvedAt = now;
+	}
+	if (!failed && !provider.mResolution.valid() &&
+		(provider.mAddresses.empty() || now - provider.mResolvedAt >= chrono::seconds(sResolveInterval))) {
+		PushNotificationClient *client = provider.mClient;
+		string name = client->mName, host = client->mHost, port = client->mPort;
+		provider.mResolution = async(launch::async, [this, name, host, port]() {
+			vector<Address> addresses = resolveServer(name, host, port);
+			wakeUp();
+			return addresses;
+		});
+	}
+	return !provider.mAddresses.empty();
+}
+
+vector<PushNotificationEngine::Address> PushNotificationEngine::resolveServer(const string &name, const string &host,
+																			  const string &port) {
+	vector<Address> addresses;
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *res = NULL;
+	int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+	if (err != 0) {
+		SLOGE << "PushNotificationEngine " << name << " cannot resolve " << host << ": " << gai_strerror(err);
+		return addresses;
+	}
+	for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+		Address address;
+		memcpy(&address.mAddress, ai->ai_addr, ai->ai_addrlen);
+		address.mLength = ai->ai_addrlen;
+		addresses.push_back(address);
+	}
+	freeaddrinfo(res);
+	return addresses;
+}
+
+/* connect to the server, trying its addresses from the preferred one, after the given number of attempts */
+PushNotificationEngine::Connection *PushNotificationEngine::openConnection(Provider &provider, size_t attempt) {
+	PushNotificationClient *client = provider.mClient;
+	if (!resolve(provider))
+		return NULL;
+	int fd = -1;
+	size_t index = 0;
+	for (; attempt < provider.mAddresses.size(); ++attempt) {
+		index = (provider.mPreferredAddress + attempt) % provider.mAddresses.size();
+		const Address &address = provider.mAddresses[index];
+		fd = socket(address.mAddress.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd == -1) {
+			SLOGE << "PushNotificationEngine " << client->mName << " cannot create socket: " << strerror(errno);
+			continue;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (connect(fd, (const struct sockaddr *)&address.mAddress, address.mLength) == -1 && errno != EINPROGRESS) {
+			SLOGE << "Error attempting to connect to " << client->mHost << ":" << client->mPort << ": "
+				  << strerror(errno);
+			close(fd);
+			fd = -1;
+			continue;
+		}
+		break;
+	}
+	if (fd == -1)
+		return NULL;
+
+	unique_ptr<Connection> conn(new Connection());
+	conn->mProvider = &provider;
+	conn->mState = Connection::Connecting;
+	conn->mAttempt = attempt;
+	conn->mAddressIndex = index;
+	conn->mSocket = fd;
+	conn->mSsl = NULL;
+	conn->mOutputOffset = 0;
+	conn->mWrittenBytes = 0;
+	conn->mCloseAfterResponse = false;
+	conn->mWantWrite = true; /* the end of the connection is notified by EPOLLOUT */
+	conn->mLastActivity = chrono::steady_clock::now();
+
+	struct epoll_event ev = {0};
+	ev.events = EPOLLOUT;
+	ev.data.ptr = conn.get();
+	if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		SLOGE << "PushNotificationEngine cannot watch socket " << fd << ": " << strerror(errno);
+		close(fd);
+		return NULL;
+	}
+	SLOGD << "PushNotificationEngine " << client->mName << " connecting to " << client->mHost << ":" << client->mPort
+		  << ", connection " << conn.get();
+	provider.mConnections.push_back(move(conn));
+	return provider.mConnections.back().get();
+}
+
+void PushNotificationEngine::closeConnection(Connection &conn, const string &reason) {
+	if (conn.mState == Connection::Closed)
+		return;
+	Provider &provider = *conn.mProvider;
+	PushNotificationClient *client = provider.mClient;
+	SLOGD << "PushNotificationEngine " << client->mName << " closing connection " << &conn << ": " << reason;
+	bool wasReady = conn.mState == Connection::Ready;
+	struct epoll_event ev = {0}; /* a non-NULL event is required by kernels older than 2.6.9*/
+	epoll_ctl(mEpollFd, EPOLL_CTL_DEL, conn.mSocket, &ev);
+	if (conn.mSsl)
+		SSL_free(conn.mSsl);
+	close(conn.mSocket);
+	conn.mSsl = NULL;
+	conn.mSocket = -1;
+	conn.mState = Connection::Closed;
+
+	/* the requests that were not completely written cannot have been processed: they can be sent again */
+	deque<Request> unsent;
+	for (auto &req : conn.mRequests) {
+		if (req.mEndOffset > conn.mWrittenBytes) {
+			unsent.push_back(req);
+		} else {
+			client->onError(req.mRequest, reason);
+			onRequestDone(provider, req, false);
+		}
+	}
+	conn.mRequests.clear();
+	requeue(provider, unsent);
+
+	if (!wasReady) {
+		/* do not retry in loop when the server cannot be reached */
+		bool otherConnection = false;
+		for (auto &other : provider.mConnections)
+			otherConnection |= other->mState != Connection::Closed;
+		if (!otherConnection) {
+			mMutex.lock();
+			deque<Request> failed = provider.mQueue.takeAll();
+			mMutex.unlock();
+			for (auto &req : failed)
+				client->onError(req.mRequest, "Cannot create connection to server");
+		}
+	}
+}
+
+/* a connection that cannot be established is replaced by one to the next address of the server, if any */
+void PushNotificationEngine::retryConnection(Connection &conn, const string &reason) {
+	Provider &provider = *conn.mProvider;
+	if (conn.mAttempt + 1 < provider.mAddresses.size())
+		openConnection(provider, conn.mAttempt + 1);
+	closeConnection(conn, reason);
+}
+
+void PushNotificationEngine::requeue(Provider &provider, deque<Request> &requests) {
+	if (requests.empty())
+		return;
+	for (auto &req : requests)
+		provider.mClient->mService->onRequestDone(*req.mRequest, req.mSentAt, false);
+	lock_guard<mutex> lock(mMutex);
+	for (auto it = requests.rbegin(); it != requests.rend(); ++it)
+		provider.mQueue.pushFront(*it, it->mRequest->getPriority());
+	provider.mInFlight -= requests.size();
+}
+
+void PushNotificationEngine::onRequestDone(Provider &provider, const Request &req, bool answered) {
+	provider.mClient->mService->onRequestDone(*req.mRequest, req.mSentAt, answered);
+	lock_guard<mutex> lock(mMutex);
+	provider.mInFlight--;
+}
+
+void PushNotificationEngine::updateEvents(Connection &conn) {
+	if (conn.mState == Connection::Closed)
+		return;
+	struct epoll_event ev = {0};
+	if (conn.mState == Connection::Connecting)
+		ev.events = EPOLLOUT;
+	else
+		ev.events = EPOLLIN | (conn.mWantWrite ? EPOLLOUT : 0);
+	ev.data.ptr = &conn;
+	epoll_ctl(mEpollFd, EPOLL_CTL_MOD, conn.mSocket, &ev);
+}
+
+void PushNotificationEngine::checkTimeouts() {
+	auto now = chrono::steady_clock::now();
+	mMutex.lock();
+	vector<Provider *> providers;
+	for (auto &it : mProviders)
+		providers.push_back(it.second.get());
+	mMutex.unlock();
+	for (Provider *provider : providers) {
+		/* by index: a connection may be opened to replace a failed one */
+		for (size_t i = 0; i < provider->mConnections.size(); ++i) {
+			Connection *conn = provider->mConnections[i].get();
+			auto inactivity = now - conn->mLastActivity;
+			switch (conn->mState) {
+				case Connection::Connecting:
+					if (inactivity > chrono::seconds(sConnectTimeout))
+						retryConnection(*conn, "Connection timeout");
+					break;
+				case Connection::Handshaking:
+					if (inactivity > chrono::seconds(sConnectTimeout))
+						closeConnection(*conn, "Connection timeout");
+					break;
+				case Connection::Ready:
+					if (!conn->mRequests.empty() && inactivity > chrono::seconds(sResponseTimeout))
+						closeConnection(*conn, "No response from server");
+					else if (conn->mRequests.empty() && inactivity > chrono::seconds(sIdleTimeout))
+						closeConnection(*conn, "Connection unused");
+					break;
+				case Connection::Closed:
+					break;
+			}
+		}
+	}
+}
+
+void PushNotificationEngine::onConnectionEvent(Connection &conn, uint32_t events) {
+	if (conn.mState == Connection::Closed)
+		return;
+	if (conn.mState == Connection::Connecting) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if (getsockopt(conn.mSocket, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+			error = errno;
+		if (error != 0) {
+			PushNotificationClient *client = conn.mProvider->mClient;
+			SLOGE << "Error attempting to connect to " << client->mHost << ":" << client->mPort << ": "
+				  << strerror(error);
+			retryConnection(conn, "Cannot create connection to server");
+			return;
+		}
+		conn.mProvider->mPreferredAddress = conn.mAddressIndex;
+		if (conn.mProvider->mClient->mIsSecure) {
+			if (!startHandshake(conn)) {
+				closeConnection(conn, "Cannot create connection to server");
+				return;
+			}
+		} else {
+			conn.mState = Connection::Ready;
+			conn.mWantWrite = false;
+		}
+	} else if (conn.mState == Connection::Handshaking) {
+		if (!continueHandshake(conn)) {
+			closeConnection(conn, "Cannot create connection to server");
+			return;
+		}
+	} else {
+		if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+			bool closedByServer = false;
+			bool readOk = readFromServer(conn, closedByServer);
+			/* the responses received before an error are still processed */
+			if (!parseResponses(conn, closedByServer || !readOk) || !readOk) {
+				closeConnection(conn, "Connection lost");
+				return;
+			}
+			if (closedByServer || (conn.mCloseAfterResponse && conn.mRequests.empty())) {
+				closeConnection(conn, "Connection closed by server");
+				return;
+			}
+		}
+		if ((events & EPOLLOUT) && !writeToServer(conn)) {
+			closeConnection(conn, "Cannot send to server");
+			return;
+		}
+	}
+	updateEvents(conn);
+}
+
+bool PushNotificationEngine::startHandshake(Connection &conn) {
+	PushNotificationClient *client = conn.mProvider->mClient;
+	conn.mSsl = SSL_new(client->mCtx);
+	if (conn.mSsl == NULL) {
+		ERR_print_errors_fp(stderr);
+		return false;
+	}
+	SSL_set_fd(conn.mSsl, conn.mSocket);
+	SSL_set_tlsext_host_name(conn.mSsl, client->mHost.c_str());
+	SSL_set_mode(conn.mSsl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_set_options(conn.mSsl, SSL_OP_ALL);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	/* servers often close their keep-alive connections without notification */
+	SSL_set_options(conn.mSsl, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	conn.mState = Connection::Handshaking;
+	return continueHandshake(conn);
+}
+
+bool PushNotificationEngine::continueHandshake(Connection &conn) {
+	PushNotificationClient *client = conn.mProvider->mClient;
+	ERR_clear_error();
+	int ret = SSL_connect(conn.mSsl);
+	if (ret != 1) {
+		int err = SSL_get_error(conn.mSsl, ret);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+			conn.mWantWrite = err == SSL_ERROR_WANT_WRITE;
+			return true;
+		}
+		SLOGE << "Error attempting to handshake to " << client->mHost << ":" << client->mPort << ": " << err;
+		ERR_print_errors_fp(stderr);
+		return false;
+	}
+	if (SSL_get_verify_mode(conn.mSsl) == SSL_VERIFY_PEER && SSL_get_verify_result(conn.mSsl) != X509_V_OK) {
+		SLOGE << "Certificate verification error: " << X509_verify_cert_error_string(SSL_get_verify_result(conn.mSsl));
+		return false;
+	}
+	SLOGD << "PushNotificationEngine " << client->mName << " connection " << &conn << " ready";
+	conn.mState = Connection::Ready;
+	conn.mWantWrite = false;
+	return true;
+}
+
+bool PushNotificationEngine::writeToServer(Connection &conn) {
+	while (conn.mOutputOffset < conn.mOutput.size()) {
+		const char *data = conn.mOutput.data() + conn.mOutputOffset;
+		size_t size = conn.mOutput.size() - conn.mOutputOffset;
+		ssize_t count;
+		if (conn.mSsl) {
+			ERR_clear_error();
+			count = SSL_write(conn.mSsl, data, size);
+			if (count <= 0) {
+				int err = SSL_get_error(conn.mSsl, count);
+				if (err != SSL_ERROR_WANT_WRITE && err != SSL_ERROR_WANT_READ)
+					return false;
+				conn.mWantWrite = true;
+				return true;
+			}
+		} else {
+			count = send(conn.mSocket, data, size, MSG_NOSIGNAL);
+			if (count < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					return false;
+				conn.mWantWrite = true;
+				return true;
+			}
+		}
+		conn.mOutputOffset += count;
+		conn.mWrittenBytes += count;
+	}
+	conn.mOutput.clear();
+	conn.mOutputOffset = 0;
+	conn.mWantWrite = false;
+	return true;
+}
+
+bool PushNotificationEngine::readFromServer(Connection &conn, bool &closedByServer) {
+	char buf[16384];
+	while (true) {
+		ssize_t count;
+		if (conn.mSsl) {
+			ERR_clear_error();
+			count = SSL_read(conn.mSsl, buf, sizeof(buf));
+			if (count <= 0) {
+				int err = SSL_get_error(conn.mSsl, count);
+				if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+					return true;
+				if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && count == 0)) {
+					closedByServer = true;
+					return true;
+				}
+				return false;
+			}
+		} else {
+			count = recv(conn.mSocket, buf, sizeof(buf), 0);
+			if (count == 0) {
+				closedByServer = true;
+				return true;
+			} else if (count < 0) {
+				return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+			}
+		}
+		conn.mInput.append(buf, count);
+		conn.mLastActivity = chrono::steady_clock::now();
+	}
+}
+
+/* extract the complete HTTP/1.1 responses received on a connection, and match them with its requests in order */
+bool PushNotificationEngine::parseResponses(Connection &conn, bool closedByServer) {
+	while (!conn.mInput.empty()) {
+		HttpResponseParser::Response response;
+		HttpResponseParser::Result result = HttpResponseParser::parse(conn.mInput, closedByServer, response);
+		if (result == HttpResponseParser::Incomplete)
+			return true;
+		if (result == HttpResponseParser::Invalid) {
+			SLOGE << "PushNotificationEngine " << conn.mProvider->mClient->mName << " invalid response from server";
+			return false;
+		}
+		if (conn.mRequests.empty()) {
+			SLOGE << "PushNotificationEngine " << conn.mProvider->mClient->mName << " unexpected response from server";
+			return false;
+		}
+		onResponse(conn, response.mMessage);
+		if (!response.mKeepAlive) {
+			/* the server does not process the requests that follow on this connection */
+			conn.mCloseAfterResponse = true;
+			requeue(*conn.mProvider, conn.mRequests);
+			conn.mRequests.clear();
+			conn.mInput.clear();
+		}
+	}
+	return true;
+}
+
+void PushNotificationEngine::onResponse(Connection &conn, const string &response) {
+	Provider &provider = *conn.mProvider;
+	PushNotificationClient *client = provider.mClient;
+	Request req = conn.mRequests.front();
+	conn.mRequests.pop_front();
+	SLOGD << "PushNotificationEngine " << client->mName << " PNR " << req.mRequest.get() << " read "
+		  << response.size() << " data:\n" << response;
+	string error = req.mRequest->isValidResponse(response);
+	if (!error.empty()) {
+		client->onError(req.mRequest, "Invalid server response: " + error);
+	} else {
+		client->onSuccess(req.mRequest);
+		if (client->mService->mDeliveryTime)
+			client->mService->mDeliveryTime->recordDuration(chrono::steady_clock::now() - req.mQueuedAt);
+	}
+	onRequestDone(provider, req, true);
+}
+
+#else
+
+PushNotificationEngine::PushNotificationEngine(int connectionsPerProvider, int pipeliningDepth)
+	: mConnectionsPerProvider(connectionsPerProvider), mPipeliningDepth(pipeliningDepth), mEpollFd(-1),
+	  mRunning(false) {
+}
+
+PushNotificationEngine::~PushNotificationEngine() {
+}
+
+bool PushNotificationEngine::start() {
+	LOGW("PushNotificationEngine requires epoll, the push notification clients use their own threads.");
+	return false;
+}
+
+int PushNotificationEngine::sendPush(PushNotificationClient *client, const shared_ptr<PushNotificationRequest> &req) {
+	return 0;
+}
+
+bool PushNotificationEngine::isIdle(PushNotificationClient *client) {
+	return true;
+}
+
+#endif
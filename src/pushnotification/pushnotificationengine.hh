@@ -0,0 +1,151 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+
+#include "pushnotification.hh"
+#include "pushnotificationqueue.hh"
+
+namespace flexisip {
+
+class PushNotificationClient;
+
+/*
+ * Parser of the HTTP/1.1 responses received on a connection, which may hold several pipelined responses.
+ */
+class HttpResponseParser {
+	public:
+		enum Result { Complete, Incomplete, Invalid };
+		struct Response {
+			int mStatus;
+			std::string mMessage; /* status line and headers, followed by the decoded body */
+			bool mKeepAlive; /* false if the server does not process the requests that follow */
+		};
+		// Extracts the first final response of input, which is removed from it along with the interim responses
+		// before it. closedByServer tells that no more data will be received, which ends an undelimited body.
+		static Result parse(std::string &input, bool closedByServer, Response &response);
+};
+
+/*
+ * Event-driven sender of the push notification requests whose server always answers (the HTTP/1.1 services): a single
+ * epoll thread serves all the clients. Each client, called a provider here, gets a pool of keep-alive connections, on
+ * which the requests can be pipelined up to a given depth.
+ * A request is sent again on another connection only if it was not completely written, so that a notification is never
+ * delivered twice: the requests in flight on a broken connection fail.
+ */
+class PushNotificationEngine {
+	public:
+		PushNotificationEngine(int connectionsPerProvider, int pipeliningDepth);
+		~PushNotificationEngine();
+		// Starts the thread of the engine, false if it cannot be started.
+		bool start();
+		// Queues a request of a client, to be sent on one of its connections. Thread-safe.
+		int sendPush(PushNotificationClient *client, const std::shared_ptr<PushNotificationRequest> &req);
+		// Tells whether the engine has no request of a client, queued or in flight. Thread-safe.
+		bool isIdle(PushNotificationClient *client);
+
+	private:
+		struct Request {
+			std::shared_ptr<PushNotificationRequest> mRequest;
+			std::chrono::steady_clock::time_point mQueuedAt;
+			std::chrono::steady_clock::time_point mSentAt;
+			size_t mEndOffset; /* position of its end in the bytes written to the connection */
+		};
+		struct Address {
+			sockaddr_storage mAddress;
+			socklen_t mLength;
+		};
+		struct Provider;
+		struct Connection {
+			enum State { Connecting, Handshaking, Ready, Closed };
+			Provider *mProvider;
+			State mState;
+			size_t mAttempt; /* number of addresses of the server tried before this one */
+			size_t mAddressIndex;
+			int mSocket;
+			SSL *mSsl;
+			std::deque<Request> mRequests; /* assigned to this connection, in the order of their responses */
+			std::string mOutput;
+			size_t mOutputOffset;
+			size_t mWrittenBytes;
+			std::string mInput;
+			bool mCloseAfterResponse; /* the server announced it would not process the next requests */
+			bool mWantWrite;
+			std::chrono::steady_clock::time_point mLastActivity;
+		};
+		struct Provider {
+			PushNotificationClient *mClient;
+			PushNotificationQueue<Request> mQueue; /* shared with the callers of sendPush() */
+			size_t mInFlight; /* taken from the queue, shared with the callers of isIdle() */
+			std::vector<std::unique_ptr<Connection>> mConnections;
+			std::vector<Address> mAddresses; /* of the server, in the order given by the resolver */
+			size_t mPreferredAddress; /* index of the address of the last established connection */
+			std::chrono::steady_clock::time_point mResolvedAt;
+			std::future<std::vector<Address>> mResolution; /* pending resolution, which runs off the engine thread */
+		};
+
+		void run();
+		void dispatch(Provider &provider);
+		Connection *openConnection(Provider &provider, size_t attempt = 0);
+		bool resolve(Provider &provider);
+		static std::vector<Address> resolveServer(const std::string &name, const std::string &host,
+												  const std::string &port);
+		void closeConnection(Connection &conn, const std::string &reason);
+		void retryConnection(Connection &conn, const std::string &reason);
+		void onConnectionEvent(Connection &conn, uint32_t events);
+		bool startHandshake(Connection &conn);
+		bool continueHandshake(Connection &conn);
+		bool writeToServer(Connection &conn);
+		bool readFromServer(Connection &conn, bool &closedByServer);
+		bool parseResponses(Connection &conn, bool closedByServer);
+		void onResponse(Connection &conn, const std::string &response);
+		void onRequestDone(Provider &provider, const Request &req, bool answered);
+		void requeue(Provider &provider, std::deque<Request> &requests);
+		void updateEvents(Connection &conn);
+		void checkTimeouts();
+		void wakeUp();
+
+		static const int sConnectTimeout; /* seconds */
+		static const int sResponseTimeout; /* seconds without data from the server while waiting for it */
+		static const int sIdleTimeout; /* seconds after which an unused connection is closed */
+		static const int sResolveInterval; /* seconds during which the address of a server is reused */
+
+		int mConnectionsPerProvider;
+		int mPipeliningDepth;
+		int mEpollFd;
+		int mWakeUpPipe[2];
+		std::thread mThread;
+		std::mutex mMutex;
+		bool mRunning;
+		std::map<PushNotificationClient *, std::unique_ptr<Provider>> mProviders;
+};
+
+}
@@ -0,0 +1,120 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2015  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <deque>
+
+#include "pushnotification.hh"
+
+namespace flexisip {
+
+/*
+ * Queue of the requests waiting to be sent by a client: one FIFO per priority class, the most urgent class being served
+ * first. A waiting request is said preempted the first time a request of a more urgent class is queued after it.
+ * Not thread-safe: the clients protect it with their own lock.
+ */
+template <typename T> class PushNotificationQueue {
+	public:
+		typedef T value_type;
+
+		PushNotificationQueue() : mSize(0) {
+		}
+		// Queues an item at the end of its class. Returns the number of waiting items it preempts.
+		size_t push(const T &item, PushNotificationRequest::Priority priority) {
+			size_t preempted = 0;
+			for (int i = priority + 1; i < sClassCount; ++i) {
+				preempted += mClasses[i].mItems.size() - mClasses[i].mPreempted;
+				mClasses[i].mPreempted = mClasses[i].mItems.size();
+			}
+			mClasses[priority].mItems.push_back(item);
+			mSize++;
+			return preempted;
+		}
+		// Queues an item again at the head of its class, typically when its sending was interrupted.
+		void pushFront(const T &item, PushNotificationRequest::Priority priority) {
+			Class &c = mClasses[priority];
+			c.mItems.push_front(item);
+			if (c.mPreempted > 0)
+				c.mPreempted++; /* the preempted items remain a prefix of the class */
+			mSize++;
+		}
+		// Removes the most recently queued item of the least urgent class, if this class is less urgent than priority.
+		bool evict(PushNotificationRequest::Priority priority, T &item) {
+			for (int i = sClassCount - 1; i > priority; --i) {
+				Class &c = mClasses[i];
+				if (c.mItems.empty())
+					continue;
+				item = c.mItems.back();
+				c.mItems.pop_back();
+				if (c.mPreempted > c.mItems.size())
+					c.mPreempted = c.mItems.size();
+				mSize--;
+				return true;
+			}
+			return false;
+		}
+		T &front() {
+			return mClasses[frontClass()].mItems.front();
+		}
+		void pop() {
+			Class &c = mClasses[frontClass()];
+			c.mItems.pop_front();
+			if (c.mPreempted > 0)
+				c.mPreempted--;
+			mSize--;
+		}
+		// Empties the queue, returning its items in the order they would have been sent.
+		std::deque<T> takeAll() {
+			std::deque<T> items;
+			for (Class &c : mClasses) {
+				items.insert(items.end(), c.mItems.begin(), c.mItems.end());
+				c.mItems.clear();
+				c.mPreempted = 0;
+			}
+			mSize = 0;
+			return items;
+		}
+		bool empty() const {
+			return mSize == 0;
+		}
+		size_t size() const {
+			return mSize;
+		}
+
+	private:
+		struct Class {
+			Class() : mPreempted(0) {
+			}
+			std::deque<T> mItems;
+			size_t mPreempted; /* number of items at the head of the class that were already preempted */
+		};
+
+		int frontClass() const {
+			int i = 0;
+			while (i < sClassCount - 1 && mClasses[i].mItems.empty())
+				++i;
+			return i;
+		}
+
+		static const int sClassCount = PushNotificationRequest::Other + 1;
+		Class mClasses[sClassCount];
+		size_t mSize;
+};
+
+}
@@ -21,6 +21,10 @@
 #include "pushnotificationservice.hh"
 #include "pushnotificationclient.hh"
 #include "pushnotificationclient_wp.hh"
+#include "pushnotificationengine.hh"
+#ifdef ENABLE_APNS_HTTP2
+#include "pushnotificationclient_apns.hh"
+#endif
 #include <flexisip/common.hh>
 
 #include <sstream>
@@ -36,6 +40,10 @@ static const char *APN_DEV_ADDRESS = "gateway.sandbox.push.apple.com";
 static const char *APN_PROD_ADDRESS = "gateway.push.apple.com";
 static const char *APN_PORT = "2195";
 
+static const char *APN_HTTP2_DEV_ADDRESS = "api.sandbox.push.apple.com";
+static const char *APN_HTTP2_PROD_ADDRESS = "api.push.apple.com";
+static const char *APN_HTTP2_PORT = "443";
+
 static const char *GPN_ADDRESS = "gcm-http.googleapis.com";
 static const char *GPN_PORT = "443";
 
@@ -45,18 +53,60 @@ static const char *FIREBASE_PORT = "443";
 static const char *WPPN_PORT = "443";
 
 PushNotificationService::PushNotificationService(int maxQueueSize)
-: mMaxQueueSize(maxQueueSize), mClients(), mCountFailed(NULL), mCountSent(NULL) {
+: mMaxQueueSize(maxQueueSize), mClients(), mCountFailed(NULL), mCountSent(NULL), mDeliveryTime(NULL),
+  mCountPreempted(NULL) {
 	SSL_library_init();
 	SSL_load_error_strings();
 }
 
 PushNotificationService::~PushNotificationService() {
+	// The engine refers to the clients.
+	mEngine.reset();
 	ERR_free_strings();
 }
 
+void PushNotificationService::setRequestStats(const string &type, StatHistogram *latency, StatCounter64 *inFlight) {
+	RequestStats &stats = mRequestStats[type];
+	stats.mLatency = latency;
+	stats.mInFlight = inFlight;
+}
+
+void PushNotificationService::setupHttpEngine(int connectionsPerProvider, int pipeliningDepth) {
+	mEngine.reset(new PushNotificationEngine(connectionsPerProvider, pipeliningDepth));
+	if (!mEngine->start())
+		mEngine.reset();
+}
+
+void PushNotificationService::onRequestSent(const PushNotificationRequest &req) {
+	auto it = mRequestStats.find(req.getType());
+	if (it != mRequestStats.end() && it->second.mInFlight)
+		++(*it->second.mInFlight);
+}
+
+void PushNotificationService::onRequestsPreempted(size_t count) {
+	if (count > 0 && mCountPreempted)
+		mCountPreempted->add(count);
+}
+
+void PushNotificationService::onRequestDone(const PushNotificationRequest &req, chrono::steady_clock::time_point sentAt,
+											bool answered) {
+	auto it = mRequestStats.find(req.getType());
+	if (it == mRequestStats.end())
+		return;
+	if (it->second.mInFlight)
+		--(*it->second.mInFlight);
+	if (answered && it->second.mLatency)
+		it->second.mLatency->recordDuration(chrono::steady_clock::now() - sentAt);
+}
+
 
 int PushNotificationService::sendPush(const std::shared_ptr<PushNotificationRequest> &pn){	
 	std::shared_ptr<PushNotificationClient> client = mClients[pn->getAppIdentifier()];
+	if (client == 0 && pn->getType() == "apple" && mAppleTokenProdClient) {
+		// A token is valid for all the applications of the developer account.
+		bool dev = pn->getAppIdentifier().find(".dev") != string::npos;
+		client = mClients[pn->getAppIdentifier()] = dev ? mAppleTokenDevClient : mAppleTokenProdClient;
+	}
 	if (client == 0) {
 		bool isW10 = (pn->getType().compare(string("w10")) == 0);
 		bool isWP = (pn->getType().compare(string("wp")) == 0);
@@ -201,10 +251,18 @@ int handle_verify_callback(X509_STORE_CTX* mCtx, void* ud) {
 	return 0;
 }
 
-void PushNotificationService::setupiOSClient(const std::string &certdir, const std::string &cafile) {
+void PushNotificationService::setupiOSClient(const std::string &certdir, const std::string &cafile, bool useHttp2,
+											 const std::string &server) {
 	struct dirent *dirent;
 	DIR *dirp;
 
+#ifndef ENABLE_APNS_HTTP2
+	if (useHttp2) {
+		LOGE("Flexisip is built without the HTTP/2 API of APNs, using the binary API");
+		useHttp2 = false;
+	}
+#endif
+
 	dirp = opendir(certdir.c_str());
 	if (dirp == NULL) {
 		LOGE("Could not open push notification certificates directory (%s): %s", certdir.c_str(), strerror(errno));
@@ -227,26 +285,33 @@ void PushNotificationService::setupiOSClient(const std::string &certdir, const s
 			(cert.compare(cert.length() - suffix.length(), suffix.length(), suffix) != 0)) {
 			continue;
 		}
-		/*March 2016: Yes Apple production push server doesn't support TLS > 1.0*/
-		SSL_CTX* ctx = SSL_CTX_new(TLSv1_client_method());
-		if (!ctx) {
-			SLOGE << "Could not create ctx!";
-			ERR_print_errors_fp(stderr);
-			continue;
-		}
-
-		if (cafile.empty()) {
-			SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+		SSL_CTX *ctx;
+		if (useHttp2) {
+			ctx = createiOSHttp2Context(cafile);
+			if (!ctx)
+				continue;
 		} else {
-			SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
-			SSL_CTX_set_cert_verify_callback(ctx, handle_verify_callback, NULL);
-		}
+			/*March 2016: Yes Apple production push server doesn't support TLS > 1.0*/
+			ctx = SSL_CTX_new(TLSv1_client_method());
+			if (!ctx) {
+				SLOGE << "Could not create ctx!";
+				ERR_print_errors_fp(stderr);
+				continue;
+			}
 
-		if(! SSL_CTX_load_verify_locations(ctx, cafile.empty()?NULL:cafile.c_str(), "/etc/ssl/certs")) {
-			SLOGE << "Error loading trust store";
-			ERR_print_errors_fp(stderr);
-			SSL_CTX_free(ctx);
-			continue;
+			if (cafile.empty()) {
+				SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+			} else {
+				SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+				SSL_CTX_set_cert_verify_callback(ctx, handle_verify_callback, NULL);
+			}
+
+			if(! SSL_CTX_load_verify_locations(ctx, cafile.empty()?NULL:cafile.c_str(), "/etc/ssl/certs")) {
+				SLOGE << "Error loading trust store";
+				ERR_print_errors_fp(stderr);
+				SSL_CTX_free(ctx);
+				continue;
+			}
 		}
 
 		string certpath = string(certdir) + "/" + cert;
@@ -268,13 +333,95 @@ void PushNotificationService::setupiOSClient(const std::string &certdir, const s
 		}
 
 		string certName = cert.substr(0, cert.size() - 4); // Remove .pem at the end of cert
-		const char *apn_server = (certName.find(".dev") != string::npos) ? APN_DEV_ADDRESS : APN_PROD_ADDRESS;
+		bool dev = certName.find(".dev") != string::npos;
+#ifdef ENABLE_APNS_HTTP2
+		if (useHttp2) {
+			string host, port;
+			getiOSHttp2Server(server, dev, host, port);
+			mClients[certName] = std::make_shared<PushNotificationClientApns>(cert, this, ctx, host, port, mMaxQueueSize);
+			SLOGD << "Adding ios HTTP/2 push notification client [" << certName << "] for " << host << ":" << port;
+			continue;
+		}
+#endif
+		const char *apn_server = dev ? APN_DEV_ADDRESS : APN_PROD_ADDRESS;
 		mClients[certName] = std::make_shared<PushNotificationClient>(cert, this, ctx, apn_server, APN_PORT, mMaxQueueSize, true);
 		SLOGD << "Adding ios push notification client [" << certName << "]";
 	}
 	closedir(dirp);
 }
 
+void PushNotificationService::setupiOSTokenClients(const std::string &keyFile, const std::string &keyId,
+												   const std::string &teamId, const std::string &cafile,
+												   const std::string &server) {
+#ifdef ENABLE_APNS_HTTP2
+	auto signer = ApnsTokenSigner::create(keyFile, keyId, teamId);
+	if (!signer)
+		return;
+	for (bool dev : {true, false}) {
+		SSL_CTX *ctx = createiOSHttp2Context(cafile);
+		if (!ctx)
+			return;
+		string host, port;
+		getiOSHttp2Server(server, dev, host, port);
+		auto client = std::make_shared<PushNotificationClientApns>(dev ? "apns-token-dev" : "apns-token-prod", this, ctx,
+																	host, port, mMaxQueueSize, signer);
+		(dev ? mAppleTokenDevClient : mAppleTokenProdClient) = client;
+		SLOGD << "Adding ios HTTP/2 push notification client with key [" << keyId << "] for " << host << ":" << port;
+	}
+#else
+	LOGE("Flexisip is built without the HTTP/2 API of APNs, token-based authentication is not available");
+#endif
+}
+
+SSL_CTX *PushNotificationService::createiOSHttp2Context(const std::string &cafile) {
+#ifdef ENABLE_APNS_HTTP2
+	SSL_CTX *ctx = SSL_CTX_new(SSLv23_client_method());
+	if (!ctx || !PushNotificationClientApns::setupSslContext(ctx)) {
+		SLOGE << "Could not create ctx!";
+		ERR_print_errors_fp(stderr);
+		if (ctx)
+			SSL_CTX_free(ctx);
+		return NULL;
+	}
+	/*
+	 * The requests carry the certificate or the authentication token of the applications: the server is always
+	 * authenticated, against the system trust store unless a CA file is given. Its name is checked by the client.
+	 */
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+	int loaded = cafile.empty() ? SSL_CTX_set_default_verify_paths(ctx)
+								: SSL_CTX_load_verify_locations(ctx, cafile.c_str(), NULL);
+	if (!loaded) {
+		SLOGE << "Error loading trust store " << (cafile.empty() ? "of the system" : cafile);
+		ERR_print_errors_fp(stderr);
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	return ctx;
+#else
+	return NULL;
+#endif
+}
+
+/* server is host[:port], to use instead of the servers of Apple, for example a local test server */
+void PushNotificationService::getiOSHttp2Server(const std::string &server, bool dev, std::string &host,
+												std::string &port) {
+	if (server.empty()) {
+		host = dev ? APN_HTTP2_DEV_ADDRESS : APN_HTTP2_PROD_ADDRESS;
+		port = APN_HTTP2_PORT;
+		return;
+	}
+	size_t sep = server.rfind(':');
+	if (sep == string::npos || server.find(']', sep) != string::npos) {
+		host = server;
+		port = APN_HTTP2_PORT;
+	} else {
+		host = server.substr(0, sep);
+		port = server.substr(sep + 1);
+	}
+	if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+		host = host.substr(1, host.size() - 2);
+}
+
 void PushNotificationService::setupAndroidClient(const std::map<std::string, std::string> googleKeys) {
 	map<string, string>::const_iterator it;
 	for (it = googleKeys.begin(); it != googleKeys.end(); ++it) {
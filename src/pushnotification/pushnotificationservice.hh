@@ -20,9 +20,14 @@
 #include "pushnotification.hh"
 #include <flexisip/configmanager.hh>
 
+#include <openssl/ssl.h>
+
 #include <list>
+#include <memory>
 
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <string>
@@ -30,22 +35,42 @@
 namespace flexisip {
 
 class PushNotificationClient;
+class PushNotificationClientApns;
+class PushNotificationEngine;
 
 class PushNotificationService {
 	friend class PushNotificationClient;
+	friend class PushNotificationClientApns;
+	friend class PushNotificationEngine;
 
   public:
 	PushNotificationService(int maxQueueSize);
 	~PushNotificationService();
 
-	void setStatCounters(StatCounter64 *countFailed, StatCounter64 *countSent) {
+	void setStatCounters(StatCounter64 *countFailed, StatCounter64 *countSent, StatHistogram *deliveryTime = nullptr,
+						 StatCounter64 *countPreempted = nullptr) {
 		mCountFailed = countFailed;
 		mCountSent = countSent;
+		mDeliveryTime = deliveryTime;
+		mCountPreempted = countPreempted;
+	}
+	// Statistics of the requests of a type: time between sending and response, and number of requests in flight.
+	void setRequestStats(const std::string &type, StatHistogram *latency, StatCounter64 *inFlight);
+	// Called from the threads of the clients when a request fails because its device token is invalid.
+	void setInvalidTokenListener(const std::function<void(const std::shared_ptr<PushNotificationRequest> &)> &listener) {
+		mInvalidTokenListener = listener;
 	}
+	// Sends the requests of the HTTP/1.1 clients from a shared event loop, instead of a thread per client.
+	void setupHttpEngine(int connectionsPerProvider, int pipeliningDepth);
 
 	int sendPush(const std::shared_ptr<PushNotificationRequest> &pn);
 	void setupGenericClient(const url_t *url);
-	void setupiOSClient(const std::string &certdir, const std::string &cafile);
+	// With useHttp2, the certificates are used with the HTTP/2 API of APNs, reached at server when it is not empty.
+	void setupiOSClient(const std::string &certdir, const std::string &cafile, bool useHttp2 = false,
+						const std::string &server = "");
+	// Token-based authentication with the HTTP/2 API: one client per APNs environment serves all the applications.
+	void setupiOSTokenClients(const std::string &keyFile, const std::string &keyId, const std::string &teamId,
+							  const std::string &cafile, const std::string &server = "");
 	void setupAndroidClient(const std::map<std::string, std::string> googleKeys);
 	void setupFirebaseClient(const std::map<std::string, std::string> firebaseKeys);
 	void setupWindowsPhoneClient(const std::string& packageSID, const std::string& applicationSecret);
@@ -54,17 +79,32 @@ class PushNotificationService {
   private:
 	void setupClients(const std::string &certdir, const std::string &ca, int maxQueueSize);
 	bool isCertExpired( const std::string &certPath );
-
+	SSL_CTX *createiOSHttp2Context(const std::string &cafile);
+	void getiOSHttp2Server(const std::string &server, bool dev, std::string &host, std::string &port);
+	void onRequestSent(const PushNotificationRequest &req);
+	void onRequestsPreempted(size_t count);
+	void onRequestDone(const PushNotificationRequest &req, std::chrono::steady_clock::time_point sentAt, bool answered);
 
   private:
+	struct RequestStats {
+		StatHistogram *mLatency;
+		StatCounter64 *mInFlight;
+	};
+
 	std::thread *mThread;
 	int mMaxQueueSize;
 	bool mHaveToStop;
 	std::map<std::string, std::shared_ptr<PushNotificationClient>> mClients;
+	std::shared_ptr<PushNotificationClient> mAppleTokenDevClient, mAppleTokenProdClient;
 	std::string mPassword;
 	std::string mWindowsPhonePackageSID, mWindowsPhoneApplicationSecret;
 	StatCounter64 *mCountFailed;
 	StatCounter64 *mCountSent;
+	StatHistogram *mDeliveryTime;
+	StatCounter64 *mCountPreempted;
+	std::map<std::string, RequestStats> mRequestStats;
+	std::function<void(const std::shared_ptr<PushNotificationRequest> &)> mInvalidTokenListener;
+	std::unique_ptr<PushNotificationEngine> mEngine;
 };
 
 }
\ No newline at end of file
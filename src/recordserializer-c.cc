@@ -123,8 +123,8 @@ bool RecordSerializerC::serialize(Record *r, string &serialized, bool log) {
 		}
 		oss << "#" << pathstr;
 		string acceptstr;
-		for (auto pit = ec->mAcceptHeader.cbegin(); pit != ec->mAcceptHeader.cend(); ++pit) {
-			if (pit != ec->mAcceptHeader.cbegin())
+		for (auto pit = ec->mAcceptHeader->cbegin(); pit != ec->mAcceptHeader->cend(); ++pit) {
+			if (pit != ec->mAcceptHeader->cbegin())
 				acceptstr += ",";
 			acceptstr += *pit;
 		}
@@ -126,7 +126,7 @@ bool RecordSerializerJson::serialize(Record *r, string &serialized, bool log) {
 			cJSON *pitem = cJSON_CreateString(pit->c_str());
 			cJSON_AddItemToArray(path, pitem);
 		}
-		for (auto pit = ec->mAcceptHeader.cbegin(); pit != ec->mAcceptHeader.cend(); ++pit) {
+		for (auto pit = ec->mAcceptHeader->cbegin(); pit != ec->mAcceptHeader->cend(); ++pit) {
 			cJSON *pitem = cJSON_CreateString(pit->c_str());
 			cJSON_AddItemToArray(acceptHeaders, pitem);
 		}
@@ -86,7 +86,7 @@ bool RecordSerializerMsgPack::serialize(Record *r, std::string &serialized, bool
 			c->mUpdatedTime,
 			c->mCSeq,
 			c->mAlias,
-			c->mAcceptHeader,
+			*c->mAcceptHeader,
 			c->mUsedAsRoute,
 			c->line()
 		});
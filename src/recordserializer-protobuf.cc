@@ -87,7 +87,7 @@ bool RecordSerializerPb::serialize(Record *r, string &serialized, bool log) {
 		for (auto pit = ec->mPath.cbegin(); pit != ec->mPath.cend(); ++pit) {
 			c->add_path(*pit);
 		}
-		for (auto pit = ec->mAcceptHeader.cbegin(); pit != ec->mAcceptHeader.cend(); ++pit) {
+		for (auto pit = ec->mAcceptHeader->cbegin(); pit != ec->mAcceptHeader->cend(); ++pit) {
 			c->add_accept_header(*pit);
 		}
 		c->set_used_as_route(ec->mUsedAsRoute);
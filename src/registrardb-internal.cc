@@ -98,7 +98,7 @@ void RegistrarDbInternal::doFetchInstance(const url_t *url, const string &unique
 		return;
 	}
 
-	const list<shared_ptr<ExtendedContact>> &contacts = r->getExtendedContacts();
+	const auto &contacts = r->getExtendedContacts();
 	shared_ptr<Record> retRecord = make_shared<Record>(url);
 	for (const auto &contact : contacts) {
 		if (contact->mUniqueId == uniqueId){
@@ -20,12 +20,16 @@
 #include "registrardb-redis.hh"
 #include <flexisip/common.hh>
 
+#include <chrono>
+#include <cstdarg>
 #include <ctime>
 #include <cstdio>
 #include <vector>
 #include <algorithm>
 #include <iterator>
 #include <set>
+#include <deque>
+#include <unordered_set>
 
 #include <flexisip/configmanager.hh>
 
@@ -56,20 +60,32 @@ RegistrarUserData::~RegistrarUserData() {
 RegistrarDbRedisAsync::RegistrarDbRedisAsync(Agent *ag, RedisParameters params)
 	: RegistrarDb(ag), mContext(nullptr), mSubscribeContext(nullptr),
 	  mDomain(params.domain), mAuthPassword(params.auth), mPort(params.port), mTimeout(params.timeout), mRoot(ag->getRoot()),
-	  mReplicationTimer(nullptr), mSlaveCheckTimeout(params.mSlaveCheckTimeout) {
+	  mReplicationTimer(nullptr), mSlaveCheckTimeout(params.mSlaveCheckTimeout), mFetchBatchSize(params.mFetchBatchSize),
+	  mRecordCache(params.mRecordCacheSize, params.mRecordCacheTtl, [this](const string &key) { releaseTopic(key); }),
+	  mBinaryContacts(params.mBinaryContacts), mRoundTripTime(params.mRoundTripTime) {
 	mSerializer = RecordSerializer::get();
 	mCurSlave = 0;
+	setupShards(params.mShards, params.mShardStats);
+	mRecordCache.mCountHits = params.mCacheHits;
+	mRecordCache.mCountMisses = params.mCacheMisses;
+	mRecordCache.mCountEvictions = params.mCacheEvictions;
 }
 
 RegistrarDbRedisAsync::RegistrarDbRedisAsync(const string &preferredRoute, su_root_t *root, RecordSerializer *serializer, RedisParameters params)
 	: RegistrarDb(nullptr), mContext(nullptr), mSubscribeContext(nullptr),
 	  mDomain(params.domain), mAuthPassword(params.auth), mPort(params.port), mTimeout(params.timeout), mRoot(root),
-	  mReplicationTimer(nullptr), mSlaveCheckTimeout(params.mSlaveCheckTimeout) {
+	  mReplicationTimer(nullptr), mSlaveCheckTimeout(params.mSlaveCheckTimeout), mFetchBatchSize(params.mFetchBatchSize),
+	  mRecordCache(params.mRecordCacheSize, params.mRecordCacheTtl, [this](const string &key) { releaseTopic(key); }),
+	  mBinaryContacts(params.mBinaryContacts), mRoundTripTime(params.mRoundTripTime) {
 	mSerializer = serializer;
 	mCurSlave = 0;
+	setupShards(params.mShards, params.mShardStats);
 }
 
 RegistrarDbRedisAsync::~RegistrarDbRedisAsync() {
+	for (auto &shard : mShards) {
+		disconnectShard(*shard);
+	}
 	if (mContext) {
 		redisAsyncDisconnect(mContext);
 	}
@@ -114,6 +130,8 @@ void RegistrarDbRedisAsync::onSubscribeDisconnect(const redisAsyncContext *c, in
 	}
 
 	mSubscribeContext = nullptr;
+	// The invalidations of the cached records cannot be received anymore.
+	mRecordCache.clear();
 	LOGD("Disconnected subscribe context %p...", c);
 	if (status != REDIS_OK) {
 		LOGE("Redis disconnection message: %s", c->errstr);
@@ -130,6 +148,8 @@ void RegistrarDbRedisAsync::onSubscribeConnect(const redisAsyncContext *c, int s
 		return;
 	}
 	LOGD("REDIS Connection done for subscribe channel %p", c);
+	// Records cached before were not subscribed on this connection.
+	mRecordCache.clear();
 	if (!mContactListenersMap.empty()){
 		LOGD("Now re-subscribing all topics we had before being disconnected.");
 		subscribeAll();
@@ -409,6 +429,9 @@ bool RegistrarDbRedisAsync::connect() {
 	} else {
 		getReplicationInfo();
 	}
+	for (auto &shard : mShards) {
+		connectShard(*shard);
+	}
 	return true;
 }
 
@@ -441,7 +464,7 @@ void RegistrarDbRedisAsync::subscribeAll() {
 
 void RegistrarDbRedisAsync::subscribeToKeyExpiration() {
 	SLOGD << "Subscribing to key expiration";
-	redisAsyncCommand(mSubscribeContext, sKeyExpirationPublishCallback, nullptr, "SUBSCRIBE __keyevent@0__:expired");
+	redisAsyncCommand(mSubscribeContext, sKeyExpirationPublishCallback, this, "SUBSCRIBE __keyevent@0__:expired");
 }
 
 void RegistrarDbRedisAsync::subscribeTopic(const string &topic) {
@@ -463,7 +486,12 @@ void RegistrarDbRedisAsync::subscribe(const string &topic, const shared_ptr<Cont
 
 void RegistrarDbRedisAsync::unsubscribe(const string &topic, const shared_ptr<ContactRegisteredListener> &listener) {
 	RegistrarDb::unsubscribe(topic, listener);
-	if (mContactListenersMap.count(topic) == 0)
+	releaseTopic(topic);
+}
+
+/* Unsubscribes from the topic once nothing is interested in it anymore: neither listeners nor the record cache. */
+void RegistrarDbRedisAsync::releaseTopic(const string &topic) {
+	if (mContactListenersMap.count(topic) == 0 && !mRecordCache.contains(topic) && mSubscribeContext)
 		redisAsyncCommand(mSubscribeContext, nullptr, nullptr, "UNSUBSCRIBE %s", topic.c_str());
 }
 
@@ -474,6 +502,231 @@ void RegistrarDbRedisAsync::publish(const string &topic, const string &uid) {
 	}else LOGE("RegistrarDbRedisAsync::publish(): no context !");
 }
 
+/*
+ * Sharding of the records across several redis primaries. The main connection (mContext) is still used for
+ * replication checks, publish/subscribe and the migration of legacy records, while the "fs:" records are read and
+ * written on the shard their key hashes to.
+ */
+
+/* Points placed on the hash ring for each shard, enough to spread the keys evenly between a few servers. */
+static constexpr int sShardRingPoints = 100;
+
+/* FNV-1a followed by the murmur3 finalizer, which spreads the ring points of a shard that only differ by their last
+ * characters. The ring must be identical on every flexisip node, so std::hash cannot be used. */
+static uint32_t shardHash(const string &str) {
+	uint32_t hash = 2166136261u;
+	for (unsigned char c : str) {
+		hash ^= c;
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+/* Context of a record command whose reply is timed, sent to a shard or, when 'shard' is null, to the main server. */
+struct RegistrarDbRedisAsync::ShardCommand {
+	RegistrarDbRedisAsync *db;
+	RedisShard *shard;
+	redisCallbackFn *fn;
+	void *privdata;
+	chrono::steady_clock::time_point start;
+};
+
+void RegistrarDbRedisAsync::setupShards(const vector<RedisHost> &hosts, const vector<RedisShardStats> &stats) {
+#ifdef WITHOUT_HIREDIS_CONNECT_CALLBACK
+	// A shard whose connection fails could not be told apart from a connected one, and would never be reconnected.
+	if (!hosts.empty())
+		LOGF("Redis shards require a hiredis version providing redisAsyncSetConnectCallback().");
+#endif
+	for (size_t i = 0; i < hosts.size(); ++i) {
+		const RedisHost &host = hosts[i];
+		RedisShard *shard = new RedisShard(this, host);
+		mShards.emplace_back(shard);
+		ostringstream name;
+		name << host.address << ":" << host.port;
+		for (int j = 0; j < sShardRingPoints; ++j) {
+			mShardRing.emplace_back(shardHash(name.str() + "#" + to_string(j)), shard);
+		}
+		if (i < stats.size()) {
+			shard->mCountCommands = stats[i].mCountCommands;
+			shard->mCountErrors = stats[i].mCountErrors;
+			shard->mCountLatency = stats[i].mCountLatency;
+		}
+		LOGI("Redis shard %d: %s", host.id, name.str().c_str());
+	}
+	sort(mShardRing.begin(), mShardRing.end(),
+		 [](const pair<uint32_t, RedisShard *> &a, const pair<uint32_t, RedisShard *> &b) { return a.first < b.first; });
+}
+
+RedisShard *RegistrarDbRedisAsync::findShard(const string &key) const {
+	uint32_t hash = shardHash(key);
+	auto it = upper_bound(mShardRing.begin(), mShardRing.end(), hash,
+						  [](uint32_t h, const pair<uint32_t, RedisShard *> &point) { return h < point.first; });
+	if (it == mShardRing.end())
+		it = mShardRing.begin();
+	return it->second;
+}
+
+/* Opens the connections of the shard that are not established yet. Returns whether commands can be sent to it. */
+bool RegistrarDbRedisAsync::connectShard(RedisShard &shard) {
+	const RedisHost &host = shard.mHost;
+
+	if (!shard.mContext) {
+		shard.mContext = redisAsyncConnect(host.address.c_str(), host.port);
+		if (shard.mContext->err) {
+			SLOGE << "Redis shard " << host.address << ":" << host.port << " connection error: " << shard.mContext->errstr;
+			redisAsyncFree(shard.mContext);
+			shard.mContext = nullptr;
+			return false;
+		}
+		shard.mContext->data = &shard;
+#ifndef WITHOUT_HIREDIS_CONNECT_CALLBACK
+		// hiredis frees the context of a failed connection without calling the disconnect callback.
+		redisAsyncSetConnectCallback(shard.mContext, sShardConnectCallback);
+#endif
+		redisAsyncSetDisconnectCallback(shard.mContext, sShardDisconnectCallback);
+		if (REDIS_OK != redisSofiaAttach(shard.mContext, mRoot)) {
+			LOGE("Redis shard connection error - %p", shard.mContext);
+			redisAsyncDisconnect(shard.mContext);
+			shard.mContext = nullptr;
+			return false;
+		}
+		if (!mAuthPassword.empty())
+			redisAsyncCommand(shard.mContext, nullptr, nullptr, "AUTH %s", mAuthPassword.c_str());
+		LOGD("Connecting to redis shard %s:%d (%p)", host.address.c_str(), host.port, shard.mContext);
+	}
+
+	// Expiration of the records held by this shard are only notified on its own pub/sub channels.
+	if (!shard.mSubscribeContext) {
+		shard.mSubscribeContext = redisAsyncConnect(host.address.c_str(), host.port);
+		if (shard.mSubscribeContext->err) {
+			SLOGE << "Redis shard " << host.address << ":" << host.port
+				  << " subscribe connection error: " << shard.mSubscribeContext->errstr;
+			redisAsyncFree(shard.mSubscribeContext);
+			shard.mSubscribeContext = nullptr;
+			scheduleShardReconnect(shard);
+		} else {
+			shard.mSubscribeContext->data = &shard;
+#ifndef WITHOUT_HIREDIS_CONNECT_CALLBACK
+			redisAsyncSetConnectCallback(shard.mSubscribeContext, sShardSubscribeConnectCallback);
+#endif
+			redisAsyncSetDisconnectCallback(shard.mSubscribeContext, sShardSubscribeDisconnectCallback);
+			if (REDIS_OK != redisSofiaAttach(shard.mSubscribeContext, mRoot)) {
+				LOGE("Redis shard subscribe connection error - %p", shard.mSubscribeContext);
+				redisAsyncDisconnect(shard.mSubscribeContext);
+				shard.mSubscribeContext = nullptr;
+				scheduleShardReconnect(shard);
+			} else {
+				if (!mAuthPassword.empty())
+					redisAsyncCommand(shard.mSubscribeContext, nullptr, nullptr, "AUTH %s", mAuthPassword.c_str());
+				redisAsyncCommand(shard.mSubscribeContext, sKeyExpirationPublishCallback, this,
+								  "SUBSCRIBE __keyevent@0__:expired");
+			}
+		}
+	}
+	return true;
+}
+
+/* Closes the shard connections immediately: the pending commands are failed before the shard is destroyed. */
+void RegistrarDbRedisAsync::disconnectShard(RedisShard &shard) {
+	if (shard.mReconnectTimer) {
+		su_timer_destroy(shard.mReconnectTimer);
+		shard.mReconnectTimer = nullptr;
+	}
+	if (shard.mContext) {
+		redisAsyncContext *context = shard.mContext;
+		shard.mContext = nullptr;
+		redisAsyncFree(context);
+	}
+	if (shard.mSubscribeContext) {
+		redisAsyncContext *context = shard.mSubscribeContext;
+		shard.mSubscribeContext = nullptr;
+		redisAsyncFree(context);
+	}
+}
+
+/*
+ * Opens the lost connections of the shard again after a delay. Commands also reconnect the command context when
+ * needed, but nothing else would restore the subscription to the key expirations.
+ */
+void RegistrarDbRedisAsync::scheduleShardReconnect(RedisShard &shard) {
+	if (shard.mReconnectTimer)
+		return;
+	shard.mReconnectTimer = su_timer_create(su_root_task(mRoot), redisRetryTimeoutMs);
+	su_timer_set(shard.mReconnectTimer, (su_timer_f)sShardReconnect, &shard);
+}
+
+void RegistrarDbRedisAsync::sShardReconnect(void *unused, su_timer_t *t, void *data) {
+	RedisShard *shard = (RedisShard *)data;
+	su_timer_destroy(shard->mReconnectTimer);
+	shard->mReconnectTimer = nullptr;
+	LOGI("Reconnecting to redis shard %s:%d", shard->mHost.address.c_str(), shard->mHost.port);
+	if (!shard->mDb->connectShard(*shard) || !shard->mSubscribeContext)
+		shard->mDb->scheduleShardReconnect(*shard);
+}
+
+/* Returns the context of the server holding the record 'key', connecting to it if needed, or nullptr. */
+redisAsyncContext *RegistrarDbRedisAsync::getRecordContext(const string &key, RedisShard **shard) {
+	if (mShards.empty()) {
+		if (shard)
+			*shard = nullptr;
+		return (isConnected() || connect()) ? mContext : nullptr;
+	}
+	RedisShard *s = findShard(key);
+	if (shard)
+		*shard = s;
+	if (!s->mContext && !connectShard(*s))
+		return nullptr;
+	return s->mContext;
+}
+
+int RegistrarDbRedisAsync::recordCommand(const string &key, redisCallbackFn *fn, void *privdata, const char *format, ...) {
+	RedisShard *shard;
+	redisAsyncContext *context = getRecordContext(key, &shard);
+	if (!context)
+		return REDIS_ERR;
+
+	va_list ap;
+	int status;
+	va_start(ap, format);
+	if (shard || mRoundTripTime) {
+		ShardCommand *cmd = new ShardCommand{this, shard, fn, privdata, chrono::steady_clock::now()};
+		status = redisvAsyncCommand(context, sShardCommandCallback, cmd, format, ap);
+		if (status != REDIS_OK) {
+			if (shard && shard->mCountErrors)
+				shard->mCountErrors->incr();
+			delete cmd;
+		}
+	} else {
+		status = redisvAsyncCommand(context, fn, privdata, format, ap);
+	}
+	va_end(ap);
+	return status;
+}
+
+int RegistrarDbRedisAsync::recordCommandArgv(const string &key, redisCallbackFn *fn, void *privdata, int argc,
+											 const char **argv, const size_t *argvlen) {
+	RedisShard *shard;
+	redisAsyncContext *context = getRecordContext(key, &shard);
+	if (!context)
+		return REDIS_ERR;
+	if (!shard && !mRoundTripTime)
+		return redisAsyncCommandArgv(context, fn, privdata, argc, argv, argvlen);
+
+	ShardCommand *cmd = new ShardCommand{this, shard, fn, privdata, chrono::steady_clock::now()};
+	int status = redisAsyncCommandArgv(context, sShardCommandCallback, cmd, argc, argv, argvlen);
+	if (status != REDIS_OK) {
+		if (shard && shard->mCountErrors)
+			shard->mCountErrors->incr();
+		delete cmd;
+	}
+	return status;
+}
+
 /* Static functions that are used as callbacks to redisAsync API */
 
 #ifndef WITHOUT_HIREDIS_CONNECT_CALLBACK
@@ -515,7 +768,12 @@ void RegistrarDbRedisAsync::sPublishCallback(redisAsyncContext *c, void *r, void
 		if (reply->element[2]->str != nullptr) {
 			RegistrarDbRedisAsync *zis = (RegistrarDbRedisAsync *)c->data;
 			if (zis) {
-				zis->notifyContactListener(reply->element[1]->str, reply->element[2]->str);
+				string topic = reply->element[1]->str;
+				// The record was modified by a flexisip node, the topic being its key.
+				zis->invalidateRecord(topic);
+				// Topics may also be subscribed only for the cache, in which case nobody is to be notified.
+				if (zis->mContactListenersMap.count(topic))
+					zis->notifyContactListener(topic, reply->element[2]->str);
 			}
 		}
 	}
@@ -528,18 +786,89 @@ void RegistrarDbRedisAsync::sKeyExpirationPublishCallback(redisAsyncContext *c,
 
 	if (reply->type == REDIS_REPLY_ARRAY) {
 		if (reply->element[2]->str != nullptr) {
-			RegistrarDbRedisAsync *zis = reinterpret_cast<RegistrarDbRedisAsync *>(c->data);
+			RegistrarDbRedisAsync *zis = reinterpret_cast<RegistrarDbRedisAsync *>(data);
 			if (zis) {
 				string prefix = "fs:";
 				string key = reply->element[2]->str;
 				if (key.substr(0, prefix.size()) == prefix)
 					key = key.substr(prefix.size());
+				zis->invalidateRecord(key);
 				zis->notifyContactListener(key, "");
 			}
 		}
 	}
 }
 
+#ifndef WITHOUT_HIREDIS_CONNECT_CALLBACK
+void RegistrarDbRedisAsync::sShardConnectCallback(const redisAsyncContext *c, int status) {
+	RedisShard *shard = (RedisShard *)c->data;
+	if (status != REDIS_OK) {
+		LOGE("Couldn't connect to redis shard %s:%d: %s", shard->mHost.address.c_str(), shard->mHost.port, c->errstr);
+		// The context is freed by hiredis, without calling the disconnect callback.
+		if (shard->mContext == c)
+			shard->mContext = nullptr;
+		shard->mDb->scheduleShardReconnect(*shard);
+		return;
+	}
+	LOGD("Redis shard %s:%d connected (%p)", shard->mHost.address.c_str(), shard->mHost.port, c);
+}
+
+void RegistrarDbRedisAsync::sShardSubscribeConnectCallback(const redisAsyncContext *c, int status) {
+	RedisShard *shard = (RedisShard *)c->data;
+	if (status != REDIS_OK) {
+		LOGE("Couldn't connect to redis shard %s:%d for subscriptions: %s", shard->mHost.address.c_str(),
+			 shard->mHost.port, c->errstr);
+		// The context is freed by hiredis, without calling the disconnect callback.
+		if (shard->mSubscribeContext == c)
+			shard->mSubscribeContext = nullptr;
+		shard->mDb->scheduleShardReconnect(*shard);
+		return;
+	}
+	LOGD("Redis shard %s:%d subscribe context connected (%p)", shard->mHost.address.c_str(), shard->mHost.port, c);
+}
+#endif
+
+void RegistrarDbRedisAsync::sShardDisconnectCallback(const redisAsyncContext *c, int status) {
+	RedisShard *shard = (RedisShard *)c->data;
+	if (shard->mContext == c)
+		shard->mContext = nullptr;
+	if (status != REDIS_OK) {
+		LOGE("Redis shard %s:%d disconnected: %s", shard->mHost.address.c_str(), shard->mHost.port, c->errstr);
+		shard->mDb->scheduleShardReconnect(*shard);
+	}
+}
+
+void RegistrarDbRedisAsync::sShardSubscribeDisconnectCallback(const redisAsyncContext *c, int status) {
+	RedisShard *shard = (RedisShard *)c->data;
+	if (shard->mSubscribeContext == c)
+		shard->mSubscribeContext = nullptr;
+	if (status != REDIS_OK) {
+		LOGE("Redis shard %s:%d subscribe context disconnected: %s", shard->mHost.address.c_str(), shard->mHost.port,
+			 c->errstr);
+		// The key expirations of the shard are subscribed again with the new connection.
+		shard->mDb->scheduleShardReconnect(*shard);
+	}
+}
+
+void RegistrarDbRedisAsync::sShardCommandCallback(redisAsyncContext *c, void *r, void *privdata) {
+	ShardCommand *cmd = (ShardCommand *)privdata;
+	redisReply *reply = (redisReply *)r;
+	RedisShard *shard = cmd->shard;
+	auto latency = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - cmd->start);
+
+	if (cmd->db->mRoundTripTime)
+		cmd->db->mRoundTripTime->recordDuration(latency);
+	if (shard && shard->mCountCommands) {
+		shard->mCountCommands->incr();
+		shard->mCountLatency->add(latency.count());
+		if (!reply || reply->type == REDIS_REPLY_ERROR)
+			shard->mCountErrors->incr();
+	}
+	if (cmd->fn)
+		cmd->fn(c, r, cmd->privdata);
+	delete cmd;
+}
+
 void RegistrarDbRedisAsync::sHandleBindStart(redisAsyncContext *ac, redisReply *reply, RegistrarUserData *data) {
 	shared_ptr<Record> recordToStore = data->mRecord;
 
@@ -620,6 +949,9 @@ void RegistrarDbRedisAsync::serializeAndSendToRedis(RegistrarUserData *data, for
 
 	const char** argv = new const char*[argc];
 	size_t* argvlen = new size_t[argc];
+	// Binary encoded contacts may contain NUL bytes, the fields are passed with their length.
+	vector<string> fields;
+	fields.reserve(contacts.size() * 2);
 
 	argv[0] = cmd.c_str();
 	argvlen[0] = strlen(argv[0]);
@@ -634,24 +966,22 @@ void RegistrarDbRedisAsync::serializeAndSendToRedis(RegistrarUserData *data, for
 	for (auto it = contacts.begin(); it != contacts.end(); ++it) {
 		shared_ptr<ExtendedContact> ec = (*it);
 
-		argv[i] = strdup(ec->getUniqueId().c_str());
-		argvlen[i] = strlen(argv[i]);
+		fields.push_back(ec->getUniqueId());
+		argv[i] = fields.back().c_str();
+		argvlen[i] = fields.back().size();
 		i += 1;
 
-		string contact = ec->serializeAsUrlEncodedParams();
-		argv[i] = strdup(contact.c_str());
-		argvlen[i] = strlen(argv[i]);
+		fields.push_back(mBinaryContacts ? ec->serializeAsBinary() : ec->serializeAsUrlEncodedParams());
+		argv[i] = fields.back().data();
+		argvlen[i] = fields.back().size();
 		i += 1;
 	}
 
 	data->mUpdateExpire = true;
 	LOGD("Binding fs:%s [%lu], %lu contacts in record", key, data->token, (unsigned long)contacts.size());
-	check_redis_command(redisAsyncCommandArgv(mContext, (void (*)(redisAsyncContext*, void*, void*))forward_fn,
+	check_redis_command(recordCommandArgv(data->mRecord->getKey(), (void (*)(redisAsyncContext*, void*, void*))forward_fn,
 		data, argc, argv, argvlen), data);
 
-	for (i = 2; i < argc; i++) {
-		free((char *)argv[i]);
-	}
 	delete[] argv;
 	delete[] argvlen;
 }
@@ -663,7 +993,7 @@ void RegistrarDbRedisAsync::sBindRetry(void *unused, su_timer_t *t, void *ud){
 	su_timer_destroy(data->mRetryTimer);
 	data->mRetryTimer = nullptr;
 	RegistrarDbRedisAsync *self = data->self;
-	if (self->isConnected()){
+	if (self->getRecordContext(data->mRecord->getKey())){
 		self->serializeAndSendToRedis(data, sHandleBindFinish);
 	}else{
 		LOGE("Unrecoverable error while updating record fs:%s : no connection", data->mRecord->getKey().c_str());
@@ -687,6 +1017,8 @@ void RegistrarDbRedisAsync::handleBind(redisReply *reply, RegistrarUserData *dat
 		}
 	} else {
 		data->mRetryCount = 0;
+		// A fetch sent before the update may have cached the previous state of the record.
+		invalidateRecord(data->mRecord->getKey());
 		if (data->listener) data->listener->onRecordFound(data->mRecord);
 		delete data;
 	}
@@ -701,8 +1033,9 @@ void RegistrarDbRedisAsync::doBind(const sip_t *sip, int globalExpire, bool alia
 
 	data->mRecord->update(sip, globalExpire, alias, version, data->listener);
 	mLocalRegExpire->update(data->mRecord);
+	invalidateRecord(data->mRecord->getKey());
 
-	if (!isConnected() && !connect()) {
+	if (!getRecordContext(data->mRecord->getKey())) {
 		LOGE("Not connected to redis server");
 		if (data->listener) data->listener->onError();
 		delete data;
@@ -718,11 +1051,11 @@ void RegistrarDbRedisAsync::doBind(const sip_t *sip, int globalExpire, bool alia
 		uid = data->mRecord->getExtendedContacts().front()->getUniqueId();
 	}
 	if (globalExpire > 0 || message_expires > 0) {
-		check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleBindStart,
+		check_redis_command(recordCommand(data->mRecord->getKey(), (void (*)(redisAsyncContext*, void*, void*))sHandleBindStart,
 			data, "HGETALL fs:%s", key), data);
 	} else {
 		data->mIsUnregister = true;
-		check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleBindFinish,
+		check_redis_command(recordCommand(data->mRecord->getKey(), (void (*)(redisAsyncContext*, void*, void*))sHandleBindFinish,
 			data, "HDEL fs:%s %s", key, uid.c_str()), data);
 	}
 }
@@ -740,6 +1073,8 @@ void RegistrarDbRedisAsync::handleClear(redisReply *reply, RegistrarUserData *da
 		}
 	} else {
 		LOGD("Clearing fs:%s [%lu] success", key, data->token);
+		invalidateRecord(key);
+		publishRecordChange(data->mRecord->getKey());
 		if (data->listener) data->listener->onRecordFound(data->mRecord);
 	}
 	delete data;
@@ -747,16 +1082,21 @@ void RegistrarDbRedisAsync::handleClear(redisReply *reply, RegistrarUserData *da
 
 void RegistrarDbRedisAsync::parseAndClean(redisReply *reply, RegistrarUserData *data) {
 	const char *key = data->mRecord->getKey().c_str();
+	bool removed = false;
 	for (size_t i = 0; i < reply->elements; i+=2) {
 			// Elements list is twice the size of the contacts list because the key is an element of the list itself
 		redisReply *element = reply->element[i];
 		const char *uid = element->str;
 		element = reply->element[i+1];
 		const char *contact = element->str;
-		LOGD("Parsing contact %s => %s", uid, contact);
-		if (!data->mRecord->updateFromUrlEncodedParams(key, uid, contact, data->listener)) {
+		if (ExtendedContact::isBinaryEncoded(contact, element->len))
+			LOGD("Parsing contact %s => %lu bytes binary contact", uid, (unsigned long)element->len);
+		else
+			LOGD("Parsing contact %s => %s", uid, contact);
+		if (!data->mRecord->updateFromSerializedContact(key, uid, contact, element->len, data->listener)) {
 			LOGD("Record %s seems to have an outdated contact %s, remove it from redis", key, uid);
-			check_redis_command(redisAsyncCommand(data->self->mContext, nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
+			check_redis_command(recordCommand(data->mRecord->getKey(), nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
+			removed = true;
 		}
 	}
 	data->mRecord->applyMaxAor();
@@ -765,13 +1105,16 @@ void RegistrarDbRedisAsync::parseAndClean(redisReply *reply, RegistrarUserData *
 		// Remove from REDIS contacts removed from record
 		const char *uid = (*it)->mUniqueId.c_str();
 		LOGD("Record %s has too many contacts, removing %s from redis", key, uid);
-		check_redis_command(redisAsyncCommand(data->self->mContext, nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
+		check_redis_command(recordCommand(data->mRecord->getKey(), nullptr, nullptr, "HDEL fs:%s %s", key, uid), data);
+		removed = true;
 	}
 	data->mRecord->cleanContactsToRemoveList();
+	if (removed)
+		publishRecordChange(data->mRecord->getKey());
 
 	if (data->mUpdateExpire) {
 		time_t expireat = data->mRecord->latestExpire();
-		check_redis_command(redisAsyncCommand(data->self->mContext, nullptr, nullptr, "EXPIREAT fs:%s %lu", key, expireat), data);
+		check_redis_command(recordCommand(data->mRecord->getKey(), nullptr, nullptr, "EXPIREAT fs:%s %lu", key, expireat), data);
 	}
 
 	time_t now = getCurrentTime();
@@ -783,7 +1126,7 @@ void RegistrarDbRedisAsync::doClear(const sip_t *sip, const shared_ptr<ContactUp
 	// Once it is done, fetch all the contacts in the AOR and call the onRecordFound of the listener ?
 	RegistrarUserData *data = new RegistrarUserData(this, sip->sip_from->a_url, listener);
 
-	if (!isConnected() && !connect()) {
+	if (!getRecordContext(data->mRecord->getKey())) {
 		LOGE("Not connected to redis server");
 		if (data->listener) data->listener->onError();
 		delete data;
@@ -793,7 +1136,8 @@ void RegistrarDbRedisAsync::doClear(const sip_t *sip, const shared_ptr<ContactUp
 	const char *key = data->mRecord->getKey().c_str();
 	LOGD("Clearing fs:%s [%lu]", key, data->token);
 	mLocalRegExpire->remove(key);
-	check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleClear,
+	invalidateRecord(key);
+	check_redis_command(recordCommand(data->mRecord->getKey(), (void (*)(redisAsyncContext*, void*, void*))sHandleClear,
 		data, "DEL fs:%s", key), data);
 }
 
@@ -808,9 +1152,15 @@ void RegistrarDbRedisAsync::handleFetch(redisReply *reply, RegistrarUserData *da
 		// This is the most common scenario: we want all contacts inside the record
 		LOGD("GOT fs:%s [%lu] --> %lu contacts", key, data->token, (reply->elements / 2));
 		if (reply->elements > 0) {
+			cacheRecord(data->mRecord->getKey(), reply);
 			parseAndClean(reply, data);
 			if (data->listener) data->listener->onRecordFound(data->mRecord);
 			delete data;
+		} else if (!isConnected()) {
+			// Legacy records are only looked up on the main server, which may be unreachable when sharding is used.
+			LOGD("Record fs:%s not found", key);
+			if (data->listener) data->listener->onRecordFound(data->mIsUnregister ? data->mRecord : nullptr);
+			delete data;
 		} else {
 			// We haven't found the record in redis, trying to find an old record
 			LOGD("Record fs:%s not found, trying aor:%s", key, key);
@@ -821,8 +1171,8 @@ void RegistrarDbRedisAsync::handleFetch(redisReply *reply, RegistrarUserData *da
 		// This is only when we want a contact matching a given gruu
 		const char *gruu = data->mUniqueId.c_str();
 		if (reply->len > 0) {
-			LOGD("GOT fs:%s [%lu] for gruu %s --> %s", key, data->token, gruu, reply->str);
-			data->mRecord->updateFromUrlEncodedParams(key, gruu, reply->str, data->listener);
+			LOGD("GOT fs:%s [%lu] for gruu %s --> %lu bytes", key, data->token, gruu, (unsigned long)reply->len);
+			data->mRecord->updateFromSerializedContact(key, gruu, reply->str, reply->len, data->listener);
 			time_t now = getCurrentTime();
 			data->mRecord->clean(now, data->listener);
 			if (data->listener) data->listener->onRecordFound(data->mRecord);
@@ -836,9 +1186,18 @@ void RegistrarDbRedisAsync::handleFetch(redisReply *reply, RegistrarUserData *da
 
 void RegistrarDbRedisAsync::doFetch(const url_t *url, const shared_ptr<ContactUpdateListener> &listener) {
 	// fetch all the contacts in the AOR (HGETALL) and call the onRecordFound of the listener
-	RegistrarUserData *data = new RegistrarUserData(this, url, listener);
+	sendFetch(new RegistrarUserData(this, url, listener));
+}
 
-	if (!isConnected() && !connect()) {
+void RegistrarDbRedisAsync::sendFetch(RegistrarUserData *data) {
+	if (mRecordCache.enabled()) {
+		const RedisRecordCache::Fields *fields = mRecordCache.find(data->mRecord->getKey(), getCurrentTime());
+		if (fields) {
+			fetchFromCache(data, *fields);
+			return;
+		}
+	}
+	if (!getRecordContext(data->mRecord->getKey())) {
 		LOGE("Not connected to redis server");
 		if (data->listener) data->listener->onError();
 		delete data;
@@ -847,7 +1206,7 @@ void RegistrarDbRedisAsync::doFetch(const url_t *url, const shared_ptr<ContactUp
 
 	const char *key = data->mRecord->getKey().c_str();
 	LOGD("Fetching fs:%s [%lu]", key, data->token);
-	check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
+	check_redis_command(recordCommand(data->mRecord->getKey(), (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
 		data, "HGETALL fs:%s", key), data);
 }
 
@@ -856,7 +1215,7 @@ void RegistrarDbRedisAsync::doFetchInstance(const url_t *url, const string &uniq
 	RegistrarUserData *data = new RegistrarUserData(this, url, listener);
 	data->mUniqueId = uniqueId;
 
-	if (!isConnected() && !connect()) {
+	if (!getRecordContext(data->mRecord->getKey())) {
 		LOGE("Not connected to redis server");
 		if (data->listener) data->listener->onError();
 		delete data;
@@ -866,10 +1225,210 @@ void RegistrarDbRedisAsync::doFetchInstance(const url_t *url, const string &uniq
 	const char *key = data->mRecord->getKey().c_str();
 	const char *field = uniqueId.c_str();
 	LOGD("Fetching fs:%s [%lu] contact matching unique id %s", key, data->token, field);
-	check_redis_command(redisAsyncCommand(mContext, (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
+	check_redis_command(recordCommand(data->mRecord->getKey(), (void (*)(redisAsyncContext*, void*, void*))sHandleFetch,
 		data, "HGET fs:%s %s", key, field), data);
 }
 
+/*
+ * Local cache of the fetched records.
+ */
+
+const RedisRecordCache::Fields *RedisRecordCache::find(const string &key, time_t now) {
+	auto it = mEntries.find(key);
+	if (it == mEntries.end() || it->second.expireAt <= now) {
+		// The entry is kept, the subscription to the record is still needed when it is fetched again.
+		if (it != mEntries.end()) {
+			it->second.fields.clear();
+			it->second.expireAt = 0;
+		}
+		if (mCountMisses)
+			mCountMisses->incr();
+		return nullptr;
+	}
+	mLru.splice(mLru.begin(), mLru, it->second.lruIt);
+	if (mCountHits)
+		mCountHits->incr();
+	return &it->second.fields;
+}
+
+bool RedisRecordCache::insert(const string &key, Fields &&fields, time_t now) {
+	auto it = mEntries.find(key);
+	if (it != mEntries.end()) {
+		it->second.fields = move(fields);
+		it->second.expireAt = now + mTtl;
+		mLru.splice(mLru.begin(), mLru, it->second.lruIt);
+		return false;
+	}
+	if (mEntries.size() >= mMaxSize) {
+		if (mCountEvictions)
+			mCountEvictions->incr();
+		erase(mEntries.find(mLru.back()));
+	}
+	mLru.push_front(key);
+	Entry &entry = mEntries[key];
+	entry.fields = move(fields);
+	entry.expireAt = now + mTtl;
+	entry.lruIt = mLru.begin();
+	return true;
+}
+
+void RedisRecordCache::invalidate(const string &key) {
+	auto it = mEntries.find(key);
+	if (it != mEntries.end()) {
+		it->second.fields.clear();
+		it->second.expireAt = 0;
+	}
+}
+
+void RedisRecordCache::clear() {
+	mEntries.clear();
+	mLru.clear();
+}
+
+void RedisRecordCache::erase(unordered_map<string, Entry>::iterator it) {
+	string key = it->first;
+	mLru.erase(it->second.lruIt);
+	mEntries.erase(it);
+	mOnRemoved(key);
+}
+
+void RegistrarDbRedisAsync::cacheRecord(const string &key, redisReply *reply) {
+	if (!mRecordCache.enabled())
+		return;
+	RedisRecordCache::Fields fields;
+	fields.reserve(reply->elements / 2);
+	for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+		fields.emplace_back(string(reply->element[i]->str, reply->element[i]->len),
+							string(reply->element[i + 1]->str, reply->element[i + 1]->len));
+	}
+	if (mRecordCache.insert(key, move(fields), getCurrentTime()) && mContactListenersMap.count(key) == 0) {
+		// Be told when another node modifies the record.
+		subscribeTopic(key);
+	}
+}
+
+void RegistrarDbRedisAsync::invalidateRecord(const string &key) {
+	if (mRecordCache.enabled())
+		mRecordCache.invalidate(key);
+}
+
+/*
+ * Tells the other flexisip nodes that a record was modified outside of a registration, which the Registrar module
+ * publishes itself, so that they drop it from their cache. No contact is given to the listeners of the record.
+ */
+void RegistrarDbRedisAsync::publishRecordChange(const string &key) {
+	publish(key, "");
+}
+
+/* Same as handleFetch() and parseAndClean() for a record found in the cache: the outdated contacts were already removed
+ * from redis when it was fetched. */
+void RegistrarDbRedisAsync::fetchFromCache(RegistrarUserData *data, const RedisRecordCache::Fields &fields) {
+	const char *key = data->mRecord->getKey().c_str();
+	LOGD("GOT fs:%s [%lu] from cache --> %lu contacts", key, data->token, (unsigned long)fields.size());
+	for (const auto &field : fields) {
+		data->mRecord->updateFromSerializedContact(key, field.first.c_str(), field.second.data(), field.second.size(),
+												   data->listener);
+	}
+	data->mRecord->applyMaxAor();
+	data->mRecord->cleanContactsToRemoveList();
+	data->mRecord->clean(getCurrentTime(), data->listener);
+	if (data->listener) data->listener->onRecordFound(data->mRecord);
+	delete data;
+}
+
+/*
+ * Fetch of a list of AORs. The records are requested by chunks of at most mFetchBatchSize HGETALL commands, which
+ * hiredis pipelines on the connection. The next chunk is only sent once every reply of the current one was handled,
+ * and the list listener is notified once all the records were fetched.
+ */
+class RegistrarDbRedisAsync::BatchFetch : public ContactUpdateListener, public enable_shared_from_this<BatchFetch> {
+public:
+	BatchFetch(RegistrarDbRedisAsync *db, const shared_ptr<ListContactUpdateListener> &listener)
+		: mDb(db), mListener(listener), mPending(0) {
+	}
+	~BatchFetch() {
+		for (auto data : mQueue)
+			delete data;
+	}
+
+	void start(const vector<url_t *> &urls) {
+		unordered_set<string> keys;
+		vector<const url_t *> instances;
+
+		for (const url_t *url : urls) {
+			// A gruu designates a single contact: it is fetched with HGET by the regular path.
+			if (url_has_param(url, "gr")) {
+				instances.push_back(url);
+				continue;
+			}
+			RegistrarUserData *data = new RegistrarUserData(mDb, url, shared_from_this());
+			if (!keys.insert(data->mRecord->getKey()).second) {
+				// Several urls of the list lead to the same record, fetch it only once.
+				delete data;
+				continue;
+			}
+			mQueue.push_back(data);
+		}
+		LOGD("Fetching %lu records from redis by batches of %lu", (unsigned long)mQueue.size(),
+			 (unsigned long)mDb->mFetchBatchSize);
+
+		// Hold one pending reference so that synchronous failures cannot complete the batch while it is sent.
+		mPending = 1;
+		for (const url_t *url : instances) {
+			mPending++;
+			mDb->fetch(url, shared_from_this());
+		}
+		sendNextChunk();
+	}
+
+private:
+	void onRecordFound(const shared_ptr<Record> &r) override {
+		if (r)
+			mListener->records.push_back(r);
+		done();
+	}
+	void onError() override {
+		SLOGE << "Error while fetching contact";
+		done();
+	}
+	void onInvalid() override {
+		SLOGE << "Invalid fetch of contact";
+		done();
+	}
+	void onContactUpdated(const shared_ptr<ExtendedContact> &ec) override {
+	}
+
+	void sendNextChunk() {
+		size_t count = min(mQueue.size(), mDb->mFetchBatchSize);
+		mPending += count;
+		for (size_t i = 0; i < count; ++i) {
+			RegistrarUserData *data = mQueue.front();
+			mQueue.pop_front();
+			mDb->sendFetch(data);
+		}
+		done();
+	}
+	void done() {
+		if (--mPending > 0)
+			return;
+		if (!mQueue.empty()) {
+			mPending = 1;
+			sendNextChunk();
+			return;
+		}
+		mListener->onContactsUpdated();
+	}
+
+	RegistrarDbRedisAsync *mDb;
+	shared_ptr<ListContactUpdateListener> mListener;
+	deque<RegistrarUserData *> mQueue;
+	size_t mPending;
+};
+
+void RegistrarDbRedisAsync::doFetchList(const vector<url_t *> &urls, const shared_ptr<ListContactUpdateListener> &listener) {
+	make_shared<BatchFetch>(this, listener)->start(urls);
+}
+
 /*
  * The following code is to migrate a redis database to the new way
  */
@@ -25,19 +25,14 @@
 #include <hiredis/hiredis.h>
 #include <hiredis/async.h>
 #include <flexisip/agent.hh>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace flexisip {
 
-struct RedisParameters {
-	RedisParameters() : port(0), timeout(0) {
-	}
-	std::string domain;
-	std::string auth;
-	int port;
-	int timeout;
-	int mSlaveCheckTimeout;
-};
-
 /**
  * @brief The RedisHost struct, which is used to store redis slave description.
  */
@@ -71,6 +66,57 @@ struct RedisHost {
 	std::string state;
 };
 
+/* Statistics of a redis shard, declared once by RegistrarDb::initialize() along with the shard list. */
+struct RedisShardStats {
+	StatCounter64 *mCountCommands = nullptr;
+	StatCounter64 *mCountErrors = nullptr;
+	StatCounter64 *mCountLatency = nullptr;
+};
+
+struct RedisParameters {
+	RedisParameters()
+		: port(0), timeout(0), mSlaveCheckTimeout(0), mFetchBatchSize(64), mRecordCacheSize(0), mRecordCacheTtl(30),
+		  mBinaryContacts(false), mRoundTripTime(nullptr) {
+	}
+	std::string domain;
+	std::string auth;
+	int port;
+	int timeout;
+	int mSlaveCheckTimeout;
+	int mFetchBatchSize;
+	std::vector<RedisHost> mShards;
+	std::vector<RedisShardStats> mShardStats; // one per shard, or empty to not count
+	int mRecordCacheSize;
+	int mRecordCacheTtl;
+	bool mBinaryContacts;
+	StatHistogram *mRoundTripTime; // declared with the Registrar module, null to not measure
+	StatCounter64 *mCacheHits = nullptr; // same for the record cache counters
+	StatCounter64 *mCacheMisses = nullptr;
+	StatCounter64 *mCacheEvictions = nullptr;
+};
+
+class RegistrarDbRedisAsync;
+
+/**
+ * @brief A redis primary holding part of the records when they are sharded across several servers.
+ *
+ * Records are assigned to shards by consistent hashing of their key, so that adding a shard only moves a fraction of
+ * them. The shard list must be the same, and in the same order, on all the flexisip nodes sharing the servers.
+ */
+struct RedisShard {
+	RedisShard(RegistrarDbRedisAsync *db, const RedisHost &host) : mDb(db), mHost(host) {
+	}
+
+	RegistrarDbRedisAsync *mDb;
+	RedisHost mHost;
+	redisAsyncContext *mContext = nullptr;
+	redisAsyncContext *mSubscribeContext = nullptr;
+	su_timer_t *mReconnectTimer = nullptr; // pending while a lost connection waits to be opened again
+	StatCounter64 *mCountCommands = nullptr;
+	StatCounter64 *mCountErrors = nullptr;
+	StatCounter64 *mCountLatency = nullptr;
+};
+
 
 
 /******
@@ -96,6 +142,54 @@ struct RegistrarUserData {
 	~RegistrarUserData();
 };
 
+/**
+ * @brief Size bounded LRU cache of the records fetched from redis.
+ *
+ * The raw fields of the redis hash are kept rather than the Record, so that a new Record is built for each hit and
+ * listeners never share one. An invalidated or expired entry keeps its place until it is fetched again or evicted, so
+ * that the owner stays subscribed to the changes of the record meanwhile. The owner is told through the removal
+ * callback when an entry leaves the cache, except on clear().
+ */
+class RedisRecordCache {
+  public:
+	typedef std::vector<std::pair<std::string, std::string>> Fields;
+
+	RedisRecordCache(size_t maxSize, time_t ttl, const std::function<void(const std::string &)> &onRemoved)
+		: mMaxSize(maxSize), mTtl(ttl), mOnRemoved(onRemoved) {
+	}
+
+	bool enabled() const {
+		return mMaxSize > 0;
+	}
+	bool contains(const std::string &key) const {
+		return mEntries.find(key) != mEntries.end();
+	}
+	/* Returns the fields of the record, or nullptr if it is not cached, or its entry was invalidated or expired. */
+	const Fields *find(const std::string &key, time_t now);
+	/* Returns whether the key was not cached yet. */
+	bool insert(const std::string &key, Fields &&fields, time_t now);
+	void invalidate(const std::string &key);
+	void clear();
+
+	StatCounter64 *mCountHits = nullptr;
+	StatCounter64 *mCountMisses = nullptr;
+	StatCounter64 *mCountEvictions = nullptr;
+
+  private:
+	struct Entry {
+		Fields fields;
+		time_t expireAt; // 0 once invalidated
+		std::list<std::string>::iterator lruIt;
+	};
+	void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+	size_t mMaxSize;
+	time_t mTtl;
+	std::function<void(const std::string &)> mOnRemoved;
+	std::list<std::string> mLru; // most recently used first
+	std::unordered_map<std::string, Entry> mEntries;
+};
+
 class RegistrarDbRedisAsync : public RegistrarDb {
   public:
 	RegistrarDbRedisAsync(const std::string &preferredRoute, su_root_t *root, RecordSerializer *serializer,
@@ -109,12 +203,16 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	virtual void doClear(const sip_t *sip, const std::shared_ptr<ContactUpdateListener> &listener)override;
 	virtual void doFetch(const url_t *url, const std::shared_ptr<ContactUpdateListener> &listener)override;
 	virtual void doFetchInstance(const url_t *url, const std::string &uniqueId, const std::shared_ptr<ContactUpdateListener> &listener)override;
+	virtual void doFetchList(const std::vector<url_t *> &urls, const std::shared_ptr<ListContactUpdateListener> &listener)override;
 	virtual void doMigration()override;
 	virtual void subscribe(const std::string &topic, const std::shared_ptr<ContactRegisteredListener> &listener)override;
 	virtual void unsubscribe(const std::string &topic, const std::shared_ptr<ContactRegisteredListener> &listener)override;
 	virtual void publish(const std::string &topic, const std::string &uid)override;
 
   private:
+	class BatchFetch;
+	struct ShardCommand;
+
 	RegistrarDbRedisAsync(Agent *agent, RedisParameters params);
 	~RegistrarDbRedisAsync();
 	static void sConnectCallback(const redisAsyncContext *c, int status);
@@ -124,6 +222,12 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	static void sPublishCallback(redisAsyncContext *c, void *r, void *privdata);
 	static void sKeyExpirationPublishCallback(redisAsyncContext *c, void *r, void *data);
 	static void sBindRetry(void *unused, su_timer_t *t, void *ud);
+	static void sShardConnectCallback(const redisAsyncContext *c, int status);
+	static void sShardDisconnectCallback(const redisAsyncContext *c, int status);
+	static void sShardSubscribeConnectCallback(const redisAsyncContext *c, int status);
+	static void sShardSubscribeDisconnectCallback(const redisAsyncContext *c, int status);
+	static void sShardReconnect(void *unused, su_timer_t *t, void *data);
+	static void sShardCommandCallback(redisAsyncContext *c, void *r, void *privdata);
 	bool isConnected();
 	void setWritable (bool value);
 	friend class RegistrarDb;
@@ -138,6 +242,12 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	size_t mCurSlave;
 	su_timer_t *mReplicationTimer;
 	int mSlaveCheckTimeout;
+	size_t mFetchBatchSize;
+	std::vector<std::unique_ptr<RedisShard>> mShards;
+	std::vector<std::pair<uint32_t, RedisShard *>> mShardRing; // sorted by hash
+	RedisRecordCache mRecordCache;
+	bool mBinaryContacts;
+	StatHistogram *mRoundTripTime = nullptr;
 	/*std::list<RegistrarUserData*> mQueue;
 	bool mAddToQueue;*/
 
@@ -148,6 +258,23 @@ class RegistrarDbRedisAsync : public RegistrarDb {
 	void subscribeAll();
 	void subscribeToKeyExpiration();
 	void parseAndClean(redisReply *reply, RegistrarUserData *data);
+	void sendFetch(RegistrarUserData *data);
+	void fetchFromCache(RegistrarUserData *data, const RedisRecordCache::Fields &fields);
+	void cacheRecord(const std::string &key, redisReply *reply);
+	void invalidateRecord(const std::string &key);
+	void publishRecordChange(const std::string &key);
+	void releaseTopic(const std::string &topic);
+
+	/* sharding */
+	void setupShards(const std::vector<RedisHost> &hosts, const std::vector<RedisShardStats> &stats);
+	RedisShard *findShard(const std::string &key) const;
+	bool connectShard(RedisShard &shard);
+	void disconnectShard(RedisShard &shard);
+	void scheduleShardReconnect(RedisShard &shard);
+	redisAsyncContext *getRecordContext(const std::string &key, RedisShard **shard = nullptr);
+	int recordCommand(const std::string &key, redisCallbackFn *fn, void *privdata, const char *format, ...);
+	int recordCommandArgv(const std::string &key, redisCallbackFn *fn, void *privdata, int argc, const char **argv,
+						  const size_t *argvlen);
 	//void dequeueNextRedisCommand();
 
 	/* callbacks */
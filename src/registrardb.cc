@@ -59,7 +59,7 @@ ostream &ExtendedContact::print(ostream &stream, time_t _now, time_t _offset) co
 		stream << *it;
 	}
 	stream << "\"";
-	stream << " user-agent=\"" << mUserAgent << "\"";
+	stream << " user-agent=\"" << *mUserAgent << "\"";
 	stream << " alias=" << (mAlias ? "yes" : "no");
 	if (!mAlias)
 		stream << " uid=" << mUniqueId;
@@ -159,7 +159,7 @@ string Record::extractUniqueId(const sip_contact_t *contact) {
 }
 
 const shared_ptr<ExtendedContact> Record::extractContactByUniqueId(string uid) {
-	const auto contacts = getExtendedContacts();
+	const auto &contacts = getExtendedContacts();
 	for (auto it = contacts.begin(); it != contacts.end(); ++it) {
 		const shared_ptr<ExtendedContact> ec = *it;
 		if (ec && ec->mUniqueId.compare(uid) == 0) {
@@ -308,6 +308,7 @@ void ExtendedContact::extractInfoFromHeader(const char *urlHeaders) {
 		msg_prepare(msg.get());
 
 		headers = *msg_chain_head(msg.get());
+		list<string> acceptHeaders;
 
 		while(headers) {
 			if (reinterpret_cast<msg_common_t*>(headers)->h_len > 0 &&
@@ -330,29 +331,28 @@ void ExtendedContact::extractInfoFromHeader(const char *urlHeaders) {
 						LOGE("ExtendedContact::extractInfoFromHeader(): bad path [%s]", valueStr.c_str()); 
 					}
 				} else if (keyStr == "accept") {
-					mAcceptHeader.push_back(valueStr);
+					acceptHeaders.push_back(valueStr);
 				} else if (keyStr == "user-agent") {
 					mUserAgent = valueStr;
 				}
 			}
 			headers = reinterpret_cast<msg_common_t*>(headers)->h_succ;
 		}
+		mAcceptHeader = acceptHeaders;
 	}
 }
 
-static bool compare_contact_using_last_update (shared_ptr<ExtendedContact> first, shared_ptr<ExtendedContact> second) {
+static bool compare_contact_using_last_update (const shared_ptr<ExtendedContact> &first, const shared_ptr<ExtendedContact> &second) {
 	return first->mUpdatedTime < second->mUpdatedTime;
 }
 
 void Record::applyMaxAor() {
 	// If contact doesn't exist and there is space left
 	if (mContacts.size() > (unsigned int)sMaxContacts) {
-		mContacts.sort(compare_contact_using_last_update);
-		do {
-			shared_ptr<ExtendedContact> front = mContacts.front();
-			mContacts.pop_front();
-			mContactsToRemove.push_back(front);
-		} while (mContacts.size() > (unsigned int)sMaxContacts);
+		stable_sort(mContacts.begin(), mContacts.end(), compare_contact_using_last_update);
+		auto removedEnd = mContacts.begin() + (mContacts.size() - sMaxContacts);
+		mContactsToRemove.insert(mContactsToRemove.end(), mContacts.begin(), removedEnd);
+		mContacts.erase(mContacts.begin(), removedEnd);
 	}
 }
 
@@ -415,19 +415,164 @@ string ExtendedContact::serializeAsUrlEncodedParams() {
 
 	// AcceptHeaders
 	ostringstream oss_accept;
-	for (auto it = mAcceptHeader.begin(); it != mAcceptHeader.end(); ++it) {
-		if (it != mAcceptHeader.begin()) oss_accept << ",";
+	for (auto it = mAcceptHeader->begin(); it != mAcceptHeader->end(); ++it) {
+		if (it != mAcceptHeader->begin()) oss_accept << ",";
 		oss_accept << *it;
 	}
 
 	contact->m_url->url_headers = sip_headers_as_url_query(home.home(),
 		SIPTAG_PATH_STR(oss_path.str().c_str()), SIPTAG_ACCEPT_STR(oss_accept.str().c_str()),
-		SIPTAG_USER_AGENT_STR(mUserAgent.c_str()) , TAG_END());
+		SIPTAG_USER_AGENT_STR(mUserAgent->c_str()) , TAG_END());
 
 	string contact_string(sip_header_as_string(home.home(), (sip_header_t const *)contact));
 	return contact_string;
 }
 
+static void appendVarint(string &out, uint64_t value) {
+	while (value >= 0x80) {
+		out += char((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += char(value);
+}
+
+static void appendSignedVarint(string &out, int64_t value) {
+	appendVarint(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+static void appendString(string &out, const char *str, size_t len) {
+	appendVarint(out, len);
+	out.append(str, len);
+}
+
+static void appendString(string &out, const string &str) {
+	appendString(out, str.data(), str.size());
+}
+
+enum BinaryContactFlags { BinaryContactAlias = 1, BinaryContactUsedAsRoute = 2 };
+
+string ExtendedContact::serializeAsBinary() const {
+	SofiaAutoHome home;
+	const char *contact = sip_header_as_string(home.home(), (sip_header_t const *)mSipContact);
+	string out;
+	out.reserve(128);
+	out += sBinaryMarker;
+	out += char(sBinaryVersion);
+	appendString(out, contact ? contact : "", contact ? strlen(contact) : 0);
+	appendString(out, mCallId);
+	appendSignedVarint(out, mExpireNotAtMessage - getCurrentTime());
+	appendVarint(out, mUpdatedTime);
+	appendVarint(out, mCSeq);
+	out += char((mAlias ? BinaryContactAlias : 0) | (mUsedAsRoute ? BinaryContactUsedAsRoute : 0));
+	appendVarint(out, mPath.size());
+	for (const auto &path : mPath)
+		appendString(out, path);
+	appendVarint(out, mAcceptHeader->size());
+	for (const auto &accept : *mAcceptHeader)
+		appendString(out, accept);
+	appendString(out, *mUserAgent);
+	return out;
+}
+
+namespace {
+/* Reads the fields of a binary encoded contact in place. */
+class BinaryContactReader {
+  public:
+	BinaryContactReader(const char *data, size_t len) : mPos(data), mEnd(data + len) {
+	}
+	bool readVarint(uint64_t &value) {
+		value = 0;
+		for (int shift = 0; shift < 64 && mPos < mEnd; shift += 7) {
+			uint8_t byte = *mPos++;
+			value |= uint64_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+	bool readSignedVarint(int64_t &value) {
+		uint64_t zigzag;
+		if (!readVarint(zigzag))
+			return false;
+		value = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+		return true;
+	}
+	bool readByte(uint8_t &value) {
+		if (mPos >= mEnd)
+			return false;
+		value = *mPos++;
+		return true;
+	}
+	bool readString(const char *&str, size_t &len) {
+		uint64_t size;
+		if (!readVarint(size) || size > uint64_t(mEnd - mPos))
+			return false;
+		str = mPos;
+		len = size;
+		mPos += size;
+		return true;
+	}
+	bool readString(string &value) {
+		const char *str;
+		size_t len;
+		if (!readString(str, len))
+			return false;
+		value.assign(str, len);
+		return true;
+	}
+	bool readStringList(list<string> &values) {
+		uint64_t count;
+		if (!readVarint(count) || count > uint64_t(mEnd - mPos))
+			return false;
+		for (uint64_t i = 0; i < count; ++i) {
+			values.emplace_back();
+			if (!readString(values.back()))
+				return false;
+		}
+		return true;
+	}
+
+  private:
+	const char *mPos;
+	const char *mEnd;
+};
+}
+
+bool ExtendedContact::extractInfoFromBinary(const char *data, size_t len) {
+	BinaryContactReader reader(data + 2, len - 2);
+	const char *contact;
+	size_t contactLen;
+	int64_t expires;
+	uint64_t updatedAt, cseq;
+	uint8_t flags;
+	list<string> acceptHeaders;
+	string userAgent;
+
+	if ((uint8_t)data[1] != sBinaryVersion) {
+		LOGE("ExtendedContact::extractInfoFromBinary(): unsupported version %u", (unsigned)(uint8_t)data[1]);
+		return false;
+	}
+	if (!reader.readString(contact, contactLen) || !reader.readString(mCallId) || !reader.readSignedVarint(expires) ||
+		!reader.readVarint(updatedAt) || !reader.readVarint(cseq) || !reader.readByte(flags) ||
+		!reader.readStringList(mPath) || !reader.readStringList(acceptHeaders) || !reader.readString(userAgent)) {
+		LOGE("ExtendedContact::extractInfoFromBinary(): truncated contact");
+		return false;
+	}
+	mExpireNotAtMessage = expires;
+	mUpdatedTime = updatedAt;
+	mCSeq = cseq;
+	mAlias = flags & BinaryContactAlias;
+	mUsedAsRoute = flags & BinaryContactUsedAsRoute;
+	mAcceptHeader = acceptHeaders;
+	mUserAgent = userAgent;
+	mSipContact = sip_contact_make(mHome.home(), su_strndup(mHome.home(), contact, contactLen));
+	if (!mSipContact) {
+		LOGE("ExtendedContact::extractInfoFromBinary(): bad contact [%.*s]", (int)contactLen, contact);
+		return false;
+	}
+	return true;
+}
+
 static string extractStringParam(url_t *url, const char *param) {
 	char buffer[255] = {0};
 	if (url_has_param(url, param)) {
@@ -535,6 +680,18 @@ bool Record::updateFromUrlEncodedParams(const char *key, const char *uid, const
 	return false;
 }
 
+bool Record::updateFromSerializedContact(const char *key, const char *uid, const char *data, size_t len,
+										  const shared_ptr<ContactUpdateListener> &listener) {
+	auto exc = make_shared<ExtendedContact>(key, uid, data, len);
+
+	if (exc->mSipContact && getCurrentTime() < exc->mExpireAt) {
+		insertOrUpdateBinding(exc, listener);
+		return true;
+	}
+
+	return false;
+}
+
 void Record::update(const sip_t *sip, int globalExpire, bool alias, int version, const shared_ptr<ContactUpdateListener> &listener) {
 	list<string> stlPath;
 	SofiaAutoHome home;
@@ -682,9 +839,7 @@ void Record::appendContactsFrom(const shared_ptr<Record> &src) {
 	if (!src)
 		return;
 
-	for (auto it = src->mContacts.begin(); it != src->mContacts.end(); ++it) {
-		mContacts.push_back(*it);
-	}
+	mContacts.insert(mContacts.end(), src->mContacts.begin(), src->mContacts.end());
 }
 
 RegistrarDb::LocalRegExpire::LocalRegExpire(Agent *ag) : mAgent(ag) {
@@ -780,10 +935,12 @@ void RegistrarDb::LocalRegExpire::update(const shared_ptr<Record> &record) {
 	if (latest > 0) {
 		auto it = mRegMap.find(record->getKey());
 		if (it != mRegMap.end()) {
-			(*it).second = latest;
+			(*it).second.mExpire = latest;
+			setTimer((*it).first, (*it).second);
 		} else {
 			if (!record->isEmpty() && !record->haveOnlyStaticContacts()) {
-				mRegMap.insert(make_pair(record->getKey(), latest));
+				it = mRegMap.insert(make_pair(record->getKey(), Expiration{latest, nullptr})).first;
+				setTimer((*it).first, (*it).second);
 				notifyLocalRegExpireListener(mRegMap.size());
 			}
 		}
@@ -793,23 +950,24 @@ void RegistrarDb::LocalRegExpire::update(const shared_ptr<Record> &record) {
 	}
 }
 
-size_t RegistrarDb::LocalRegExpire::countActives() {
-	return mRegMap.size();
+void RegistrarDb::LocalRegExpire::setTimer(const string &key, Expiration &expiration) {
+	if (!mAgent)
+		return;
+	if (!expiration.mTimer)
+		expiration.mTimer.reset(new WheelTimer(mAgent->getTimerWheel()));
+	time_t now = getCurrentTime();
+	expiration.mTimer->setSeconds(expiration.mExpire > now ? expiration.mExpire - now : 0,
+								  [this, key]() { onExpired(key); });
 }
-void RegistrarDb::LocalRegExpire::removeExpiredBefore(time_t before) {
+
+void RegistrarDb::LocalRegExpire::onExpired(const string &key) {
 	unique_lock<mutex> lock(mMutex);
+	mRegMap.erase(key);
+	notifyLocalRegExpireListener(mRegMap.size());
+}
 
-	for (auto it = mRegMap.begin(); it != mRegMap.end();) {
-		// LOGE("> %s [%lu]", (*it).first.c_str(), (*it).second-before);
-		if ((*it).second <= before) {
-			auto prevIt = it;
-			++it;
-			mRegMap.erase(prevIt);
-			notifyLocalRegExpireListener(mRegMap.size());
-		} else {
-			++it;
-		}
-	}
+size_t RegistrarDb::LocalRegExpire::countActives() {
+	return mRegMap.size();
 }
 
 void RegistrarDb::LocalRegExpire::subscribe(LocalRegExpireListener *listener) {
@@ -887,6 +1045,47 @@ RegistrarDb *RegistrarDb::initialize(Agent *ag){
 		params.timeout = registrar->get<ConfigInt>("redis-server-timeout")->read();
 		params.auth = registrar->get<ConfigString>("redis-auth-password")->read();
 		params.mSlaveCheckTimeout = registrar->get<ConfigInt>("redis-slave-check-period")->read();
+		params.mFetchBatchSize = registrar->get<ConfigInt>("redis-fetch-batch-size")->read();
+		if (params.mFetchBatchSize <= 0) {
+			LOGF("Invalid 'redis-fetch-batch-size' value %i, it must be strictly positive.", params.mFetchBatchSize);
+		}
+		params.mRecordCacheSize = registrar->get<ConfigInt>("redis-record-cache-size")->read();
+		params.mRecordCacheTtl = registrar->get<ConfigInt>("redis-record-cache-ttl")->read();
+		if (params.mRecordCacheSize < 0 || params.mRecordCacheTtl <= 0) {
+			LOGF("Invalid 'redis-record-cache-size' or 'redis-record-cache-ttl' value.");
+		}
+		string contactEncoding = registrar->get<ConfigString>("redis-contact-encoding")->read();
+		if (contactEncoding != "url-params" && contactEncoding != "binary") {
+			LOGF("Invalid 'redis-contact-encoding' value '%s', expecting 'url-params' or 'binary'.", contactEncoding.c_str());
+		}
+		params.mBinaryContacts = (contactEncoding == "binary");
+		params.mRoundTripTime = registrar->get<StatHistogram>("redis-round-trip-time-us");
+		params.mCacheHits = registrar->get<StatCounter64>("count-redis-cache-hits");
+		params.mCacheMisses = registrar->get<StatCounter64>("count-redis-cache-misses");
+		params.mCacheEvictions = registrar->get<StatCounter64>("count-redis-cache-evictions");
+		for (const auto &shard : registrar->get<ConfigStringList>("redis-shards")->read()) {
+			string address = shard;
+			int port = params.port;
+			size_t colon = shard.rfind(':');
+			if (colon != string::npos) {
+				address = shard.substr(0, colon);
+				port = atoi(shard.substr(colon + 1).c_str());
+			}
+			if (address.empty() || port <= 0 || port > 65535) {
+				LOGF("Invalid redis shard '%s', expecting host[:port].", shard.c_str());
+			}
+			int id = (int)params.mShards.size();
+			params.mShards.emplace_back(id, address, port, "");
+			/* initialize() runs once, the statistics of the configured shards are declared here */
+			string prefix = "count-redis-shard-" + to_string(id);
+			string desc = " on redis shard " + address + ":" + to_string(port) + ".";
+			RedisShardStats stats;
+			stats.mCountCommands = registrar->createStat(prefix + "-commands", "Number of commands sent" + desc);
+			stats.mCountErrors = registrar->createStat(prefix + "-errors", "Number of failed commands" + desc);
+			stats.mCountLatency = registrar->createStat(prefix + "-latency-us",
+				"Cumulated latency of the commands in microseconds" + desc);
+			params.mShardStats.push_back(stats);
+		}
 
 		sUnique = new RegistrarDbRedisAsync(ag, params);
 		sUnique->mUseGlobalDomain = useGlobalDomain;
@@ -960,6 +1159,9 @@ class RecursiveRegistrarDbListener : public ContactUpdateListener,
 			list<sip_contact_t *> vectToRecurseOn;
 			for (auto it : extlist) {
 				shared_ptr<ExtendedContact> ec = it;
+				// The deepest level is the record the contact is bound to, the upper ones only merge its contacts
+				if (ec->mRecordKey.empty())
+					ec->mRecordKey = r->getKey();
 				// Also add alias for late forking (context in the forks map for this alias key)
 				SLOGD << "Step: " << m_step << (ec->mAlias ? "\tFound alias " : "\tFound contact ") << m_url << " -> "
 					  << ExtendedContact::urlToString(ec->mSipContact->m_url) << " usedAsRoute:" << ec->mUsedAsRoute;
@@ -1085,6 +1287,14 @@ void RegistrarDb::fetch(const url_t *url, const shared_ptr<ContactUpdateListener
 }
 
 void RegistrarDb::fetchList(const vector<url_t *> urls, const shared_ptr<ListContactUpdateListener> &listener) {
+	if (urls.empty()) {
+		listener->onContactsUpdated();
+		return;
+	}
+	doFetchList(urls, listener);
+}
+
+void RegistrarDb::doFetchList(const vector<url_t *> &urls, const shared_ptr<ListContactUpdateListener> &listener) {
 	class InternalContactUpdateListener : public ContactUpdateListener {
 	public:
 		InternalContactUpdateListener(shared_ptr<ListContactUpdateListener> listener, size_t size) : listListener(listener), count(size) {}
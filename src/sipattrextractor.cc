@@ -22,132 +22,182 @@
 #include <sofia-sip/sip.h>
 #include <sofia-sip/sip_protos.h>
 #include <stdexcept>
+#include <cstdio>
 
 using namespace std;
 using namespace flexisip;
 
-static string subKey(const string &key, size_t *pos) {
-	size_t dot = key.find('.', *pos) - *pos;
-	if (dot != string::npos) {
-		string id = key.substr(*pos, dot);
-		//			LOGD("SUBKEY '%s' from '%s'", id.c_str(), key.c_str());
-		*pos += dot + 1;
-		return id;
-	}
+/*
+ * Each attribute that can be used in a filter expression is extracted by a dedicated function, so that the dotted
+ * key only has to be resolved once. The functions return false when the attribute is missing from the message.
+ */
+typedef bool (*AttributeGetter)(const sip_t *sip, string &value);
+typedef bool (*BooleanAttributeGetter)(const sip_t *sip);
 
-	if (key.size() != *pos) {
-		//			LOGD("SUBKEY '%s'", key.c_str());
-		*pos = key.size();
-		return key;
-	}
-	return "";
+inline static bool cstring_get(const char *str, string &value) {
+	if (!str)
+		return false;
+	value.assign(str);
+	return true;
 }
 
-inline static string cstring_get(const string &key, size_t pos, const char *str) {
-	if (!str)
-		throw invalid_argument("Null string found in sip msg for " + key);
-	return str;
+inline static bool int_get(int number, string &value) {
+	char tmp[16];
+	snprintf(tmp, sizeof(tmp), "%i", number);
+	value.assign(tmp);
+	return true;
+}
+
+static const url_t *from_url(const sip_t *sip) {
+	return sip->sip_from ? sip->sip_from->a_url : NULL;
+}
+
+static const url_t *to_url(const sip_t *sip) {
+	return sip->sip_to ? sip->sip_to->a_url : NULL;
 }
-inline static string cstring_or_empty_get(const string &key, size_t pos, const char *str) {
-	return str ? str : "";
+
+static const url_t *request_url(const sip_t *sip) {
+	return sip->sip_request ? sip->sip_request->rq_url : NULL;
+}
+
+template <const url_t *(*urlOf)(const sip_t *)> static bool url_domain_get(const sip_t *sip, string &value) {
+	const url_t *url = urlOf(sip);
+	return url && cstring_get(url->url_host, value);
 }
 
-inline static string int_get(const string &key, size_t pos, int value) {
-	ostringstream oss;
-	oss << value;
-	return oss.str();
+template <const url_t *(*urlOf)(const sip_t *)> static bool url_user_get(const sip_t *sip, string &value) {
+	const url_t *url = urlOf(sip);
+	return url && cstring_get(url->url_user, value);
 }
 
-static string url_get(const string &key, size_t pos, const url_t *url) {
-	string id = subKey(key, &pos);
+template <const url_t *(*urlOf)(const sip_t *)> static bool url_params_get(const sip_t *sip, string &value) {
+	const url_t *url = urlOf(sip);
 	if (!url)
-		throw invalid_argument("No url found in sip msg for " + key);
-	if (id == "domain")
-		return cstring_get(key, pos, url->url_host);
-	if (id == "user")
-		return cstring_get(key, pos, url->url_user);
-	if (id == "params")
-		return cstring_or_empty_get(key, pos, url->url_params);
-	throw runtime_error("url_get: unhandled arg '" + id + "' in " + key);
-}
-
-static string addr_get(const string &key, size_t pos, const sip_addr_s *addr) {
-	string id = subKey(key, &pos);
-	if (!addr)
-		throw invalid_argument("No address found in sip msg for " + key);
-	if (id == "uri")
-		return url_get(key, pos, addr->a_url);
-	throw runtime_error("addr_get: unhandled arg '" + id + "' in " + key);
-}
-
-static string request_get(const string &key, size_t pos, const sip_request_t *req) {
-	string id = subKey(key, &pos);
-	if (!req)
-		throw invalid_argument("No request found in sip msg for " + key);
-	if (id == "uri")
-		return url_get(key, pos, req->rq_url);
-	if (id == "mn" || id == "method-name")
-		return cstring_get(key, pos, req->rq_method_name);
-	throw runtime_error("request_get: unhandled arg '" + id + "' in " + key);
-}
-
-static string ua_get(const string &key, size_t pos, const sip_user_agent_t *ua) {
-	if (!ua)
-		throw invalid_argument("No user-agent found in sip msg for " + key);
-	return cstring_get(key, pos, ua->g_string);
-}
-
-static string status_get(const string &key, size_t pos, const sip_status_s *status) {
-	string id = subKey(key, &pos);
-	if (!status)
-		throw invalid_argument("No status found in sip msg for " + key);
-	if (id == "phrase")
-		return cstring_get(key, pos, status->st_phrase);
-	if (id == "code")
-		return int_get(key, pos, status->st_status);
-	throw runtime_error("status_get: unhandled arg '" + id + "' in " + key);
-}
-
-static string callid_get(const string &key, size_t pos, const sip_call_id_s *callid) {
-	string id = subKey(key, &pos);
-	if (id.empty())
-		return cstring_get(key, pos, callid->i_id);
-	if (id == "hash")
-		return int_get(key, pos, callid->i_hash);
-	throw runtime_error("callid_get: unhandled arg '" + id + "' in " + key);
+		return false;
+	if (!cstring_get(url->url_params, value))
+		value.clear();
+	return true;
 }
 
 static bool is_request(const sip_t *sip) {
 	return sip_is_request((sip_header_t *)sip->sip_request);
 }
 
-std::string SipAttributes::get(const std::string &key) const {
-	size_t pos = 0;
-	string id = subKey(key, &pos);
+static bool is_response(const sip_t *sip) {
+	return !is_request(sip);
+}
 
-	if (id == "from")
-		return addr_get(key, pos, (sip_addr_s *)sip->sip_from);
-	if (id == "to")
-		return addr_get(key, pos, (sip_addr_s *)sip->sip_to);
-	if (id == "request")
-		return request_get(key, pos, sip->sip_request);
-	if (id == "direction")
-		return is_request(sip) ? "request" : "response";
-	if (id == "status")
-		return status_get(key, pos, (sip_status_s *)sip->sip_status);
-	if (id == "ua" || id == "user-agent")
-		return ua_get(key, pos, sip->sip_user_agent);
-	if (id == "callid")
-		return callid_get(key, pos, sip->sip_call_id);
+static bool method_get(const sip_t *sip, string &value) {
+	return sip->sip_request && cstring_get(sip->sip_request->rq_method_name, value);
+}
 
-	throw runtime_error("unhandled arg '" + id + "' in '" + key + "'");
+static bool direction_get(const sip_t *sip, string &value) {
+	value.assign(is_request(sip) ? "request" : "response");
+	return true;
 }
 
-bool SipAttributes::isTrue(const string &key) const {
-	if (key == "is_request") {
-		return is_request(sip);
-	} else if (key == "is_response") {
-		return !is_request(sip);
-	}
-	throw runtime_error("unhandled true/false " + key);
+static bool status_phrase_get(const sip_t *sip, string &value) {
+	return sip->sip_status && cstring_get(sip->sip_status->st_phrase, value);
+}
+
+static bool status_code_get(const sip_t *sip, string &value) {
+	return sip->sip_status && int_get(sip->sip_status->st_status, value);
+}
+
+static bool ua_get(const sip_t *sip, string &value) {
+	return sip->sip_user_agent && cstring_get(sip->sip_user_agent->g_string, value);
+}
+
+static bool callid_get(const sip_t *sip, string &value) {
+	return sip->sip_call_id && cstring_get(sip->sip_call_id->i_id, value);
+}
+
+static bool callid_hash_get(const sip_t *sip, string &value) {
+	return sip->sip_call_id && int_get(sip->sip_call_id->i_hash, value);
+}
+
+static const pair<const char *, AttributeGetter> sAttributes[] = {
+	{"from.uri.domain", &url_domain_get<from_url>},
+	{"from.uri.user", &url_user_get<from_url>},
+	{"from.uri.params", &url_params_get<from_url>},
+	{"to.uri.domain", &url_domain_get<to_url>},
+	{"to.uri.user", &url_user_get<to_url>},
+	{"to.uri.params", &url_params_get<to_url>},
+	{"request.uri.domain", &url_domain_get<request_url>},
+	{"request.uri.user", &url_user_get<request_url>},
+	{"request.uri.params", &url_params_get<request_url>},
+	{"request.mn", &method_get},
+	{"request.method-name", &method_get},
+	{"direction", &direction_get},
+	{"status.phrase", &status_phrase_get},
+	{"status.code", &status_code_get},
+	{"ua", &ua_get},
+	{"user-agent", &ua_get},
+	{"callid", &callid_get},
+	{"callid.hash", &callid_hash_get}
+};
+
+static const pair<const char *, BooleanAttributeGetter> sBooleanAttributes[] = {
+	{"is_request", &is_request},
+	{"is_response", &is_response}
 };
+
+template <typename _tableT, size_t _size> static int find_key(const _tableT (&table)[_size], const string &key) {
+	for (size_t i = 0; i < _size; ++i) {
+		if (key == table[i].first)
+			return (int)i;
+	}
+	return -1;
+}
+
+int SipAttributes::compileKey(const string &key) {
+	int id = find_key(sAttributes, key);
+	if (id == -1)
+		throw invalid_argument("unhandled arg '" + key + "'");
+	return id;
+}
+
+int SipAttributes::compileBooleanKey(const string &key) {
+	int id = find_key(sBooleanAttributes, key);
+	if (id == -1)
+		throw invalid_argument("unhandled true/false " + key);
+	return id;
+}
+
+bool SipAttributes::get(int id, string &value) const {
+	return sAttributes[id].second(sip, value);
+}
+
+bool SipAttributes::isTrue(int id) const {
+	return sBooleanAttributes[id].second(sip);
+}
+
+string SipAttributes::get(const string &key) const {
+	string value;
+	int id = find_key(sAttributes, key);
+	if (id == -1)
+		throw runtime_error("unhandled arg '" + key + "'");
+	if (!get(id, value))
+		throw invalid_argument("No value found in sip msg for " + key);
+	return value;
+}
+
+string SipAttributes::getOrEmpty(const string &key) const {
+	string value;
+	if (key == "method_or_status") {
+		if (!method_get(sip, value))
+			status_code_get(sip, value);
+		return value;
+	}
+	int id = find_key(sAttributes, key);
+	if (id != -1)
+		get(id, value);
+	return value;
+}
+
+bool SipAttributes::isTrue(const string &key) const {
+	int id = find_key(sBooleanAttributes, key);
+	if (id == -1)
+		throw runtime_error("unhandled true/false " + key);
+	return isTrue(id);
+}
@@ -42,23 +42,25 @@ class SipAttributes {
 	~SipAttributes() {
 	}
 
-	std::string get(const std::string &arg) const;
-
-	std::string getOrEmpty(const std::string &arg) const {
-		if (arg == "method_or_status") {
-			std::string method = getOrEmpty("request.mn");
-			if (!method.empty())
-				return method;
-			return getOrEmpty("status.code");
-		}
+	/**
+	 * Resolves a dotted key such as 'from.uri.domain' to an attribute identifier, to be given to get().
+	 * Meant to be called once, when a filter expression is parsed. Throws invalid_argument if the key is unknown.
+	 */
+	static int compileKey(const std::string &key);
+	/**
+	 * Same as compileKey() for the boolean attributes ('is_request', 'is_response'), to be given to isTrue().
+	 */
+	static int compileBooleanKey(const std::string &key);
+	/**
+	 * Fills value and returns true if the attribute is present in the message, returns false otherwise.
+	 * Never throws.
+	 */
+	bool get(int id, std::string &value) const;
+	bool isTrue(int id) const;
 
-		try {
-			return get(arg);
-		} catch (...) {
-			return "";
-		}
-	}
+	std::string get(const std::string &arg) const;
+	std::string getOrEmpty(const std::string &arg) const;
 	bool isTrue(const std::string &arg) const;
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,120 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Micro-benchmark of the entry filter expressions, evaluated against a real SIP message.
+ * For each attribute, the lookup by dotted key (SipAttributes::getOrEmpty(), which resolves the key on each call) is
+ * compared with the lookup through the identifier resolved once by SipAttributes::compileKey(), as done by filters.
+ */
+
+#include <flexisip/expressionparser.hh>
+#include "../sipattrextractor.hh"
+
+#include <sofia-sip/msg.h>
+#include <sofia-sip/sip.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *sInvite =
+	"INVITE sip:callee@sip.example.org SIP/2.0\r\n"
+	"Via: SIP/2.0/TLS 192.168.1.10:5061;branch=z9hG4bK.abcdef;rport\r\n"
+	"From: <sip:caller@sip.example.org>;tag=4321\r\n"
+	"To: <sip:callee@sip.example.org>\r\n"
+	"Call-ID: a84b4c76e66710@pc33.example.org\r\n"
+	"CSeq: 20 INVITE\r\n"
+	"Contact: <sip:caller@192.168.1.10:5061;transport=tls>\r\n"
+	"User-Agent: Linphone/3.5.2 (belle-sip/1.2.4)\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+static const char *sFilters[] = {
+	"is_request && request.method-name == 'INVITE'",
+	"from.uri.domain contains 'example.org'",
+	"from.uri.domain in 'a.org b.org c.org sip.example.org'",
+	"(to.uri.domain in 'a.org b.org c.org') && (user-agent == 'Linphone v2')",
+	"is_response || !(ua contains 'Linphone/3.5.2') || ((request.method-name == 'INVITE') && "
+	"!(request.uri.user contains 'ip'))",
+	"user-agent regex 'Linphone/[0-9.]+' && defined callid",
+	NULL};
+
+static const char *sKeys[] = {"from.uri.domain", "to.uri.user", "request.method-name", "user-agent", "status.code",
+							  NULL};
+
+template <typename _funcT> static double ratePerSecond(int iterations, _funcT func) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		func();
+	}
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	return iterations / elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	int iterations = 1000000;
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations <= 0) {
+		cerr << argv[0] << " [iterations]" << endl;
+		return -1;
+	}
+
+	msg_t *msg = msg_make(sip_default_mclass(), 0, sInvite, strlen(sInvite));
+	sip_t *sip = sip_object(msg);
+	if (!msg || !sip) {
+		cerr << "Cannot parse test message" << endl;
+		return -1;
+	}
+	SipAttributes attributes(sip);
+	volatile size_t sink = 0;
+
+	cout << fixed << setprecision(0);
+	cout << "Attribute lookups per second (by key / compiled):" << endl;
+	for (int k = 0; sKeys[k]; ++k) {
+		string key = sKeys[k];
+		int id = SipAttributes::compileKey(key);
+		string value;
+		double byKey = ratePerSecond(iterations, [&]() { sink += attributes.getOrEmpty(key).size(); });
+		double compiled = ratePerSecond(iterations, [&]() { sink += attributes.get(id, value) ? value.size() : 0; });
+		cout << "  " << setw(24) << left << key << right << setw(14) << byKey << setw(14) << compiled << endl;
+	}
+
+	cout << "Filter evaluations per second:" << endl;
+	for (int f = 0; sFilters[f]; ++f) {
+		shared_ptr<BooleanExpression> expr;
+		try {
+			expr = BooleanExpression::parse(sFilters[f]);
+		} catch (exception &e) {
+			cerr << "Cannot parse '" << sFilters[f] << "': " << e.what() << endl;
+			return -1;
+		}
+		bool result = false;
+		double rate = ratePerSecond(iterations, [&]() { result = expr->eval(&attributes); });
+		cout << "  " << setw(14) << rate << "  [" << (result ? "true " : "false") << "] " << sFilters[f] << endl;
+	}
+
+	msg_destroy(msg);
+	return 0;
+}
@@ -22,6 +22,8 @@
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 using namespace flexisip;
@@ -34,6 +36,7 @@ namespace flexisip {
 class SipAttributes {
 	map<string, string> mStringArgs;
 	map<string, bool> mBoolArgs;
+	static vector<string> sKeys;
 
 	void insertArg(char *keyval) {
 		cout << "Parsing keyval arg " << keyval << endl;
@@ -88,8 +91,40 @@ class SipAttributes {
 			return (*it).second;
 		throw new runtime_error("unknown argument " + id);
 	}
+
+	// Any key is accepted here, the compiled identifier is just its index in sKeys.
+	static int compileKey(const string &key);
+	static int compileBooleanKey(const string &key);
+	bool get(int id, string &value) const;
+	bool isTrue(int id) const;
 };
 
+vector<string> SipAttributes::sKeys;
+
+int SipAttributes::compileKey(const string &key) {
+	auto it = find(sKeys.begin(), sKeys.end(), key);
+	if (it != sKeys.end())
+		return it - sKeys.begin();
+	sKeys.push_back(key);
+	return sKeys.size() - 1;
+}
+
+int SipAttributes::compileBooleanKey(const string &key) {
+	return compileKey(key);
+}
+
+bool SipAttributes::get(int id, string &value) const {
+	auto it = mStringArgs.find(sKeys[id]);
+	if (it == mStringArgs.end())
+		return false;
+	value = (*it).second;
+	return true;
+}
+
+bool SipAttributes::isTrue(int id) const {
+	return isTrue(sKeys[id]);
+}
+
 }
 
 static void print_test_value(size_t nb, const char *expr, const char *args, bool expected, bool actual) {
@@ -242,6 +277,20 @@ void do_defined(void) {
 	btest_true("!defined a", "b=toto");
 }
 
+void do_missing(void) {
+	::count = 0;
+	cerr << "Suite missing" << endl;
+	btest_false("a=='toto'", "b=toto");
+	btest_true("a!='toto'", "b=toto");
+	btest_false("numeric a", "b=123");
+	btest_false("a regex 'toto'", "b=toto");
+	btest_false("a in 'toto titi'", "b=toto");
+	btest_false("a contains 'to'", "b=toto");
+	btest_true("!(a=='toto')", "b=toto");
+	btest_false("!(a!='toto')", "b=toto");
+	btest_true("a!=b", "b=toto");
+}
+
 void do_predefined_tests(void) {
 	do_true_false();
 	do_or();
@@ -258,6 +307,7 @@ void do_predefined_tests(void) {
 	do_interceptor_tests();
 
 	do_defined();
+	do_missing();
 }
 
 void do_cmd_test(int argc, char *argv[]) {
@@ -0,0 +1,178 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the parser of the HTTP/1.1 responses received by the push notification engine: chunked bodies, responses
+ * closing the connection, and pipelined responses arriving in pieces.
+ */
+
+#include "pushnotification/pushnotificationengine.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace flexisip;
+
+static bool sErrorOccured = false;
+
+static void check(bool condition, const string &what) {
+	cerr << (condition ? "[OK] " : "[KO] ") << what << endl;
+	if (!condition)
+		sErrorOccured = true;
+}
+
+static string bodyOf(const HttpResponseParser::Response &response) {
+	size_t start = response.mMessage.find("\r\n\r\n");
+	return start == string::npos ? "" : response.mMessage.substr(start + 4);
+}
+
+/* Responses parsed from data received in pieces of the given size, with the number of bytes they were taken from. */
+static vector<HttpResponseParser::Response> parseInPieces(const string &data, size_t pieceSize, bool closedAtEnd,
+														   size_t &consumed, bool &invalid) {
+	vector<HttpResponseParser::Response> responses;
+	string input;
+	size_t received = 0;
+	invalid = false;
+	for (; received < data.size(); received = min(received + pieceSize, data.size())) {
+		input.append(data, received, pieceSize);
+		bool closed = closedAtEnd && received + pieceSize >= data.size();
+		HttpResponseParser::Response response;
+		HttpResponseParser::Result result = HttpResponseParser::Incomplete;
+		while (!input.empty() && (result = HttpResponseParser::parse(input, closed, response)) ==
+									 HttpResponseParser::Complete) {
+			responses.push_back(response);
+			/* like the engine: nothing is read after a response that closes the connection */
+			if (!response.mKeepAlive) {
+				consumed = min(received + pieceSize, data.size()) - input.size();
+				return responses;
+			}
+		}
+		if (!input.empty() && result == HttpResponseParser::Invalid) {
+			invalid = true;
+			break;
+		}
+	}
+	consumed = received - input.size();
+	return responses;
+}
+
+static void checkChunked() {
+	const string data = "HTTP/1.1 200 OK\r\n"
+						"Content-Type: application/json\r\n"
+						"Transfer-Encoding: chunked\r\n"
+						"\r\n"
+						"6\r\n{\"id\":\r\n"
+						"a;ext=1\r\n\"12345678\"\r\n"
+						"1\r\n}\r\n"
+						"0\r\n"
+						"\r\n";
+	for (size_t piece : {data.size(), (size_t)7, (size_t)1}) {
+		size_t consumed;
+		bool invalid;
+		auto responses = parseInPieces(data, piece, false, consumed, invalid);
+		string what = "chunked body in pieces of " + to_string(piece) + " bytes";
+		check(!invalid && responses.size() == 1 && consumed == data.size(), what + ": one complete response");
+		if (responses.size() == 1) {
+			check(responses[0].mStatus == 200 && responses[0].mKeepAlive, what + ": status and keep-alive");
+			check(bodyOf(responses[0]) == "{\"id\":\"12345678\"}", what + ": decoded body " + bodyOf(responses[0]));
+		}
+	}
+
+	const string trailers = "HTTP/1.1 200 OK\r\n"
+							"Transfer-Encoding: chunked\r\n"
+							"\r\n"
+							"2\r\nok\r\n"
+							"0\r\n"
+							"Expires: never\r\n"
+							"\r\n"
+							"HTTP/1.1 204 No Content\r\n\r\n";
+	size_t consumed;
+	bool invalid;
+	auto responses = parseInPieces(trailers, trailers.size(), false, consumed, invalid);
+	check(!invalid && responses.size() == 2 && consumed == trailers.size(), "chunked body with trailers, then another response");
+	if (responses.size() == 2)
+		check(bodyOf(responses[0]) == "ok" && responses[1].mStatus == 204, "trailers are not part of the body");
+}
+
+static void checkConnectionClose() {
+	const string delimited = "HTTP/1.1 200 OK\r\n"
+							 "Connection: close\r\n"
+							 "\r\n"
+							 "body ended by the connection";
+	size_t consumed;
+	bool invalid;
+	auto responses = parseInPieces(delimited, 5, false, consumed, invalid);
+	check(!invalid && responses.empty(), "body without length is incomplete while the connection is open");
+	responses = parseInPieces(delimited, 5, true, consumed, invalid);
+	check(!invalid && responses.size() == 1 && consumed == delimited.size(), "body without length ends with the connection");
+	if (responses.size() == 1) {
+		check(!responses[0].mKeepAlive, "connection is not kept alive");
+		check(bodyOf(responses[0]) == "body ended by the connection", "body up to the end of the connection");
+	}
+
+	const string http10 = "HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nok";
+	responses = parseInPieces(http10, http10.size(), false, consumed, invalid);
+	check(responses.size() == 1 && !responses[0].mKeepAlive, "HTTP/1.0 response closes the connection");
+	const string http10KeepAlive = "HTTP/1.0 200 OK\r\nConnection: Keep-Alive\r\nContent-Length: 2\r\n\r\nok";
+	responses = parseInPieces(http10KeepAlive, http10KeepAlive.size(), false, consumed, invalid);
+	check(responses.size() == 1 && responses[0].mKeepAlive, "HTTP/1.0 response with keep-alive");
+}
+
+static void checkPipelining() {
+	/* answers to four pipelined requests: the server stops processing them after the second one */
+	const string data = "HTTP/1.1 100 Continue\r\n\r\n"
+						"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nfirst"
+						"HTTP/1.1 410 Gone\r\nContent-Length: 6\r\nConnection: close\r\n\r\nsecond"
+						"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nthird";
+	for (size_t piece : {data.size(), (size_t)3, (size_t)1}) {
+		size_t consumed;
+		bool invalid;
+		auto responses = parseInPieces(data, piece, false, consumed, invalid);
+		string what = "pipelined responses in pieces of " + to_string(piece) + " bytes";
+		check(!invalid && responses.size() == 2, what + ": parsing stops at the response closing the connection");
+		if (responses.size() == 2) {
+			check(responses[0].mStatus == 200 && responses[0].mKeepAlive && bodyOf(responses[0]) == "first",
+				  what + ": interim response skipped");
+			check(responses[1].mStatus == 410 && !responses[1].mKeepAlive && bodyOf(responses[1]) == "second",
+				  what + ": second response closes the connection");
+		}
+		/* the requests after the second one are sent again on another connection, their answers are dropped */
+		check(consumed == data.find("HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nthird"),
+			  what + ": response to the requeued request is not consumed");
+	}
+
+	string input = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort";
+	HttpResponseParser::Response response;
+	check(HttpResponseParser::parse(input, false, response) == HttpResponseParser::Incomplete &&
+			  input.size() == 44,
+		  "truncated body is incomplete and kept");
+	input = "SIP/2.0 200 OK\r\n\r\n";
+	check(HttpResponseParser::parse(input, false, response) == HttpResponseParser::Invalid, "not an HTTP response");
+	input = "HTTP/1.1 200 OK\r\n" + string(20000, 'x');
+	check(HttpResponseParser::parse(input, false, response) == HttpResponseParser::Invalid, "header too large");
+}
+
+int main(int argc, char *argv[]) {
+	checkChunked();
+	checkConnectionClose();
+	checkPipelining();
+	return sErrorOccured;
+}
@@ -0,0 +1,147 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Micro-benchmark of Agent::isUs() over the Via stack of a request that went through a few proxies.
+ * An agent is started on loopback transports, and the lookup in its precomputed address sets is compared with the
+ * walk of the aliases and primary transports that isUs() used to do for each call.
+ */
+
+#include <flexisip/agent.hh>
+#include <flexisip/module.hh>
+
+#include <sofia-sip/msg.h>
+#include <sofia-sip/sip.h>
+#include <sofia-sip/su_wait.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *sTransports = "sip:127.0.0.1:25060 sip:127.0.0.1:25060;transport=tcp sip:[::1]:25060;transport=tcp";
+static const char *sAliases = "localhost sip.example.org proxy.example.org sip.example.com";
+
+static const char *sInvite =
+	"INVITE sip:callee@sip.example.org SIP/2.0\r\n"
+	"Via: SIP/2.0/TCP 10.0.0.3:5060;branch=z9hG4bK.proxy3;rport\r\n"
+	"Via: SIP/2.0/TCP 127.0.0.1:25060;branch=z9hG4bK.ourselves;rport\r\n"
+	"Via: SIP/2.0/TLS 10.0.0.2:5061;branch=z9hG4bK.proxy2;rport\r\n"
+	"Via: SIP/2.0/TLS [2001:db8::2]:5061;branch=z9hG4bK.proxy1;rport\r\n"
+	"Via: SIP/2.0/TLS 192.168.1.10:5061;branch=z9hG4bK.abcdef;rport\r\n"
+	"From: <sip:caller@sip.example.org>;tag=4321\r\n"
+	"To: <sip:callee@sip.example.org>\r\n"
+	"Call-ID: a84b4c76e66710@pc33.example.org\r\n"
+	"CSeq: 20 INVITE\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+// The algorithm of Agent::isUs() before the addresses were precomputed.
+static bool linearIsUs(Agent *agent, const list<string> &aliases, const char *host, const char *port) {
+	char *tmp = NULL;
+	size_t end;
+	if (host[end = (strlen(host) - 1)] == '.') {
+		tmp = (char *)alloca(end + 1);
+		memcpy(tmp, host, end);
+		tmp[end] = '\0';
+		host = tmp;
+	}
+	for (const string &alias : aliases) {
+		if (ModuleToolbox::urlHostMatch(host, alias.c_str()))
+			return true;
+	}
+	const char *matchedPort = port;
+	for (tport_t *tport = tport_primaries(nta_agent_tports(agent->getSofiaAgent())); tport; tport = tport_next(tport)) {
+		const tp_name_t *tn = tport_name(tport);
+		if (port == NULL)
+			matchedPort = strcasecmp(tn->tpn_proto, "tls") == 0 ? "5061" : "5060";
+		if (strcmp(matchedPort, tn->tpn_port) == 0) {
+			if (ModuleToolbox::urlHostMatch(host, tn->tpn_canon) || ModuleToolbox::urlHostMatch(host, tn->tpn_host))
+				return true;
+		}
+	}
+	return false;
+}
+
+template <typename _funcT> static double ratePerSecond(int iterations, _funcT func) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		func();
+	}
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	return iterations / elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+	int iterations = 1000000;
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations <= 0) {
+		cerr << argv[0] << " [iterations]" << endl;
+		return -1;
+	}
+
+	GenericManager *cfg = GenericManager::get();
+	cfg->setOverrideMap(map<string, string>{{"global/aliases", sAliases}});
+	cfg->load("/dev/null");
+	su_root_t *root = su_root_create(NULL);
+	auto agent = make_shared<Agent>(root);
+	agent->loadConfig(cfg);
+	agent->start(sTransports, "");
+
+	msg_t *msg = msg_make(sip_default_mclass(), 0, sInvite, strlen(sInvite));
+	sip_t *sip = sip_object(msg);
+	if (!msg || !sip) {
+		cerr << "Cannot parse test message" << endl;
+		return -1;
+	}
+	list<string> aliases = cfg->getGlobal()->get<ConfigStringList>("aliases")->read();
+
+	for (sip_via_t *via = sip->sip_via; via; via = via->v_next) {
+		bool precomputed = agent->isUs(via->v_host, via->v_port, true);
+		bool linear = linearIsUs(agent.get(), aliases, via->v_host, via->v_port);
+		if (precomputed != linear) {
+			cerr << "Mismatch for " << via->v_host << ":" << via->v_port << endl;
+			return -1;
+		}
+	}
+
+	volatile int sink = 0;
+	double precomputed = ratePerSecond(iterations, [&]() {
+		for (sip_via_t *via = sip->sip_via; via; via = via->v_next)
+			sink += agent->isUs(via->v_host, via->v_port, true);
+	});
+	double linear = ratePerSecond(iterations, [&]() {
+		for (sip_via_t *via = sip->sip_via; via; via = via->v_next)
+			sink += linearIsUs(agent.get(), aliases, via->v_host, via->v_port);
+	});
+
+	cout << fixed << setprecision(0);
+	cout << "Via stacks checked per second:" << endl;
+	cout << "  precomputed sets  " << setw(14) << precomputed << endl;
+	cout << "  linear walk       " << setw(14) << linear << endl;
+
+	msg_destroy(msg);
+	agent.reset();
+	su_root_destroy(root);
+	return 0;
+}
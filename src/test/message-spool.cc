@@ -0,0 +1,220 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the spool of the messages waiting for late registrations: messages read back as they were written, across
+ * a restart too, recovery of a file whose last record was cut, and a failed compaction leaving the spool usable.
+ */
+
+#include <flexisip/message-spool.hh>
+
+#include <sofia-sip/su_wait.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace flexisip;
+
+static bool sErrorOccured = false;
+
+static void check(bool condition, const string &what) {
+	cerr << (condition ? "[OK] " : "[KO] ") << what << endl;
+	if (!condition)
+		sErrorOccured = true;
+}
+
+class KeyListener : public MessageSpoolListener {
+  public:
+	void onSpoolKeyAdded(const string &key) override {
+		mKeys.insert(key);
+	}
+	void onSpoolKeyRemoved(const string &key) override {
+		mKeys.erase(key);
+	}
+
+	set<string> mKeys;
+};
+
+static MessageSpool::Message makeMessage(const string &key, const string &request) {
+	MessageSpool::Message message;
+	message.mRequest = request;
+	message.mKeys = {key, "alias:" + key};
+	message.mDeliveredUids = {"<urn:uuid:delivered>"};
+	message.mPendingUids = {"<urn:uuid:pending-1>", "<urn:uuid:pending-2>"};
+	message.mTargetGr = "urn:uuid:gr";
+	message.mExpireAt = time(NULL) + 3600;
+	return message;
+}
+
+static bool sameMessage(const MessageSpool::Message &a, const MessageSpool::Message &b) {
+	return a.mRequest == b.mRequest && a.mKeys == b.mKeys && a.mDeliveredUids == b.mDeliveredUids &&
+		   a.mPendingUids == b.mPendingUids && a.mTargetGr == b.mTargetGr && a.mExpireAt == b.mExpireAt;
+}
+
+static vector<MessageSpool::Message> takeAll(MessageSpool &spool, const string &key) {
+	return spool.take(key, [](const MessageSpool::Message &) { return true; });
+}
+
+static uint64_t sizeOnDisk(const string &path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+static void checkRoundTrip(TimerWheel &wheel, const string &path) {
+	/* a request with binary content, and a message with empty lists */
+	MessageSpool::Message first =
+		makeMessage("sip:alice@example.org", "MESSAGE sip:alice@example.org SIP/2.0\r\n\r\n");
+	first.mRequest.append("\0\x01\xff", 3);
+	MessageSpool::Message second;
+	second.mRequest = "MESSAGE sip:bob@example.org SIP/2.0\r\n\r\n";
+	second.mKeys = {"sip:bob@example.org"};
+	second.mExpireAt = time(NULL) + 60;
+	MessageSpool::Message expired =
+		makeMessage("sip:carol@example.org", "MESSAGE sip:carol@example.org SIP/2.0\r\n\r\n");
+	expired.mExpireAt = time(NULL) - 1;
+	{
+		KeyListener listener;
+		MessageSpool spool(wheel, path, &listener);
+		check(spool.isReady(), "new spool created");
+		check(spool.add(first) && spool.add(second) && spool.add(expired), "messages added");
+		check(spool.size() == 3, "three messages pending");
+		check(listener.mKeys.count("alias:sip:alice@example.org") == 1, "all routing keys announced");
+		auto taken = takeAll(spool, "sip:bob@example.org");
+		check(taken.size() == 1 && sameMessage(taken[0], second), "message without lists read back");
+		check(listener.mKeys.count("sip:bob@example.org") == 0, "key of the taken message removed");
+		check(spool.add(second), "message added again");
+	}
+	uint64_t sizeBefore = sizeOnDisk(path);
+
+	KeyListener listener;
+	MessageSpool spool(wheel, path, &listener);
+	check(spool.isReady() && spool.size() == 2, "pending messages restored, expired one dropped");
+	const set<string> keys = {"sip:alice@example.org", "alias:sip:alice@example.org", "sip:bob@example.org"};
+	check(listener.mKeys == keys, "routing keys of the restored messages announced");
+	check(spool.getFileSize() < sizeBefore && spool.getFileSize() == sizeOnDisk(path), "file compacted on load");
+	auto rejected = spool.take("alias:sip:alice@example.org", [](const MessageSpool::Message &) { return false; });
+	check(rejected.empty() && spool.size() == 2, "messages refused by the filter stay");
+	auto taken = takeAll(spool, "alias:sip:alice@example.org");
+	check(taken.size() == 1 && sameMessage(taken[0], first), "restored message identical, binary request included");
+	check(takeAll(spool, "sip:alice@example.org").empty(), "message taken by one key is gone for the other");
+	taken = takeAll(spool, "sip:bob@example.org");
+	check(taken.size() == 1 && sameMessage(taken[0], second), "second restored message identical");
+	check(spool.size() == 0 && listener.mKeys.empty() && sizeOnDisk(path) == 8, "empty spool truncated to its header");
+}
+
+static void checkTruncatedTail(TimerWheel &wheel, const string &path) {
+	MessageSpool::Message first = makeMessage("sip:alice@example.org", "MESSAGE sip:alice@example.org SIP/2.0\r\n\r\n");
+	MessageSpool::Message second = makeMessage("sip:bob@example.org", "MESSAGE sip:bob@example.org SIP/2.0\r\n\r\n");
+	uint64_t firstEnd;
+	{
+		KeyListener listener;
+		MessageSpool spool(wheel, path, &listener);
+		spool.add(first);
+		firstEnd = spool.getFileSize();
+		spool.add(second);
+	}
+	/* the proxy stopped while appending the second record */
+	uint64_t fullSize = sizeOnDisk(path);
+	check(truncate(path.c_str(), fullSize - 10) == 0, "last record cut");
+	{
+		KeyListener listener;
+		MessageSpool spool(wheel, path, &listener);
+		check(spool.isReady() && spool.size() == 1, "complete record restored");
+		check(spool.getFileSize() == firstEnd && sizeOnDisk(path) == firstEnd,
+			  "file truncated after the complete record");
+		auto taken = takeAll(spool, "sip:alice@example.org");
+		check(taken.size() == 1 && sameMessage(taken[0], first), "complete record read back");
+		check(spool.add(second) && spool.add(first), "records appended after the recovery");
+	}
+	/* only part of a record header was written */
+	fullSize = sizeOnDisk(path);
+	FILE *file = fopen(path.c_str(), "a");
+	fwrite("XFSM", 1, 4, file);
+	fclose(file);
+	KeyListener listener;
+	MessageSpool spool(wheel, path, &listener);
+	check(spool.size() == 2 && sizeOnDisk(path) == fullSize, "partial record header dropped");
+	check(takeAll(spool, "sip:bob@example.org").size() == 1 && takeAll(spool, "sip:alice@example.org").size() == 1,
+		  "records appended after the recovery read back");
+}
+
+static void checkCompactionFailure(TimerWheel &wheel, const string &path) {
+	/* compaction needs more than 1 MiB of removed records, and more than half of the file */
+	const string body(600 * 1024, 'x');
+	KeyListener listener;
+	MessageSpool spool(wheel, path, &listener);
+	for (int i = 0; i < 4; ++i)
+		spool.add(makeMessage("sip:user" + to_string(i) + "@example.org", body + to_string(i)));
+	uint64_t fullSize = spool.getFileSize();
+	takeAll(spool, "sip:user0@example.org");
+	takeAll(spool, "sip:user1@example.org");
+	check(spool.getFileSize() == fullSize, "half of the file removed, not compacted yet");
+
+	/* the compacted file cannot be created */
+	string tmpPath = path + ".tmp";
+	check(mkdir(tmpPath.c_str(), 0700) == 0, "compacted file path taken by a directory");
+	takeAll(spool, "sip:user2@example.org");
+	check(spool.size() == 1 && spool.getFileSize() == fullSize && sizeOnDisk(path) == fullSize,
+		  "spool left as it was after the failed compaction");
+	string request;
+	spool.take("sip:user3@example.org", [&request](const MessageSpool::Message &message) {
+		request = message.mRequest;
+		return false;
+	});
+	check(request == body + "3", "messages still readable after the failed compaction");
+
+	rmdir(tmpPath.c_str());
+	check(spool.add(makeMessage("sip:user4@example.org", "short")), "message added after the failed compaction");
+	auto taken = takeAll(spool, "sip:user4@example.org");
+	check(taken.size() == 1 && taken[0].mRequest == "short", "message added after the failed compaction read back");
+	check(spool.getFileSize() < fullSize / 2 && sizeOnDisk(path) == spool.getFileSize(),
+		  "next removal compacts the file, to " + to_string(spool.getFileSize()) + " bytes");
+	taken = takeAll(spool, "sip:user3@example.org");
+	check(taken.size() == 1 && taken[0].mRequest == body + "3", "message read back from the compacted file");
+}
+
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/flexisip-message-spool-XXXXXX";
+	if (!mkdtemp(dir)) {
+		cerr << "Cannot create a temporary directory." << endl;
+		return -1;
+	}
+	su_init();
+	su_root_t *root = su_root_create(NULL);
+	{
+		TimerWheel wheel(root);
+		checkRoundTrip(wheel, string(dir) + "/round-trip.spool");
+		checkTruncatedTail(wheel, string(dir) + "/truncated.spool");
+		checkCompactionFailure(wheel, string(dir) + "/compaction.spool");
+	}
+	su_root_destroy(root);
+	su_deinit();
+
+	for (const char *name : {"round-trip.spool", "truncated.spool", "compaction.spool"})
+		unlink((string(dir) + "/" + name).c_str());
+	rmdir(dir);
+	return sErrorOccured;
+}
@@ -0,0 +1,121 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the copy of a MsgSip made for each fork branch: the headers must be duplicated in their original order
+ * (Via and Record-Route stacks included), and the body must be shared with the original message.
+ */
+
+#include <flexisip/event.hh>
+
+#include <sofia-sip/msg.h>
+#include <sofia-sip/sip.h>
+#include <sofia-sip/sip_protos.h>
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *sMessage =
+	"MESSAGE sip:callee@sip.example.org SIP/2.0\r\n"
+	"Via: SIP/2.0/TCP 10.0.0.3:5060;branch=z9hG4bK.proxy3;rport\r\n"
+	"Via: SIP/2.0/TLS 10.0.0.2:5061;branch=z9hG4bK.proxy2;rport\r\n"
+	"Via: SIP/2.0/TLS 192.168.1.10:5061;branch=z9hG4bK.client;rport\r\n"
+	"Record-Route: <sip:10.0.0.3:5060;transport=tcp;lr>\r\n"
+	"Record-Route: <sip:10.0.0.2:5061;transport=tls;lr>\r\n"
+	"From: <sip:caller@sip.example.org>;tag=4321\r\n"
+	"To: <sip:callee@sip.example.org>\r\n"
+	"Call-ID: a84b4c76e66710@pc33.example.org\r\n"
+	"CSeq: 20 MESSAGE\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 13\r\n"
+	"\r\n"
+	"Hello, world!";
+
+static bool sErrorOccured = false;
+
+static void check(bool condition, const string &what) {
+	cerr << (condition ? "[OK] " : "[KO] ") << what << endl;
+	if (!condition)
+		sErrorOccured = true;
+}
+
+static string viaBranches(const sip_t *sip) {
+	string branches;
+	for (const sip_via_t *via = sip->sip_via; via != NULL; via = via->v_next)
+		branches += string(via->v_branch ? via->v_branch : "") + " ";
+	return branches;
+}
+
+static string recordRouteHosts(const sip_t *sip) {
+	string hosts;
+	for (const sip_record_route_t *rr = sip->sip_record_route; rr != NULL; rr = rr->r_next)
+		hosts += string(rr->r_url->url_host ? rr->r_url->url_host : "") + " ";
+	return hosts;
+}
+
+/* Text of the headers of a given name in the serialized message, in order. */
+static string serializedHeaders(MsgSip &ms, const char *name) {
+	string text(ms.print());
+	string prefix = string("\r\n") + name + ": ";
+	string headers;
+	for (size_t pos = text.find(prefix); pos != string::npos; pos = text.find(prefix, pos + 1)) {
+		size_t start = pos + prefix.size();
+		headers += text.substr(start, text.find("\r\n", start) - start) + "|";
+	}
+	return headers;
+}
+
+int main(int argc, char *argv[]) {
+	msg_t *msg = msg_make(sip_default_mclass(), 0, sMessage, strlen(sMessage));
+	if (!msg || !sip_object(msg)) {
+		cerr << "Cannot parse test message" << endl;
+		return -1;
+	}
+	auto orig = make_shared<MsgSip>(msg);
+	msg_destroy(msg);
+	const sip_t *origSip = orig->getSip();
+
+	MsgSip copy(*orig);
+	const sip_t *copySip = copy.getSip();
+
+	check(copy.getMsg() != orig->getMsg(), "copy is a distinct message");
+	check(viaBranches(copySip) == viaBranches(origSip), "Via order: " + viaBranches(copySip));
+	check(recordRouteHosts(copySip) == recordRouteHosts(origSip), "Record-Route order: " + recordRouteHosts(copySip));
+	check(copySip->sip_via != origSip->sip_via, "Via headers are duplicated");
+	check(copySip->sip_payload && copySip->sip_payload->pl_data == origSip->sip_payload->pl_data,
+		  "payload is shared with the original");
+
+	string origVias = serializedHeaders(*orig, "Via");
+	string origRoutes = serializedHeaders(*orig, "Record-Route");
+	check(serializedHeaders(copy, "Via") == origVias, "serialized Via order");
+	check(serializedHeaders(copy, "Record-Route") == origRoutes, "serialized Record-Route order");
+
+	/* A fork branch adds its own Via on top, the copy made for another branch must not see it. */
+	MsgSip branch(*orig);
+	sip_via_t *via = sip_via_format(branch.getHome(), "SIP/2.0/TCP 127.0.0.1:5060;branch=z9hG4bK.branch");
+	msg_header_insert(branch.getMsg(), (msg_pub_t *)branch.getSip(), (msg_header_t *)via);
+	check(string(branch.getSip()->sip_via->v_branch) == "z9hG4bK.branch", "new Via is on top of the branch copy");
+	check(viaBranches(orig->getSip()) == viaBranches(copySip), "original Via stack is unchanged");
+
+	return sErrorOccured;
+}
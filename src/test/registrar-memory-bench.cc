@@ -0,0 +1,152 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Memory footprint of the bindings held by the internal registrar.
+ * Records are filled the way RegistrarDbInternal keeps them, with contacts as registered by mobile clients (instance id,
+ * push parameters, path, accept headers and a handful of distinct user agents), and the heap in use is measured before
+ * and after.
+ * The fields changed to share user agents and accept headers are also measured on their own, laid out as they used to
+ * be (a string and a list of strings per binding, bindings in a std::list) and as they are now (interned values,
+ * bindings in a std::vector), to compare the two layouts.
+ */
+
+#include <flexisip/logmanager.hh>
+#include <flexisip/registrardb.hh>
+
+#include <sofia-sip/sip.h>
+#include <sofia-sip/su_alloc.h>
+
+#include <malloc.h>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *sUserAgents[] = {"LinphoneIphone/4.1 (iPhone) LinphoneSDK/4.1.0 (belle-sip/1.6.3)",
+									"LinphoneAndroid/4.1 (Pixel 2) LinphoneSDK/4.1.0 (belle-sip/1.6.3)",
+									"Linphone Desktop/4.1.1 (Ubuntu 18.04 LTS, Qt 5.9.5) LinphoneCore/4.1.1"};
+
+static size_t heapInUse() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	return mallinfo2().uordblks;
+#else
+	return (size_t)(unsigned)mallinfo().uordblks;
+#endif
+}
+
+static shared_ptr<ExtendedContact> makeBinding(su_home_t *home, int user, int device, time_t now) {
+	ostringstream uniqueId;
+	uniqueId << "\"<urn:uuid:5a2fd7a0-8dc4-4f1c-" << setw(8) << setfill('0') << user << setw(4) << device << ">\"";
+	sip_contact_t *contact = sip_contact_format(home,
+		"<sip:user-%d@10.%d.%d.%d:%d;transport=tls;fs-conn-id=%x;pn-type=apple;pn-tok=%064d>"
+		";+sip.instance=%s;expires=3600;message-expires=604800",
+		user, (user >> 16) & 0xff, (user >> 8) & 0xff, user & 0xff, 40000 + device, 0x7f5a0000 + user, user,
+		uniqueId.str().c_str());
+	string contactId = "tls:user-" + to_string(user) + ":10.0.0.1:" + to_string(40000 + device);
+	ExtendedContactCommon ecc(contactId.c_str(), {"sip:proxy1.example.org:5061;transport=tls;lr"},
+							  "callid-" + to_string(user) + "-" + to_string(device) + "-5a2fd7a08dc44f1c",
+							  uniqueId.str());
+	return make_shared<ExtendedContact>(ecc, contact, 3600, 20 + device, now, false,
+		sAcceptHeaders,
+		sUserAgents[(user + device) % 3]);
+}
+
+static const list<string> sAcceptHeaders{"application/sdp", "text/plain", "application/vnd.gsma.rcs-ft-http+xml"};
+
+// The fields of ExtendedContact and Record changed by the sharing, as they were before it.
+struct LegacyBindingFields {
+	string mUserAgent;
+	list<string> mAcceptHeader;
+};
+typedef list<shared_ptr<LegacyBindingFields>> LegacyRecordFields;
+
+// The same fields, as they are now.
+struct SharedBindingFields {
+	InternedString mUserAgent;
+	InternedStringList mAcceptHeader;
+};
+typedef vector<shared_ptr<SharedBindingFields>> SharedRecordFields;
+
+template <typename RecordT> static size_t fieldsBytesPerBinding(int users, int devices) {
+	size_t before = heapInUse();
+	vector<RecordT> records(users);
+	for (int user = 0; user < users; ++user) {
+		RecordT &record = records[user];
+		for (int device = 0; device < devices; ++device) {
+			auto binding = make_shared<typename RecordT::value_type::element_type>();
+			binding->mUserAgent = string(sUserAgents[(user + device) % 3]);
+			binding->mAcceptHeader = sAcceptHeaders;
+			record.push_back(binding);
+		}
+	}
+	size_t after = heapInUse();
+	return (after - before) / ((size_t)users * devices);
+}
+
+int main(int argc, char *argv[]) {
+	int users = argc > 1 ? atoi(argv[1]) : 100000;
+	int devices = argc > 2 ? atoi(argv[2]) : 2;
+	if (users <= 0 || devices <= 0) {
+		cerr << argv[0] << " [users] [devices per user]" << endl;
+		return -1;
+	}
+	flexisip::log::preinit(false, false, 0, "bench");
+	flexisip::log::initLogs(false, "error", "error", false, false);
+	Record::sLineFieldNames = {"+sip.instance", "pn-tok", "line"};
+	Record::sMaxContacts = devices;
+
+	time_t now = time(NULL);
+	size_t before = heapInUse();
+	map<string, shared_ptr<Record>> records;
+	{
+		su_home_t home;
+		su_home_init(&home);
+		for (int user = 0; user < users; ++user) {
+			auto record = make_shared<Record>(nullptr);
+			for (int device = 0; device < devices; ++device) {
+				record->insertOrUpdateBinding(makeBinding(&home, user, device, now), nullptr);
+			}
+			records["user-" + to_string(user) + "@example.org"] = record;
+			// The contacts are duplicated in the home of each binding.
+			su_home_deinit(&home);
+			su_home_init(&home);
+		}
+		su_home_deinit(&home);
+	}
+	size_t after = heapInUse();
+
+	size_t bindings = (size_t)users * devices;
+	cout << users << " records of " << devices << " bindings: " << (after - before) / 1024 << " kB, "
+		 << (after - before) / bindings << " bytes per binding" << endl;
+	records.clear();
+
+	cout << "User agent, accept headers and record containers alone, bytes per binding:" << endl;
+	cout << "  before sharing (string, list<string>, list of bindings): "
+		 << fieldsBytesPerBinding<LegacyRecordFields>(users, devices) << endl;
+	cout << "  after sharing (interned values, vector of bindings):     "
+		 << fieldsBytesPerBinding<SharedRecordFields>(users, devices) << endl;
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks the timing wheel on a clock driven by the test: timers cascading down from every level, timers beyond the
+ * range of the wheel, timers cancelled or destroyed from a callback, and the wake-ups skipping the empty slots.
+ */
+
+#include <flexisip/timer-wheel.hh>
+
+#include <sofia-sip/su_wait.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace flexisip;
+
+static bool sErrorOccured = false;
+static steady_clock::time_point sNow;
+
+static void check(bool condition, const string &what) {
+	cerr << (condition ? "[OK] " : "[KO] ") << what << endl;
+	if (!condition)
+		sErrorOccured = true;
+}
+
+static steady_clock::time_point fakeNow() {
+	return sNow;
+}
+
+/* Moves the clock from one wake-up of the wheel to the next until no timer is left, returns the number of wake-ups. */
+static int runAll(TimerWheel &wheel, int maxWakeUps) {
+	int wakeUps = 0;
+	while (wheel.size() > 0 && wakeUps < maxWakeUps) {
+		sNow = max(sNow, wheel.getWakeUpTime());
+		wheel.runDue();
+		++wakeUps;
+	}
+	return wakeUps;
+}
+
+static void checkCascade(su_root_t *root) {
+	TimerWheel wheel(root, milliseconds(10), &fakeNow);
+	const steady_clock::time_point start = sNow;
+	/* one timer per level of the wheel, the last one beyond 2^24 ticks */
+	const vector<milliseconds> delays = {milliseconds(30), milliseconds(700), seconds(50), hours(2), hours(72)};
+	vector<unique_ptr<WheelTimer>> timers;
+	vector<milliseconds> fired(delays.size(), milliseconds(-1));
+	for (size_t i = delays.size(); i-- > 0;) {
+		timers.emplace_back(new WheelTimer(wheel));
+		timers.back()->set(delays[i], [&fired, &start, i]() { fired[i] = duration_cast<milliseconds>(sNow - start); });
+	}
+	check(wheel.size() == delays.size(), "all timers pending");
+	check(wheel.getWakeUpTime() <= start + milliseconds(40), "wheel armed for the first timer");
+
+	int wakeUps = runAll(wheel, 1000);
+	check(wheel.size() == 0, "all timers fired");
+	check(wakeUps <= 15, "at most one wake-up per level and timer, " + to_string(wakeUps) + " wake-ups");
+	for (size_t i = 0; i < delays.size(); ++i) {
+		check(fired[i] >= delays[i] && fired[i] <= delays[i] + milliseconds(20),
+			  "timer of " + to_string(delays[i].count()) + " ms fired after " + to_string(fired[i].count()) + " ms");
+	}
+	check(wheel.getWakeUpTime() == steady_clock::time_point::max(), "wheel stopped once idle");
+}
+
+static void checkEmptyStretches(su_root_t *root) {
+	TimerWheel wheel(root, milliseconds(10), &fakeNow);
+	const steady_clock::time_point start = sNow;
+	WheelTimer timer(wheel);
+	bool fired = false;
+	timer.set(seconds(5), [&fired]() { fired = true; });
+	check(wheel.getWakeUpTime() >= start + seconds(4), "no wake-up before the slot of the timer comes up");
+
+	/* woken up early, as if by another sofia timer */
+	sNow = start + seconds(1);
+	wheel.runDue();
+	check(!fired && wheel.getWakeUpTime() >= start + seconds(4), "early wake-up arms the same tick again");
+
+	int wakeUps = runAll(wheel, 100);
+	check(fired && wakeUps <= 2, "timer of 5 s fired after " + to_string(wakeUps) + " wake-ups");
+	check(sNow >= start + seconds(5) && sNow <= start + seconds(5) + milliseconds(20), "timer of 5 s not late");
+
+	/* a sooner timer set while the wheel waits for a later one */
+	bool later = false, sooner = false;
+	timer.set(seconds(30), [&later]() { later = true; });
+	WheelTimer soonerTimer(wheel);
+	soonerTimer.set(milliseconds(100), [&sooner]() { sooner = true; });
+	check(wheel.getWakeUpTime() <= sNow + milliseconds(120), "sooner timer arms the wheel again");
+	runAll(wheel, 100);
+	check(sooner && later, "both timers fired");
+}
+
+static void checkOutOfRange(su_root_t *root) {
+	TimerWheel wheel(root, milliseconds(10), &fakeNow);
+	const steady_clock::time_point start = sNow;
+	/* the wheel covers 2^30 ticks, about 124 days at 10 ms */
+	const milliseconds delay = hours(24 * 400);
+	WheelTimer farTimer(wheel), nearTimer(wheel);
+	steady_clock::time_point farFired, nearFired;
+	farTimer.set(delay, [&farFired]() { farFired = sNow; });
+	nearTimer.set(seconds(1), [&nearFired]() { nearFired = sNow; });
+
+	int wakeUps = runAll(wheel, 1000);
+	check(wheel.size() == 0, "out of range timer fired after " + to_string(wakeUps) + " wake-ups");
+	check(nearFired >= start + seconds(1) && nearFired <= start + seconds(1) + milliseconds(20),
+		  "timer in range not delayed by the parked one");
+	check(farFired >= start + delay && farFired <= start + delay + milliseconds(20),
+		  "out of range timer fired after " + to_string(duration_cast<hours>(farFired - start).count()) + " h");
+}
+
+static void checkCallbacks(su_root_t *root) {
+	TimerWheel wheel(root, milliseconds(10), &fakeNow);
+	/* timers due at the same tick, run in the order they were set */
+	unique_ptr<WheelTimer> first(new WheelTimer(wheel)), cancelled(new WheelTimer(wheel)),
+		destroyed(new WheelTimer(wheel)), last(new WheelTimer(wheel)), self(new WheelTimer(wheel));
+	int firstCount = 0, cancelledCount = 0, destroyedCount = 0, lastCount = 0, selfCount = 0;
+	function<void()> firstCallback = [&]() {
+		if (++firstCount > 1)
+			return;
+		cancelled->cancel();
+		destroyed.reset();
+		first->set(milliseconds(50), firstCallback);
+	};
+	first->set(milliseconds(100), firstCallback);
+	cancelled->set(milliseconds(100), [&]() { ++cancelledCount; });
+	destroyed->set(milliseconds(100), [&]() { ++destroyedCount; });
+	last->set(milliseconds(100), [&]() { ++lastCount; });
+	self->set(milliseconds(100), [&]() {
+		++selfCount;
+		self.reset();
+	});
+
+	runAll(wheel, 100);
+	check(wheel.size() == 0, "no timer left");
+	check(firstCount == 2, "timer set again from its own callback");
+	check(cancelledCount == 0 && !cancelled->isSet(), "timer cancelled from a callback of the same tick");
+	check(destroyedCount == 0, "timer destroyed from a callback of the same tick");
+	check(lastCount == 1, "timer after the cancelled ones still fired");
+	check(selfCount == 1 && !self, "timer destroyed from its own callback");
+
+	/* timers outliving the wheel */
+	unique_ptr<TimerWheel> shortLived(new TimerWheel(root, milliseconds(10), &fakeNow));
+	WheelTimer orphan(*shortLived);
+	orphan.set(seconds(1), []() {});
+	shortLived.reset();
+	check(!orphan.isSet(), "timers detached when the wheel is destroyed");
+}
+
+int main(int argc, char *argv[]) {
+	su_init();
+	su_root_t *root = su_root_create(NULL);
+	sNow = steady_clock::now();
+
+	checkCascade(root);
+	checkEmptyStretches(root);
+	checkOutOfRange(root);
+	checkCallbacks(root);
+
+	su_root_destroy(root);
+	su_deinit();
+	return sErrorOccured;
+}
@@ -0,0 +1,213 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <flexisip/timer-wheel.hh>
+
+#include <algorithm>
+
+using namespace std;
+using namespace std::chrono;
+using namespace flexisip;
+
+constexpr int TimerWheel::sLevelBits;
+constexpr int TimerWheel::sBucketCount;
+constexpr int TimerWheel::sLevels;
+
+void WheelTimer::set(milliseconds delay, const Callback &cb) {
+	cancel();
+	mCallback = cb;
+	mWheel->schedule(*this, delay);
+}
+
+void WheelTimer::cancel() {
+	if (isSet() && mWheel)
+		mWheel->remove(*this);
+}
+
+TimerWheel::TimerWheel(su_root_t *root, milliseconds resolution, const Clock &clock)
+	: mRoot(root), mResolution(resolution), mClock(clock), mStart(mClock()) {
+	for (auto &level : mSlots) {
+		for (auto &slot : level) {
+			slot.mPrev = slot.mNext = &slot;
+		}
+	}
+	mTimer = su_timer_create(su_root_task(mRoot), mResolution.count());
+}
+
+TimerWheel::~TimerWheel() {
+	// Timers still set are detached, so that their owners may outlive the wheel.
+	for (auto &level : mSlots) {
+		for (auto &slot : level) {
+			WheelTimer *timer = slot.mNext;
+			while (timer != &slot) {
+				WheelTimer *next = timer->mNext;
+				timer->mPrev = timer->mNext = nullptr;
+				timer = next;
+			}
+			slot.mPrev = slot.mNext = nullptr;
+		}
+	}
+	su_timer_destroy(mTimer);
+}
+
+uint64_t TimerWheel::currentTick() const {
+	return duration_cast<milliseconds>(mClock() - mStart).count() / mResolution.count();
+}
+
+steady_clock::time_point TimerWheel::getWakeUpTime() const {
+	if (mWakeUpTick == UINT64_MAX)
+		return steady_clock::time_point::max();
+	return mStart + mResolution * static_cast<milliseconds::rep>(mWakeUpTick);
+}
+
+void TimerWheel::schedule(WheelTimer &timer, milliseconds delay) {
+	uint64_t now = currentTick();
+	if (mCount == 0) {
+		// The wheel was idle, skip the ticks it did not run.
+		mTick = max(mTick, now);
+	}
+	// Round up, and count the tick in progress as elapsed, so that the timer never fires early.
+	uint64_t ticks = (delay.count() + mResolution.count() - 1) / mResolution.count();
+	timer.mExpireTick = now + 1 + ticks;
+	uint64_t due = insert(timer);
+	++mCount;
+	if (due < mWakeUpTick)
+		arm(due);
+}
+
+void TimerWheel::remove(WheelTimer &timer) {
+	timer.unlink();
+	timer.mCallback = nullptr;
+	--mCount;
+}
+
+// Returns the tick at which the slot of the timer comes up.
+uint64_t TimerWheel::insert(WheelTimer &timer) {
+	uint64_t expire = max(timer.mExpireTick, mTick);
+	uint64_t delta = expire - mTick;
+	int level = 0;
+	while (level < sLevels - 1 && delta >= (uint64_t(1) << (sLevelBits * (level + 1))))
+		++level;
+	if (delta >= (uint64_t(1) << (sLevelBits * sLevels))) {
+		// Out of range: parked in the last slot to come up, then rehashed.
+		expire = mTick + (uint64_t(1) << (sLevelBits * sLevels)) - 1;
+	}
+	WheelTimer &slot = mSlots[level][(expire >> (sLevelBits * level)) & (sBucketCount - 1)];
+	timer.mPrev = slot.mPrev;
+	timer.mNext = &slot;
+	slot.mPrev->mNext = &timer;
+	slot.mPrev = &timer;
+	return expire >> (sLevelBits * level) << (sLevelBits * level);
+}
+
+// Moves the timers of the current slot of a level to the lower levels.
+void TimerWheel::cascade(int level) {
+	WheelTimer &slot = mSlots[level][(mTick >> (sLevelBits * level)) & (sBucketCount - 1)];
+	WheelTimer *timer = slot.mNext;
+	slot.mPrev = slot.mNext = &slot;
+	while (timer != &slot) {
+		WheelTimer *next = timer->mNext;
+		insert(*timer);
+		timer = next;
+	}
+}
+
+// First tick from mTick at which a slot holding timers comes up: to run them at level 0, to cascade them above.
+uint64_t TimerWheel::nextDueTick() const {
+	uint64_t next = UINT64_MAX;
+	for (int level = 0; level < sLevels; ++level) {
+		int shift = sLevelBits * level;
+		uint64_t step = uint64_t(1) << shift;
+		uint64_t tick = (mTick + step - 1) >> shift << shift;
+		for (int i = 0; i < sBucketCount && tick < next; ++i, tick += step) {
+			const WheelTimer &slot = mSlots[level][(tick >> shift) & (sBucketCount - 1)];
+			if (slot.mNext != &slot) {
+				next = tick;
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+void TimerWheel::arm(uint64_t tick) {
+	mWakeUpTick = tick;
+	steady_clock::duration left = mStart + mResolution * static_cast<milliseconds::rep>(tick) - mClock();
+	// Round up, so that the wheel does not wake up before the tick.
+	milliseconds delay = duration_cast<milliseconds>(left);
+	if (delay < left)
+		delay += milliseconds(1);
+	su_duration_t interval = static_cast<su_duration_t>(max(delay.count(), milliseconds::rep(0)));
+	su_timer_set_interval(mTimer, &TimerWheel::sOnTick, this, interval);
+}
+
+void TimerWheel::runTick() {
+	if ((mTick & (sBucketCount - 1)) == 0) {
+		for (int level = 1; level < sLevels; ++level) {
+			cascade(level);
+			if (((mTick >> (sLevelBits * level)) & (sBucketCount - 1)) != 0)
+				break;
+		}
+	}
+
+	// The due timers are moved to a list of their own: the callbacks may set, cancel or destroy any timer.
+	WheelTimer due;
+	WheelTimer &slot = mSlots[0][mTick & (sBucketCount - 1)];
+	if (slot.mNext == &slot) {
+		++mTick;
+		return;
+	}
+	due.mNext = slot.mNext;
+	due.mPrev = slot.mPrev;
+	due.mNext->mPrev = &due;
+	due.mPrev->mNext = &due;
+	slot.mPrev = slot.mNext = &slot;
+	++mTick;
+
+	while (due.mNext != &due) {
+		WheelTimer *timer = due.mNext;
+		timer->unlink();
+		--mCount;
+		WheelTimer::Callback callback = move(timer->mCallback);
+		timer->mCallback = nullptr;
+		callback();
+	}
+	due.mPrev = due.mNext = nullptr;
+}
+
+void TimerWheel::runDue() {
+	uint64_t now = currentTick();
+	uint64_t next = UINT64_MAX;
+	// The callbacks may set timers: the sofia timer is armed once they all ran.
+	mWakeUpTick = 0;
+	while (mCount > 0 && (next = nextDueTick()) <= now) {
+		mTick = next;
+		runTick();
+	}
+	if (mCount == 0) {
+		mTick = max(mTick, now + 1);
+		mWakeUpTick = UINT64_MAX;
+		su_timer_reset(mTimer);
+	} else {
+		arm(next);
+	}
+}
+
+void TimerWheel::sOnTick(su_root_magic_t *magic, su_timer_t *t, su_timer_arg_t *arg) {
+	static_cast<TimerWheel *>(arg)->runDue();
+}
@@ -0,0 +1,920 @@
+/*
+	Flexisip, a flexible SIP proxy server with media capabilities.
+	Copyright (C) 2010-2018  Belledonne Communications SARL, All rights reserved.
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Affero General Public License as
+	published by the Free Software Foundation, either version 3 of the
+	License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Affero General Public License for more details.
+
+	You should have received a copy of the GNU Affero General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * flexisip_bench: SIP load generator and benchmark of the proxy.
+ *
+ * The proxy is run in a child process listening on loopback, configured like the sipp based tests of the test/
+ * directory (Registrar on 'localhost', media and DoS protection modules disabled), or from a configuration file given
+ * with --config. The parent process simulates the user agents on a single UDP socket and plays one of the scenarios
+ * below, keeping --concurrency of them in progress until --count have been played:
+ *  - register:  REGISTER, answered by a digest challenge when --auth is set, then authenticated REGISTER.
+ *  - invite:    INVITE answered 200 by the callee, ACK, BYE.
+ *  - message:   MESSAGE forked by the proxy to the --devices contacts of the callee.
+ *  - subscribe: SUBSCRIBE answered 200 by the callee, followed by its NOTIFY.
+ * For all scenarios but register, the callees are registered before the measurement starts.
+ *
+ * The latency of a scenario is the time between its first request and its last expected message. The CPU time and
+ * the memory of the proxy process are read from /proc, so that the cost of the load generator is not accounted.
+ */
+
+#include <flexisip/agent.hh>
+#include <flexisip/configmanager.hh>
+#include <flexisip/event.hh>
+#include <flexisip/logmanager.hh>
+
+#include <sofia-sip/auth_digest.h>
+#include <sofia-sip/msg.h>
+#include <sofia-sip/sip.h>
+#include <sofia-sip/su_wait.h>
+#include <sofia-sip/url.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace flexisip;
+
+static const char *sDomain = "localhost";
+static const char *sPassword = "bench";
+
+struct BenchArgs {
+	BenchArgs()
+		: scenario("register"), count(1000), concurrency(10), users(100), devices(1), port(25070), timeout(5),
+		  auth(false), debug(false) {
+	}
+	string scenario;
+	int count;
+	int concurrency;
+	int users;
+	int devices;
+	int port;
+	int timeout;
+	bool auth;
+	bool debug;
+	string config;
+	string json;
+
+	void usage(const char *app) {
+		cout << app << " [--scenario register|invite|message|subscribe] [--count n] [--concurrency n] [--users n]"
+			 << " [--devices n] [--auth] [--port port] [--timeout seconds] [--config flexisip.conf] [--json file]"
+			 << " [--debug]" << endl;
+	}
+
+	void parse(int argc, char *argv[]) {
+#define EQ0(i, name) (strcmp(name, argv[i]) == 0)
+#define EQ1(i, name) (strcmp(name, argv[i]) == 0 && argc > i + 1)
+		for (int i = 1; i < argc; ++i) {
+			if (EQ1(i, "--scenario")) {
+				scenario = argv[++i];
+			} else if (EQ1(i, "--count")) {
+				count = atoi(argv[++i]);
+			} else if (EQ1(i, "--concurrency")) {
+				concurrency = atoi(argv[++i]);
+			} else if (EQ1(i, "--users")) {
+				users = atoi(argv[++i]);
+			} else if (EQ1(i, "--devices")) {
+				devices = atoi(argv[++i]);
+			} else if (EQ1(i, "--port")) {
+				port = atoi(argv[++i]);
+			} else if (EQ1(i, "--timeout")) {
+				timeout = atoi(argv[++i]);
+			} else if (EQ1(i, "--config")) {
+				config = argv[++i];
+			} else if (EQ1(i, "--json")) {
+				json = argv[++i];
+			} else if (EQ0(i, "--auth")) {
+				auth = true;
+			} else if (EQ0(i, "--debug")) {
+				debug = true;
+			} else if (EQ0(i, "--help") || EQ0(i, "-h")) {
+				usage(*argv);
+				exit(0);
+			} else {
+				cerr << "? arg" << i << " " << argv[i] << endl;
+				usage(*argv);
+				exit(-1);
+			}
+		}
+#undef EQ0
+#undef EQ1
+		if (scenario != "register" && scenario != "invite" && scenario != "message" && scenario != "subscribe") {
+			cerr << "? scenario " << scenario << endl;
+			usage(*argv);
+			exit(-1);
+		}
+		if (count <= 0 || concurrency <= 0 || users <= 0 || devices <= 0 || timeout <= 0) {
+			cerr << "--count, --concurrency, --users, --devices and --timeout must be positive" << endl;
+			exit(-1);
+		}
+		if (scenario != "register" && users < 2) {
+			cerr << "The " << scenario << " scenario needs at least 2 users" << endl;
+			exit(-1);
+		}
+	}
+};
+
+/*
+ * Proxy process.
+ */
+
+static su_root_t *sServerRoot = nullptr;
+
+static void stopServer(int signum) {
+	if (sServerRoot)
+		su_root_break(sServerRoot);
+}
+
+static void setConfig(GenericManager *cfg, const char *key, const string &value) {
+	ConfigValue *val = cfg->getRoot()->getDeep<ConfigValue>(key, false);
+	if (val)
+		val->set(value);
+}
+
+static int runServer(const BenchArgs &args, const string &passwordFile, int readyFd) {
+	flexisip::log::preinit(flexisip_sUseSyslog, args.debug, 0, "bench");
+	flexisip::log::initLogs(flexisip_sUseSyslog, args.debug ? "debug" : "error", "error", false, true);
+
+	GenericManager *cfg = GenericManager::get();
+	if (cfg->load(args.config.empty() ? "/dev/null" : args.config.c_str()) == -1) {
+		cerr << "Cannot load " << args.config << endl;
+		return -1;
+	}
+	if (args.config.empty()) {
+		setConfig(cfg, "module::NatHelper/enabled", "false");
+		setConfig(cfg, "module::Transcoder/enabled", "false");
+		setConfig(cfg, "module::MediaRelay/enabled", "false");
+	}
+	// The load generator would be banned.
+	setConfig(cfg, "module::DoSProtection/enabled", "false");
+	setConfig(cfg, "module::Registrar/enabled", "true");
+	setConfig(cfg, "module::Registrar/reg-domains", sDomain);
+	setConfig(cfg, "module::Authentication/enabled", args.auth ? "true" : "false");
+	if (args.auth) {
+		setConfig(cfg, "module::Authentication/auth-domains", sDomain);
+		setConfig(cfg, "module::Authentication/db-implementation", "file");
+		setConfig(cfg, "module::Authentication/datasource", passwordFile);
+	}
+
+	sServerRoot = su_root_create(NULL);
+	signal(SIGTERM, stopServer);
+	signal(SIGINT, SIG_IGN);
+	auto agent = make_shared<Agent>(sServerRoot);
+	agent->loadConfig(cfg);
+	agent->start("sip:127.0.0.1:" + to_string(args.port) + ";transport=udp", "");
+
+	char ready = 1;
+	if (write(readyFd, &ready, 1) != 1)
+		return -1;
+	close(readyFd);
+
+	su_root_run(sServerRoot);
+
+	agent->unloadConfig();
+	agent.reset();
+	su_root_destroy(sServerRoot);
+	return 0;
+}
+
+static string writePasswordFile(const BenchArgs &args) {
+	char path[] = "/tmp/flexisip-bench-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1)
+		return "";
+	close(fd);
+	ofstream ofs(path);
+	ofs << "version:1" << endl;
+	for (int i = 0; i < args.users; ++i) {
+		ofs << "user-" << i << "@" << sDomain << " clrtxt:" << sPassword << " ;" << endl;
+	}
+	return path;
+}
+
+/*
+ * Resource usage of the proxy process, from /proc.
+ */
+
+struct ProcessSample {
+	double cpuSeconds = 0;
+	long rssKb = 0;
+	long peakRssKb = 0;
+};
+
+static ProcessSample sampleProcess(pid_t pid) {
+	ProcessSample sample;
+	ifstream stat("/proc/" + to_string(pid) + "/stat");
+	string line;
+	if (getline(stat, line)) {
+		// Fields are counted after the process name, which may contain spaces.
+		istringstream fields(line.substr(line.rfind(')') + 2));
+		string field;
+		unsigned long utime = 0, stime = 0;
+		for (int i = 3; fields >> field; ++i) {
+			if (i == 14)
+				utime = stoul(field);
+			else if (i == 15) {
+				stime = stoul(field);
+				break;
+			}
+		}
+		sample.cpuSeconds = double(utime + stime) / sysconf(_SC_CLK_TCK);
+	}
+	ifstream status("/proc/" + to_string(pid) + "/status");
+	while (getline(status, line)) {
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			sample.rssKb = atol(line.c_str() + 6);
+		else if (line.compare(0, 6, "VmHWM:") == 0)
+			sample.peakRssKb = atol(line.c_str() + 6);
+	}
+	return sample;
+}
+
+/*
+ * Load generator.
+ */
+
+struct ClientTransaction {
+	string method;
+	string requestUri;
+	string user; // used for digest authentication
+	string from; // header values, with their tags
+	string to;
+	string callId;
+	uint32_t cseq = 1;
+	string headers; // other headers, each one terminated by CRLF
+	string body;
+	string branch;
+	bool authenticated = false;
+	chrono::steady_clock::time_point sentAt;
+	function<void(const sip_t *)> onFinal;
+};
+
+struct Session {
+	chrono::steady_clock::time_point start;
+	bool finished = false;
+	// Messages still expected before the scenario completes.
+	int pending = 1;
+	function<void(bool)> onDone;
+	// Requests received in the dialog of the session (NOTIFY).
+	function<void(const sip_t *)> onRequest;
+};
+
+class LoadGenerator {
+  public:
+	LoadGenerator(const BenchArgs &args) : mArgs(args) {
+	}
+	~LoadGenerator() {
+		if (mSock != -1)
+			close(mSock);
+	}
+	int run(pid_t server);
+
+  private:
+	bool open();
+	void loop(const function<bool()> &done);
+	void onDatagram(const char *data, size_t len);
+	void onResponse(const sip_t *sip);
+	void onRequest(const char *data, size_t len, const sip_t *sip, msg_t *msg);
+	void sweep();
+	void send(const string &data);
+	void sendRequest(const shared_ptr<ClientTransaction> &tr);
+	void sendAck(const ClientTransaction &tr, const sip_t *response, bool newBranch, const string &requestUri);
+	void reply(const char *data, size_t len, const sip_t *sip, int status, const char *phrase,
+			   const string &headers = "");
+	string authorization(const sip_t *response, const ClientTransaction &tr);
+	string newTag();
+	string aor(int user) const;
+	string contact(int user, int device) const;
+	string dialogTag(const sip_t *sip) const;
+
+	shared_ptr<Session> newSession(const function<void(bool)> &onDone);
+	void complete(const shared_ptr<Session> &session, bool success);
+	void startScenario(int index, const function<void(bool)> &onDone);
+	void startRegister(const shared_ptr<Session> &session, int user, int device);
+	void startInvite(const shared_ptr<Session> &session, int caller, int callee);
+	void startMessage(const shared_ptr<Session> &session, int caller, int callee);
+	void startSubscribe(const shared_ptr<Session> &session, int caller, int callee);
+	void report(double elapsed, const ProcessSample &before, const ProcessSample &after);
+
+	const BenchArgs &mArgs;
+	int mSock = -1;
+	struct sockaddr_in mProxy;
+	string mLocalAddress;
+	unsigned long mSeq = 0;
+	map<string, shared_ptr<ClientTransaction>> mTransactions; // by branch
+	map<string, shared_ptr<Session>> mDialogs;				  // sessions expecting requests, by Call-ID
+	vector<shared_ptr<Session>> mSessions;
+	unsigned long mSent = 0;
+	unsigned long mReceived = 0;
+	int mCompleted = 0;
+	int mFailed = 0;
+	vector<double> mLatencies; // in milliseconds
+};
+
+bool LoadGenerator::open() {
+	mSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (mSock == -1) {
+		cerr << "Cannot create socket: " << strerror(errno) << endl;
+		return false;
+	}
+	int bufferSize = 4 * 1024 * 1024;
+	setsockopt(mSock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+	setsockopt(mSock, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+	fcntl(mSock, F_SETFL, fcntl(mSock, F_GETFL) | O_NONBLOCK);
+
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	local.sin_port = 0;
+	socklen_t len = sizeof(local);
+	if (::bind(mSock, (struct sockaddr *)&local, sizeof(local)) == -1 ||
+		getsockname(mSock, (struct sockaddr *)&local, &len) == -1) {
+		cerr << "Cannot bind socket: " << strerror(errno) << endl;
+		return false;
+	}
+	mLocalAddress = "127.0.0.1:" + to_string(ntohs(local.sin_port));
+
+	memset(&mProxy, 0, sizeof(mProxy));
+	mProxy.sin_family = AF_INET;
+	mProxy.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	mProxy.sin_port = htons(mArgs.port);
+	return true;
+}
+
+void LoadGenerator::send(const string &data) {
+	if (sendto(mSock, data.data(), data.size(), 0, (struct sockaddr *)&mProxy, sizeof(mProxy)) == -1) {
+		if (mArgs.debug)
+			cerr << "sendto() failed: " << strerror(errno) << endl;
+		return;
+	}
+	++mSent;
+}
+
+string LoadGenerator::newTag() {
+	return to_string(++mSeq);
+}
+
+string LoadGenerator::aor(int user) const {
+	return "sip:user-" + to_string(user) + "@" + sDomain;
+}
+
+string LoadGenerator::contact(int user, int device) const {
+	return "sip:user-" + to_string(user) + "-" + to_string(device) + "@" + mLocalAddress;
+}
+
+// Tag of the dialogs answered by the simulated callees, stable across retransmissions.
+string LoadGenerator::dialogTag(const sip_t *sip) const {
+	return "uas" + to_string(hash<string>()(sip->sip_call_id->i_id));
+}
+
+void LoadGenerator::sendRequest(const shared_ptr<ClientTransaction> &tr) {
+	tr->branch = "z9hG4bK." + to_string(++mSeq);
+	tr->sentAt = chrono::steady_clock::now();
+	mTransactions[tr->branch] = tr;
+
+	ostringstream os;
+	os << tr->method << " " << tr->requestUri << " SIP/2.0\r\n"
+	   << "Via: SIP/2.0/UDP " << mLocalAddress << ";branch=" << tr->branch << ";rport\r\n"
+	   << "Max-Forwards: 70\r\n"
+	   << "From: " << tr->from << "\r\n"
+	   << "To: " << tr->to << "\r\n"
+	   << "Call-ID: " << tr->callId << "\r\n"
+	   << "CSeq: " << tr->cseq << " " << tr->method << "\r\n"
+	   << tr->headers << "Content-Length: " << tr->body.size() << "\r\n\r\n"
+	   << tr->body;
+	send(os.str());
+}
+
+/*
+ * ACK of a final response to an INVITE: in the INVITE transaction for error responses, and as a new transaction sent
+ * to the callee contact for 2xx.
+ */
+void LoadGenerator::sendAck(const ClientTransaction &tr, const sip_t *response, bool newBranch,
+							const string &requestUri) {
+	string to = tr.to;
+	if (response->sip_to->a_tag && to.find(";tag=") == string::npos)
+		to += string(";tag=") + response->sip_to->a_tag;
+	ostringstream os;
+	os << "ACK " << requestUri << " SIP/2.0\r\n"
+	   << "Via: SIP/2.0/UDP " << mLocalAddress << ";branch="
+	   << (newBranch ? "z9hG4bK." + to_string(++mSeq) : tr.branch) << ";rport\r\n"
+	   << "Max-Forwards: 70\r\n"
+	   << "From: " << tr.from << "\r\n"
+	   << "To: " << to << "\r\n"
+	   << "Call-ID: " << tr.callId << "\r\n"
+	   << "CSeq: " << tr.cseq << " ACK\r\n"
+	   << "Content-Length: 0\r\n\r\n";
+	send(os.str());
+}
+
+/* Replies to a request, copying the headers of the transaction from the received message. */
+void LoadGenerator::reply(const char *data, size_t len, const sip_t *sip, int status, const char *phrase,
+						  const string &headers) {
+	static const char *copied[] = {"via", "v", "from", "f", "to", "t", "call-id", "i", "cseq", NULL};
+	ostringstream os;
+	os << "SIP/2.0 " << status << " " << phrase << "\r\n";
+
+	string message(data, len);
+	size_t pos = message.find("\r\n") + 2;
+	while (pos < message.size()) {
+		size_t end = message.find("\r\n", pos);
+		if (end == string::npos || end == pos)
+			break;
+		string line = message.substr(pos, end - pos);
+		pos = end + 2;
+		size_t colon = line.find(':');
+		if (colon == string::npos)
+			continue;
+		string name = line.substr(0, colon);
+		name.erase(name.find_last_not_of(" \t") + 1);
+		transform(name.begin(), name.end(), name.begin(), ::tolower);
+		for (const char **h = copied; *h; ++h) {
+			if (name == *h) {
+				os << line;
+				if ((name == "to" || name == "t") && !sip->sip_to->a_tag)
+					os << ";tag=" << dialogTag(sip);
+				os << "\r\n";
+				break;
+			}
+		}
+	}
+	os << headers << "Content-Length: 0\r\n\r\n";
+	send(os.str());
+}
+
+string LoadGenerator::authorization(const sip_t *response, const ClientTransaction &tr) {
+	bool proxy = response->sip_status->st_status == 407;
+	const msg_auth_t *challenge = proxy ? response->sip_proxy_authenticate : response->sip_www_authenticate;
+	SofiaAutoHome home;
+	auth_challenge_t ac;
+	for (; challenge; challenge = challenge->au_next) {
+		memset(&ac, 0, sizeof(ac));
+		ac.ac_size = sizeof(ac);
+		if (auth_digest_challenge_get(home.home(), &ac, challenge->au_params) >= 0 && ac.ac_md5)
+			break;
+	}
+	if (!challenge)
+		return "";
+
+	auth_response_t ar;
+	memset(&ar, 0, sizeof(ar));
+	ar.ar_size = sizeof(ar);
+	ar.ar_username = tr.user.c_str();
+	ar.ar_realm = ac.ac_realm;
+	ar.ar_nonce = ac.ac_nonce;
+	ar.ar_uri = tr.requestUri.c_str();
+	ar.ar_algorithm = "MD5";
+	ar.ar_md5 = 1;
+	if (ac.ac_auth) {
+		ar.ar_qop = "auth";
+		ar.ar_auth = 1;
+		ar.ar_cnonce = "0a4f113b";
+		ar.ar_nc = "00000001";
+	}
+	auth_hexmd5_t ha1, digest;
+	auth_digest_a1(&ar, ha1, sPassword);
+	auth_digest_response(&ar, digest, ha1, tr.method.c_str(), NULL, 0);
+
+	ostringstream os;
+	os << (proxy ? "Proxy-Authorization" : "Authorization") << ": Digest username=\"" << tr.user << "\", realm=\""
+	   << ac.ac_realm << "\", nonce=\"" << ac.ac_nonce << "\", uri=\"" << tr.requestUri << "\", response=\"" << digest
+	   << "\", algorithm=MD5";
+	if (ac.ac_opaque)
+		os << ", opaque=\"" << ac.ac_opaque << "\"";
+	if (ac.ac_auth)
+		os << ", cnonce=\"" << ar.ar_cnonce << "\", nc=" << ar.ar_nc << ", qop=auth";
+	os << "\r\n";
+	return os.str();
+}
+
+void LoadGenerator::onDatagram(const char *data, size_t len) {
+	++mReceived;
+	msg_t *msg = msg_make(sip_default_mclass(), 0, data, len);
+	sip_t *sip = sip_object(msg);
+	if (sip && sip->sip_call_id && sip->sip_cseq && sip->sip_via && sip->sip_from && sip->sip_to) {
+		if (sip->sip_status)
+			onResponse(sip);
+		else if (sip->sip_request)
+			onRequest(data, len, sip, msg);
+	} else if (mArgs.debug) {
+		cerr << "Cannot parse received message:" << endl << string(data, len) << endl;
+	}
+	if (msg)
+		msg_destroy(msg);
+}
+
+void LoadGenerator::onResponse(const sip_t *sip) {
+	if (!sip->sip_via->v_branch)
+		return;
+	auto it = mTransactions.find(sip->sip_via->v_branch);
+	if (it == mTransactions.end())
+		return;
+	int status = sip->sip_status->st_status;
+	if (status < 200)
+		return;
+	shared_ptr<ClientTransaction> tr = it->second;
+	mTransactions.erase(it);
+
+	if (tr->method == "INVITE" && status >= 300)
+		sendAck(*tr, sip, false, tr->requestUri);
+	if ((status == 401 || status == 407) && mArgs.auth && !tr->authenticated) {
+		string auth = authorization(sip, *tr);
+		if (!auth.empty()) {
+			tr->authenticated = true;
+			tr->cseq++;
+			tr->headers += auth;
+			sendRequest(tr);
+			return;
+		}
+	}
+	// The callback may hold the transaction, release it once called.
+	auto onFinal = move(tr->onFinal);
+	tr->onFinal = nullptr;
+	if (onFinal)
+		onFinal(sip);
+}
+
+/* Requests received by the simulated user agents. */
+void LoadGenerator::onRequest(const char *data, size_t len, const sip_t *sip, msg_t *msg) {
+	sip_method_t method = sip->sip_request->rq_method;
+	if (method == sip_method_ack)
+		return;
+
+	string requestUri = url_as_string(msg_home(msg), sip->sip_request->rq_url);
+	switch (method) {
+		case sip_method_invite:
+			reply(data, len, sip, 200, "OK", "Contact: <" + requestUri + ">\r\n");
+			break;
+		case sip_method_subscribe: {
+			reply(data, len, sip, 200, "OK", "Contact: <" + requestUri + ">\r\nExpires: 600\r\n");
+			if (!sip->sip_contact || !sip->sip_from->a_tag)
+				break;
+			// The callee notifies the subscriber in the new dialog.
+			auto tr = make_shared<ClientTransaction>();
+			tr->method = "NOTIFY";
+			tr->requestUri = url_as_string(msg_home(msg), sip->sip_contact->m_url);
+			tr->user = sip->sip_to->a_url->url_user ? sip->sip_to->a_url->url_user : "";
+			tr->from = "<" + string(url_as_string(msg_home(msg), sip->sip_to->a_url)) + ">;tag=" + dialogTag(sip);
+			tr->to = "<" + string(url_as_string(msg_home(msg), sip->sip_from->a_url)) + ">;tag=" + sip->sip_from->a_tag;
+			tr->callId = sip->sip_call_id->i_id;
+			tr->headers = "Contact: <" + requestUri + ">\r\nEvent: " +
+						  (sip->sip_event ? sip->sip_event->o_type : "presence") +
+						  "\r\nSubscription-State: active;expires=600\r\n";
+			sendRequest(tr);
+			break;
+		}
+		default: {
+			reply(data, len, sip, 200, "OK");
+			auto it = mDialogs.find(sip->sip_call_id->i_id);
+			if (it != mDialogs.end() && it->second->onRequest) {
+				// Completing the session resets its callback.
+				auto onRequest = it->second->onRequest;
+				onRequest(sip);
+			}
+			break;
+		}
+	}
+}
+
+shared_ptr<Session> LoadGenerator::newSession(const function<void(bool)> &onDone) {
+	auto session = make_shared<Session>();
+	session->start = chrono::steady_clock::now();
+	session->onDone = onDone;
+	mSessions.push_back(session);
+	return session;
+}
+
+void LoadGenerator::complete(const shared_ptr<Session> &session, bool success) {
+	if (session->finished)
+		return;
+	if (success && --session->pending > 0)
+		return;
+	session->finished = true;
+	session->onRequest = nullptr;
+	mSessions.erase(find(mSessions.begin(), mSessions.end(), session));
+	session->onDone(success);
+}
+
+void LoadGenerator::startRegister(const shared_ptr<Session> &session, int user, int device) {
+	auto tr = make_shared<ClientTransaction>();
+	tr->method = "REGISTER";
+	tr->requestUri = string("sip:") + sDomain;
+	tr->user = "user-" + to_string(user);
+	tr->from = "<" + aor(user) + ">;tag=" + newTag();
+	tr->to = "<" + aor(user) + ">";
+	tr->callId = "bench-" + newTag();
+	tr->headers = "Contact: <" + contact(user, device) + ">\r\nExpires: 3600\r\n";
+	tr->onFinal = [this, session](const sip_t *sip) { complete(session, sip->sip_status->st_status == 200); };
+	sendRequest(tr);
+}
+
+void LoadGenerator::startInvite(const shared_ptr<Session> &session, int caller, int callee) {
+	auto tr = make_shared<ClientTransaction>();
+	tr->method = "INVITE";
+	tr->requestUri = aor(callee);
+	tr->user = "user-" + to_string(caller);
+	tr->from = "<" + aor(caller) + ">;tag=" + newTag();
+	tr->to = "<" + aor(callee) + ">";
+	tr->callId = "bench-" + newTag();
+	tr->headers = "Contact: <" + contact(caller, 0) + ">\r\n";
+	tr->onFinal = [this, session, tr](const sip_t *sip) {
+		if (sip->sip_status->st_status != 200 || !sip->sip_contact || !sip->sip_to->a_tag) {
+			complete(session, false);
+			return;
+		}
+		// ACK then hang up, in the dialog established with the callee contact.
+		SofiaAutoHome home;
+		string remote = url_as_string(home.home(), sip->sip_contact->m_url);
+		sendAck(*tr, sip, true, remote);
+		auto bye = make_shared<ClientTransaction>(*tr);
+		bye->method = "BYE";
+		bye->requestUri = remote;
+		bye->to = tr->to + ";tag=" + sip->sip_to->a_tag;
+		bye->cseq = tr->cseq + 1;
+		bye->authenticated = false;
+		bye->onFinal = [this, session](const sip_t *sip) { complete(session, sip->sip_status->st_status == 200); };
+		sendRequest(bye);
+	};
+	sendRequest(tr);
+}
+
+void LoadGenerator::startMessage(const shared_ptr<Session> &session, int caller, int callee) {
+	auto tr = make_shared<ClientTransaction>();
+	tr->method = "MESSAGE";
+	tr->requestUri = aor(callee);
+	tr->user = "user-" + to_string(caller);
+	tr->from = "<" + aor(caller) + ">;tag=" + newTag();
+	tr->to = "<" + aor(callee) + ">";
+	tr->callId = "bench-" + newTag();
+	tr->headers = "Content-Type: text/plain\r\n";
+	tr->body = "Benchmark message " + tr->callId;
+	tr->onFinal = [this, session](const sip_t *sip) { complete(session, sip->sip_status->st_status == 200); };
+	sendRequest(tr);
+}
+
+void LoadGenerator::startSubscribe(const shared_ptr<Session> &session, int caller, int callee) {
+	auto tr = make_shared<ClientTransaction>();
+	tr->method = "SUBSCRIBE";
+	tr->requestUri = aor(callee);
+	tr->user = "user-" + to_string(caller);
+	tr->from = "<" + aor(caller) + ">;tag=" + newTag();
+	tr->to = "<" + aor(callee) + ">";
+	tr->callId = "bench-" + newTag();
+	tr->headers = "Contact: <" + contact(caller, 0) + ">\r\nEvent: presence\r\nExpires: 600\r\n";
+	// Completed by the 200 and the first NOTIFY, in any order.
+	session->pending = 2;
+	string callId = tr->callId;
+	mDialogs[callId] = session;
+	session->onRequest = [this, session, callId](const sip_t *sip) {
+		if (sip->sip_request->rq_method != sip_method_notify)
+			return;
+		mDialogs.erase(callId);
+		complete(session, true);
+	};
+	tr->onFinal = [this, session, callId](const sip_t *sip) {
+		if (sip->sip_status->st_status != 200)
+			mDialogs.erase(callId);
+		complete(session, sip->sip_status->st_status == 200);
+	};
+	sendRequest(tr);
+}
+
+void LoadGenerator::startScenario(int index, const function<void(bool)> &onDone) {
+	auto session = newSession(onDone);
+	int caller = index % mArgs.users;
+	int callee = (index + 1) % mArgs.users;
+	if (mArgs.scenario == "register")
+		startRegister(session, caller, 0);
+	else if (mArgs.scenario == "invite")
+		startInvite(session, caller, callee);
+	else if (mArgs.scenario == "message")
+		startMessage(session, caller, callee);
+	else
+		startSubscribe(session, caller, callee);
+}
+
+void LoadGenerator::sweep() {
+	auto now = chrono::steady_clock::now();
+	auto timeout = chrono::seconds(mArgs.timeout);
+	for (auto it = mTransactions.begin(); it != mTransactions.end();) {
+		if (now - it->second->sentAt > timeout)
+			it = mTransactions.erase(it);
+		else
+			++it;
+	}
+	vector<shared_ptr<Session>> expired;
+	for (const auto &session : mSessions) {
+		if (now - session->start > timeout)
+			expired.push_back(session);
+	}
+	for (const auto &session : expired) {
+		for (auto it = mDialogs.begin(); it != mDialogs.end();) {
+			if (it->second == session)
+				it = mDialogs.erase(it);
+			else
+				++it;
+		}
+		complete(session, false);
+	}
+}
+
+void LoadGenerator::loop(const function<bool()> &done) {
+	char buffer[65536];
+	auto lastSweep = chrono::steady_clock::now();
+	while (!done()) {
+		struct pollfd pfd = {mSock, POLLIN, 0};
+		if (poll(&pfd, 1, 10) > 0) {
+			ssize_t len;
+			while ((len = recv(mSock, buffer, sizeof(buffer), 0)) > 0) {
+				onDatagram(buffer, len);
+			}
+		}
+		auto now = chrono::steady_clock::now();
+		if (now - lastSweep > chrono::milliseconds(100)) {
+			sweep();
+			lastSweep = now;
+		}
+	}
+}
+
+int LoadGenerator::run(pid_t server) {
+	if (!open())
+		return -1;
+
+	if (mArgs.scenario != "register") {
+		int registered = 0, failed = 0;
+		int total = mArgs.users * mArgs.devices;
+		int next = 0;
+		loop([&]() {
+			while (next < total && int(mSessions.size()) < mArgs.concurrency) {
+				auto session = newSession([&](bool success) { success ? ++registered : ++failed; });
+				startRegister(session, next / mArgs.devices, next % mArgs.devices);
+				++next;
+			}
+			return registered + failed == total;
+		});
+		if (failed > 0) {
+			cerr << failed << " of the " << total << " callee registrations failed" << endl;
+			return -1;
+		}
+	}
+
+	unsigned long sentBefore = mSent, receivedBefore = mReceived;
+	ProcessSample before = sampleProcess(server);
+	auto start = chrono::steady_clock::now();
+	int next = 0;
+	loop([&]() {
+		while (next < mArgs.count && int(mSessions.size()) < mArgs.concurrency) {
+			auto started = chrono::steady_clock::now();
+			startScenario(next++, [this, started](bool success) {
+				if (success) {
+					++mCompleted;
+					chrono::duration<double, milli> latency = chrono::steady_clock::now() - started;
+					mLatencies.push_back(latency.count());
+				} else {
+					++mFailed;
+				}
+			});
+		}
+		return mCompleted + mFailed == mArgs.count;
+	});
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	ProcessSample after = sampleProcess(server);
+	mSent -= sentBefore;
+	mReceived -= receivedBefore;
+
+	report(elapsed.count(), before, after);
+	return mFailed == 0 ? 0 : 1;
+}
+
+static double percentile(const vector<double> &sorted, double q) {
+	if (sorted.empty())
+		return 0;
+	size_t index = min(sorted.size() - 1, size_t(q * sorted.size()));
+	return sorted[index];
+}
+
+void LoadGenerator::report(double elapsed, const ProcessSample &before, const ProcessSample &after) {
+	sort(mLatencies.begin(), mLatencies.end());
+	double throughput = mCompleted / elapsed;
+	unsigned long messages = mSent + mReceived;
+	double cpu = after.cpuSeconds - before.cpuSeconds;
+	double cpuPerMessageUs = messages ? cpu * 1e6 / messages : 0;
+
+	cout << fixed << setprecision(2);
+	cout << "Scenario " << mArgs.scenario << (mArgs.auth ? " with authentication" : "") << ": " << mCompleted
+		 << " completed, " << mFailed << " failed in " << elapsed << " s" << endl;
+	cout << "  throughput          " << throughput << " scenarios/s" << endl;
+	cout << "  latency (ms)        p50 " << percentile(mLatencies, 0.5) << "  p90 " << percentile(mLatencies, 0.9)
+		 << "  p99 " << percentile(mLatencies, 0.99) << "  max " << (mLatencies.empty() ? 0 : mLatencies.back())
+		 << endl;
+	cout << "  messages            " << mSent << " sent, " << mReceived << " received by the user agents" << endl;
+	cout << "  proxy cpu           " << cpu << " s, " << cpuPerMessageUs << " us/message" << endl;
+	cout << "  proxy rss           " << after.rssKb << " kB, peak " << after.peakRssKb << " kB" << endl;
+
+	if (mArgs.json.empty())
+		return;
+	ofstream ofs(mArgs.json);
+	ofs << fixed << setprecision(3);
+	ofs << "{" << endl
+		<< "  \"scenario\": \"" << mArgs.scenario << "\"," << endl
+		<< "  \"auth\": " << (mArgs.auth ? "true" : "false") << "," << endl
+		<< "  \"count\": " << mArgs.count << "," << endl
+		<< "  \"concurrency\": " << mArgs.concurrency << "," << endl
+		<< "  \"users\": " << mArgs.users << "," << endl
+		<< "  \"devices\": " << mArgs.devices << "," << endl
+		<< "  \"completed\": " << mCompleted << "," << endl
+		<< "  \"failed\": " << mFailed << "," << endl
+		<< "  \"duration_s\": " << elapsed << "," << endl
+		<< "  \"throughput_per_s\": " << throughput << "," << endl
+		<< "  \"latency_ms\": {\"p50\": " << percentile(mLatencies, 0.5) << ", \"p90\": "
+		<< percentile(mLatencies, 0.9) << ", \"p99\": " << percentile(mLatencies, 0.99)
+		<< ", \"max\": " << (mLatencies.empty() ? 0 : mLatencies.back()) << "}," << endl
+		<< "  \"messages_sent\": " << mSent << "," << endl
+		<< "  \"messages_received\": " << mReceived << "," << endl
+		<< "  \"proxy_cpu_s\": " << cpu << "," << endl
+		<< "  \"proxy_cpu_us_per_message\": " << cpuPerMessageUs << "," << endl
+		<< "  \"proxy_rss_kb\": " << after.rssKb << "," << endl
+		<< "  \"proxy_peak_rss_kb\": " << after.peakRssKb << endl
+		<< "}" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	BenchArgs args;
+	args.parse(argc, argv);
+	signal(SIGPIPE, SIG_IGN);
+
+	string passwordFile = writePasswordFile(args);
+	if (passwordFile.empty()) {
+		cerr << "Cannot create the password file: " << strerror(errno) << endl;
+		return -1;
+	}
+
+	int readyPipe[2];
+	if (pipe(readyPipe) == -1) {
+		cerr << "pipe() failed: " << strerror(errno) << endl;
+		return -1;
+	}
+	pid_t server = fork();
+	if (server == -1) {
+		cerr << "fork() failed: " << strerror(errno) << endl;
+		return -1;
+	}
+	if (server == 0) {
+		close(readyPipe[0]);
+		_exit(runServer(args, passwordFile, readyPipe[1]) == 0 ? 0 : 1);
+	}
+	close(readyPipe[1]);
+
+	int ret = -1;
+	char ready;
+	if (read(readyPipe[0], &ready, 1) == 1) {
+		LoadGenerator generator(args);
+		ret = generator.run(server);
+	} else {
+		cerr << "The proxy failed to start" << endl;
+	}
+	close(readyPipe[0]);
+
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	unlink(passwordFile.c_str());
+	return ret;
+}
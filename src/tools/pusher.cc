@@ -37,7 +37,7 @@ static const int MAX_QUEUE_SIZE = 3000;
 // static const int PRINT_STATS_TIMEOUT = 3000;	/* In milliseconds. */
 
 struct PusherArgs {
-	PusherArgs() : debug(false), isSilent(false){
+	PusherArgs() : debug(false), isSilent(false), useHttp2(false){
 	}
 	string prefix;
 	string pntype;
@@ -47,9 +47,16 @@ struct PusherArgs {
 	vector<string> pntok;
 	string apikey;
 	string packageSID;
+	bool useHttp2;
+	string apnsServer;
+	string authKey;
+	string authKeyId;
+	string teamId;
 	void usage(const char *app) {
 		cout << app
 			 << " --pntype google|firebase|wp|w10|apple --appid id --key apikey(secretkey) --sid ms-app://value --prefix dir --silent --debug --pntok id1 (id2 id3 ...)"
+			 << endl
+			 << "apple HTTP/2 API: --http2 (--apns-server host:port) (--auth-key file.p8 --auth-key-id id --team-id id)"
 			 << endl;
 	}
 
@@ -87,6 +94,16 @@ struct PusherArgs {
 				appid = argv[++i];
 			} else if (EQ1(i, "--sid")) {
 				packageSID = argv[++i];
+			} else if (EQ0(i, "--http2")) {
+				useHttp2 = true;
+			} else if (EQ1(i, "--apns-server")) {
+				apnsServer = argv[++i];
+			} else if (EQ1(i, "--auth-key")) {
+				authKey = argv[++i];
+			} else if (EQ1(i, "--auth-key-id")) {
+				authKeyId = argv[++i];
+			} else if (EQ1(i, "--team-id")) {
+				teamId = argv[++i];
 			} else if (EQ0(i, "--debug")) {
 				debug = true;
 			}else if (EQ0(i, "--silent")) {
@@ -179,8 +196,10 @@ int main(int argc, char *argv[]) {
 	{
 		PushNotificationService service(MAX_QUEUE_SIZE);
 
-		if (args.pntype == "apple") {
-			service.setupiOSClient(args.prefix + "/apn", "");
+		if (args.pntype == "apple" && args.useHttp2 && !args.authKey.empty()) {
+			service.setupiOSTokenClients(args.authKey, args.authKeyId, args.teamId, "", args.apnsServer);
+		} else if (args.pntype == "apple") {
+			service.setupiOSClient(args.prefix + "/apn", "", args.useHttp2, args.apnsServer);
 		} else if (args.pntype == "google") {
 			map<string, string> googleKey;
 			googleKey.insert(make_pair(args.appid, args.apikey));
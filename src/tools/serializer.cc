@@ -17,6 +17,10 @@
 */
 #include "tool_utils.hh"
 
+#include <chrono>
+#include <functional>
+#include <iomanip>
+
 using namespace std;
 using namespace flexisip;
 
@@ -110,9 +114,131 @@ int test_bind_without_ecc(ExtendedContactCommon &ecc, const unique_ptr<RecordSer
 
 SofiaHome home;
 
+/*
+ * Benchmark mode: a record holding contacts as they are found in production (instance id, push parameters, path,
+ * accept headers, user agent) is encoded and decoded with each record serializer, and with each encoding of the
+ * contacts in the redis hash used by the redis registrar backend.
+ */
+
+static void fillBenchRecord(Record &record, int count, time_t now) {
+	for (int i = 0; i < count; ++i) {
+		ostringstream uniqueId;
+		uniqueId << "\"<urn:uuid:5a2fd7a0-8dc4-4f1c-9a6b-00000000" << setw(4) << setfill('0') << i << ">\"";
+		sip_contact_t *contact = sip_contact_format(home.h,
+			"<sip:user@192.168.0.%d:5223;transport=tls;fs-conn-id=%x;pn-type=apple;pn-tok=%040d;pn-msg-str=IM_MSG>"
+			";+sip.instance=%s;expires=3600;q=0.%d;message-expires=604800",
+			i + 1, 0x7f5a2c00 + i, i, uniqueId.str().c_str(), 9 - i % 9);
+		ExtendedContactCommon ecc(("tls:user:192.168.0." + to_string(i + 1) + ":5223").c_str(),
+								  {"sip:proxy1.example.org;transport=tls;lr", "sip:proxy2.example.org;transport=tls;lr"},
+								  "callid-" + to_string(i) + "-5a2fd7a08dc44f1c", uniqueId.str());
+		record.pushContact(make_shared<ExtendedContact>(ecc, contact, 3600, 1000 + i, now, false,
+			list<string>{"application/sdp", "text/plain", "application/vnd.gsma.rcs-ft-http+xml"},
+			"LinphoneIphone/4.1 (iPhone) LinphoneSDK/4.1.0 (belle-sip/1.6.3)"));
+	}
+}
+
+template <typename _funcT> static double ratePerSecond(int iterations, _funcT func) {
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		func();
+	}
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	return iterations / elapsed.count();
+}
+
+static void printBenchResult(const string &name, size_t size, double encodes, double decodes) {
+	cout << "  " << left << setw(22) << name << right << setw(10) << size << setw(14) << encodes << setw(14) << decodes
+		 << endl;
+}
+
+static void benchRecordSerializer(const string &name, Record &record, int iterations) {
+	auto serializer = unique_ptr<RecordSerializer>(RecordSerializer::create(name));
+	if (!serializer) {
+		cout << "  " << left << setw(22) << name << "not available in this build" << endl;
+		return;
+	}
+	string serialized;
+	if (!serializer->serialize(&record, serialized)) {
+		cout << "  " << left << setw(22) << name << "serialization failed" << endl;
+		return;
+	}
+	double encodes = ratePerSecond(iterations, [&]() {
+		string out;
+		serializer->serialize(&record, out);
+	});
+	double decodes = ratePerSecond(iterations, [&]() {
+		Record parsed(NULL);
+		serializer->parse(serialized, &parsed);
+	});
+	printBenchResult(name, serialized.size(), encodes, decodes);
+}
+
+static void benchContactEncoding(const string &name, Record &record, int iterations,
+								 const function<string(ExtendedContact &)> &encode) {
+	vector<pair<string, string>> fields;
+	size_t size = 0;
+	for (const auto &ec : record.getExtendedContacts()) {
+		fields.emplace_back(ec->getUniqueId(), encode(*ec));
+		size += fields.back().first.size() + fields.back().second.size();
+	}
+	Record parsed(NULL);
+	for (const auto &field : fields) {
+		parsed.updateFromSerializedContact("bench", field.first.c_str(), field.second.data(), field.second.size(),
+										   nullptr);
+	}
+	if (parsed.count() != record.count() || !compare(record, parsed)) {
+		cout << "  " << left << setw(22) << name << "round trip failed" << endl;
+		return;
+	}
+	double encodes = ratePerSecond(iterations, [&]() {
+		for (const auto &ec : record.getExtendedContacts()) {
+			encode(*ec);
+		}
+	});
+	double decodes = ratePerSecond(iterations, [&]() {
+		Record parsed(NULL);
+		for (const auto &field : fields) {
+			parsed.updateFromSerializedContact("bench", field.first.c_str(), field.second.data(), field.second.size(),
+											   nullptr);
+		}
+	});
+	printBenchResult(name, size, encodes, decodes);
+}
+
+static int benchmark(int iterations, int contacts) {
+	flexisip::log::updateFilter("%Severity% >= error");
+	Record record(NULL);
+	fillBenchRecord(record, contacts, time(NULL));
+
+	cout << "Record of " << contacts << " contacts, " << iterations << " iterations" << endl;
+	cout << fixed << setprecision(0);
+	cout << "  " << left << setw(22) << "serializer" << right << setw(10) << "bytes" << setw(14) << "encodes/s"
+		 << setw(14) << "decodes/s" << endl;
+	for (const char *name : {"c", "json", "protobuf", "msgpack"}) {
+		benchRecordSerializer(name, record, iterations);
+	}
+	// Sizes of the redis hash fields, unique ids included.
+	benchContactEncoding("redis url-params", record, iterations,
+						 [](ExtendedContact &ec) { return ec.serializeAsUrlEncodedParams(); });
+	benchContactEncoding("redis binary", record, iterations,
+						 [](ExtendedContact &ec) { return ec.serializeAsBinary(); });
+	return 0;
+}
+
 int main(int argc, char **argv) {
+	if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+		int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+		int contacts = argc > 3 ? atoi(argv[3]) : 5;
+		if (iterations <= 0 || contacts <= 0) {
+			cerr << argv[0] << " --bench [iterations] [contacts]" << endl;
+			exit(-1);
+		}
+		init_tests();
+		return benchmark(iterations, contacts);
+	}
 	if (argc != 2) {
-		cerr << "bad usage" << endl;
+		cerr << "bad usage: " << argv[0] << " c|json|protobuf|msgpack, or " << argv[0]
+			 << " --bench [iterations] [contacts]" << endl;
 		exit(-1);
 	}
 	init_tests();